@@ -0,0 +1,504 @@
+/***************************************************************************
+ * benchserver.c
+ *
+ * Minimal DataLink server used by the benchmark programs, and the
+ * starting of helper programs such as dalimock.
+ *
+ * The server is forked from the benchmark, accepts a single
+ * connection and serves the ID exchange, WRITE commands (acknowledged
+ * when requested) and STREAM, which is answered with a fixed number
+ * of packets.  Other commands are acknowledged with OK.  Reads and
+ * writes are buffered so the server is not limited by system call
+ * overhead.
+ *
+ * This code requires a POSIX system.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "benchserver.h"
+
+#define BENCH_BUFSIZE 262144
+#define BENCH_UNIX_PREFIX "unix:"
+
+typedef struct BenchConn_s
+{
+  int sock;
+  char readbuf[BENCH_BUFSIZE];
+  size_t readlen;
+  size_t readpos;
+  char writebuf[BENCH_BUFSIZE];
+  size_t writelen;
+} BenchConn;
+
+static void serve_connection (BenchConn *conn, int packetsize, int streampackets);
+static int conn_read (BenchConn *conn, void *buffer, size_t size);
+static int conn_write (BenchConn *conn, const void *buffer, size_t size);
+static int conn_flush (BenchConn *conn);
+static int conn_reply (BenchConn *conn, const char *header, const void *data, size_t datasize);
+
+/***************************************************************************
+ * bench_listen:
+ *
+ * Create a listening socket on an ephemeral loopback port (AF_INET)
+ * or a temporary Unix domain socket path (AF_UNIX) and write the
+ * libdali address to connect to into address.
+ *
+ * Returns listening socket on success and -1 on error.
+ ***************************************************************************/
+int
+bench_listen (int family, char *address, size_t addresssize)
+{
+  struct sockaddr_in sin;
+  struct sockaddr_un sun;
+  socklen_t addrlen;
+  int sock;
+
+  if ((sock = socket (family, SOCK_STREAM, 0)) < 0)
+  {
+    fprintf (stderr, "Cannot create socket: %s\n", strerror (errno));
+    return -1;
+  }
+
+  if (family == AF_INET)
+  {
+    memset (&sin, 0, sizeof (sin));
+    sin.sin_family      = AF_INET;
+    sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    sin.sin_port        = 0;
+    addrlen             = sizeof (sin);
+
+    if (bind (sock, (struct sockaddr *)&sin, sizeof (sin)) ||
+        getsockname (sock, (struct sockaddr *)&sin, &addrlen))
+    {
+      fprintf (stderr, "Cannot bind TCP socket: %s\n", strerror (errno));
+      close (sock);
+      return -1;
+    }
+
+    snprintf (address, addresssize, "127.0.0.1:%d", ntohs (sin.sin_port));
+  }
+  else
+  {
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    snprintf (sun.sun_path, sizeof (sun.sun_path), "/tmp/benchserver.%d.sock",
+              (int)getpid ());
+    unlink (sun.sun_path);
+
+    if (bind (sock, (struct sockaddr *)&sun, sizeof (sun)))
+    {
+      fprintf (stderr, "Cannot bind %s: %s\n", sun.sun_path, strerror (errno));
+      close (sock);
+      return -1;
+    }
+
+    snprintf (address, addresssize, "%s%s", BENCH_UNIX_PREFIX, sun.sun_path);
+  }
+
+  if (listen (sock, 1))
+  {
+    fprintf (stderr, "Cannot listen: %s\n", strerror (errno));
+    close (sock);
+    return -1;
+  }
+
+  return sock;
+} /* End of bench_listen() */
+
+/***************************************************************************
+ * bench_serve:
+ *
+ * Fork a server process to accept a single connection on listener
+ * and serve it until the client disconnects.  The listener is closed
+ * in the calling process.
+ *
+ * Returns the server process ID on success and -1 on error.
+ ***************************************************************************/
+pid_t
+bench_serve (int listener, int packetsize, int streampackets)
+{
+  BenchConn *conn;
+  pid_t pid;
+
+  if ((pid = fork ()) < 0)
+  {
+    fprintf (stderr, "Cannot fork: %s\n", strerror (errno));
+    close (listener);
+    return -1;
+  }
+  else if (pid > 0)
+  {
+    close (listener);
+    return pid;
+  }
+
+  if (!(conn = (BenchConn *)calloc (1, sizeof (BenchConn))))
+    _exit (1);
+
+  if ((conn->sock = accept (listener, NULL, NULL)) < 0)
+    _exit (1);
+
+  close (listener);
+
+  serve_connection (conn, packetsize, streampackets);
+
+  close (conn->sock);
+  _exit (0);
+} /* End of bench_serve() */
+
+/***************************************************************************
+ * bench_cleanup:
+ *
+ * Remove the socket file of a Unix domain socket address.
+ ***************************************************************************/
+void
+bench_cleanup (const char *address)
+{
+  if (!strncmp (address, BENCH_UNIX_PREFIX, strlen (BENCH_UNIX_PREFIX)))
+    unlink (address + strlen (BENCH_UNIX_PREFIX));
+} /* End of bench_cleanup() */
+
+/***************************************************************************
+ * bench_spawn:
+ *
+ * Start a program.  If address is not NULL the listening address is
+ * read from the "listening on" line the program writes to stdout.
+ * Unless verbose, stderr and any other stdout of the program is
+ * discarded.
+ *
+ * Returns the process ID on success and -1 on error.
+ ***************************************************************************/
+pid_t
+bench_spawn (char *const argv[], char *address, size_t addresssize, int verbose)
+{
+  char line[300];
+  const char *cp;
+  ssize_t rv;
+  size_t length = 0;
+  int fds[2]    = {-1, -1};
+  int null;
+  pid_t pid;
+
+  if (address && pipe (fds))
+  {
+    fprintf (stderr, "Cannot create pipe: %s\n", strerror (errno));
+    return -1;
+  }
+
+  if ((pid = fork ()) < 0)
+  {
+    fprintf (stderr, "Cannot fork: %s\n", strerror (errno));
+    return -1;
+  }
+
+  if (pid == 0)
+  {
+    if (address)
+    {
+      dup2 (fds[1], STDOUT_FILENO);
+      close (fds[0]);
+      close (fds[1]);
+    }
+
+    if (!verbose && (null = open ("/dev/null", O_WRONLY)) >= 0)
+    {
+      if (!address)
+        dup2 (null, STDOUT_FILENO);
+      dup2 (null, STDERR_FILENO);
+      close (null);
+    }
+
+    execv (argv[0], argv);
+    fprintf (stderr, "Cannot execute %s: %s\n", argv[0], strerror (errno));
+    _exit (127);
+  }
+
+  if (!address)
+    return pid;
+
+  close (fds[1]);
+
+  /* Read the first line, one byte at a time to leave later output in the pipe */
+  while (length < sizeof (line) - 1 && (rv = read (fds[0], line + length, 1)) == 1)
+  {
+    if (line[length] == '\n')
+      break;
+    length++;
+  }
+  line[length] = '\0';
+
+  /* The pipe is left open for the life of the program, later output is not read */
+
+  if (!(cp = strstr (line, " listening on ")))
+  {
+    fprintf (stderr, "Cannot start %s\n", argv[0]);
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+    return -1;
+  }
+
+  snprintf (address, addresssize, "%s", cp + strlen (" listening on "));
+
+  if (verbose)
+    fprintf (stderr, "Started %s at %s\n", argv[0], address);
+
+  return pid;
+} /* End of bench_spawn() */
+
+/***************************************************************************
+ * bench_stop:
+ *
+ * Stop a program started by bench_spawn() with SIGTERM, killing it
+ * if it has not exited after seconds, for programs blocked in I/O.
+ ***************************************************************************/
+void
+bench_stop (pid_t pid, int seconds)
+{
+  int status;
+  int waited;
+
+  if (pid <= 0)
+    return;
+
+  kill (pid, SIGTERM);
+
+  for (waited = 0; waited < seconds * 100; waited++)
+  {
+    if (waitpid (pid, &status, WNOHANG) != 0)
+      return;
+
+    usleep (10000);
+  }
+
+  kill (pid, SIGKILL);
+  waitpid (pid, &status, 0);
+} /* End of bench_stop() */
+
+/***************************************************************************
+ * serve_connection:
+ *
+ * Serve DataLink commands until the client disconnects.
+ ***************************************************************************/
+static void
+serve_connection (BenchConn *conn, int packetsize, int streampackets)
+{
+  char header[256];
+  char reply[256];
+  char flag[10];
+  char *data;
+  long long int pktid = 0;
+  long long int now;
+  int headerlen;
+  int size;
+  int idx;
+
+  if (!(data = (char *)calloc (1, packetsize)))
+    return;
+
+  for (;;)
+  {
+    if (conn_read (conn, header, 3) || header[0] != 'D' || header[1] != 'L')
+      break;
+
+    headerlen = (unsigned char)header[2];
+    if (conn_read (conn, header, headerlen))
+      break;
+    header[headerlen] = '\0';
+
+    if (!strncmp (header, "ID", 2))
+    {
+      snprintf (reply, sizeof (reply),
+                "ID DataLink benchserver :: DLPROTO:1.0 PACKETSIZE:%d WRITE",
+                packetsize);
+      if (conn_reply (conn, reply, NULL, 0))
+        break;
+    }
+    else if (!strncmp (header, "WRITE", 5))
+    {
+      if (sscanf (header, "WRITE %*s %*s %*s %9s %d", flag, &size) != 2 ||
+          size < 0 || size > packetsize || conn_read (conn, data, size))
+        break;
+
+      pktid++;
+
+      if (flag[0] == 'A')
+      {
+        snprintf (reply, sizeof (reply), "OK %lld 0", pktid);
+        if (conn_reply (conn, reply, NULL, 0))
+          break;
+      }
+    }
+    else if (!strncmp (header, "STREAM", 6))
+    {
+      now = 1700000000000000LL;
+
+      for (idx = 0; idx < streampackets; idx++)
+      {
+        pktid++;
+        snprintf (reply, sizeof (reply), "PACKET XX_BENCH_00_BHZ/MSEED %lld %lld %lld %lld %d",
+                  pktid, now, now, now + 1000, packetsize);
+        if (conn_reply (conn, reply, data, packetsize))
+          break;
+      }
+    }
+    else if (!strncmp (header, "ENDSTREAM", 9))
+    {
+      snprintf (reply, sizeof (reply), "ENDSTREAM");
+      if (conn_reply (conn, reply, NULL, 0))
+        break;
+    }
+    else
+    {
+      /* Commands with a data payload, e.g. MATCH and REJECT */
+      if (sscanf (header, "%*s %d", &size) == 1 && size > 0 &&
+          (strncmp (header, "MATCH", 5) == 0 || strncmp (header, "REJECT", 6) == 0))
+      {
+        if (size > packetsize || conn_read (conn, data, size))
+          break;
+      }
+
+      if (conn_reply (conn, "OK 0 0", NULL, 0))
+        break;
+    }
+  }
+
+  free (data);
+} /* End of serve_connection() */
+
+/***************************************************************************
+ * conn_reply:
+ *
+ * Queue a DataLink packet with header and optional data and flush.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+conn_reply (BenchConn *conn, const char *header, const void *data, size_t datasize)
+{
+  char preheader[3];
+  size_t headerlen = strlen (header);
+
+  preheader[0] = 'D';
+  preheader[1] = 'L';
+  preheader[2] = (char)headerlen;
+
+  if (conn_write (conn, preheader, 3) ||
+      conn_write (conn, header, headerlen) ||
+      (data && conn_write (conn, data, datasize)))
+    return -1;
+
+  /* Only flush when the client could be waiting, i.e. not mid-stream */
+  if (!data || conn->writelen > BENCH_BUFSIZE / 2)
+    return conn_flush (conn);
+
+  return 0;
+} /* End of conn_reply() */
+
+/***************************************************************************
+ * conn_read:
+ *
+ * Read exactly size bytes, flushing pending output first.
+ *
+ * Returns 0 on success and -1 on error or end of stream.
+ ***************************************************************************/
+static int
+conn_read (BenchConn *conn, void *buffer, size_t size)
+{
+  ssize_t nread;
+  size_t copy;
+
+  while (size > 0)
+  {
+    if (conn->readpos == conn->readlen)
+    {
+      if (conn_flush (conn))
+        return -1;
+
+      if ((nread = recv (conn->sock, conn->readbuf, sizeof (conn->readbuf), 0)) <= 0)
+        return -1;
+
+      conn->readlen = nread;
+      conn->readpos = 0;
+    }
+
+    copy = (conn->readlen - conn->readpos < size) ? conn->readlen - conn->readpos : size;
+    memcpy (buffer, conn->readbuf + conn->readpos, copy);
+    conn->readpos += copy;
+    buffer = (char *)buffer + copy;
+    size -= copy;
+  }
+
+  return 0;
+} /* End of conn_read() */
+
+/***************************************************************************
+ * conn_write:
+ *
+ * Append data to the output buffer, flushing when full.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+conn_write (BenchConn *conn, const void *buffer, size_t size)
+{
+  size_t copy;
+
+  while (size > 0)
+  {
+    if (conn->writelen == sizeof (conn->writebuf) && conn_flush (conn))
+      return -1;
+
+    copy = sizeof (conn->writebuf) - conn->writelen;
+    if (copy > size)
+      copy = size;
+
+    memcpy (conn->writebuf + conn->writelen, buffer, copy);
+    conn->writelen += copy;
+    buffer = (const char *)buffer + copy;
+    size -= copy;
+  }
+
+  return 0;
+} /* End of conn_write() */
+
+/***************************************************************************
+ * conn_flush:
+ *
+ * Send all buffered output.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+conn_flush (BenchConn *conn)
+{
+  size_t sent = 0;
+  ssize_t nsent;
+
+  while (sent < conn->writelen)
+  {
+    if ((nsent = send (conn->sock, conn->writebuf + sent, conn->writelen - sent, MSG_NOSIGNAL)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    sent += nsent;
+  }
+
+  conn->writelen = 0;
+
+  return 0;
+} /* End of conn_flush() */
@@ -0,0 +1,20 @@
+/***************************************************************************
+ * benchserver.h
+ *
+ * Minimal DataLink server and program starting used by the benchmark
+ * programs.
+ ***************************************************************************/
+
+#ifndef BENCHSERVER_H
+#define BENCHSERVER_H 1
+
+#include <sys/types.h>
+
+extern int   bench_listen (int family, char *address, size_t addresssize);
+extern pid_t bench_serve (int listener, int packetsize, int streampackets);
+extern void  bench_cleanup (const char *address);
+extern pid_t bench_spawn (char *const argv[], char *address, size_t addresssize,
+                          int verbose);
+extern void  bench_stop (pid_t pid, int seconds);
+
+#endif /* BENCHSERVER_H */
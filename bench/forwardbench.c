@@ -0,0 +1,574 @@
+/***************************************************************************
+ * forwardbench.c
+ *
+ * End-to-end forwarding throughput and latency of dali2dali.
+ *
+ * Two dalimock servers and dali2dali are started on loopback: the
+ * source server generates packets at a fixed rate once dali2dali
+ * streams from it, dali2dali forwards them to the destination server
+ * and this program streams them from the destination.  The latency of
+ * each packet is measured from its data end time, set by the source
+ * server when the packet is generated, to its arrival here.
+ *
+ * Packets and megabytes per second, latency percentiles and the CPU
+ * time of dali2dali per packet are printed and written as a flat JSON
+ * object.  Given a baseline file the results are compared to it and
+ * regressions beyond a tolerance are reported with exit code 2, a
+ * missing baseline is written from the results.  The 99.9th percentile
+ * latency, a handful of packets, is shown but not a regression.
+ *
+ * The dali2dali and dalimock programs are expected in the parent
+ * directory by default.  This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libdali.h>
+
+#include "benchserver.h"
+
+#define PACKAGE "forwardbench"
+
+/* Seconds without a packet before the run is abandoned */
+#define IDLE_TIMEOUT 5
+
+/* Maximum number of extra dali2dali arguments */
+#define MAX_EXTRA 32
+
+/* Parameters and results of a run */
+typedef struct Results_s
+{
+  double packets;         /* Packets received */
+  double size;            /* Payload size in bytes */
+  double streams;         /* Number of streams */
+  double rate;            /* Generated packets per second, 0 for unlimited */
+  double ack;             /* Forwarded with acknowledgements */
+  double packets_per_sec; /* Received packets per second */
+  double mb_per_sec;      /* Received megabytes per second */
+  double latency_p50_us;  /* Median latency */
+  double latency_p99_us;  /* 99th percentile latency */
+  double latency_p999_us; /* 99.9th percentile latency */
+  double cpu_us_per_packet; /* dali2dali user and system time per packet */
+} Results;
+
+/* How a result is compared to a baseline */
+#define RESULT_PARAM  0 /* Run parameter, results of different parameters are not compared */
+#define RESULT_HIGHER 1 /* Higher is better */
+#define RESULT_LOWER  2 /* Lower is better */
+#define RESULT_SHOWN  3 /* Shown but too noisy to be a regression */
+
+/* Results in JSON: name, field of Results and comparison */
+typedef struct ResultField_s
+{
+  const char *name;
+  size_t offset;
+  int compare;
+} ResultField;
+
+static const ResultField resultfields[] = {
+    {"packets", offsetof (Results, packets), RESULT_PARAM},
+    {"size", offsetof (Results, size), RESULT_PARAM},
+    {"streams", offsetof (Results, streams), RESULT_PARAM},
+    {"rate", offsetof (Results, rate), RESULT_PARAM},
+    {"ack", offsetof (Results, ack), RESULT_PARAM},
+    {"packets_per_sec", offsetof (Results, packets_per_sec), RESULT_HIGHER},
+    {"mb_per_sec", offsetof (Results, mb_per_sec), RESULT_HIGHER},
+    {"latency_p50_us", offsetof (Results, latency_p50_us), RESULT_LOWER},
+    {"latency_p99_us", offsetof (Results, latency_p99_us), RESULT_LOWER},
+    {"latency_p999_us", offsetof (Results, latency_p999_us), RESULT_SHOWN},
+    {"cpu_us_per_packet", offsetof (Results, cpu_us_per_packet), RESULT_LOWER}};
+
+#define RESULT_COUNT (int)(sizeof (resultfields) / sizeof (resultfields[0]))
+
+/* Field of a result in a Results */
+#define RESULT_VALUE(results, idx) \
+  (*(double *)((char *)(results) + resultfields[idx].offset))
+#define RESULT_CVALUE(results, idx) \
+  (*(const double *)((const char *)(results) + resultfields[idx].offset))
+
+static int collect (const char *address, int packets, int packetsize, Results *results);
+static int write_results (const char *path, const Results *results);
+static int read_results (const char *path, Results *results);
+static int compare (const Results *baseline, const Results *results, double tolerance);
+static void usage (void);
+
+static int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+  Results results;
+  Results baseline;
+  struct rusage usage_;
+  char destaddress[200];
+  char srcaddress[200];
+  char bindir[512]     = "..";
+  char mockpath[600];
+  char dalipath[600];
+  char ringarg[32];
+  char ratearg[32];
+  char streamsarg[32];
+  char sizearg[32];
+  char countarg[32];
+  char *extra[MAX_EXTRA];
+  char *mockargv[20];
+  char *daliargv[MAX_EXTRA + 10];
+  const char *output   = NULL;
+  const char *basefile = NULL;
+  double tolerance     = 10.0;
+  int packets          = 20000;
+  int packetsize       = 512;
+  int streams          = 10;
+  double rate          = 20000.0;
+  int ack              = 0;
+  int extras           = 0;
+  int status;
+  int rv = 0;
+  int argi;
+  int idx;
+  pid_t destpid = -1;
+  pid_t srcpid  = -1;
+  pid_t dalipid = -1;
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      packets = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-s") == 0 && (idx + 1) < argc)
+      packetsize = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-m") == 0 && (idx + 1) < argc)
+      streams = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-r") == 0 && (idx + 1) < argc)
+      rate = atof (argv[++idx]);
+    else if (strcmp (argv[idx], "-a") == 0)
+      ack = 1;
+    else if (strcmp (argv[idx], "-d") == 0 && (idx + 1) < argc)
+      snprintf (bindir, sizeof (bindir), "%s", argv[++idx]);
+    else if (strcmp (argv[idx], "-o") == 0 && (idx + 1) < argc)
+      output = argv[++idx];
+    else if (strcmp (argv[idx], "-b") == 0 && (idx + 1) < argc)
+      basefile = argv[++idx];
+    else if (strcmp (argv[idx], "-t") == 0 && (idx + 1) < argc)
+      tolerance = atof (argv[++idx]);
+    else if (strcmp (argv[idx], "-v") == 0)
+      verbose++;
+    else if (strcmp (argv[idx], "--") == 0)
+    {
+      for (idx++; idx < argc && extras < MAX_EXTRA; idx++)
+        extra[extras++] = argv[idx];
+    }
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (packets <= 0 || packetsize <= 0 || streams <= 0 || rate < 0.0 || tolerance < 0.0)
+  {
+    usage ();
+    return 1;
+  }
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  memset (&results, 0, sizeof (results));
+  results.packets = packets;
+  results.size    = packetsize;
+  results.streams = streams;
+  results.rate    = rate;
+  results.ack     = ack;
+
+  snprintf (mockpath, sizeof (mockpath), "%s/dalimock", bindir);
+  snprintf (dalipath, sizeof (dalipath), "%s/dali2dali", bindir);
+
+  /* Both rings hold the whole run so no packet is overwritten before it is read */
+  snprintf (ringarg, sizeof (ringarg), "%d", packets + 1024);
+  snprintf (ratearg, sizeof (ratearg), "%.0f", (rate > 0.0) ? rate : 1e9);
+  snprintf (streamsarg, sizeof (streamsarg), "%d", streams);
+  snprintf (sizearg, sizeof (sizearg), "%d", packetsize);
+  snprintf (countarg, sizeof (countarg), "%d", packets);
+
+  /* Destination server, streamed from before anything is forwarded */
+  argi             = 0;
+  mockargv[argi++] = mockpath;
+  mockargv[argi++] = "-p";
+  mockargv[argi++] = "127.0.0.1:0";
+  mockargv[argi++] = "-packetsize";
+  mockargv[argi++] = sizearg;
+  mockargv[argi++] = "-ring";
+  mockargv[argi++] = ringarg;
+  mockargv[argi]   = NULL;
+
+  if ((destpid = bench_spawn (mockargv, destaddress, sizeof (destaddress), verbose)) < 0)
+    return 1;
+
+  /* Source server, generating once dali2dali streams */
+  argi             = 0;
+  mockargv[argi++] = mockpath;
+  mockargv[argi++] = "-p";
+  mockargv[argi++] = "127.0.0.1:0";
+  mockargv[argi++] = "-packetsize";
+  mockargv[argi++] = sizearg;
+  mockargv[argi++] = "-ring";
+  mockargv[argi++] = ringarg;
+  mockargv[argi++] = "-waitstream";
+  mockargv[argi++] = "-rate";
+  mockargv[argi++] = ratearg;
+  mockargv[argi++] = "-streams";
+  mockargv[argi++] = streamsarg;
+  mockargv[argi++] = "-size";
+  mockargv[argi++] = sizearg;
+  mockargv[argi++] = "-count";
+  mockargv[argi++] = countarg;
+  mockargv[argi]   = NULL;
+
+  if ((srcpid = bench_spawn (mockargv, srcaddress, sizeof (srcaddress), verbose)) < 0)
+  {
+    rv = 1;
+    goto cleanup;
+  }
+
+  argi             = 0;
+  daliargv[argi++] = dalipath;
+  daliargv[argi++] = "-trace";
+  daliargv[argi++] = "0";
+  if (ack)
+    daliargv[argi++] = "-ack";
+  for (idx = 0; idx < extras; idx++)
+    daliargv[argi++] = extra[idx];
+  daliargv[argi++] = srcaddress;
+  daliargv[argi++] = destaddress;
+  daliargv[argi]   = NULL;
+
+  if ((dalipid = bench_spawn (daliargv, NULL, 0, verbose)) < 0)
+  {
+    rv = 1;
+    goto cleanup;
+  }
+
+  if (collect (destaddress, packets, packetsize, &results) < 0)
+    rv = 1;
+
+  /* CPU time of dali2dali over the whole run */
+  kill (dalipid, SIGTERM);
+  if (wait4 (dalipid, &status, 0, &usage_) == dalipid && results.packets > 0)
+  {
+    results.cpu_us_per_packet = (usage_.ru_utime.tv_sec + usage_.ru_stime.tv_sec) * 1e6 +
+                                usage_.ru_utime.tv_usec + usage_.ru_stime.tv_usec;
+    results.cpu_us_per_packet /= results.packets;
+  }
+  dalipid = -1;
+
+  if (rv)
+    goto cleanup;
+
+  printf ("%10s %8s %8s %10s %4s %12s %8s %10s %10s %10s %10s\n",
+          "packets", "size", "streams", "rate", "ack", "packets/s", "MB/s",
+          "p50 us", "p99 us", "p99.9 us", "CPU us/pkt");
+  printf ("%10.0f %8.0f %8.0f %10.0f %4s %12.0f %8.1f %10.0f %10.0f %10.0f %10.2f\n",
+          results.packets, results.size, results.streams, results.rate,
+          (ack) ? "yes" : "no", results.packets_per_sec, results.mb_per_sec,
+          results.latency_p50_us, results.latency_p99_us, results.latency_p999_us,
+          results.cpu_us_per_packet);
+
+  if (output && write_results (output, &results))
+    rv = 1;
+
+  if (basefile && !rv)
+  {
+    if (access (basefile, F_OK))
+    {
+      if (write_results (basefile, &results))
+        rv = 1;
+      else
+        printf ("Baseline written to %s\n", basefile);
+    }
+    else if (read_results (basefile, &baseline))
+    {
+      rv = 1;
+    }
+    else
+    {
+      rv = compare (&baseline, &results, tolerance);
+    }
+  }
+
+cleanup:
+  if (dalipid > 0)
+  {
+    kill (dalipid, SIGTERM);
+    waitpid (dalipid, &status, 0);
+  }
+  if (srcpid > 0)
+  {
+    kill (srcpid, SIGTERM);
+    waitpid (srcpid, &status, 0);
+  }
+  if (destpid > 0)
+  {
+    kill (destpid, SIGTERM);
+    waitpid (destpid, &status, 0);
+  }
+
+  return rv;
+} /* End of main() */
+
+/***************************************************************************
+ * collect:
+ *
+ * Stream packets from the server at address until packets are
+ * received or none arrives for IDLE_TIMEOUT seconds, recording the
+ * latency of each.  Throughput is measured from the first to the last
+ * packet received.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+collect (const char *address, int packets, int packetsize, Results *results)
+{
+  static DLHistogram hist;
+  DLCP *dlconn;
+  DLPacket packet;
+  char *data;
+  dltime_t first = 0;
+  dltime_t last  = 0;
+  dltime_t now;
+  dltime_t idle;
+  double seconds;
+  int received = 0;
+  int rv;
+
+  if (!(dlconn = dl_newdlcp ((char *)address, PACKAGE)))
+    return -1;
+
+  if (!(data = (char *)malloc (packetsize)))
+  {
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  if (dl_connect (dlconn) < 0)
+  {
+    fprintf (stderr, "Cannot connect to %s\n", address);
+    free (data);
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  /* Start streaming before dali2dali writes anything */
+  rv   = dl_collect_nb (dlconn, &packet, data, packetsize, 0);
+  idle = dlp_time ();
+
+  while (rv != DLERROR && received < packets)
+  {
+    if (rv == DLPACKET)
+    {
+      now = dlp_time ();
+
+      if (!first)
+        first = now;
+      last = idle = now;
+
+      dl_hist_record (&hist, now - packet.dataend);
+      received++;
+    }
+    else if (dlp_time () - idle > (dltime_t)IDLE_TIMEOUT * DLTMODULUS)
+    {
+      fprintf (stderr, "No packet for %d seconds, received %d of %d\n",
+               IDLE_TIMEOUT, received, packets);
+      break;
+    }
+    else
+    {
+      dlp_usleep (100);
+    }
+
+    rv = dl_collect_nb (dlconn, &packet, data, packetsize, 0);
+  }
+
+  if (rv == DLERROR)
+    fprintf (stderr, "Error collecting from %s\n", address);
+
+  dl_disconnect (dlconn);
+  dl_freedlcp (dlconn);
+  free (data);
+
+  if (received < 2)
+    return -1;
+
+  seconds = (double)(last - first) / DLTMODULUS;
+
+  results->packets         = received;
+  results->packets_per_sec = (seconds > 0.0) ? (received - 1) / seconds : 0.0;
+  results->mb_per_sec      = results->packets_per_sec * packetsize / 1048576.0;
+  results->latency_p50_us  = dl_hist_percentile (&hist, 50.0);
+  results->latency_p99_us  = dl_hist_percentile (&hist, 99.0);
+  results->latency_p999_us = dl_hist_percentile (&hist, 99.9);
+
+  return 0;
+} /* End of collect() */
+
+/***************************************************************************
+ * write_results:
+ *
+ * Write results as a flat JSON object to path, "-" for stdout.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+write_results (const char *path, const Results *results)
+{
+  FILE *fp;
+  int idx;
+
+  if (strcmp (path, "-") == 0)
+    fp = stdout;
+  else if ((fp = fopen (path, "w")) == NULL)
+  {
+    fprintf (stderr, "Cannot open %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+
+  fprintf (fp, "{");
+  for (idx = 0; idx < RESULT_COUNT; idx++)
+    fprintf (fp, "%s\n  \"%s\": %.6g", (idx) ? "," : "",
+             resultfields[idx].name, RESULT_CVALUE (results, idx));
+  fprintf (fp, "\n}\n");
+
+  if (fp != stdout && fclose (fp))
+  {
+    fprintf (stderr, "Cannot write %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+
+  return 0;
+} /* End of write_results() */
+
+/***************************************************************************
+ * read_results:
+ *
+ * Read results written by write_results() from path, a missing name
+ * is read as 0.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+read_results (const char *path, Results *results)
+{
+  char buffer[4096];
+  char key[64];
+  const char *cp;
+  size_t length;
+  FILE *fp;
+  int idx;
+
+  if ((fp = fopen (path, "r")) == NULL)
+  {
+    fprintf (stderr, "Cannot open %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+
+  length         = fread (buffer, 1, sizeof (buffer) - 1, fp);
+  buffer[length] = '\0';
+  fclose (fp);
+
+  for (idx = 0; idx < RESULT_COUNT; idx++)
+  {
+    snprintf (key, sizeof (key), "\"%s\":", resultfields[idx].name);
+    RESULT_VALUE (results, idx) = ((cp = strstr (buffer, key))) ? strtod (cp + strlen (key), NULL) : 0.0;
+  }
+
+  return 0;
+} /* End of read_results() */
+
+/***************************************************************************
+ * compare:
+ *
+ * Compare results to a baseline and print the change of each.  Lower
+ * throughput or higher latency or CPU time than the baseline by more
+ * than tolerance percent is a regression.  Results of different
+ * parameters are not compared.
+ *
+ * Returns 0 without regressions and 2 otherwise.
+ ***************************************************************************/
+static int
+compare (const Results *baseline, const Results *results, double tolerance)
+{
+  double base;
+  double value;
+  double change;
+  int regressions = 0;
+  int idx;
+
+  /* Fewer packets received than requested is not a parameter change */
+  for (idx = 0; idx < RESULT_COUNT; idx++)
+  {
+    if (resultfields[idx].compare != RESULT_PARAM ||
+        resultfields[idx].offset == offsetof (Results, packets))
+      continue;
+
+    if (RESULT_CVALUE (baseline, idx) != RESULT_CVALUE (results, idx))
+    {
+      printf ("Baseline %s is %g, not %g, not compared\n", resultfields[idx].name,
+              RESULT_CVALUE (baseline, idx), RESULT_CVALUE (results, idx));
+      return 0;
+    }
+  }
+
+  printf ("%-20s %12s %12s %9s\n", "result", "baseline", "current", "change");
+
+  for (idx = 0; idx < RESULT_COUNT; idx++)
+  {
+    if (resultfields[idx].compare == RESULT_PARAM)
+      continue;
+
+    base   = RESULT_CVALUE (baseline, idx);
+    value  = RESULT_CVALUE (results, idx);
+    change = (base > 0.0) ? (value - base) * 100.0 / base : 0.0;
+
+    printf ("%-20s %12.2f %12.2f %8.1f%%", resultfields[idx].name, base, value, change);
+
+    if ((resultfields[idx].compare == RESULT_HIGHER && change < -tolerance) ||
+        (resultfields[idx].compare == RESULT_LOWER && change > tolerance))
+    {
+      printf ("  REGRESSION");
+      regressions++;
+    }
+
+    printf ("\n");
+  }
+
+  if (regressions)
+    printf ("%d regression(s) beyond %g%% of the baseline\n", regressions, tolerance);
+
+  return (regressions) ? 2 : 0;
+} /* End of compare() */
+
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [options] [-- dali2dali options]\n\n", PACKAGE);
+  fprintf (stderr, " -n packets   Number of packets to forward, default 20000\n");
+  fprintf (stderr, " -s size      Packet payload size in bytes, default 512\n");
+  fprintf (stderr, " -m streams   Number of streams, default 10\n");
+  fprintf (stderr, " -r rate      Generated packets per second, 0 for unlimited, default 20000\n");
+  fprintf (stderr, " -a           Forward with acknowledgements\n");
+  fprintf (stderr, " -d dir       Directory of dali2dali and dalimock, default ..\n");
+  fprintf (stderr, " -o file      Write results as JSON to file, '-' for stdout\n");
+  fprintf (stderr, " -b file      Compare to a baseline file, written if missing\n");
+  fprintf (stderr, " -t percent   Tolerance of the baseline comparison, default 10\n");
+  fprintf (stderr, " -v           Be more verbose, show program output\n");
+  fprintf (stderr, "\nExit code 2 reports a regression from the baseline.\n");
+} /* End of usage() */
@@ -0,0 +1,157 @@
+/***************************************************************************
+ * logbench.c
+ *
+ * Compare the cost of logging a message for the caller with
+ * synchronous output through a print handler, as used by dali2dali
+ * before asynchronous logging, and with asynchronous output from a
+ * background writer (see dl_logasync_start()).
+ *
+ * Messages are written to /dev/null so only the logging overhead is
+ * measured.  Multiple logging threads can be used to exercise the
+ * multiple-producer ring.
+ *
+ * This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libdali.h>
+
+#define PACKAGE "logbench"
+
+static void *log_thread (void *arg);
+static void print_timelog (const char *msg);
+static void usage (void);
+
+static FILE *devnull = NULL;
+static int messages  = 1000000;
+
+int
+main (int argc, char **argv)
+{
+  pthread_t threads[64];
+  dltime_t start;
+  double seconds;
+  int nthreads = 1;
+  int async;
+  int idx;
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      messages = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-t") == 0 && (idx + 1) < argc)
+      nthreads = atoi (argv[++idx]);
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (messages <= 0 || nthreads <= 0 || nthreads > 64)
+  {
+    usage ();
+    return 1;
+  }
+
+  if (!(devnull = fopen ("/dev/null", "w")))
+  {
+    fprintf (stderr, "Cannot open /dev/null\n");
+    return 1;
+  }
+  setvbuf (devnull, NULL, _IOLBF, 0);
+
+  dl_loginit (1, &print_timelog, "", &print_timelog, "");
+
+  printf ("%-6s %8s %10s %14s %10s\n", "output", "threads", "messages", "messages/s", "ns/msg");
+
+  for (async = 0; async <= 1; async++)
+  {
+    if (async && dl_logasync_start (NULL, fileno (devnull), "%a %b %e %H:%M:%S %Y - ", 0))
+    {
+      printf ("async  unavailable\n");
+      break;
+    }
+
+    start = dlp_time ();
+
+    for (idx = 0; idx < nthreads; idx++)
+      pthread_create (&threads[idx], NULL, log_thread, NULL);
+    for (idx = 0; idx < nthreads; idx++)
+      pthread_join (threads[idx], NULL);
+
+    /* Caller-side cost only, pending asynchronous output is not included */
+    seconds = (double)(dlp_time () - start) / DLTMODULUS;
+
+    if (async)
+      dl_logasync_stop (NULL);
+
+    printf ("%-6s %8d %10d %14.0f %10.1f\n", (async) ? "async" : "sync",
+            nthreads, messages * nthreads, messages * nthreads / seconds,
+            seconds * 1e9 / messages);
+  }
+
+  fclose (devnull);
+
+  return 0;
+} /* End of main() */
+
+/***************************************************************************
+ * log_thread:
+ *
+ * Log messages like dali2dali at -vv, one per forwarded packet.
+ ***************************************************************************/
+static void *
+log_thread (void *arg)
+{
+  int idx;
+
+  (void)arg;
+
+  for (idx = 0; idx < messages; idx++)
+    dl_log (1, 0, "Forwarding packet %s, %s, %d bytes\n",
+            "XX_BENCH_00_BHZ/MSEED", "2026,292,08:00:00.000000", 512);
+
+  return NULL;
+} /* End of log_thread() */
+
+/***************************************************************************
+ * print_timelog:
+ *
+ * Synchronous print handler equivalent to the one in dali2dali.
+ ***************************************************************************/
+static void
+print_timelog (const char *msg)
+{
+  char timestr[100];
+  struct tm tms;
+  time_t loc_time;
+
+  time (&loc_time);
+  localtime_r (&loc_time, &tms);
+  asctime_r (&tms, timestr);
+  timestr[strlen (timestr) - 1] = '\0';
+
+  fprintf (devnull, "%s - %s", timestr, msg);
+} /* End of print_timelog() */
+
+/***************************************************************************
+ * usage:
+ *
+ * Print usage message.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [-n messages] [-t threads]\n\n", PACKAGE);
+  fprintf (stderr,
+           " -n messages  Number of messages to log per thread, default 1000000\n"
+           " -t threads   Number of logging threads, default 1, maximum 64\n");
+} /* End of usage() */
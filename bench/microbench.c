@@ -0,0 +1,587 @@
+/***************************************************************************
+ * microbench.c
+ *
+ * Time the hot libdali primitives in isolation: parsing PACKET
+ * headers, formatting WRITE headers, handling command replies,
+ * framing and sending packets, formatting SEED time strings,
+ * splitting stream IDs, reading stream lists and adding and finding
+ * packets in a full packet ring.
+ *
+ * Each benchmark runs on fixed inputs.  The number of operations per
+ * sample is calibrated to fill a target time, then after a discarded
+ * warm up sample a number of samples are timed with the monotonic
+ * clock.  The median, minimum and mean time per operation are
+ * reported with the 95% confidence interval of the mean and the
+ * median absolute deviation, so a change can be judged against the
+ * run to run noise.
+ *
+ * Packets are sent over a Unix domain socket pair drained by a
+ * thread, no network is involved.  Benchmarks can be selected by
+ * naming them on the command line.
+ *
+ * This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libdali.h>
+
+/* Internal helpers of libdali, e.g. dlp_parsepacket() */
+#include "portable.h"
+
+#define PACKAGE "microbench"
+
+/* Most samples of a benchmark */
+#define MAX_SAMPLES 1000
+
+/* A benchmark running a number of operations */
+typedef struct Bench_s
+{
+  const char *name;
+  const char *description;
+  int (*setup) (void);
+  void (*run) (int64_t operations);
+  void (*teardown) (void);
+} Bench;
+
+static int run_bench (const Bench *bench);
+static int compare_double (const void *a, const void *b);
+static int setup_conn (void);
+static void teardown_conn (void);
+static int setup_send (void);
+static void teardown_send (void);
+static void *drain_thread (void *arg);
+static int setup_streamlist (void);
+static void teardown_streamlist (void);
+static int setup_ring (void);
+static void teardown_ring (void);
+static void run_parsepacket (int64_t operations);
+static void run_formatwrite (int64_t operations);
+static void run_handlereply (int64_t operations);
+static void run_sendpacket (int64_t operations);
+static void run_seedtimestr (int64_t operations);
+static void run_splitstreamid (int64_t operations);
+static void run_streamlist (int64_t operations);
+static void run_ringadd (int64_t operations);
+static void run_ringfind (int64_t operations);
+static void run_ringafter (int64_t operations);
+static void usage (void);
+
+static const Bench benches[] = {
+    {"parsepacket", "Parse a PACKET header", NULL, run_parsepacket, NULL},
+    {"formatwrite", "Format a WRITE header", NULL, run_formatwrite, NULL},
+    {"handlereply", "dl_handlereply() of an OK reply", setup_conn, run_handlereply, teardown_conn},
+    {"sendpacket", "dl_sendpacket() of a WRITE header and payload", setup_send, run_sendpacket, teardown_send},
+    {"seedtimestr", "dl_dltime2seedtimestr() with subseconds", NULL, run_seedtimestr, NULL},
+    {"splitstreamid", "dl_splitstreamid() of all parts", NULL, run_splitstreamid, NULL},
+    {"streamlist", "dl_read_streamlist() of a stream list file", setup_streamlist, run_streamlist, teardown_streamlist},
+    {"ringadd", "dl_ring_add() to a full ring, evicting", setup_ring, run_ringadd, teardown_ring},
+    {"ringfind", "dl_ring_find() of a packet ID and dl_ring_get()", setup_ring, run_ringfind, teardown_ring},
+    {"ringafter", "dl_ring_after() of a data end time", setup_ring, run_ringafter, teardown_ring},
+};
+
+#define BENCH_COUNT (int)(sizeof (benches) / sizeof (benches[0]))
+
+/* Fixed inputs */
+static const char *packetheader = "PACKET IU_ANMO_00_BHZ/MSEED 123456789 1697712345123456 "
+                                  "1697712344000000 1697712345000000 512";
+static const char *replyheader  = "OK 123456789 0";
+static char streamid[]          = "IU_ANMO_00_BHZ/MSEED";
+static dltime_t datastart       = 1697712344000000;
+static dltime_t dataend         = 1697712345000000;
+
+static int samples      = 21;
+static int targetms     = 10;
+static int liststreams  = 1000;
+static int payloadsize  = 512;
+static int ringpackets  = 65536;
+static int verbose      = 0;
+
+static DLCP *dlconn       = NULL;
+static int sockets[2]     = {-1, -1};
+static pthread_t drainer;
+static char *payload      = NULL;
+static char listfile[64]  = "";
+static DLRing *ring       = NULL;
+static DLPacket ringpacket;
+
+/* Results of operations, kept so they are not optimized away */
+static volatile int64_t sink;
+
+int
+main (int argc, char **argv)
+{
+  int selected[BENCH_COUNT];
+  int anyselected = 0;
+  int rv          = 0;
+  int idx;
+  int jdx;
+
+  memset (selected, 0, sizeof (selected));
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      samples = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-t") == 0 && (idx + 1) < argc)
+      targetms = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-l") == 0 && (idx + 1) < argc)
+      liststreams = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-s") == 0 && (idx + 1) < argc)
+      payloadsize = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-v") == 0)
+      verbose++;
+    else if (argv[idx][0] != '-')
+    {
+      for (jdx = 0; jdx < BENCH_COUNT; jdx++)
+        if (strcmp (argv[idx], benches[jdx].name) == 0)
+          break;
+
+      if (jdx == BENCH_COUNT)
+      {
+        fprintf (stderr, "Unknown benchmark: %s\n", argv[idx]);
+        usage ();
+        return 1;
+      }
+
+      selected[jdx] = anyselected = 1;
+    }
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (samples < 2 || samples > MAX_SAMPLES || targetms <= 0 || liststreams <= 0 ||
+      payloadsize < 0 || payloadsize > MAXPACKETSIZE - 255 - 3)
+  {
+    usage ();
+    return 1;
+  }
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+
+  printf ("%-14s %12s %10s %10s %10s %8s %8s\n",
+          "benchmark", "ops/sample", "median ns", "min ns", "mean ns", "+-95%", "MAD %");
+
+  for (idx = 0; idx < BENCH_COUNT; idx++)
+  {
+    if (anyselected && !selected[idx])
+      continue;
+
+    if (run_bench (&benches[idx]))
+      rv = 1;
+  }
+
+  return rv;
+} /* End of main() */
+
+/***************************************************************************
+ * run_bench:
+ *
+ * Calibrate, warm up and time the samples of a benchmark and print
+ * the statistics of the time per operation.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+run_bench (const Bench *bench)
+{
+  double pertime[MAX_SAMPLES];
+  double deviation[MAX_SAMPLES];
+  uint64_t target = (uint64_t)targetms * 1000000;
+  uint64_t start;
+  uint64_t elapsed = 0;
+  int64_t operations = 1;
+  double median;
+  double mean = 0.0;
+  double variance = 0.0;
+  double interval;
+  int idx;
+
+  if (bench->setup && bench->setup ())
+  {
+    fprintf (stderr, "Cannot set up %s\n", bench->name);
+    return -1;
+  }
+
+  /* Double the operations until a sample fills the target time */
+  for (;;)
+  {
+    start = dlp_monotonic ();
+    bench->run (operations);
+    elapsed = dlp_monotonic () - start;
+
+    if (elapsed >= target || operations >= ((int64_t)1 << 40))
+      break;
+
+    operations *= 2;
+  }
+
+  /* Scale to the target, the last calibration run is the warm up */
+  if (elapsed > 0)
+    operations = (int64_t)((double)operations * target / elapsed) + 1;
+
+  for (idx = 0; idx < samples; idx++)
+  {
+    start = dlp_monotonic ();
+    bench->run (operations);
+    pertime[idx] = (double)(dlp_monotonic () - start) / operations;
+    mean += pertime[idx];
+  }
+
+  if (bench->teardown)
+    bench->teardown ();
+
+  mean /= samples;
+
+  for (idx = 0; idx < samples; idx++)
+    variance += (pertime[idx] - mean) * (pertime[idx] - mean);
+  variance /= (samples - 1);
+
+  /* Half width of the 95% confidence interval of the mean, normal approximation */
+  interval = 1.96 * sqrt (variance / samples);
+
+  qsort (pertime, samples, sizeof (double), compare_double);
+  median = (samples % 2) ? pertime[samples / 2]
+                         : (pertime[samples / 2 - 1] + pertime[samples / 2]) / 2.0;
+
+  for (idx = 0; idx < samples; idx++)
+    deviation[idx] = fabs (pertime[idx] - median);
+  qsort (deviation, samples, sizeof (double), compare_double);
+
+  printf ("%-14s %12lld %10.1f %10.1f %10.1f %7.1f%% %7.1f%%\n",
+          bench->name, (long long int)operations, median, pertime[0], mean,
+          (mean > 0.0) ? interval * 100.0 / mean : 0.0,
+          (median > 0.0) ? deviation[samples / 2] * 100.0 / median : 0.0);
+
+  return 0;
+} /* End of run_bench() */
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+
+  return (da > db) - (da < db);
+} /* End of compare_double() */
+
+/***************************************************************************
+ * setup_conn:
+ *
+ * Create an unconnected connection description, as needed for the
+ * logging of library functions.
+ ***************************************************************************/
+static int
+setup_conn (void)
+{
+  if (!(dlconn = dl_newdlcp ("localhost:16000", PACKAGE)))
+    return -1;
+
+  return 0;
+} /* End of setup_conn() */
+
+static void
+teardown_conn (void)
+{
+  dl_freedlcp (dlconn);
+  dlconn = NULL;
+} /* End of teardown_conn() */
+
+/***************************************************************************
+ * setup_send:
+ *
+ * Create a connection description using one end of a socket pair,
+ * the other end is drained by a thread.
+ ***************************************************************************/
+static int
+setup_send (void)
+{
+  if (setup_conn ())
+    return -1;
+
+  if (!(payload = (char *)calloc (1, payloadsize + 1)))
+    return -1;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sockets))
+  {
+    fprintf (stderr, "Cannot create socket pair\n");
+    return -1;
+  }
+
+  /* The library expects non-blocking sockets */
+  dlp_socknoblock (sockets[0]);
+  dlconn->link = sockets[0];
+
+  if (pthread_create (&drainer, NULL, drain_thread, NULL))
+  {
+    fprintf (stderr, "Cannot create drain thread\n");
+    return -1;
+  }
+
+  return 0;
+} /* End of setup_send() */
+
+static void
+teardown_send (void)
+{
+  /* Closing the sending end ends the drain thread */
+  dlconn->link = -1;
+  close (sockets[0]);
+  pthread_join (drainer, NULL);
+  close (sockets[1]);
+
+  free (payload);
+  payload = NULL;
+  teardown_conn ();
+} /* End of teardown_send() */
+
+static void *
+drain_thread (void *arg)
+{
+  char buffer[65536];
+
+  (void)arg;
+
+  while (read (sockets[1], buffer, sizeof (buffer)) > 0)
+    ;
+
+  return NULL;
+} /* End of drain_thread() */
+
+/***************************************************************************
+ * setup_streamlist:
+ *
+ * Write a stream list file of liststreams stream IDs.  The compound
+ * pattern is limited to MAXREGEXSIZE bytes, about 1000 streams.
+ ***************************************************************************/
+static int
+setup_streamlist (void)
+{
+  FILE *fp;
+  int fd;
+  int idx;
+
+  if (setup_conn ())
+    return -1;
+
+  snprintf (listfile, sizeof (listfile), "/tmp/microbench.XXXXXX");
+
+  if ((fd = mkstemp (listfile)) < 0 || !(fp = fdopen (fd, "w")))
+  {
+    fprintf (stderr, "Cannot create stream list file\n");
+    return -1;
+  }
+
+  fprintf (fp, "# Stream list for %s\n", PACKAGE);
+  for (idx = 0; idx < liststreams; idx++)
+    fprintf (fp, "XX_S%04d_00_HHZ\n", idx % 10000);
+
+  if (fclose (fp))
+    return -1;
+
+  return 0;
+} /* End of setup_streamlist() */
+
+static void
+teardown_streamlist (void)
+{
+  unlink (listfile);
+  teardown_conn ();
+} /* End of teardown_streamlist() */
+
+/***************************************************************************
+ * setup_ring:
+ *
+ * Fill a ring of ringpackets packets of payloadsize bytes, packets one
+ * second apart with consecutive packet IDs.
+ ***************************************************************************/
+static int
+setup_ring (void)
+{
+  int idx;
+
+  if (!(payload = (char *)calloc (1, payloadsize + 1)) ||
+      !(ring = dl_ring_new (ringpackets, (size_t)ringpackets * (payloadsize + 1))))
+    return -1;
+
+  memset (&ringpacket, 0, sizeof (ringpacket));
+  strcpy (ringpacket.streamid, streamid);
+  ringpacket.datasize = payloadsize;
+
+  for (idx = 0; idx < ringpackets; idx++)
+  {
+    ringpacket.pktid++;
+    ringpacket.datastart = datastart + (dltime_t)ringpacket.pktid * DLTMODULUS;
+    ringpacket.dataend   = ringpacket.datastart + DLTMODULUS;
+
+    if (dl_ring_add (ring, &ringpacket, payload) < 0)
+      return -1;
+  }
+
+  return 0;
+} /* End of setup_ring() */
+
+static void
+teardown_ring (void)
+{
+  dl_ring_free (ring);
+  ring = NULL;
+  free (payload);
+  payload = NULL;
+} /* End of teardown_ring() */
+
+static void
+run_parsepacket (int64_t operations)
+{
+  DLPacket packet;
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+  {
+    dlp_parsepacket (packetheader, &packet);
+    sink = packet.datasize;
+  }
+} /* End of run_parsepacket() */
+
+static void
+run_formatwrite (int64_t operations)
+{
+  char header[255];
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+    sink = dlp_formatwrite (header, sizeof (header), streamid, datastart, dataend, 1, 512);
+} /* End of run_formatwrite() */
+
+static void
+run_handlereply (int64_t operations)
+{
+  char reply[255];
+  int64_t value;
+  int64_t idx;
+
+  /* The reply is copied each time as it is overwritten by the message */
+  for (idx = 0; idx < operations; idx++)
+  {
+    strcpy (reply, replyheader);
+    dl_handlereply (dlconn, reply, sizeof (reply) - 1, &value);
+    sink = value;
+  }
+} /* End of run_handlereply() */
+
+static void
+run_sendpacket (int64_t operations)
+{
+  char header[255];
+  int headerlen;
+  int64_t idx;
+
+  headerlen = dlp_formatwrite (header, sizeof (header), streamid, datastart, dataend, 0, payloadsize);
+
+  for (idx = 0; idx < operations; idx++)
+    sink = dl_sendpacket (dlconn, header, headerlen, payload, payloadsize, NULL, 0);
+} /* End of run_sendpacket() */
+
+static void
+run_seedtimestr (int64_t operations)
+{
+  char timestr[30];
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+  {
+    dl_dltime2seedtimestr (dataend + idx, timestr, 1);
+    sink = timestr[0];
+  }
+} /* End of run_seedtimestr() */
+
+static void
+run_splitstreamid (int64_t operations)
+{
+  char w[20], x[20], y[20], z[20], type[20];
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+  {
+    dl_splitstreamid (streamid, w, x, y, z, type);
+    sink = z[0];
+  }
+} /* End of run_splitstreamid() */
+
+static void
+run_streamlist (int64_t operations)
+{
+  char *regex;
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+  {
+    if ((regex = dl_read_streamlist (dlconn, listfile)))
+    {
+      sink = regex[0];
+      free (regex);
+    }
+  }
+} /* End of run_streamlist() */
+
+static void
+run_ringadd (int64_t operations)
+{
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+  {
+    ringpacket.pktid++;
+    ringpacket.dataend += DLTMODULUS;
+    sink = dl_ring_add (ring, &ringpacket, payload);
+  }
+} /* End of run_ringadd() */
+
+static void
+run_ringfind (int64_t operations)
+{
+  const void *data;
+  int64_t idx;
+
+  /* Packet IDs spread over the ring */
+  for (idx = 0; idx < operations; idx++)
+  {
+    dl_ring_get (ring, dl_ring_find (ring, ringpacket.pktid - (idx * 7919) % ringpackets), &data);
+    sink = (int64_t)(intptr_t)data;
+  }
+} /* End of run_ringfind() */
+
+static void
+run_ringafter (int64_t operations)
+{
+  int64_t idx;
+
+  for (idx = 0; idx < operations; idx++)
+    sink = dl_ring_after (ring, ringpacket.dataend - ((idx * 7919) % ringpackets) * DLTMODULUS);
+} /* End of run_ringafter() */
+
+static void
+usage (void)
+{
+  int idx;
+
+  fprintf (stderr, "Usage: %s [options] [benchmark ...]\n\n", PACKAGE);
+  fprintf (stderr, " -n samples   Number of timed samples, default 21\n");
+  fprintf (stderr, " -t ms        Target time of each sample, default 10\n");
+  fprintf (stderr, " -l streams   Number of streams in the stream list, default 1000\n");
+  fprintf (stderr, " -s size      Payload size of sent and ring packets, default 512\n");
+  fprintf (stderr, " -v           Be more verbose\n");
+  fprintf (stderr, "\nBenchmarks, all by default:\n");
+
+  for (idx = 0; idx < BENCH_COUNT; idx++)
+    fprintf (stderr, " %-14s %s\n", benches[idx].name, benches[idx].description);
+} /* End of usage() */
@@ -0,0 +1,689 @@
+/***************************************************************************
+ * recoverbench.c
+ *
+ * Recovery of dali2dali from link faults injected by daliproxy.
+ *
+ * For each scenario a source and a destination dalimock server,
+ * daliproxy in front of the destination and dali2dali are started on
+ * loopback: the source server generates packets at a fixed rate once
+ * dali2dali streams from it and dali2dali forwards them through the
+ * proxy, which applies the faults of the scenario, while this program
+ * streams them from the destination.  Scenarios degrade the link with
+ * delay, a bandwidth cap or partial writes, or break it with a reset
+ * or a half-open window from which dali2dali must reconnect.
+ *
+ * For each scenario the packets received, lost and duplicated, the
+ * throughput, latency percentiles and the longest gap between
+ * arrivals, the time to recover from a broken link, are printed and
+ * written as a flat JSON object of scenario.result names.  Given a
+ * baseline file the results are compared to it and regressions beyond
+ * a tolerance are reported with exit code 2, a missing baseline is
+ * written from the results.
+ *
+ * The dali2dali, dalimock and daliproxy programs are expected in the
+ * parent directory by default.  This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libdali.h>
+
+#include "benchserver.h"
+
+#define PACKAGE "recoverbench"
+
+/* Seconds without a packet before a run ends, longer than any fault */
+#define IDLE_TIMEOUT 3
+
+/* Maximum number of extra dali2dali arguments and custom faults */
+#define MAX_EXTRA  32
+#define MAX_FAULTS 8
+
+/* Number of generated streams, packets of a stream are checked for duplicates */
+#define STREAMS 10
+
+/* Faults applied by the proxy in a scenario */
+typedef struct Scenario_s
+{
+  const char *name;
+  const char *faults[MAX_FAULTS + 1];
+} Scenario;
+
+/* Results of a scenario */
+typedef struct Results_s
+{
+  double received;        /* Distinct packets received */
+  double lost;            /* Packets generated but not received */
+  double duplicates;      /* Packets received more than once */
+  double packets_per_sec; /* Received packets per second */
+  double latency_p50_ms;  /* Median latency */
+  double latency_p99_ms;  /* 99th percentile latency */
+  double max_gap_ms;      /* Longest time between arrivals */
+} Results;
+
+/* How a result is compared to a baseline */
+#define RESULT_HIGHER 1 /* Higher is better */
+#define RESULT_LOWER  2 /* Lower is better */
+
+/* Results in JSON: name, field of Results and comparison */
+typedef struct ResultField_s
+{
+  const char *name;
+  size_t offset;
+  int compare;
+} ResultField;
+
+static const ResultField resultfields[] = {
+    {"received", offsetof (Results, received), RESULT_HIGHER},
+    {"lost", offsetof (Results, lost), RESULT_LOWER},
+    {"duplicates", offsetof (Results, duplicates), RESULT_LOWER},
+    {"packets_per_sec", offsetof (Results, packets_per_sec), RESULT_HIGHER},
+    {"latency_p50_ms", offsetof (Results, latency_p50_ms), RESULT_LOWER},
+    {"latency_p99_ms", offsetof (Results, latency_p99_ms), RESULT_LOWER},
+    {"max_gap_ms", offsetof (Results, max_gap_ms), RESULT_LOWER}};
+
+#define RESULT_COUNT (int)(sizeof (resultfields) / sizeof (resultfields[0]))
+
+/* Field of a result in a Results */
+#define RESULT_VALUE(results, idx) \
+  (*(double *)((char *)(results) + resultfields[idx].offset))
+#define RESULT_CVALUE(results, idx) \
+  (*(const double *)((const char *)(results) + resultfields[idx].offset))
+
+/* Built-in scenarios, faults start shortly after dali2dali connects and
+ * end well before the default run, dali2dali only notices a broken link
+ * when it next writes */
+static Scenario scenarios[] = {
+    {"clean", {NULL}},
+    {"delay", {"delay=20", NULL}},
+    {"bandwidth", {"bandwidth=2m", NULL}},
+    {"partial", {"partial=64", NULL}},
+    {"reset", {"reset@0.5", NULL}},
+    {"halfopen", {"halfopen@0.5/1", NULL}},
+    {"custom", {NULL}}};
+
+#define SCENARIO_COUNT (int)(sizeof (scenarios) / sizeof (scenarios[0]))
+#define CUSTOM         (SCENARIO_COUNT - 1)
+
+static int run_scenario (const Scenario *scenario, Results *results);
+static int collect (const char *address, Results *results);
+static int write_results (const char *path, const Results *results, const int *selected);
+static int read_results (const char *path, Results *results);
+static int compare (const Results *baseline, const Results *results,
+                    const int *selected, double tolerance);
+static void usage (void);
+
+static int verbose      = 0;
+static int packets      = 10000;
+static int packetsize   = 512;
+static double rate      = 5000.0;
+static int ack          = 0;
+static char bindir[512] = "..";
+static char *extra[MAX_EXTRA];
+static int extras = 0;
+
+int
+main (int argc, char **argv)
+{
+  static Results results[SCENARIO_COUNT];
+  static Results baseline[SCENARIO_COUNT];
+  int selected[SCENARIO_COUNT];
+  const char *output   = NULL;
+  const char *basefile = NULL;
+  double tolerance     = 25.0;
+  int customfaults     = 0;
+  int named            = 0;
+  int rv               = 0;
+  int found;
+  int idx;
+  int sdx;
+
+  memset (selected, 0, sizeof (selected));
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      packets = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-s") == 0 && (idx + 1) < argc)
+      packetsize = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-r") == 0 && (idx + 1) < argc)
+      rate = atof (argv[++idx]);
+    else if (strcmp (argv[idx], "-a") == 0)
+      ack = 1;
+    else if (strcmp (argv[idx], "-f") == 0 && (idx + 1) < argc && customfaults < MAX_FAULTS)
+      scenarios[CUSTOM].faults[customfaults++] = argv[++idx];
+    else if (strcmp (argv[idx], "-d") == 0 && (idx + 1) < argc)
+      snprintf (bindir, sizeof (bindir), "%s", argv[++idx]);
+    else if (strcmp (argv[idx], "-o") == 0 && (idx + 1) < argc)
+      output = argv[++idx];
+    else if (strcmp (argv[idx], "-b") == 0 && (idx + 1) < argc)
+      basefile = argv[++idx];
+    else if (strcmp (argv[idx], "-t") == 0 && (idx + 1) < argc)
+      tolerance = atof (argv[++idx]);
+    else if (strcmp (argv[idx], "-v") == 0)
+      verbose++;
+    else if (strcmp (argv[idx], "--") == 0)
+    {
+      for (idx++; idx < argc && extras < MAX_EXTRA; idx++)
+        extra[extras++] = argv[idx];
+    }
+    else if (argv[idx][0] != '-')
+    {
+      for (found = 0, sdx = 0; sdx < CUSTOM; sdx++)
+      {
+        if (strcmp (argv[idx], scenarios[sdx].name) == 0)
+          selected[sdx] = found = 1;
+      }
+
+      if (!found)
+      {
+        fprintf (stderr, "Unknown scenario: %s\n", argv[idx]);
+        return 1;
+      }
+
+      named++;
+    }
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (packets <= 1 || packetsize <= 0 || rate <= 0.0 || tolerance < 0.0)
+  {
+    usage ();
+    return 1;
+  }
+
+  /* Custom faults replace the built-in scenarios unless they are named */
+  if (customfaults)
+    selected[CUSTOM] = 1;
+  else if (!named)
+    for (sdx = 0; sdx < CUSTOM; sdx++)
+      selected[sdx] = 1;
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  printf ("%-10s %9s %7s %6s %11s %9s %9s %9s\n", "scenario", "received", "lost",
+          "dups", "packets/s", "p50 ms", "p99 ms", "gap ms");
+
+  for (sdx = 0; sdx < SCENARIO_COUNT; sdx++)
+  {
+    if (!selected[sdx])
+      continue;
+
+    if (run_scenario (&scenarios[sdx], &results[sdx]) < 0)
+    {
+      fprintf (stderr, "Scenario %s failed\n", scenarios[sdx].name);
+      return 1;
+    }
+
+    printf ("%-10s %9.0f %7.0f %6.0f %11.0f %9.2f %9.2f %9.1f\n", scenarios[sdx].name,
+            results[sdx].received, results[sdx].lost, results[sdx].duplicates,
+            results[sdx].packets_per_sec, results[sdx].latency_p50_ms,
+            results[sdx].latency_p99_ms, results[sdx].max_gap_ms);
+    fflush (stdout);
+  }
+
+  if (output && write_results (output, results, selected))
+    rv = 1;
+
+  if (basefile && !rv)
+  {
+    if (access (basefile, F_OK))
+    {
+      if (write_results (basefile, results, selected))
+        rv = 1;
+      else
+        printf ("Baseline written to %s\n", basefile);
+    }
+    else if (read_results (basefile, baseline))
+    {
+      rv = 1;
+    }
+    else
+    {
+      rv = compare (baseline, results, selected, tolerance);
+    }
+  }
+
+  return rv;
+} /* End of main() */
+
+/***************************************************************************
+ * run_scenario:
+ *
+ * Start the servers, the proxy with the faults of a scenario and
+ * dali2dali, collect the forwarded packets and stop them all.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+run_scenario (const Scenario *scenario, Results *results)
+{
+  char destaddress[200];
+  char srcaddress[200];
+  char proxyaddress[200];
+  char mockpath[600];
+  char proxypath[600];
+  char dalipath[600];
+  char ringarg[32];
+  char ratearg[32];
+  char streamsarg[32];
+  char sizearg[32];
+  char countarg[32];
+  char *mockargv[20];
+  char *proxyargv[2 * MAX_FAULTS + 10];
+  char *daliargv[MAX_EXTRA + 10];
+  pid_t pids[4] = {-1, -1, -1, -1};
+  int rv = 0;
+  int argi;
+  int idx;
+
+  memset (results, 0, sizeof (Results));
+
+  snprintf (mockpath, sizeof (mockpath), "%s/dalimock", bindir);
+  snprintf (proxypath, sizeof (proxypath), "%s/daliproxy", bindir);
+  snprintf (dalipath, sizeof (dalipath), "%s/dali2dali", bindir);
+
+  /* Both rings hold the whole run so no packet is overwritten before it is read */
+  snprintf (ringarg, sizeof (ringarg), "%d", 2 * packets + 1024);
+  snprintf (ratearg, sizeof (ratearg), "%.0f", rate);
+  snprintf (streamsarg, sizeof (streamsarg), "%d", STREAMS);
+  snprintf (sizearg, sizeof (sizearg), "%d", packetsize);
+  snprintf (countarg, sizeof (countarg), "%d", packets);
+
+  /* Destination server */
+  argi             = 0;
+  mockargv[argi++] = mockpath;
+  mockargv[argi++] = "-p";
+  mockargv[argi++] = "127.0.0.1:0";
+  mockargv[argi++] = "-packetsize";
+  mockargv[argi++] = sizearg;
+  mockargv[argi++] = "-ring";
+  mockargv[argi++] = ringarg;
+  mockargv[argi]   = NULL;
+
+  if ((pids[0] = bench_spawn (mockargv, destaddress, sizeof (destaddress), verbose)) < 0)
+    return -1;
+
+  /* Proxy in front of the destination, the fault schedule starts now */
+  argi              = 0;
+  proxyargv[argi++] = proxypath;
+  proxyargv[argi++] = "-p";
+  proxyargv[argi++] = "127.0.0.1:0";
+  for (idx = 0; scenario->faults[idx]; idx++)
+  {
+    proxyargv[argi++] = "-fault";
+    proxyargv[argi++] = (char *)scenario->faults[idx];
+  }
+  proxyargv[argi++] = destaddress;
+  proxyargv[argi]   = NULL;
+
+  if ((pids[1] = bench_spawn (proxyargv, proxyaddress, sizeof (proxyaddress), verbose)) < 0)
+  {
+    rv = -1;
+    goto cleanup;
+  }
+
+  /* Source server, generating once dali2dali streams */
+  argi             = 0;
+  mockargv[argi++] = mockpath;
+  mockargv[argi++] = "-p";
+  mockargv[argi++] = "127.0.0.1:0";
+  mockargv[argi++] = "-packetsize";
+  mockargv[argi++] = sizearg;
+  mockargv[argi++] = "-ring";
+  mockargv[argi++] = ringarg;
+  mockargv[argi++] = "-waitstream";
+  mockargv[argi++] = "-rate";
+  mockargv[argi++] = ratearg;
+  mockargv[argi++] = "-streams";
+  mockargv[argi++] = streamsarg;
+  mockargv[argi++] = "-size";
+  mockargv[argi++] = sizearg;
+  mockargv[argi++] = "-count";
+  mockargv[argi++] = countarg;
+  mockargv[argi]   = NULL;
+
+  if ((pids[2] = bench_spawn (mockargv, srcaddress, sizeof (srcaddress), verbose)) < 0)
+  {
+    rv = -1;
+    goto cleanup;
+  }
+
+  argi             = 0;
+  daliargv[argi++] = dalipath;
+  daliargv[argi++] = "-trace";
+  daliargv[argi++] = "0";
+  if (ack)
+    daliargv[argi++] = "-ack";
+  for (idx = 0; idx < extras; idx++)
+    daliargv[argi++] = extra[idx];
+  daliargv[argi++] = srcaddress;
+  daliargv[argi++] = proxyaddress;
+  daliargv[argi]   = NULL;
+
+  if ((pids[3] = bench_spawn (daliargv, NULL, 0, verbose)) < 0)
+  {
+    rv = -1;
+    goto cleanup;
+  }
+
+  rv = collect (destaddress, results);
+
+cleanup:
+  /* dali2dali may be blocked writing to a half-open connection */
+  for (idx = 3; idx >= 0; idx--)
+    bench_stop (pids[idx], 2);
+
+  return rv;
+} /* End of run_scenario() */
+
+/***************************************************************************
+ * collect:
+ *
+ * Stream packets from the destination server at address until all
+ * generated packets are received or none arrives for IDLE_TIMEOUT
+ * seconds, which counts as a gap when the latest packets generated are
+ * missing.  A packet with a data end time not after the latest of its
+ * stream is a duplicate, the source generates them in order.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+collect (const char *address, Results *results)
+{
+  static DLHistogram hist;
+  dltime_t lastend[STREAMS];
+  DLCP *dlconn;
+  DLPacket packet;
+  char *data;
+  dltime_t first = 0;
+  dltime_t last  = 0;
+  dltime_t maxgap = 0;
+  dltime_t firstend = 0;
+  dltime_t latest   = 0;
+  dltime_t now;
+  double seconds;
+  int received   = 0;
+  int duplicates = 0;
+  int stream;
+  int rv;
+
+  memset (&hist, 0, sizeof (hist));
+  memset (lastend, 0, sizeof (lastend));
+
+  if (!(dlconn = dl_newdlcp ((char *)address, PACKAGE)))
+    return -1;
+
+  if (!(data = (char *)malloc (packetsize)))
+  {
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  if (dl_connect (dlconn) < 0)
+  {
+    fprintf (stderr, "Cannot connect to %s\n", address);
+    free (data);
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  /* Start streaming before dali2dali writes anything */
+  rv   = dl_collect_nb (dlconn, &packet, data, packetsize, 0);
+  last = dlp_time ();
+
+  while (rv != DLERROR && received < packets)
+  {
+    if (rv == DLPACKET)
+    {
+      now = dlp_time ();
+
+      if (!first)
+        first = now, firstend = packet.dataend;
+      else if (now - last > maxgap)
+        maxgap = now - last;
+      last = now;
+
+      if (packet.dataend > latest)
+        latest = packet.dataend;
+
+      if (sscanf (packet.streamid, "XX_MK%d", &stream) != 1 || stream < 0 || stream >= STREAMS)
+        stream = 0;
+
+      if (packet.dataend <= lastend[stream])
+      {
+        duplicates++;
+      }
+      else
+      {
+        lastend[stream] = packet.dataend;
+        dl_hist_record (&hist, now - packet.dataend);
+        received++;
+      }
+    }
+    else if ((now = dlp_time ()) - last > (dltime_t)IDLE_TIMEOUT * DLTMODULUS)
+    {
+      /* Never recovered if the latest packet was generated well before the
+       * last, the stall then lasts to the end of the run */
+      if (latest < firstend + (dltime_t)((packets - 1) / rate * DLTMODULUS) - DLTMODULUS / 10 &&
+          now - last > maxgap)
+        maxgap = now - last;
+      break;
+    }
+    else
+    {
+      dlp_usleep (100);
+    }
+
+    rv = dl_collect_nb (dlconn, &packet, data, packetsize, 0);
+  }
+
+  if (rv == DLERROR)
+    fprintf (stderr, "Error collecting from %s\n", address);
+
+  dl_disconnect (dlconn);
+  dl_freedlcp (dlconn);
+  free (data);
+
+  if (received < 2)
+  {
+    fprintf (stderr, "Received %d of %d packets\n", received, packets);
+    return -1;
+  }
+
+  seconds = (double)(last - first) / DLTMODULUS;
+
+  results->received        = received;
+  results->lost            = packets - received;
+  results->duplicates      = duplicates;
+  results->packets_per_sec = (seconds > 0.0) ? (received - 1) / seconds : 0.0;
+  results->latency_p50_ms  = dl_hist_percentile (&hist, 50.0) / 1000.0;
+  results->latency_p99_ms  = dl_hist_percentile (&hist, 99.0) / 1000.0;
+  results->max_gap_ms      = (double)maxgap / 1000.0;
+
+  return 0;
+} /* End of collect() */
+
+/***************************************************************************
+ * write_results:
+ *
+ * Write the results of the selected scenarios as a flat JSON object
+ * to path, "-" for stdout.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+write_results (const char *path, const Results *results, const int *selected)
+{
+  const char *separator = "";
+  FILE *fp;
+  int sdx;
+  int idx;
+
+  if (strcmp (path, "-") == 0)
+    fp = stdout;
+  else if ((fp = fopen (path, "w")) == NULL)
+  {
+    fprintf (stderr, "Cannot open %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+
+  fprintf (fp, "{");
+  for (sdx = 0; sdx < SCENARIO_COUNT; sdx++)
+  {
+    if (!selected[sdx])
+      continue;
+
+    for (idx = 0; idx < RESULT_COUNT; idx++, separator = ",")
+      fprintf (fp, "%s\n  \"%s.%s\": %.6g", separator, scenarios[sdx].name,
+               resultfields[idx].name, RESULT_CVALUE (&results[sdx], idx));
+  }
+  fprintf (fp, "\n}\n");
+
+  if (fp != stdout && fclose (fp))
+  {
+    fprintf (stderr, "Cannot write %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+
+  return 0;
+} /* End of write_results() */
+
+/***************************************************************************
+ * read_results:
+ *
+ * Read results written by write_results() from path, a missing name
+ * is read as -1.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+read_results (const char *path, Results *results)
+{
+  static char buffer[65536];
+  char key[100];
+  const char *cp;
+  size_t length;
+  FILE *fp;
+  int sdx;
+  int idx;
+
+  if ((fp = fopen (path, "r")) == NULL)
+  {
+    fprintf (stderr, "Cannot open %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+
+  length         = fread (buffer, 1, sizeof (buffer) - 1, fp);
+  buffer[length] = '\0';
+  fclose (fp);
+
+  for (sdx = 0; sdx < SCENARIO_COUNT; sdx++)
+  {
+    for (idx = 0; idx < RESULT_COUNT; idx++)
+    {
+      snprintf (key, sizeof (key), "\"%s.%s\":", scenarios[sdx].name, resultfields[idx].name);
+      RESULT_VALUE (&results[sdx], idx) = ((cp = strstr (buffer, key))) ? strtod (cp + strlen (key), NULL) : -1.0;
+    }
+  }
+
+  return 0;
+} /* End of read_results() */
+
+/***************************************************************************
+ * compare:
+ *
+ * Compare the results of the selected scenarios to a baseline and
+ * print the change of each.  Fewer packets received, lower throughput
+ * or more of anything else than the baseline by more than tolerance
+ * percent is a regression.  Scenarios missing from the baseline are
+ * not compared.
+ *
+ * Returns 0 without regressions and 2 otherwise.
+ ***************************************************************************/
+static int
+compare (const Results *baseline, const Results *results, const int *selected,
+         double tolerance)
+{
+  char name[100];
+  double base;
+  double value;
+  double change;
+  int regressions = 0;
+  int higherbetter;
+  int sdx;
+  int idx;
+
+  printf ("%-28s %12s %12s %9s\n", "result", "baseline", "current", "change");
+
+  for (sdx = 0; sdx < SCENARIO_COUNT; sdx++)
+  {
+    if (!selected[sdx])
+      continue;
+
+    if (baseline[sdx].received < 0.0)
+    {
+      printf ("Scenario %s is not in the baseline, not compared\n", scenarios[sdx].name);
+      continue;
+    }
+
+    for (idx = 0; idx < RESULT_COUNT; idx++)
+    {
+      higherbetter = (resultfields[idx].compare == RESULT_HIGHER);
+      base         = RESULT_CVALUE (&baseline[sdx], idx);
+      value        = RESULT_CVALUE (&results[sdx], idx);
+      change       = (base > 0.0) ? (value - base) * 100.0 / base : 0.0;
+
+      /* Loss or duplicates where the baseline had none */
+      if (base == 0.0 && value > 0.0 && !higherbetter)
+        change = 100.0;
+
+      snprintf (name, sizeof (name), "%s.%s", scenarios[sdx].name, resultfields[idx].name);
+      printf ("%-28s %12.2f %12.2f %8.1f%%", name, base, value, change);
+
+      if ((higherbetter && change < -tolerance) || (!higherbetter && change > tolerance))
+      {
+        printf ("  REGRESSION");
+        regressions++;
+      }
+
+      printf ("\n");
+    }
+  }
+
+  if (regressions)
+    printf ("%d regression(s) beyond %g%% of the baseline\n", regressions, tolerance);
+
+  return (regressions) ? 2 : 0;
+} /* End of compare() */
+
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [options] [scenario ...] [-- dali2dali options]\n\n", PACKAGE);
+  fprintf (stderr, " -n packets   Number of packets per scenario, default 10000\n");
+  fprintf (stderr, " -s size      Packet payload size in bytes, default 512\n");
+  fprintf (stderr, " -r rate      Generated packets per second, default 5000\n");
+  fprintf (stderr, " -a           Forward with acknowledgements\n");
+  fprintf (stderr, " -f fault     Run a custom scenario with a daliproxy fault, repeatable\n");
+  fprintf (stderr, " -d dir       Directory of dali2dali, dalimock and daliproxy, default ..\n");
+  fprintf (stderr, " -o file      Write results as JSON to file, '-' for stdout\n");
+  fprintf (stderr, " -b file      Compare to a baseline file, written if missing\n");
+  fprintf (stderr, " -t percent   Tolerance of the baseline comparison, default 25\n");
+  fprintf (stderr, " -v           Be more verbose, show program output\n");
+  fprintf (stderr, "\nScenarios: clean, delay, bandwidth, partial, reset and halfopen,\n");
+  fprintf (stderr, "all by default.  Exit code 2 reports a regression from the baseline.\n");
+} /* End of usage() */
@@ -0,0 +1,229 @@
+/***************************************************************************
+ * splicebench.c
+ *
+ * Compare relaying packets between two DataLink connections by
+ * copying payloads through a user space buffer with relaying them
+ * with splice(), as done by dali2dali with and without -splice.
+ *
+ * For each relay mode two minimal servers (see benchserver.c) are
+ * forked, a source that streams packets and a destination that
+ * accepts written packets.  The client collects each packet from the
+ * source and writes it to the destination, the last write is
+ * acknowledged to drain the destination.
+ *
+ * On systems without splice() payloads are held in a buffer and both
+ * modes copy.
+ *
+ * This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <libdali.h>
+
+#include "benchserver.h"
+
+#define PACKAGE "splicebench"
+
+static int run_client (const char *srcaddress, const char *destaddress, int splicemode,
+                       int packets, int packetsize);
+static DLCP *bench_connect (const char *address);
+static void usage (void);
+
+static int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+  char srcaddress[200];
+  char destaddress[200];
+  int packets    = 200000;
+  int packetsize = 4096;
+  int family     = AF_INET;
+  int listener;
+  int status;
+  int splicemode;
+  int idx;
+  pid_t srcpid;
+  pid_t destpid;
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      packets = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-s") == 0 && (idx + 1) < argc)
+      packetsize = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-u") == 0)
+      family = AF_UNIX;
+    else if (strcmp (argv[idx], "-v") == 0)
+      verbose++;
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (packets <= 0 || packetsize <= 0 || packetsize > MAXPACKETSIZE)
+  {
+    usage ();
+    return 1;
+  }
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  printf ("%-7s %10s %12s %10s\n", "relay", "packets", "packets/s", "MB/s");
+
+  for (splicemode = 0; splicemode <= 1; splicemode++)
+  {
+    if ((listener = bench_listen (family, srcaddress, sizeof (srcaddress))) < 0)
+      return 1;
+
+    if ((srcpid = bench_serve (listener, packetsize, packets)) < 0)
+      return 1;
+
+    /* Unix domain socket paths are per process, use TCP for the destination */
+    if ((listener = bench_listen (AF_INET, destaddress, sizeof (destaddress))) < 0)
+      return 1;
+
+    if ((destpid = bench_serve (listener, packetsize, 0)) < 0)
+      return 1;
+
+    if (run_client (srcaddress, destaddress, splicemode, packets, packetsize))
+    {
+      kill (srcpid, SIGTERM);
+      kill (destpid, SIGTERM);
+    }
+
+    waitpid (srcpid, &status, 0);
+    waitpid (destpid, &status, 0);
+    bench_cleanup (srcaddress);
+  }
+
+  return 0;
+} /* End of main() */
+
+/***************************************************************************
+ * run_client:
+ *
+ * Connect to the source and destination servers, relay packets from
+ * the source to the destination and print the results.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+run_client (const char *srcaddress, const char *destaddress, int splicemode,
+            int packets, int packetsize)
+{
+  DLCP *srcdlcp;
+  DLCP *destdlcp;
+  DLPacket dlpacket;
+  char *packetdata;
+  dltime_t start;
+  double seconds = 0.0;
+  int relayed    = 0;
+  int64_t rv;
+
+  if (!(packetdata = (char *)malloc (MAXPACKETSIZE)))
+    return -1;
+
+  if (!(srcdlcp = bench_connect (srcaddress)))
+  {
+    free (packetdata);
+    return -1;
+  }
+
+  if (!(destdlcp = bench_connect (destaddress)))
+  {
+    dl_disconnect (srcdlcp);
+    dl_freedlcp (srcdlcp);
+    free (packetdata);
+    return -1;
+  }
+
+  start = dlp_time ();
+  while (relayed < packets)
+  {
+    if (dl_collect (srcdlcp, &dlpacket, (splicemode) ? NULL : packetdata,
+                    MAXPACKETSIZE, 0) != DLPACKET)
+      break;
+
+    if (splicemode)
+      rv = dl_write_splice (destdlcp, srcdlcp, &dlpacket, (relayed == packets - 1));
+    else
+      rv = dl_write (destdlcp, packetdata, dlpacket.datasize, dlpacket.streamid,
+                     dlpacket.datastart, dlpacket.dataend, (relayed == packets - 1));
+
+    if (rv < 0)
+    {
+      fprintf (stderr, "Write failed to %s\n", destaddress);
+      break;
+    }
+
+    relayed++;
+  }
+  if (relayed == packets)
+    seconds = (double)(dlp_time () - start) / DLTMODULUS;
+
+  printf ("%-7s %10d %12.0f %10.1f\n",
+          (splicemode) ? "splice" : "copy", relayed,
+          (seconds > 0) ? packets / seconds : 0.0,
+          (seconds > 0) ? (double)packets * packetsize / seconds / 1048576.0 : 0.0);
+
+  dl_disconnect (srcdlcp);
+  dl_freedlcp (srcdlcp);
+  dl_disconnect (destdlcp);
+  dl_freedlcp (destdlcp);
+  free (packetdata);
+
+  return 0;
+} /* End of run_client() */
+
+/***************************************************************************
+ * bench_connect:
+ *
+ * Create a connection to address.
+ *
+ * Returns connection on success and NULL on error.
+ ***************************************************************************/
+static DLCP *
+bench_connect (const char *address)
+{
+  DLCP *dlconn;
+
+  if (!(dlconn = dl_newdlcp ((char *)address, PACKAGE)))
+    return NULL;
+
+  dlconn->keepalive = 0;
+
+  if (dl_connect (dlconn) < 0)
+  {
+    fprintf (stderr, "Cannot connect to %s\n", address);
+    dl_freedlcp (dlconn);
+    return NULL;
+  }
+
+  return dlconn;
+} /* End of bench_connect() */
+
+/***************************************************************************
+ * usage:
+ *
+ * Print usage message.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [-n packets] [-s size] [-u] [-v]\n\n", PACKAGE);
+  fprintf (stderr,
+           " -n packets  Number of packets to relay, default 200000\n"
+           " -s size     Packet payload size in bytes, default 4096\n"
+           " -u          Use a Unix domain socket for the source connection\n"
+           " -v          Increase libdali verbosity\n");
+} /* End of usage() */
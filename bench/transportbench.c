@@ -0,0 +1,187 @@
+/***************************************************************************
+ * transportbench.c
+ *
+ * Compare DataLink write throughput and acknowledged round trip
+ * latency over TCP loopback and a Unix domain socket.
+ *
+ * For each transport a minimal server (see benchserver.c) is forked
+ * that accepts a single connection.  The client uses libdali to write
+ * packets without acknowledgement to measure throughput and with
+ * acknowledgement to measure round trip latency.
+ *
+ * This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <libdali.h>
+
+#include "benchserver.h"
+
+#define PACKAGE "transportbench"
+
+static int run_client (const char *address, int packets, int acked, int packetsize);
+static void usage (void);
+
+static int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+  char address[200];
+  int families[2] = {AF_INET, AF_UNIX};
+  int packets     = 200000;
+  int acked       = 10000;
+  int packetsize  = 512;
+  int listener;
+  int status;
+  int idx;
+  pid_t pid;
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      packets = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-a") == 0 && (idx + 1) < argc)
+      acked = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-s") == 0 && (idx + 1) < argc)
+      packetsize = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-v") == 0)
+      verbose++;
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (packets <= 0 || acked < 0 || packetsize <= 0)
+  {
+    usage ();
+    return 1;
+  }
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  printf ("%-12s %10s %12s %10s %12s\n",
+          "transport", "packets", "packets/s", "MB/s", "ack RTT us");
+
+  for (idx = 0; idx < 2; idx++)
+  {
+    if ((listener = bench_listen (families[idx], address, sizeof (address))) < 0)
+      return 1;
+
+    if ((pid = bench_serve (listener, packetsize, 0)) < 0)
+      return 1;
+
+    if (run_client (address, packets, acked, packetsize))
+      kill (pid, SIGTERM);
+
+    waitpid (pid, &status, 0);
+    bench_cleanup (address);
+  }
+
+  return 0;
+} /* End of main() */
+
+/***************************************************************************
+ * run_client:
+ *
+ * Connect to the server at address, write packets without
+ * acknowledgement then acked packets with acknowledgement and print
+ * the results.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+run_client (const char *address, int packets, int acked, int packetsize)
+{
+  DLCP *dlconn;
+  char *packet;
+  dltime_t start;
+  dltime_t elapsed;
+  double seconds;
+  double rtt = 0.0;
+  int idx;
+
+  if (!(dlconn = dl_newdlcp ((char *)address, PACKAGE)))
+    return -1;
+
+  if (!(packet = (char *)calloc (1, packetsize)))
+  {
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  if (dl_connect (dlconn) < 0)
+  {
+    fprintf (stderr, "Cannot connect to %s\n", address);
+    free (packet);
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  /* Throughput: unacknowledged writes, the last acknowledged to drain the server */
+  start = dlp_time ();
+  for (idx = 0; idx < packets; idx++)
+  {
+    if (dl_write (dlconn, packet, packetsize, "XX_BENCH_00_BHZ/MSEED",
+                  start, start + 1, (idx == packets - 1)) < 0)
+    {
+      fprintf (stderr, "Write failed to %s\n", address);
+      break;
+    }
+  }
+  elapsed = dlp_time () - start;
+  seconds = (double)elapsed / DLTMODULUS;
+
+  /* Latency: acknowledged writes */
+  if (idx == packets && acked > 0)
+  {
+    start = dlp_time ();
+    for (idx = 0; idx < acked; idx++)
+    {
+      if (dl_write (dlconn, packet, packetsize, "XX_BENCH_00_BHZ/MSEED",
+                    start, start + 1, 1) < 0)
+      {
+        fprintf (stderr, "Acknowledged write failed to %s\n", address);
+        break;
+      }
+    }
+    rtt = (double)(dlp_time () - start) / acked;
+  }
+
+  printf ("%-12s %10d %12.0f %10.1f %12.1f\n",
+          (strncmp (address, "unix:", 5)) ? "TCP loopback" : "Unix domain",
+          packets, (seconds > 0) ? packets / seconds : 0.0,
+          (seconds > 0) ? (double)packets * packetsize / seconds / 1048576.0 : 0.0,
+          rtt);
+
+  dl_disconnect (dlconn);
+  dl_freedlcp (dlconn);
+  free (packet);
+
+  return 0;
+} /* End of run_client() */
+
+/***************************************************************************
+ * usage:
+ *
+ * Print usage message.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [-n packets] [-a acked] [-s size] [-v]\n\n", PACKAGE);
+  fprintf (stderr,
+           " -n packets  Number of unacknowledged packets to write, default 200000\n"
+           " -a acked    Number of acknowledged packets to write, default 10000\n"
+           " -s size     Packet payload size in bytes, default 512\n"
+           " -v          Increase libdali verbosity\n");
+} /* End of usage() */
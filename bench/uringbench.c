@@ -0,0 +1,231 @@
+/***************************************************************************
+ * uringbench.c
+ *
+ * Compare the libdali io_uring socket I/O backend with the default
+ * system call (select/send/recv) path.
+ *
+ * For each I/O path a minimal server (see benchserver.c) is forked
+ * and the client measures unacknowledged write throughput,
+ * acknowledged write round trip latency and dl_collect() receive
+ * throughput of streamed packets.
+ *
+ * The io_uring path is only used if libdali was built with it, e.g.
+ * 'make IOURING=1', and the kernel supports it, otherwise it is
+ * reported as unavailable.
+ *
+ * This program requires a POSIX system.
+ ***************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <libdali.h>
+
+#include "benchserver.h"
+
+#define PACKAGE "uringbench"
+
+static int run_client (const char *address, int iouring, int packets, int acked,
+                       int packetsize);
+static DLCP *bench_connect (const char *address, int iouring);
+static void usage (void);
+
+static int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+  char address[200];
+  int packets    = 200000;
+  int acked      = 10000;
+  int packetsize = 512;
+  int family     = AF_INET;
+  int listener;
+  int status;
+  int iouring;
+  int idx;
+  pid_t pid;
+
+  for (idx = 1; idx < argc; idx++)
+  {
+    if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+      packets = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-a") == 0 && (idx + 1) < argc)
+      acked = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-s") == 0 && (idx + 1) < argc)
+      packetsize = atoi (argv[++idx]);
+    else if (strcmp (argv[idx], "-u") == 0)
+      family = AF_UNIX;
+    else if (strcmp (argv[idx], "-v") == 0)
+      verbose++;
+    else
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (packets <= 0 || acked < 0 || packetsize <= 0)
+  {
+    usage ();
+    return 1;
+  }
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  printf ("%-9s %10s %12s %12s %12s\n",
+          "I/O path", "packets", "write pkt/s", "ack RTT us", "recv pkt/s");
+
+  for (iouring = 0; iouring <= 1; iouring++)
+  {
+    if ((listener = bench_listen (family, address, sizeof (address))) < 0)
+      return 1;
+
+    /* Server streams the same number of packets as written */
+    if ((pid = bench_serve (listener, packetsize, packets)) < 0)
+      return 1;
+
+    if (run_client (address, iouring, packets, acked, packetsize))
+      kill (pid, SIGTERM);
+
+    waitpid (pid, &status, 0);
+    bench_cleanup (address);
+  }
+
+  return 0;
+} /* End of main() */
+
+/***************************************************************************
+ * run_client:
+ *
+ * Connect to the server at address, write packets without
+ * acknowledgement, write acked packets with acknowledgement and then
+ * collect streamed packets, printing the results.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+run_client (const char *address, int iouring, int packets, int acked, int packetsize)
+{
+  DLCP *dlconn;
+  DLPacket dlpacket;
+  char *packet;
+  dltime_t start;
+  double writerate = 0.0;
+  double recvrate  = 0.0;
+  double rtt       = 0.0;
+  int received     = 0;
+  int active;
+  int idx;
+
+  if (!(dlconn = bench_connect (address, iouring)))
+    return -1;
+
+  if (!(packet = (char *)calloc (1, packetsize)))
+  {
+    dl_disconnect (dlconn);
+    dl_freedlcp (dlconn);
+    return -1;
+  }
+
+  active = (dlconn->uring != NULL);
+
+  /* Write throughput: unacknowledged writes, the last acknowledged to drain the server */
+  start = dlp_time ();
+  for (idx = 0; idx < packets; idx++)
+  {
+    if (dl_write (dlconn, packet, packetsize, "XX_BENCH_00_BHZ/MSEED",
+                  start, start + 1, (idx == packets - 1)) < 0)
+      break;
+  }
+  if (idx == packets)
+    writerate = packets / ((double)(dlp_time () - start) / DLTMODULUS);
+
+  /* Latency: acknowledged writes */
+  if (idx == packets && acked > 0)
+  {
+    start = dlp_time ();
+    for (idx = 0; idx < acked; idx++)
+    {
+      if (dl_write (dlconn, packet, packetsize, "XX_BENCH_00_BHZ/MSEED",
+                    start, start + 1, 1) < 0)
+        break;
+    }
+    rtt = (double)(dlp_time () - start) / acked;
+  }
+
+  /* Receive throughput: collect streamed packets */
+  start = dlp_time ();
+  while (received < packets)
+  {
+    if (dl_collect (dlconn, &dlpacket, packet, packetsize, 0) != DLPACKET)
+      break;
+
+    received++;
+  }
+  if (received == packets)
+    recvrate = packets / ((double)(dlp_time () - start) / DLTMODULUS);
+
+  printf ("%-9s %10d %12.0f %12.1f %12.0f\n",
+          (!iouring) ? "syscalls" : (active) ? "io_uring" : "(n/a)",
+          packets, writerate, rtt, recvrate);
+
+  if (iouring && !active)
+    printf ("io_uring unavailable, build libdali with 'make IOURING=1' on Linux 6.0 or later\n");
+
+  dl_disconnect (dlconn);
+  dl_freedlcp (dlconn);
+  free (packet);
+
+  return 0;
+} /* End of run_client() */
+
+/***************************************************************************
+ * bench_connect:
+ *
+ * Create a connection to address, using io_uring if requested.
+ *
+ * Returns connection on success and NULL on error.
+ ***************************************************************************/
+static DLCP *
+bench_connect (const char *address, int iouring)
+{
+  DLCP *dlconn;
+
+  if (!(dlconn = dl_newdlcp ((char *)address, PACKAGE)))
+    return NULL;
+
+  dlconn->iouring   = iouring;
+  dlconn->keepalive = 0;
+
+  if (dl_connect (dlconn) < 0)
+  {
+    fprintf (stderr, "Cannot connect to %s\n", address);
+    dl_freedlcp (dlconn);
+    return NULL;
+  }
+
+  return dlconn;
+} /* End of bench_connect() */
+
+/***************************************************************************
+ * usage:
+ *
+ * Print usage message.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [-n packets] [-a acked] [-s size] [-u] [-v]\n\n", PACKAGE);
+  fprintf (stderr,
+           " -n packets  Number of packets to write and receive, default 200000\n"
+           " -a acked    Number of acknowledged packets to write, default 10000\n"
+           " -s size     Packet payload size in bytes, default 512\n"
+           " -u          Use a Unix domain socket instead of TCP loopback\n"
+           " -v          Increase libdali verbosity\n");
+} /* End of usage() */
@@ -0,0 +1,441 @@
+/***********************************************************************/ /**
+ * @file asynclog.c
+ *
+ * Asynchronous log message output for libdali.
+ *
+ * When asynchronous logging is started for a DLLog the messages are
+ * formatted by the logging thread into a slot of a bounded, lock-free
+ * multiple-producer single-consumer ring and a background writer
+ * thread writes them to a file descriptor in batches.  A time stamp,
+ * formatted at most once per second, can be prefixed to each message.
+ *
+ * Producers never block: when the ring is full the message is dropped
+ * and counted, the writer reports the number of dropped messages.
+ * Claiming and publishing a slot use only atomic operations and the
+ * writer is woken through a pipe with write(), but messages are
+ * formatted with vsnprintf(), so logging is not async-signal-safe.
+ *
+ * Asynchronous logging requires POSIX threads and C11 atomics and is
+ * not available under WIN.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#if !defined(DLP_WIN)
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Default number of ring slots */
+#define ASYNC_SLOTS 4096
+
+/* Size of the writer batch buffer */
+#define ASYNC_BATCH 65536
+
+/* Maximum length of the time stamp prefix */
+#define ASYNC_TIMELEN 64
+
+typedef struct AsyncSlot_s
+{
+  atomic_size_t seq;             /**< Slot sequence, see dlp_logasync_push() */
+  dltime_t time;                 /**< Time the message was logged */
+  int length;                    /**< Length of message */
+  char message[MAX_LOG_MSG_LENGTH]; /**< Formatted message including prefix */
+} AsyncSlot;
+
+struct DLLogAsync_s
+{
+  AsyncSlot *slots;              /**< Ring of message slots */
+  size_t mask;                   /**< Number of slots - 1, a power of 2 minus 1 */
+  atomic_size_t head;            /**< Next position to be claimed by producers */
+  size_t tail;                   /**< Next position to be written, writer only */
+  atomic_ulong dropped;          /**< Messages dropped because the ring was full */
+  atomic_int waiting;            /**< Writer is waiting for messages */
+  atomic_int stop;               /**< Writer should drain and exit */
+  int fd;                        /**< Output file descriptor */
+  int wakepipe[2];               /**< Pipe to wake the writer */
+  char *timeformat;              /**< strftime() format of time stamp prefix, or NULL */
+  char timestr[ASYNC_TIMELEN];   /**< Cached time stamp prefix, writer only */
+  size_t timelen;                /**< Length of cached time stamp prefix */
+  int64_t timesecond;            /**< Second of cached time stamp prefix, -1 if none */
+  pthread_t thread;              /**< Writer thread */
+};
+
+extern DLLog gDLLog;
+
+static void *dlp_logasync_writer (void *arg);
+static size_t dlp_logasync_timestamp (DLLogAsync *async, dltime_t time, char *buffer);
+static void dlp_logasync_write (int fd, const char *buffer, size_t length);
+#endif
+
+/***********************************************************************/ /**
+ * @brief Start asynchronous output of log messages
+ *
+ * Start a background thread writing all messages logged with @a log,
+ * of all levels and with the usual prefixes, to file descriptor
+ * @a fd.  The print functions of @a log are not used while
+ * asynchronous output is active.
+ *
+ * Logging a message only formats it into a lock-free ring, the time
+ * stamp formatting and writing are done by the background thread in
+ * batches.  If @a timeformat is not NULL each message is prefixed
+ * with the time it was logged, formatted with strftime() in local
+ * time, e.g. "%a %b %e %H:%M:%S %Y - ".  If the ring is full messages
+ * are dropped and the number dropped is reported.
+ *
+ * dl_logasync_stop() must be called to write pending messages before
+ * the program exits.
+ *
+ * @param log DLLog logging parameters, NULL for the global parameters
+ * @param fd File descriptor to write messages to
+ * @param timeformat strftime() format of a time stamp prefix, or NULL
+ * @param slots Number of messages the ring can hold, 0 for the default
+ *
+ * @return 0 on success and -1 on error or when not supported.
+ ***************************************************************************/
+int
+dl_logasync_start (DLLog *log, int fd, const char *timeformat, int slots)
+{
+#if defined(DLP_WIN)
+  return -1;
+#else
+  DLLogAsync *async;
+  size_t nslots = 1;
+  size_t idx;
+
+  if (!log)
+    log = &gDLLog;
+
+  if (log->async || fd < 0)
+    return -1;
+
+  /* Round up to a power of 2 for masking */
+  while (nslots < (size_t)((slots > 0) ? slots : ASYNC_SLOTS))
+    nslots <<= 1;
+
+  if (!(async = (DLLogAsync *)calloc (1, sizeof (DLLogAsync))))
+    return -1;
+
+  if (!(async->slots = (AsyncSlot *)malloc (nslots * sizeof (AsyncSlot))) ||
+      (timeformat && !(async->timeformat = strdup (timeformat))) ||
+      pipe (async->wakepipe))
+  {
+    free (async->timeformat);
+    free (async->slots);
+    free (async);
+    return -1;
+  }
+
+  for (idx = 0; idx < nslots; idx++)
+    atomic_init (&async->slots[idx].seq, idx);
+
+  fcntl (async->wakepipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (async->wakepipe[1], F_SETFL, O_NONBLOCK);
+
+  async->mask       = nslots - 1;
+  async->fd         = fd;
+  async->timesecond = -1;
+  atomic_init (&async->head, 0);
+  atomic_init (&async->dropped, 0);
+  atomic_init (&async->waiting, 0);
+  atomic_init (&async->stop, 0);
+
+  if (pthread_create (&async->thread, NULL, dlp_logasync_writer, async))
+  {
+    close (async->wakepipe[0]);
+    close (async->wakepipe[1]);
+    free (async->timeformat);
+    free (async->slots);
+    free (async);
+    return -1;
+  }
+
+  log->async = async;
+
+  return 0;
+#endif
+} /* End of dl_logasync_start() */
+
+/***********************************************************************/ /**
+ * @brief Stop asynchronous output of log messages
+ *
+ * Write all pending messages, stop the background writer and return
+ * @a log to synchronous output through its print functions.  No
+ * other thread may log with @a log while this call is in progress.
+ *
+ * @param log DLLog logging parameters, NULL for the global parameters
+ ***************************************************************************/
+void
+dl_logasync_stop (DLLog *log)
+{
+#if !defined(DLP_WIN)
+  DLLogAsync *async;
+  char wake = 0;
+
+  if (!log)
+    log = &gDLLog;
+
+  if (!(async = log->async))
+    return;
+
+  atomic_store (&async->stop, 1);
+  if (write (async->wakepipe[1], &wake, 1) < 0)
+  {
+    /* Pipe full, the writer is already awake */
+  }
+
+  pthread_join (async->thread, NULL);
+
+  log->async = NULL;
+
+  close (async->wakepipe[0]);
+  close (async->wakepipe[1]);
+  free (async->timeformat);
+  free (async->slots);
+  free (async);
+#endif
+} /* End of dl_logasync_stop() */
+
+/***********************************************************************/ /**
+ * @brief Format a log message into the asynchronous output ring
+ *
+ * Claim a ring slot, format the message with @a prefix into it and
+ * publish it to the writer.  Slots are claimed with a compare and
+ * swap on the head position, each slot's sequence number indicates
+ * whether it is free for the claiming position (seq == position) or
+ * holds a message for the writer (seq == position + 1).
+ *
+ * @param async Asynchronous output state
+ * @param prefix Prefix for the message
+ * @param format Message format in printf() style
+ * @param varlist Message format variables
+ *
+ * @return The number of characters formatted, -1 if the message was
+ * dropped.
+ ***************************************************************************/
+int
+dlp_logasync_push (DLLogAsync *async, const char *prefix, const char *format, va_list *varlist)
+{
+#if defined(DLP_WIN)
+  return -1;
+#else
+  AsyncSlot *slot;
+  size_t pos;
+  size_t seq;
+  size_t presize;
+  int retvalue;
+  char wake = 0;
+
+  pos = atomic_load_explicit (&async->head, memory_order_relaxed);
+  for (;;)
+  {
+    slot = &async->slots[pos & async->mask];
+    seq  = atomic_load_explicit (&slot->seq, memory_order_acquire);
+
+    if (seq == pos)
+    {
+      if (atomic_compare_exchange_weak_explicit (&async->head, &pos, pos + 1,
+                                                 memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if ((ptrdiff_t)(seq - pos) < 0)
+    {
+      /* Ring is full */
+      atomic_fetch_add_explicit (&async->dropped, 1, memory_order_relaxed);
+      return -1;
+    }
+    else
+    {
+      pos = atomic_load_explicit (&async->head, memory_order_relaxed);
+    }
+  }
+
+  slot->time = dlp_time ();
+
+  presize = strlen (prefix);
+  if (presize >= MAX_LOG_MSG_LENGTH)
+    presize = MAX_LOG_MSG_LENGTH - 1;
+  memcpy (slot->message, prefix, presize);
+
+  retvalue = vsnprintf (slot->message + presize, MAX_LOG_MSG_LENGTH - presize,
+                        format, *varlist);
+
+  slot->length = (int)presize + ((retvalue < 0) ? 0 : retvalue);
+  if (slot->length > MAX_LOG_MSG_LENGTH - 1)
+    slot->length = MAX_LOG_MSG_LENGTH - 1;
+
+  atomic_store_explicit (&slot->seq, pos + 1, memory_order_release);
+
+  /* Wake the writer if it is waiting */
+  if (atomic_load (&async->waiting))
+  {
+    if (write (async->wakepipe[1], &wake, 1) < 0)
+    {
+      /* Pipe full, the writer will be woken */
+    }
+  }
+
+  return retvalue;
+#endif
+} /* End of dlp_logasync_push() */
+
+#if !defined(DLP_WIN)
+/***************************************************************************
+ * Background writer: copy published messages, with time stamps, into
+ * a batch buffer and write it, waiting on the wake pipe when the ring
+ * is empty.  Exits when stopped and the ring has been drained.
+ ***************************************************************************/
+static void *
+dlp_logasync_writer (void *arg)
+{
+  DLLogAsync *async = (DLLogAsync *)arg;
+  AsyncSlot *slot;
+  struct pollfd pfd;
+  unsigned long dropped;
+  unsigned long reported = 0;
+  char drain[64];
+  char *batch;
+  size_t batchlen;
+
+  if (!(batch = (char *)malloc (ASYNC_BATCH)))
+    return NULL;
+
+  pfd.fd     = async->wakepipe[0];
+  pfd.events = POLLIN;
+
+  for (;;)
+  {
+    batchlen = 0;
+
+    /* Copy published messages into the batch while they fit */
+    while (batchlen + ASYNC_TIMELEN + MAX_LOG_MSG_LENGTH <= ASYNC_BATCH)
+    {
+      slot = &async->slots[async->tail & async->mask];
+
+      if (atomic_load_explicit (&slot->seq, memory_order_acquire) != async->tail + 1)
+        break;
+
+      if (async->timeformat)
+        batchlen += dlp_logasync_timestamp (async, slot->time, batch + batchlen);
+
+      memcpy (batch + batchlen, slot->message, slot->length);
+      batchlen += slot->length;
+
+      /* Release slot for the position one lap ahead */
+      atomic_store_explicit (&slot->seq, async->tail + async->mask + 1, memory_order_release);
+      async->tail++;
+    }
+
+    /* Report dropped messages */
+    dropped = atomic_load_explicit (&async->dropped, memory_order_relaxed);
+    if (dropped != reported && batchlen + ASYNC_TIMELEN + 80 <= ASYNC_BATCH)
+    {
+      if (async->timeformat)
+        batchlen += dlp_logasync_timestamp (async, dlp_time (), batch + batchlen);
+
+      batchlen += snprintf (batch + batchlen, 80, "%lu log messages dropped, output too slow\n",
+                            dropped - reported);
+      reported = dropped;
+    }
+
+    if (batchlen > 0)
+    {
+      dlp_logasync_write (async->fd, batch, batchlen);
+      continue;
+    }
+
+    if (atomic_load (&async->stop))
+      break;
+
+    /* Wait for messages, re-checking after announcing to avoid a lost wake up */
+    atomic_store (&async->waiting, 1);
+
+    slot = &async->slots[async->tail & async->mask];
+    if (atomic_load_explicit (&slot->seq, memory_order_acquire) != async->tail + 1 &&
+        !atomic_load (&async->stop))
+    {
+      poll (&pfd, 1, 1000);
+    }
+
+    atomic_store (&async->waiting, 0);
+
+    while (read (async->wakepipe[0], drain, sizeof (drain)) > 0)
+      ;
+  }
+
+  free (batch);
+
+  return NULL;
+} /* End of dlp_logasync_writer() */
+
+/***************************************************************************
+ * Write the time stamp prefix for time into buffer, re-formatting the
+ * cached string only when the second changes.  Returns the length of
+ * the prefix.
+ ***************************************************************************/
+static size_t
+dlp_logasync_timestamp (DLLogAsync *async, dltime_t time, char *buffer)
+{
+  struct tm tms;
+  time_t second = (time_t)(time / DLTMODULUS);
+
+  if (second != async->timesecond)
+  {
+    localtime_r (&second, &tms);
+    async->timelen    = strftime (async->timestr, sizeof (async->timestr), async->timeformat, &tms);
+    async->timesecond = second;
+  }
+
+  memcpy (buffer, async->timestr, async->timelen);
+
+  return async->timelen;
+} /* End of dlp_logasync_timestamp() */
+
+/***************************************************************************
+ * Write all of buffer to fd, retrying interrupted and partial writes.
+ ***************************************************************************/
+static void
+dlp_logasync_write (int fd, const char *buffer, size_t length)
+{
+  ssize_t nwritten;
+
+  while (length > 0)
+  {
+    if ((nwritten = write (fd, buffer, length)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return;
+    }
+
+    buffer += nwritten;
+    length -= nwritten;
+  }
+} /* End of dlp_logasync_write() */
+#endif
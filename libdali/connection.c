@@ -28,6 +28,10 @@
 #include "libdali.h"
 #include "portable.h"
 
+static int64_t dl_writepacket (DLCP *dlconn, DLCP *srcconn, void *packet, int packetlen,
+                               char *streamid, dltime_t datastart, dltime_t dataend,
+                               int ack, int wait);
+
 /***********************************************************************/ /**
  * @brief Create a new DataLink Connection Parameter (DLCP) structure
  *
@@ -57,6 +61,19 @@ dl_newdlcp (char *address, char *progname)
     dlconn->clientid[0] = '\0';
   dlconn->keepalive      = 600;
   dlconn->iotimeout      = 60;
+  dlconn->conntimeout    = 10000;
+  dlconn->resolvettl     = 300;
+  dlconn->rcvbuf         = 0;
+  dlconn->sndbuf         = 0;
+  dlconn->autobuf        = 0;
+  dlconn->tcpnodelay     = 0;
+  dlconn->tcpquickack    = 0;
+  dlconn->tcpusertimeout = 0;
+  dlconn->tcpkeepidle    = 0;
+  dlconn->tcpkeepintvl   = 0;
+  dlconn->tcpkeepcnt     = 0;
+  dlconn->busypoll       = 0;
+  dlconn->iouring        = 0;
   dlconn->link           = -1;
   dlconn->serverproto    = 0.0;
   dlconn->maxpktsize     = 0;
@@ -67,6 +84,16 @@ dl_newdlcp (char *address, char *progname)
   dlconn->keepalive_time = 0;
   dlconn->terminate      = 0;
   dlconn->streaming      = 0;
+  dlconn->autobuf_sent   = 0;
+  dlconn->autobuf_recv   = 0;
+  dlconn->autobuf_time   = 0;
+  dlconn->addrcache      = NULL;
+  dlconn->uring          = NULL;
+  dlconn->splice         = NULL;
+  dlconn->traceid        = -1;
+  dlconn->statseq        = 0;
+  dlconn->sendtime       = 0;
+  memset (&dlconn->stats, 0, sizeof (dlconn->stats));
 
   dlconn->log = NULL;
 
@@ -84,7 +111,14 @@ void
 dl_freedlcp (DLCP *dlconn)
 {
   if (dlconn->log)
+  {
+    dl_logasync_stop (dlconn->log);
     free (dlconn->log);
+  }
+
+  dlp_resolvefree (dlconn);
+  dlp_uring_free (dlconn);
+  dlp_splice_free (dlconn);
 
   free (dlconn);
 } /* End of dl_freedlcp() */
@@ -108,6 +142,7 @@ dl_exchangeIDs (DLCP *dlconn, int parseresp)
   char sendstr[255]; /* Buffer for command strings */
   char respstr[255]; /* Buffer for server response */
   char *capptr;      /* Pointer to capabilities flags */
+  DLEventField fields[2];
   int respsize;
   int ret = 0;
 
@@ -177,7 +212,14 @@ dl_exchangeIDs (DLCP *dlconn, int parseresp)
     }
 
     /* Report received server ID (without the initial "ID ") */
-    dl_log_r (dlconn, 1, 1, "[%s] connected to: %s\n", dlconn->addr, respstr + 3);
+    fields[0].name    = "server";
+    fields[0].type    = DL_FIELD_STRING;
+    fields[0].value.s = respstr + 3;
+    fields[1].name    = "capabilities";
+    fields[1].type    = DL_FIELD_STRING;
+    fields[1].value.s = capptr;
+    dl_logevent (dlconn, 1, 1, DL_EVENT_SERVERID, fields, 2,
+                 "[%s] connected to: %s\n", dlconn->addr, respstr + 3);
     if (capptr)
       dl_log_r (dlconn, 1, 1, "[%s] capabilities: %s\n", dlconn->addr, capptr);
 
@@ -520,7 +562,9 @@ dl_reject (DLCP *dlconn, char *rejectpattern)
  *
  * When an acknowledgement from the server has been requested this
  * routine will receive the response from the server and parse it, a
- * successful acknowledgement is indicated by the return value.
+ * successful acknowledgement is indicated by the return value.  Use
+ * dl_write_deferack() to request an acknowledgement without waiting
+ * for it.
  *
  * @param dlconn DataLink Connection Parameters
  * @param packet Packet data buffer to send
@@ -537,16 +581,155 @@ dl_reject (DLCP *dlconn, char *rejectpattern)
 int64_t
 dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
           dltime_t datastart, dltime_t dataend, int ack)
+{
+  if (!dlconn || !packet || !streamid)
+  {
+    dl_log_r (dlconn, 1, 1, "dl_write(): dlconn || packet || streamid is not anticipated value \n");
+    return -1;
+  }
+
+  return dl_writepacket (dlconn, NULL, packet, packetlen, streamid, datastart, dataend, ack, ack);
+} /* End of dl_write() */
+
+/***********************************************************************/ /**
+ * @brief Send a packet to the DataLink server, acknowledgement deferred
+ *
+ * Send a packet to the server like dl_write(), requesting an
+ * acknowledgement but not waiting for it.  The acknowledgement is
+ * received later with dl_pollack() and confirms that the server has
+ * handled this and all earlier packets on the connection.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param packet Packet data buffer to send
+ * @param packetlen Length of data in bytes to send from @a packet
+ * @param streamid Stream ID of packet
+ * @param datastart Data start time for packet
+ * @param dataend Data end time for packet
+ *
+ * @return -1 on error and 0 on success.
+ ***************************************************************************/
+int64_t
+dl_write_deferack (DLCP *dlconn, void *packet, int packetlen, char *streamid,
+                   dltime_t datastart, dltime_t dataend)
+{
+  if (!dlconn || !packet || !streamid)
+  {
+    dl_log_r (dlconn, 1, 1, "dl_write_deferack(): dlconn || packet || streamid is not anticipated value \n");
+    return -1;
+  }
+
+  return dl_writepacket (dlconn, NULL, packet, packetlen, streamid, datastart, dataend, 1, 0);
+} /* End of dl_write_deferack() */
+
+/***********************************************************************/ /**
+ * @brief Send a packet to the DataLink server with a held payload
+ *
+ * Send the payload held by @a srcconn, from a dl_collect() or
+ * dl_collect_nb() call with a NULL packet data buffer, as a packet
+ * to the server, with stream ID and times from @a packet.  Otherwise
+ * equivalent to dl_write().
+ *
+ * On Linux the payload is relayed between the sockets through a pipe
+ * with splice() and is never copied into user space.  The payload
+ * remains held until the next packet is collected on @a srcconn, so
+ * the write may be retried or repeated to other connections.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param srcconn DataLink Connection Parameters holding the payload
+ * @param packet Packet header information of the held payload
+ * @param ack Acknowledgement flag, if true request acknowledgement
+ *
+ * @return -1 on error and 0 on success when no acknowledgement is
+ * requested and a positive packet ID on success when acknowledgement
+ * is requested.
+ ***************************************************************************/
+int64_t
+dl_write_splice (DLCP *dlconn, DLCP *srcconn, DLPacket *packet, int ack)
+{
+  if (!srcconn || !packet)
+  {
+    dl_log_r (dlconn, 1, 1, "dl_write_splice(): srcconn || packet is not anticipated value \n");
+    return -1;
+  }
+
+  return dl_writepacket (dlconn, srcconn, NULL, packet->datasize, packet->streamid,
+                         packet->datastart, packet->dataend, ack, ack);
+} /* End of dl_write_splice() */
+
+/***********************************************************************/ /**
+ * @brief Receive a deferred write acknowledgement if one has arrived
+ *
+ * Check without blocking for the reply to a packet written with
+ * dl_write_deferack().  Replies arrive in the order the
+ * acknowledgements were requested, each confirming that the server
+ * has handled the packet and all packets written before it on the
+ * connection.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param value Set to the packet ID assigned by the server, if not NULL
+ *
+ * @return 1 when an acknowledgement was received, 0 when none has
+ * arrived and -1 on error or when the server replied with an error.
+ ***************************************************************************/
+int
+dl_pollack (DLCP *dlconn, int64_t *value)
+{
+  int64_t replyvalue = 0;
+  char reply[255];
+  int rv;
+
+  if (!dlconn || dlconn->link < 0)
+    return -1;
+
+  if ((rv = dl_recvheader (dlconn, reply, sizeof (reply), 0)) == 0)
+    return 0;
+
+  if (rv < 0)
+    return -1;
+
+  rv = dl_handlereply (dlconn, reply, sizeof (reply) - 1, &replyvalue);
+
+  if (rv == 0)
+  {
+    dl_log_r (dlconn, 1, 3, "[%s] %s\n", dlconn->addr, reply);
+    dlp_trace (dlconn, DL_TRACE_ACK, replyvalue, 0);
+
+    if (value)
+      *value = replyvalue;
+
+    return 1;
+  }
+
+  if (rv == 1)
+    dl_log_r (dlconn, 1, 0, "[%s] %s\n", dlconn->addr, reply);
+
+  return -1;
+} /* End of dl_pollack() */
+
+/***************************************************************************
+ * dl_writepacket:
+ *
+ * Send a WRITE command with packet data from the packet buffer or, if
+ * srcconn is not NULL, with the payload held by srcconn.  If ack is
+ * true an acknowledgement is requested, received and processed only
+ * if wait is also true.
+ *
+ * Returns -1 on error, 0 on success when no acknowledgement is
+ * waited for and a positive packet ID when acknowledged.
+ ***************************************************************************/
+static int64_t
+dl_writepacket (DLCP *dlconn, DLCP *srcconn, void *packet, int packetlen, char *streamid,
+                dltime_t datastart, dltime_t dataend, int ack, int wait)
 {
   int64_t replyvalue = 0;
   char reply[255];
   char header[255];
-  char *flags = (ack) ? "A" : "N";
   int headerlen;
   int replylen;
   int rv;
+  uint64_t profstart;
 
-  if (!dlconn || !packet || !streamid)
+  if (!dlconn || !streamid)
   {
     dl_log_r (dlconn, 1, 1, "dl_write(): dlconn || packet || streamid is not anticipated value \n");
     return -1;
@@ -575,15 +758,19 @@ dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
   }
 
   /* Create packet header with command: "WRITE streamid hpdatastart hpdataend flags size" */
-  headerlen = snprintf (header, sizeof (header),
-                        "WRITE %s %lld %lld %s %d",
-                        streamid, (long long int)datastart, (long long int)dataend,
-                        flags, packetlen);
+  profstart = dlp_prof_begin ();
+  headerlen = dlp_formatwrite (header, sizeof (header), streamid,
+                               datastart, dataend, ack, packetlen);
+  dlp_prof_end (DL_PROF_FORMAT, profstart);
 
   /* Send command and packet to server */
-  replylen = dl_sendpacket (dlconn, header, headerlen,
-                            packet, packetlen,
-                            (ack) ? reply : NULL, (ack) ? sizeof (reply) : 0);
+  if (srcconn)
+    replylen = dlp_splice_sendpacket (dlconn, srcconn, header, headerlen,
+                                      (wait) ? reply : NULL, (wait) ? sizeof (reply) : 0);
+  else
+    replylen = dl_sendpacket (dlconn, header, headerlen,
+                              packet, packetlen,
+                              (wait) ? reply : NULL, (wait) ? sizeof (reply) : 0);
 
   if (replylen < 0)
   {
@@ -591,7 +778,12 @@ dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
               dlconn->addr);
     return -1;
   }
-  else if (replylen > 0)
+
+  dlp_trace (dlconn, DL_TRACE_SEND, packetlen, dlp_trace_stream (streamid));
+  dlp_stats (dlconn, packetssent, 1);
+  dlp_probe4 (packet__send, dlconn, streamid, packetlen, ack);
+
+  if (replylen > 0)
   {
     /* Reply message, if sent, will be placed into the reply buffer */
     rv = dl_handlereply (dlconn, reply, sizeof (reply), &replyvalue);
@@ -600,6 +792,7 @@ dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
     if (rv == 0)
     {
       dl_log_r (dlconn, 1, 3, "[%s] %s\n", dlconn->addr, reply);
+      dlp_trace (dlconn, DL_TRACE_ACK, replyvalue, 0);
     }
     else if (rv == 1)
     {
@@ -613,7 +806,7 @@ dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
   }
 
   return replyvalue;
-} /* End of dl_write() */
+} /* End of dl_writepacket() */
 
 /***********************************************************************/ /**
  * @brief Request a packet from the DataLink server
@@ -646,12 +839,6 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
   int headerlen;
   int rv = 0;
 
-  long long int spktid;
-  long long int spkttime;
-  long long int sdatastart;
-  long long int sdataend;
-  long int sdatasize;
-
   if (!dlconn || !packet || !packetdata)
     return -1;
 
@@ -694,23 +881,13 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
   if (!strncmp (header, "PACKET", 6))
   {
     /* Parse PACKET header */
-    rv = sscanf (header, "PACKET %s %lld %lld %lld %lld %ld",
-                 packet->streamid, &spktid, &spkttime,
-                 &sdatastart, &sdataend, &sdatasize);
-
-    if (rv != 6)
+    if (dlp_parsepacket (header, packet))
     {
       dl_log_r (dlconn, 2, 0, "[%s] dl_read(): cannot parse PACKET header\n",
                 dlconn->addr);
       return -1;
     }
 
-    packet->pktid     = spktid;
-    packet->pkttime   = spkttime;
-    packet->datastart = sdatastart;
-    packet->dataend   = sdataend;
-    packet->datasize  = sdatasize;
-
     /* Check that the packet data size is not beyond the max receive buffer size */
     if (packet->datasize > (int64_t)maxdatasize)
     {
@@ -756,6 +933,10 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
     /* Update most recently received packet ID and time */
     dlconn->pktid   = packet->pktid;
     dlconn->pkttime = packet->pkttime;
+
+    dlp_trace (dlconn, DL_TRACE_RECV, packet->pktid, dlp_trace_stream (packet->streamid));
+    dlp_stats (dlconn, packetsrecv, 1);
+    dlp_probe4 (packet__recv, dlconn, packet->pktid, packet->streamid, packet->datasize);
   }
   else if (!strncmp (header, "ERROR", 5))
   {
@@ -933,6 +1114,10 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
  * successfully receiving a packet @a dlpack will be populated and the
  * packet data will be copied into @a packetdata.
  *
+ * If @a packetdata is NULL the packet data is instead held by the
+ * connection, without copying it into user space where supported,
+ * for relaying to another connection with dl_write_splice().
+ *
  * If the endflag is true the ENDSTREAM command is sent which
  * instructs the server to stop streaming packets; a client must
  * continue collecting packets until DLENDED is returned in order to
@@ -952,19 +1137,14 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
   char header[255];
   int headerlen;
   int rv;
-
-  long long int spktid;
-  long long int spkttime;
-  long long int sdatastart;
-  long long int sdataend;
-  long int sdatasize;
+  uint64_t profstart;
 
   /* For select()ing during the read loop */
   struct timeval select_tv;
   fd_set select_fd;
   int select_ret;
 
-  if (!dlconn || !packet || !packetdata)
+  if (!dlconn || !packet)
     return DLERROR;
 
   if (dlconn->link == -1)
@@ -1015,6 +1195,8 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
     if (dlconn->keepalive && dlconn->keepalive_trig > 0)
     {
       dl_log_r (dlconn, 1, 2, "[%s] Sending keepalive packet\n", dlconn->addr);
+      dlp_trace (dlconn, DL_TRACE_KEEPALIVE, 0, 0);
+      dlp_stats (dlconn, keepalives, 1);
 
       /* Send ID as a keepalive packet exchange */
       headerlen = snprintf (header, sizeof (header), "ID %s", dlconn->clientid);
@@ -1029,20 +1211,31 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
       dlconn->keepalive_trig = -1;
     }
 
-    /* Poll the socket for available data */
-    FD_ZERO (&select_fd);
-    FD_SET ((unsigned int)dlconn->link, &select_fd);
-    select_tv.tv_sec  = 0;
-    select_tv.tv_usec = 500000; /* Block up to 0.5 seconds */
+    /* Poll for available data, through io_uring if active */
+    profstart = dlp_prof_begin ();
+
+    if (dlconn->uring)
+    {
+      select_ret = dlp_uring_wait (dlconn, 500000); /* Block up to 0.5 seconds */
+    }
+    else
+    {
+      FD_ZERO (&select_fd);
+      FD_SET ((unsigned int)dlconn->link, &select_fd);
+      select_tv.tv_sec  = 0;
+      select_tv.tv_usec = 500000; /* Block up to 0.5 seconds */
+
+      select_ret = select ((dlconn->link + 1), &select_fd, NULL, NULL, &select_tv);
+    }
 
-    select_ret = select ((dlconn->link + 1), &select_fd, NULL, NULL, &select_tv);
+    dlp_prof_end (DL_PROF_WAIT, profstart);
 
     /* Check the return from select(), an interrupted system call error
 	 will be reported if a signal handler was used.  If the terminate
 	 flag is set this is not an error. */
     if (select_ret > 0)
     {
-      if (!FD_ISSET (dlconn->link, &select_fd))
+      if (!dlconn->uring && !FD_ISSET (dlconn->link, &select_fd))
       {
         dl_log_r (dlconn, 2, 0, "[%s] select() reported data but socket not in set!\n",
                   dlconn->addr);
@@ -1050,7 +1243,11 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
       else
       {
         /* Receive packet header, blocking until complete */
-        if ((rv = dl_recvheader (dlconn, header, sizeof (header), 1)) < 0)
+        profstart = dlp_prof_begin ();
+        rv        = dl_recvheader (dlconn, header, sizeof (header), 1);
+        dlp_prof_end (DL_PROF_RECVHEADER, profstart);
+
+        if (rv < 0)
         {
           if (rv == -1)
             return DLENDED;
@@ -1066,24 +1263,18 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
         if (!strncmp (header, "PACKET", 6))
         {
           /* Parse PACKET header */
-          rv = sscanf (header, "PACKET %s %lld %lld %lld %lld %ld",
-                       packet->streamid, &spktid, &spkttime,
-                       &sdatastart, &sdataend, &sdatasize);
+          profstart = dlp_prof_begin ();
+          rv        = dlp_parsepacket (header, packet);
+          dlp_prof_end (DL_PROF_PARSE, profstart);
 
-          if (rv != 6)
+          if (rv)
           {
             dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): cannot parse PACKET header\n",
                       dlconn->addr);
             return DLERROR;
           }
 
-          packet->pktid     = spktid;
-          packet->pkttime   = spkttime;
-          packet->datastart = sdatastart;
-          packet->dataend   = sdataend;
-          packet->datasize  = sdatasize;
-
-          if (packet->datasize > (int64_t)maxdatasize)
+          if (packetdata && packet->datasize > (int64_t)maxdatasize)
           {
             dl_log_r (dlconn, 2, 0,
                       "[%s] dl_collect(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
@@ -1091,8 +1282,17 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
             return DLERROR;
           }
 
-          /* Receive packet data, blocking until complete */
-          if ((rv = dl_recvdata (dlconn, packetdata, packet->datasize, 1)) != packet->datasize)
+          /* Receive packet data, or hold it for dl_write_splice(), blocking until complete */
+          profstart = dlp_prof_begin ();
+
+          if (packetdata)
+            rv = dl_recvdata (dlconn, packetdata, packet->datasize, 1);
+          else
+            rv = dlp_splice_recv (dlconn, packet->datasize);
+
+          dlp_prof_end (DL_PROF_RECVDATA, profstart);
+
+          if (rv != packet->datasize)
           {
             if (rv == -1)
               return DLENDED;
@@ -1106,6 +1306,10 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
           dlconn->pktid   = packet->pktid;
           dlconn->pkttime = packet->pkttime;
 
+          dlp_trace (dlconn, DL_TRACE_RECV, packet->pktid, dlp_trace_stream (packet->streamid));
+          dlp_stats (dlconn, packetsrecv, 1);
+          dlp_probe4 (packet__recv, dlconn, packet->pktid, packet->streamid, packet->datasize);
+
           return DLPACKET;
         }
         else if (!strncmp (header, "ID", 2))
@@ -1128,6 +1332,12 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
         }
       }
     }
+#if !defined(DLP_WIN)
+    else if (select_ret < 0 && errno == EINTR)
+    {
+      /* Interrupted by a handled signal, e.g. a flight recorder dump, wait again */
+    }
+#endif
     else if (select_ret < 0 && !dlconn->terminate)
     {
       dl_log_r (dlconn, 2, 0, "[%s] select() error: %s\n", dlconn->addr, dlp_strerror ());
@@ -1171,6 +1381,10 @@ dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
  * successfully receiving a packet @a dlpack will be populated and the
  * packet data will be copied into @a packetdata.
  *
+ * If @a packetdata is NULL the packet data is instead held by the
+ * connection, without copying it into user space where supported,
+ * for relaying to another connection with dl_write_splice().
+ *
  * If the @a endflag is true the ENDSTREAM command is sent which
  * instructs the server to stop streaming packets; a client must
  * continue collecting packets until DLENDED is returned in order to
@@ -1191,14 +1405,9 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
   char header[255];
   int headerlen;
   int rv;
+  uint64_t profstart;
 
-  long long int spktid;
-  long long int spkttime;
-  long long int sdatastart;
-  long long int sdataend;
-  long int sdatasize;
-
-  if (!dlconn || !packet || !packetdata)
+  if (!dlconn || !packet)
     return DLERROR;
 
   if (dlconn->link == -1)
@@ -1248,6 +1457,8 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
     if (dlconn->keepalive && dlconn->keepalive_trig > 0)
     {
       dl_log_r (dlconn, 1, 2, "[%s] Sending keepalive packet\n", dlconn->addr);
+      dlp_trace (dlconn, DL_TRACE_KEEPALIVE, 0, 0);
+      dlp_stats (dlconn, keepalives, 1);
 
       /* Send ID as a keepalive packet exchange */
       headerlen = snprintf (header, sizeof (header), "ID %s", dlconn->clientid);
@@ -1264,8 +1475,14 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
     }
   }
 
-  /* Receive packet header if it's available */
-  if ((rv = dl_recvheader (dlconn, header, sizeof (header), 0)) < 0)
+  /* Receive packet header if it's available, only timed when one is */
+  profstart = dlp_prof_begin ();
+  rv        = dl_recvheader (dlconn, header, sizeof (header), 0);
+
+  if (rv > 0)
+    dlp_prof_end (DL_PROF_RECVHEADER, profstart);
+
+  if (rv < 0)
   {
     if (rv == -1)
       return DLENDED;
@@ -1284,24 +1501,18 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
     if (!strncmp (header, "PACKET", 6))
     {
       /* Parse PACKET header */
-      rv = sscanf (header, "PACKET %s %lld %lld %lld %lld %ld",
-                   packet->streamid, &spktid, &spkttime,
-                   &sdatastart, &sdataend, &sdatasize);
+      profstart = dlp_prof_begin ();
+      rv        = dlp_parsepacket (header, packet);
+      dlp_prof_end (DL_PROF_PARSE, profstart);
 
-      if (rv != 6)
+      if (rv)
       {
         dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): cannot parse PACKET header\n",
                   dlconn->addr);
         return DLERROR;
       }
 
-      packet->pktid     = spktid;
-      packet->pkttime   = spkttime;
-      packet->datastart = sdatastart;
-      packet->dataend   = sdataend;
-      packet->datasize  = sdatasize;
-
-      if (packet->datasize > (int64_t)maxdatasize)
+      if (packetdata && packet->datasize > (int64_t)maxdatasize)
       {
         dl_log_r (dlconn, 2, 0,
                   "[%s] dl_collect_nb(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
@@ -1309,8 +1520,17 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
         return DLERROR;
       }
 
-      /* Receive packet data, blocking until complete */
-      if ((rv = dl_recvdata (dlconn, packetdata, packet->datasize, 1)) != packet->datasize)
+      /* Receive packet data, or hold it for dl_write_splice(), blocking until complete */
+      profstart = dlp_prof_begin ();
+
+      if (packetdata)
+        rv = dl_recvdata (dlconn, packetdata, packet->datasize, 1);
+      else
+        rv = dlp_splice_recv (dlconn, packet->datasize);
+
+      dlp_prof_end (DL_PROF_RECVDATA, profstart);
+
+      if (rv != packet->datasize)
       {
         if (rv == -1)
           return DLENDED;
@@ -1324,6 +1544,10 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
       dlconn->pktid   = packet->pktid;
       dlconn->pkttime = packet->pkttime;
 
+      dlp_trace (dlconn, DL_TRACE_RECV, packet->pktid, dlp_trace_stream (packet->streamid));
+      dlp_stats (dlconn, packetsrecv, 1);
+      dlp_probe4 (packet__recv, dlconn, packet->pktid, packet->streamid, packet->datasize);
+
       return DLPACKET;
     }
     else if (!strncmp (header, "ID", 2))
@@ -1459,6 +1683,8 @@ dl_handlereply (DLCP *dlconn, void *buffer, int buflen, int64_t *value)
     rv = -1;
   }
 
+  dlp_probe5 (reply, dlconn, rv, pvalue, cbuffer, size);
+
   return rv;
 } /* End of dl_handlereply() */
 
@@ -1478,3 +1704,74 @@ dl_terminate (DLCP *dlconn)
 
   dlconn->terminate = 1;
 } /* End of dl_terminate() */
+
+/***********************************************************************/ /**
+ * @brief Parse a PACKET header
+ *
+ * Parse a header of the form:
+ *
+ * "PACKET streamid pktid hppackettime hpdatastart hpdataend size"
+ *
+ * into the fields of @a packet.  Stream IDs longer than
+ * MAXSTREAMID - 1 characters are not accepted.
+ *
+ * @param header NULL-terminated PACKET header
+ * @param packet Packet description to fill
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_parsepacket (const char *header, DLPacket *packet)
+{
+  long long int spktid;
+  long long int spkttime;
+  long long int sdatastart;
+  long long int sdataend;
+  long int sdatasize;
+
+  if (!header || !packet)
+    return -1;
+
+  /* Width of the stream ID is MAXSTREAMID - 1 */
+  if (sscanf (header, "PACKET %59s %lld %lld %lld %lld %ld",
+              packet->streamid, &spktid, &spkttime,
+              &sdatastart, &sdataend, &sdatasize) != 6)
+    return -1;
+
+  packet->pktid     = spktid;
+  packet->pkttime   = spkttime;
+  packet->datastart = sdatastart;
+  packet->dataend   = sdataend;
+  packet->datasize  = sdatasize;
+
+  return 0;
+} /* End of dlp_parsepacket() */
+
+/***********************************************************************/ /**
+ * @brief Format a WRITE header
+ *
+ * Format a header of the form:
+ *
+ * "WRITE streamid hpdatastart hpdataend flags size"
+ *
+ * where flags is "A" if an acknowledgement is requested and "N"
+ * otherwise.
+ *
+ * @param header Buffer for the header
+ * @param size Size of @a header
+ * @param streamid Stream ID of the packet
+ * @param datastart Data start time of the packet
+ * @param dataend Data end time of the packet
+ * @param ack Request an acknowledgement if true
+ * @param packetlen Length of the packet data
+ *
+ * @return the length of the header, as from snprintf().
+ ***************************************************************************/
+int
+dlp_formatwrite (char *header, size_t size, const char *streamid,
+                 dltime_t datastart, dltime_t dataend, int ack, int packetlen)
+{
+  return snprintf (header, size, "WRITE %s %lld %lld %s %d",
+                   streamid, (long long int)datastart, (long long int)dataend,
+                   (ack) ? "A" : "N", packetlen);
+} /* End of dlp_formatwrite() */
@@ -0,0 +1,231 @@
+/***********************************************************************/ /**
+ * @file histogram.c
+ *
+ * HDR-style histograms for libdali.
+ *
+ * Values are counted in buckets indexed by the position of their
+ * most significant bit and the DL_HIST_SUBBITS bits below it, in the
+ * manner of HdrHistogram: values below 2^(DL_HIST_SUBBITS+1) each
+ * have their own bucket, above that each power of two is split into
+ * 2^DL_HIST_SUBBITS equal buckets.  Recording is a few shifts and a
+ * relaxed store, copies may be taken from other threads and signal
+ * handlers.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Number of sub-buckets in each power of two above the linear range */
+#define HIST_SUBCOUNT (1 << DL_HIST_SUBBITS)
+
+/* Mask of values counted in individual buckets */
+#define HIST_LINEARMASK ((2 << DL_HIST_SUBBITS) - 1)
+
+/* Largest value resolved, larger values are clamped */
+#define HIST_MAXVALUE (((int64_t)1 << DL_HIST_MAXBITS) - 1)
+
+static int hist_index (int64_t value);
+static int64_t hist_highest (int index);
+
+/***********************************************************************/ /**
+ * @brief Record a value in a histogram
+ *
+ * Values are clamped to the range 0 to 2^DL_HIST_MAXBITS - 1.  A
+ * histogram must only be recorded into by one thread at a time.
+ *
+ * @param hist Histogram to record into
+ * @param value Value to record
+ ***************************************************************************/
+void
+dl_hist_record (DLHistogram *hist, int64_t value)
+{
+  uint64_t *count;
+
+  if (!hist)
+    return;
+
+  if (value < 0)
+    value = 0;
+  else if (value > HIST_MAXVALUE)
+    value = HIST_MAXVALUE;
+
+  count = &hist->counts[hist_index (value)];
+
+  /* Single writer, relaxed loads and stores are enough for readers */
+  DLP_STORE_RELAXED (count, DLP_LOAD_RELAXED (count) + 1);
+  DLP_STORE_RELAXED (&hist->total, DLP_LOAD_RELAXED (&hist->total) + 1);
+  DLP_STORE_RELAXED (&hist->sum, DLP_LOAD_RELAXED (&hist->sum) + value);
+
+  if (value > DLP_LOAD_RELAXED (&hist->max))
+    DLP_STORE_RELAXED (&hist->max, value);
+} /* End of dl_hist_record() */
+
+/***********************************************************************/ /**
+ * @brief Copy a histogram that may be concurrently recorded into
+ *
+ * Each count is read atomically, the total of the copy is set to the
+ * sum of the copied counts so that it is consistent with them.  This
+ * routine is async-signal-safe.
+ *
+ * @param copy Histogram to copy into
+ * @param hist Histogram to copy
+ ***************************************************************************/
+void
+dl_hist_copy (DLHistogram *copy, const DLHistogram *hist)
+{
+  uint64_t total = 0;
+  int idx;
+
+  if (!copy || !hist)
+    return;
+
+  for (idx = 0; idx < DL_HIST_COUNTS; idx++)
+  {
+    copy->counts[idx] = DLP_LOAD_RELAXED (&hist->counts[idx]);
+    total += copy->counts[idx];
+  }
+
+  copy->total = total;
+  copy->sum   = DLP_LOAD_RELAXED (&hist->sum);
+  copy->max   = DLP_LOAD_RELAXED (&hist->max);
+} /* End of dl_hist_copy() */
+
+/***********************************************************************/ /**
+ * @brief Return a percentile of the values in a histogram
+ *
+ * The value returned is the largest value equivalent, within the
+ * histogram precision, to the value at the percentile, but never
+ * more than the largest value recorded.  Use a copy from
+ * dl_hist_copy() when the histogram may be recorded into
+ * concurrently.  This routine is async-signal-safe.
+ *
+ * @param hist Histogram
+ * @param percentile Percentile from 0 to 100, e.g. 99.9
+ *
+ * @return the value at the percentile, 0 if the histogram is empty.
+ ***************************************************************************/
+int64_t
+dl_hist_percentile (const DLHistogram *hist, double percentile)
+{
+  uint64_t target;
+  uint64_t seen = 0;
+  double rank;
+  int64_t value;
+  int idx;
+
+  if (!hist || hist->total == 0)
+    return 0;
+
+  if (percentile < 0.0)
+    percentile = 0.0;
+  else if (percentile > 100.0)
+    percentile = 100.0;
+
+  /* Rank of the value at the percentile, rounded up, at least the first value */
+  rank   = percentile / 100.0 * (double)hist->total;
+  target = (uint64_t)rank;
+  if ((double)target < rank)
+    target++;
+  if (target < 1)
+    target = 1;
+  if (target > hist->total)
+    target = hist->total;
+
+  for (idx = 0; idx < DL_HIST_COUNTS; idx++)
+  {
+    if ((seen += hist->counts[idx]) >= target)
+    {
+      value = hist_highest (idx);
+      return (value < hist->max) ? value : hist->max;
+    }
+  }
+
+  return hist->max;
+} /* End of dl_hist_percentile() */
+
+/***********************************************************************/ /**
+ * @brief Return the number of values at or below a value
+ *
+ * Buckets are only counted when all values they hold are at or below
+ * @a value, the count is exact when @a value is the upper end of a
+ * bucket and otherwise low by at most the count of one bucket.  This
+ * is suited to exporting cumulative buckets, e.g. for Prometheus.
+ *
+ * @param hist Histogram
+ * @param value Upper bound of the values counted
+ *
+ * @return the number of values counted.
+ ***************************************************************************/
+uint64_t
+dl_hist_countto (const DLHistogram *hist, int64_t value)
+{
+  uint64_t count = 0;
+  int idx;
+
+  if (!hist)
+    return 0;
+
+  for (idx = 0; idx < DL_HIST_COUNTS && hist_highest (idx) <= value; idx++)
+    count += hist->counts[idx];
+
+  return count;
+} /* End of dl_hist_countto() */
+
+/***************************************************************************
+ * hist_index:
+ *
+ * Return the bucket index of a value between 0 and HIST_MAXVALUE.
+ * Values below 2^(DL_HIST_SUBBITS+1) are their own index, above that
+ * the bucket of the power of two is the shift that leaves
+ * DL_HIST_SUBBITS+1 significant bits.
+ ***************************************************************************/
+static int
+hist_index (int64_t value)
+{
+  uint64_t bits = (uint64_t)value | HIST_LINEARMASK;
+  int msb;
+  int shift;
+
+#if defined(__GNUC__)
+  msb = 63 - __builtin_clzll (bits);
+#else
+  for (msb = 0; bits >>= 1; msb++)
+    ;
+#endif
+
+  shift = msb - DL_HIST_SUBBITS;
+
+  return (shift << DL_HIST_SUBBITS) + (int)((uint64_t)value >> shift);
+} /* End of hist_index() */
+
+/***************************************************************************
+ * hist_highest:
+ *
+ * Return the largest value counted in a bucket.
+ ***************************************************************************/
+static int64_t
+hist_highest (int index)
+{
+  int shift = (index >> DL_HIST_SUBBITS) - 1;
+
+  if (shift <= 0)
+    return index;
+
+  return ((((int64_t)(index & (HIST_SUBCOUNT - 1)) + HIST_SUBCOUNT + 1) << shift) - 1);
+} /* End of hist_highest() */
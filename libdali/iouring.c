@@ -0,0 +1,839 @@
+/***********************************************************************/ /**
+ * @file iouring.c
+ *
+ * Optional io_uring socket I/O backend.
+ *
+ * When libdali is built with DLP_IOURING defined (Linux only) and
+ * DLCP.iouring is set, connection socket I/O is performed through an
+ * io_uring instance instead of individual send(), recv() and select()
+ * system calls:
+ *
+ * - A single multishot receive fills a ring of provided buffers
+ *   registered with the kernel, data is copied out of these buffers
+ *   by dl_recvdata() and each buffer is returned to the kernel once
+ *   consumed.
+ *
+ * - Sends are submitted as linked operations, so a packet header and
+ *   payload are sent in order without first being copied into a
+ *   single buffer.
+ *
+ * The io_uring interface is used directly via system calls, no
+ * external library is required.  If io_uring cannot be set up, or
+ * the kernel does not support multishot receives, the connection
+ * silently falls back to the system call path.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#if defined(DLP_IOURING) && defined(__linux__)
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Submission and completion queue size */
+#define URING_ENTRIES 32
+
+/* Number (power of 2) and size of provided receive buffers */
+#define URING_NBUFS   64
+#define URING_BUFSIZE 16384
+
+/* Buffer group ID of the provided receive buffers */
+#define URING_BGID    0
+
+/* Operation types stored in the low byte of the SQE user data, the
+ * length of a send is stored above it to detect short sends */
+#define URING_OP_RECV   1
+#define URING_OP_SEND   2
+#define URING_OP_CANCEL 3
+#define URING_OP_MASK   0xff
+#define URING_OP_SHIFT  8
+
+/* Time to wait for cancelled operations before shutting down the socket, nanoseconds */
+#define URING_CANCEL_WAIT 1000000000
+
+/* Memory ordering for ring indexes shared with the kernel */
+#define LOAD_ACQUIRE(P)     __atomic_load_n ((P), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(P, V) __atomic_store_n ((P), (V), __ATOMIC_RELEASE)
+
+/* Received buffer awaiting consumption */
+typedef struct URingReady_s
+{
+  uint16_t bid;                  /**< Provided buffer ID */
+  uint32_t len;                  /**< Number of bytes received into the buffer */
+} URingReady;
+
+struct DLUring_s
+{
+  int ringfd;                    /**< io_uring file descriptor */
+
+  void *sqring;                  /**< Mapped submission queue ring */
+  size_t sqringsize;             /**< Size of mapped submission queue ring */
+  void *cqring;                  /**< Mapped completion queue ring */
+  size_t cqringsize;             /**< Size of mapped completion queue ring */
+  struct io_uring_sqe *sqes;     /**< Mapped submission queue entries */
+  size_t sqessize;               /**< Size of mapped submission queue entries */
+
+  unsigned *sqhead;              /**< Submission queue head, updated by kernel */
+  unsigned *sqtail;              /**< Submission queue tail */
+  unsigned *sqarray;             /**< Submission queue index array */
+  unsigned sqmask;               /**< Submission queue index mask */
+  unsigned sqentries;            /**< Submission queue size */
+  unsigned sqlocaltail;          /**< Local submission queue tail */
+
+  unsigned *cqhead;              /**< Completion queue head */
+  unsigned *cqtail;              /**< Completion queue tail, updated by kernel */
+  unsigned cqmask;               /**< Completion queue index mask */
+  struct io_uring_cqe *cqes;     /**< Completion queue entries */
+
+  struct io_uring_buf_ring *bufring; /**< Provided buffer ring */
+  size_t bufringsize;            /**< Size of provided buffer ring */
+  char *bufs;                    /**< Provided buffer memory */
+  uint16_t buftail;              /**< Local provided buffer ring tail */
+
+  URingReady ready[URING_NBUFS]; /**< Received buffers in order of arrival */
+  unsigned readyhead;            /**< Index of first ready buffer */
+  unsigned readycount;           /**< Number of ready buffers */
+  uint32_t readyoffset;          /**< Bytes already consumed from first ready buffer */
+
+  int8_t recvarmed;              /**< Multishot receive is active */
+  int8_t recveof;                /**< Peer shutdown received */
+  int8_t recvdata;               /**< Data has been received */
+  int recverror;                 /**< Receive error (errno) */
+
+  int sendpending;               /**< Number of incomplete send operations */
+  int senderror;                 /**< First send error (errno) of a chain */
+  int cancelpending;             /**< Number of incomplete cancel operations */
+};
+
+static int uring_setup (DLUring *uring);
+static void uring_release (DLUring *uring);
+static void uring_putbuffer (DLUring *uring, uint16_t bid);
+static struct io_uring_sqe *uring_getsqe (DLUring *uring);
+static int uring_armrecv (DLUring *uring);
+static int uring_enter (DLUring *uring, unsigned mincomplete, int64_t timeout_us);
+static int uring_reap (DLUring *uring);
+static int uring_cancel (DLUring *uring, SOCKET socket);
+
+/***********************************************************************/ /**
+ * @brief Set up io_uring I/O for a connected socket
+ *
+ * Create an io_uring instance for 'dlconn->link', register the socket
+ * and the provided receive buffers, and start a multishot receive.
+ * The socket is set to blocking mode, which the io_uring operations
+ * handle without blocking the caller.
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return 1 on success, 0 when not possible, the system call path
+ * should be used.
+ ***************************************************************************/
+int
+dlp_uring_init (DLCP *dlconn)
+{
+  DLUring *uring;
+
+  if (!dlconn || dlconn->link < 0)
+    return 0;
+
+  if (dlconn->uring)
+    dlp_uring_free (dlconn);
+
+  if (!(uring = (DLUring *)calloc (1, sizeof (DLUring))))
+    return 0;
+
+  uring->ringfd = -1;
+
+  if (uring_setup (uring))
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] cannot set up io_uring (%s), using system calls\n",
+              dlconn->addr, strerror (errno));
+    uring_release (uring);
+    return 0;
+  }
+
+  /* Register socket as fixed file 0 */
+  if (syscall (__NR_io_uring_register, uring->ringfd, IORING_REGISTER_FILES,
+               &dlconn->link, 1) < 0 ||
+      dlp_sockblock (dlconn->link) ||
+      uring_armrecv (uring) ||
+      uring_enter (uring, 0, 0) < 0)
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] cannot start io_uring receive (%s), using system calls\n",
+              dlconn->addr, strerror (errno));
+    uring_release (uring);
+    dlp_socknoblock (dlconn->link);
+    return 0;
+  }
+
+  dlconn->uring = uring;
+
+  dl_log_r (dlconn, 1, 2, "[%s] using io_uring for socket I/O\n", dlconn->addr);
+
+  return 1;
+} /* End of dlp_uring_init() */
+
+/***********************************************************************/ /**
+ * @brief Release io_uring I/O for a connection
+ *
+ * Any incomplete operations are cancelled and their completions
+ * reaped before the buffers they use are released, received but
+ * unconsumed data is discarded.  The socket is returned to
+ * non-blocking mode.
+ *
+ * @param dlconn DataLink Connection Parameters
+ ***************************************************************************/
+void
+dlp_uring_free (DLCP *dlconn)
+{
+  if (!dlconn || !dlconn->uring)
+    return;
+
+  if (uring_cancel (dlconn->uring, dlconn->link))
+  {
+    /* The kernel may still write to the receive buffers, leak them */
+    dl_log_r (dlconn, 2, 0, "[%s] io_uring operations not cancelled, releasing without buffers\n",
+              dlconn->addr);
+    dlconn->uring->bufs = NULL;
+  }
+
+  uring_release (dlconn->uring);
+  dlconn->uring = NULL;
+
+  if (dlconn->link >= 0)
+    dlp_socknoblock (dlconn->link);
+} /* End of dlp_uring_free() */
+
+/***********************************************************************/ /**
+ * @brief Receive data through io_uring
+ *
+ * Copy up to @a readlen bytes of received data into @a buffer with
+ * the same semantics as dl_recvdata().  The wait for data is limited
+ * by 'dlconn->iotimeout' seconds, if set.
+ *
+ * If the multishot receive is rejected by the kernel before any data
+ * was received, io_uring is released and -3 is returned to indicate
+ * the caller should use the system call path.  On timeout, or when
+ * interrupted with 'dlconn->terminate' set, the receive is cancelled
+ * before returning.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param buffer Buffer for received data
+ * @param readlen Number of bytes to read and place into @a buffer
+ * @param blockflag Flag to control use of blocking versus non-blocking mode
+ *
+ * @return number of bytes read on success
+ * @retval 0 when no data available and @a blockflag is false
+ * @retval -1 on connection shutdown
+ * @retval -2 on error
+ * @retval -3 when io_uring has been released
+ ***************************************************************************/
+int
+dlp_uring_recv (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
+{
+  DLUring *uring = dlconn->uring;
+  URingReady *ready;
+  char *bptr  = buffer;
+  size_t nread = 0;
+  size_t ncopy;
+  int timeout = dlconn->iotimeout;
+  int rv;
+
+  while (nread < readlen)
+  {
+    /* Copy from received buffers */
+    if (uring->readycount > 0)
+    {
+      ready = &uring->ready[uring->readyhead];
+      ncopy = ready->len - uring->readyoffset;
+      if (ncopy > readlen - nread)
+        ncopy = readlen - nread;
+
+      memcpy (bptr + nread,
+              uring->bufs + (size_t)ready->bid * URING_BUFSIZE + uring->readyoffset,
+              ncopy);
+      nread += ncopy;
+      uring->readyoffset += ncopy;
+
+      /* Return fully consumed buffer to the kernel */
+      if (uring->readyoffset >= ready->len)
+      {
+        uring_putbuffer (uring, ready->bid);
+        uring->readyhead = (uring->readyhead + 1) & (URING_NBUFS - 1);
+        uring->readycount--;
+        uring->readyoffset = 0;
+      }
+
+      continue;
+    }
+
+    if (uring_reap (uring) > 0 && uring->readycount > 0)
+      continue;
+
+    if (uring->recveof)
+      return -1;
+
+    if (uring->recverror)
+    {
+      /* Multishot receive not supported, fall back to system calls */
+      if (uring->recverror == EINVAL && !uring->recvdata && nread == 0)
+      {
+        dl_log_r (dlconn, 1, 1, "[%s] io_uring multishot receive not supported, using system calls\n",
+                  dlconn->addr);
+        dlp_uring_free (dlconn);
+        return -3;
+      }
+
+      dl_log_r (dlconn, 2, 0, "[%s] io_uring receive: %s\n",
+                dlconn->addr, strerror (uring->recverror));
+      return -2;
+    }
+
+    /* Only return without data if none has been received */
+    if (!blockflag && nread == 0)
+      return 0;
+
+    /* Re-start receive if terminated when buffers were exhausted */
+    if (!uring->recvarmed && uring_armrecv (uring))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] cannot re-start io_uring receive\n", dlconn->addr);
+      return -2;
+    }
+
+    if ((rv = uring_enter (uring, 1, (int64_t)timeout * 1000000)) < 0)
+    {
+      if (errno == EINTR && !dlconn->terminate)
+        continue;
+
+      dl_log_r (dlconn, 2, 0, "[%s] io_uring wait: %s\n", dlconn->addr,
+                (errno == ETIME) ? "timeout" : strerror (errno));
+      uring_cancel (uring, dlconn->link);
+      return -2;
+    }
+  }
+
+  return (int)nread;
+} /* End of dlp_uring_recv() */
+
+/***********************************************************************/ /**
+ * @brief Wait for received data through io_uring
+ *
+ * Equivalent to select() for readability of the socket: return
+ * immediately if received data, a shutdown or an error is pending,
+ * otherwise wait up to @a timeout_us microseconds for a completion.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param timeout_us Maximum time to wait in microseconds
+ *
+ * @return 1 when data, shutdown or error is available to dl_recvdata(),
+ * 0 on timeout and -1 on error.
+ ***************************************************************************/
+int
+dlp_uring_wait (DLCP *dlconn, int timeout_us)
+{
+  DLUring *uring = dlconn->uring;
+
+  uring_reap (uring);
+
+  if (uring->readycount > 0 || uring->recveof || uring->recverror)
+    return 1;
+
+  if (!uring->recvarmed && uring_armrecv (uring))
+    return -1;
+
+  if (uring_enter (uring, 1, (timeout_us > 0) ? timeout_us : 1) < 0)
+  {
+    return (errno == ETIME) ? 0 : -1;
+  }
+
+  uring_reap (uring);
+
+  return (uring->readycount > 0 || uring->recveof || uring->recverror) ? 1 : 0;
+} /* End of dlp_uring_wait() */
+
+/***********************************************************************/ /**
+ * @brief Send buffers through io_uring as linked operations
+ *
+ * Submit one send operation per buffer, linked so that they are
+ * performed in order and a failure cancels the remainder, and wait
+ * for all to complete.  All but the last are flagged with MSG_MORE so
+ * a chain is not split into small segments delayed by Nagle's
+ * algorithm.  The wait is limited by 'dlconn->iotimeout' seconds, if
+ * set.  A send completing with fewer bytes than its buffer is an
+ * error, as the linked buffers would follow a truncated one.
+ *
+ * The operations reference @a buffers, so on timeout, or when
+ * interrupted with 'dlconn->terminate' set, they are cancelled and
+ * their completions reaped before returning.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param buffers Array of buffers to send
+ * @param lengths Array of buffer lengths
+ * @param count Number of buffers
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_uring_send (DLCP *dlconn, void **buffers, size_t *lengths, int count)
+{
+  DLUring *uring = dlconn->uring;
+  struct io_uring_sqe *sqe;
+  int timeout = dlconn->iotimeout;
+  int idx;
+
+  if (count <= 0 || count > URING_ENTRIES / 2)
+    return -1;
+
+  uring->senderror = 0;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    if (!(sqe = uring_getsqe (uring)))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] io_uring submission queue full\n", dlconn->addr);
+      return -1;
+    }
+
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->flags     = IOSQE_FIXED_FILE | ((idx < count - 1) ? IOSQE_IO_LINK : 0);
+    sqe->fd        = 0;
+    sqe->addr      = (uint64_t)(uintptr_t)buffers[idx];
+    sqe->len       = (uint32_t)lengths[idx];
+    sqe->msg_flags = MSG_WAITALL | ((idx < count - 1) ? MSG_MORE : 0);
+    sqe->user_data = URING_OP_SEND | ((uint64_t)sqe->len << URING_OP_SHIFT);
+
+    uring->sendpending++;
+  }
+
+  while (uring->sendpending > 0)
+  {
+    if (uring_enter (uring, 1, (int64_t)timeout * 1000000) < 0)
+    {
+      if (errno == EINTR && !dlconn->terminate)
+        continue;
+
+      dl_log_r (dlconn, 2, 0, "[%s] io_uring send: %s\n", dlconn->addr,
+                (errno == ETIME) ? "timeout" : strerror (errno));
+
+      uring_cancel (uring, dlconn->link);
+      return -1;
+    }
+
+    uring_reap (uring);
+  }
+
+  if (uring->senderror)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] io_uring send: %s\n", dlconn->addr,
+              strerror (uring->senderror));
+    return -1;
+  }
+
+  return 0;
+} /* End of dlp_uring_send() */
+
+/***************************************************************************
+ * Create the io_uring instance, map the rings and register provided
+ * buffers.  Returns 0 on success and -1 on error with errno set.
+ ***************************************************************************/
+static int
+uring_setup (DLUring *uring)
+{
+  struct io_uring_params params;
+  struct io_uring_buf_reg bufreg;
+  void *ptr;
+  int idx;
+
+  memset (&params, 0, sizeof (params));
+
+  if ((uring->ringfd = (int)syscall (__NR_io_uring_setup, URING_ENTRIES, &params)) < 0)
+    return -1;
+
+  /* Timed waits require IORING_ENTER_EXT_ARG */
+  if (!(params.features & IORING_FEAT_EXT_ARG))
+  {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  uring->sqringsize = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+  uring->cqringsize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (uring->cqringsize > uring->sqringsize)
+      uring->sqringsize = uring->cqringsize;
+    uring->cqringsize = 0;
+  }
+
+  ptr = mmap (NULL, uring->sqringsize, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, uring->ringfd, IORING_OFF_SQ_RING);
+  if (ptr == MAP_FAILED)
+    return -1;
+  uring->sqring = ptr;
+
+  if (uring->cqringsize)
+  {
+    ptr = mmap (NULL, uring->cqringsize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, uring->ringfd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED)
+      return -1;
+    uring->cqring = ptr;
+  }
+  else
+  {
+    uring->cqring = uring->sqring;
+  }
+
+  uring->sqessize = params.sq_entries * sizeof (struct io_uring_sqe);
+  ptr = mmap (NULL, uring->sqessize, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, uring->ringfd, IORING_OFF_SQES);
+  if (ptr == MAP_FAILED)
+    return -1;
+  uring->sqes = ptr;
+
+  uring->sqhead      = (unsigned *)((char *)uring->sqring + params.sq_off.head);
+  uring->sqtail      = (unsigned *)((char *)uring->sqring + params.sq_off.tail);
+  uring->sqarray     = (unsigned *)((char *)uring->sqring + params.sq_off.array);
+  uring->sqmask      = *(unsigned *)((char *)uring->sqring + params.sq_off.ring_mask);
+  uring->sqentries   = params.sq_entries;
+  uring->sqlocaltail = *uring->sqtail;
+
+  uring->cqhead = (unsigned *)((char *)uring->cqring + params.cq_off.head);
+  uring->cqtail = (unsigned *)((char *)uring->cqring + params.cq_off.tail);
+  uring->cqmask = *(unsigned *)((char *)uring->cqring + params.cq_off.ring_mask);
+  uring->cqes   = (struct io_uring_cqe *)((char *)uring->cqring + params.cq_off.cqes);
+
+  /* Provided buffer ring and buffer memory, the ring must be page aligned */
+  uring->bufringsize = URING_NBUFS * sizeof (struct io_uring_buf);
+  ptr = mmap (NULL, uring->bufringsize, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED)
+    return -1;
+  uring->bufring = ptr;
+
+  if (!(uring->bufs = (char *)malloc ((size_t)URING_NBUFS * URING_BUFSIZE)))
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  memset (&bufreg, 0, sizeof (bufreg));
+  bufreg.ring_addr    = (uint64_t)(uintptr_t)uring->bufring;
+  bufreg.ring_entries = URING_NBUFS;
+  bufreg.bgid         = URING_BGID;
+
+  if (syscall (__NR_io_uring_register, uring->ringfd, IORING_REGISTER_PBUF_RING,
+               &bufreg, 1) < 0)
+    return -1;
+
+  for (idx = 0; idx < URING_NBUFS; idx++)
+    uring_putbuffer (uring, (uint16_t)idx);
+
+  return 0;
+} /* End of uring_setup() */
+
+/***************************************************************************
+ * Unmap rings, close the io_uring instance and free all memory.
+ ***************************************************************************/
+static void
+uring_release (DLUring *uring)
+{
+  if (uring->ringfd >= 0)
+    close (uring->ringfd);
+
+  if (uring->sqes)
+    munmap (uring->sqes, uring->sqessize);
+  if (uring->cqring && uring->cqring != uring->sqring)
+    munmap (uring->cqring, uring->cqringsize);
+  if (uring->sqring)
+    munmap (uring->sqring, uring->sqringsize);
+  if (uring->bufring)
+    munmap (uring->bufring, uring->bufringsize);
+
+  free (uring->bufs);
+  free (uring);
+} /* End of uring_release() */
+
+/***************************************************************************
+ * Return a provided buffer to the kernel.
+ ***************************************************************************/
+static void
+uring_putbuffer (DLUring *uring, uint16_t bid)
+{
+  struct io_uring_buf *buf;
+
+  buf       = &uring->bufring->bufs[uring->buftail & (URING_NBUFS - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(uring->bufs + (size_t)bid * URING_BUFSIZE);
+  buf->len  = URING_BUFSIZE;
+  buf->bid  = bid;
+
+  uring->buftail++;
+  STORE_RELEASE (&uring->bufring->tail, uring->buftail);
+} /* End of uring_putbuffer() */
+
+/***************************************************************************
+ * Return the next free submission queue entry, cleared, or NULL if
+ * the queue is full.  Entries are submitted by uring_enter().
+ ***************************************************************************/
+static struct io_uring_sqe *
+uring_getsqe (DLUring *uring)
+{
+  struct io_uring_sqe *sqe;
+  unsigned index;
+
+  if (uring->sqlocaltail - LOAD_ACQUIRE (uring->sqhead) >= uring->sqentries)
+    return NULL;
+
+  index = uring->sqlocaltail & uring->sqmask;
+  sqe   = &uring->sqes[index];
+  memset (sqe, 0, sizeof (*sqe));
+
+  uring->sqarray[index] = index;
+  uring->sqlocaltail++;
+
+  return sqe;
+} /* End of uring_getsqe() */
+
+/***************************************************************************
+ * Queue a multishot receive into the provided buffers.  Returns 0 on
+ * success and -1 if the submission queue is full.
+ ***************************************************************************/
+static int
+uring_armrecv (DLUring *uring)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = uring_getsqe (uring)))
+  {
+    errno = EBUSY;
+    return -1;
+  }
+
+  sqe->opcode    = IORING_OP_RECV;
+  sqe->flags     = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->fd        = 0;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->buf_group = URING_BGID;
+  sqe->user_data = URING_OP_RECV;
+
+  uring->recvarmed = 1;
+
+  return 0;
+} /* End of uring_armrecv() */
+
+/***************************************************************************
+ * Submit queued entries and wait for at least @a mincomplete
+ * completions, limited to @a timeout_us microseconds if not 0.
+ * Returns 0 on success and -1 on error with errno set (ETIME on
+ * timeout).
+ ***************************************************************************/
+static int
+uring_enter (DLUring *uring, unsigned mincomplete, int64_t timeout_us)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned tosubmit;
+  unsigned flags = 0;
+
+  STORE_RELEASE (uring->sqtail, uring->sqlocaltail);
+  tosubmit = uring->sqlocaltail - LOAD_ACQUIRE (uring->sqhead);
+
+  /* Nothing to wait for if completions are already available */
+  if (mincomplete && LOAD_ACQUIRE (uring->cqtail) != *uring->cqhead)
+    mincomplete = 0;
+
+  if (tosubmit == 0 && mincomplete == 0)
+    return 0;
+
+  memset (&arg, 0, sizeof (arg));
+
+  if (mincomplete)
+  {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+    if (timeout_us > 0)
+    {
+      ts.tv_sec  = timeout_us / 1000000;
+      ts.tv_nsec = (timeout_us % 1000000) * 1000;
+      arg.ts     = (uint64_t)(uintptr_t)&ts;
+    }
+  }
+
+  if (syscall (__NR_io_uring_enter, uring->ringfd, tosubmit, mincomplete, flags,
+               (flags) ? &arg : NULL, (flags) ? sizeof (arg) : 0) < 0)
+    return -1;
+
+  return 0;
+} /* End of uring_enter() */
+
+/***************************************************************************
+ * Process all available completions.  Returns the number of
+ * completions processed.
+ ***************************************************************************/
+static int
+uring_reap (DLUring *uring)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head = *uring->cqhead;
+  unsigned tail = LOAD_ACQUIRE (uring->cqtail);
+  unsigned slot;
+  int count = 0;
+
+  while (head != tail)
+  {
+    cqe = &uring->cqes[head & uring->cqmask];
+
+    if (cqe->user_data == URING_OP_RECV)
+    {
+      if (!(cqe->flags & IORING_CQE_F_MORE))
+        uring->recvarmed = 0;
+
+      if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+      {
+        slot = (uring->readyhead + uring->readycount) & (URING_NBUFS - 1);
+        uring->ready[slot].bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        uring->ready[slot].len = (uint32_t)cqe->res;
+        uring->readycount++;
+        uring->recvdata = 1;
+      }
+      else if (cqe->res == 0)
+      {
+        uring->recveof = 1;
+      }
+      else if (cqe->res < 0 && cqe->res != -ENOBUFS)
+      {
+        /* Out of buffers is not an error, receive is re-started when consumed */
+        uring->recverror = -cqe->res;
+      }
+    }
+    else if ((cqe->user_data & URING_OP_MASK) == URING_OP_SEND)
+    {
+      /* A short send leaves the rest of the chain after a truncated
+       * buffer, the stream is no longer usable */
+      if (cqe->res < 0 && !uring->senderror)
+        uring->senderror = -cqe->res;
+      else if ((uint64_t)cqe->res != (cqe->user_data >> URING_OP_SHIFT) && !uring->senderror)
+        uring->senderror = EIO;
+
+      uring->sendpending--;
+    }
+    else if (cqe->user_data == URING_OP_CANCEL)
+    {
+      uring->cancelpending--;
+    }
+
+    head++;
+    count++;
+  }
+
+  STORE_RELEASE (uring->cqhead, head);
+
+  return count;
+} /* End of uring_reap() */
+
+/***************************************************************************
+ * Cancel all incomplete operations and reap their completions, so no
+ * operation references the receive buffers or send buffers any more.
+ * Operations that do not complete within URING_CANCEL_WAIT are forced
+ * to by shutting down the socket, after which the wait is not limited.
+ * Returns 0 when none remain and -1 if the completions cannot be
+ * waited for.
+ ***************************************************************************/
+static int
+uring_cancel (DLUring *uring, SOCKET socket)
+{
+  struct io_uring_sqe *sqe;
+  uint64_t deadline;
+  int shut = 0;
+
+  uring_reap (uring);
+
+  if (uring->sendpending == 0 && !uring->recvarmed && uring->cancelpending == 0)
+    return 0;
+
+  if ((sqe = uring_getsqe (uring)))
+  {
+    sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+    sqe->fd           = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data    = URING_OP_CANCEL;
+
+    uring->cancelpending++;
+  }
+
+  deadline = dlp_monotonic () + URING_CANCEL_WAIT;
+
+  while (uring->sendpending > 0 || uring->recvarmed || uring->cancelpending > 0)
+  {
+    /* Blocked socket operations complete once the socket is shut down */
+    if (!shut && socket >= 0 && dlp_monotonic () >= deadline)
+    {
+      shutdown (socket, SHUT_RDWR);
+      shut = 1;
+    }
+
+    if (uring_enter (uring, 1, 100000) < 0 && errno != ETIME && errno != EINTR)
+      return -1;
+
+    uring_reap (uring);
+  }
+
+  return 0;
+} /* End of uring_cancel() */
+
+#else /* No io_uring support */
+
+int
+dlp_uring_init (DLCP *dlconn)
+{
+  return 0;
+}
+
+void
+dlp_uring_free (DLCP *dlconn)
+{
+}
+
+int
+dlp_uring_recv (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
+{
+  return -3;
+}
+
+int
+dlp_uring_wait (DLCP *dlconn, int timeout_us)
+{
+  return -1;
+}
+
+int
+dlp_uring_send (DLCP *dlconn, void **buffers, size_t *lengths, int count)
+{
+  return -1;
+}
+
+#endif /* DLP_IOURING */
@@ -28,13 +28,17 @@
 extern "C" {
 #endif
 
-#define LIBDALI_VERSION "1.8.1"      /**< libdali version */
-#define LIBDALI_RELEASE "2023.335"   /**< libdali release date */
+#define LIBDALI_VERSION "2.0.0"      /**< libdali version */
+#define LIBDALI_RELEASE "2026.292"   /**< libdali release date */
 
 /** @defgroup connection Connection managment functions */
 /** @defgroup network Connection network functions */
 /** @defgroup time-related Time definitions and functions */
 /** @defgroup logging Central Logging */
+/** @defgroup trace Flight recorder */
+/** @defgroup histogram Latency histograms */
+/** @defgroup pktring Packet rings */
+/** @defgroup profile Stage profiler */
 /** @defgroup utility-functions General Utility Functions */
 
 /* C99 standard headers */
@@ -213,7 +217,63 @@ extern int dl_md2doy (int year, int month, int mday, int *jday);
     format a message using printf conventions and pass the formatted
     string to the appropriate printing function.
 
+    @anchor logging-events
+    Structured log events: when an event handler is registered with
+    dl_logevents() messages are not formatted by the library, instead
+    each one is passed to the handler as a ::DLEvent containing the
+    level, an event code (see @ref event-codes), the connection and
+    typed fields.  The text form of an event is only formatted when
+    the handler asks for it with dl_event_text() or dl_event_json(),
+    and is not limited to ::MAX_LOG_MSG_LENGTH.  dl_eventsink_json()
+    is a ready-made handler writing one JSON object per line.
+
+    @{ */
+
+/** @anchor event-codes
+    @name Log event codes
     @{ */
+#define DL_EVENT_MESSAGE     0   /**< Free-form message without fields */
+#define DL_EVENT_CONNECT     1   /**< Connected, fields: family */
+#define DL_EVENT_CONNFAIL    2   /**< Connection failed, fields: error */
+#define DL_EVENT_DISCONNECT  3   /**< Connection closed */
+#define DL_EVENT_SERVERID    4   /**< Server identified, fields: server, capabilities */
+#define DL_EVENT_TIMEOUT     5   /**< Network I/O timeout, fields: seconds */
+#define DL_EVENT_IOERROR     6   /**< Network I/O error, fields: operation, error */
+/** @} */
+
+/** Log event field types */
+#define DL_FIELD_INT    'i'     /**< Integer value, DLEventField.value.i */
+#define DL_FIELD_FLOAT  'f'     /**< Floating point value, DLEventField.value.f */
+#define DL_FIELD_STRING 's'     /**< String value, DLEventField.value.s */
+
+/** Typed field of a log event */
+typedef struct DLEventField_s
+{
+  const char *name;             /**< Field name */
+  char type;                    /**< Field type, DL_FIELD_INT, DL_FIELD_FLOAT or DL_FIELD_STRING */
+  union
+  {
+    int64_t i;
+    double f;
+    const char *s;
+  } value;                      /**< Field value */
+} DLEventField;
+
+/** Structured log event passed to a handler registered with dl_logevents() */
+typedef struct DLEvent_s
+{
+  int level;                    /**< Message level, see @ref logging-levels */
+  int code;                     /**< Event code, see @ref event-codes */
+  const struct DLCP_s *dlconn;  /**< Connection of the event, NULL if none */
+  dltime_t time;                /**< Time of the event */
+  const DLEventField *fields;   /**< Typed fields of the event */
+  int nfields;                  /**< Number of fields */
+  const char *format;           /**< Text form in printf() style, see dl_event_text() */
+  va_list *varlist;             /**< Text form variables, only valid during the handler call */
+} DLEvent;
+
+/** Log event handler, see dl_logevents() */
+typedef void (*DLEventHandler) (const DLEvent *event, void *handlerdata);
 
 /** Logging parameters */
 typedef struct DLLog_s
@@ -223,6 +283,9 @@ typedef struct DLLog_s
   void (*diag_print) (const char *); /**< Function pointer for diagnostic/error message printing */
   const char *errprefix;             /**< Error message prefix */
   int verbosity;                     /**< Verbosity level */
+  struct DLLogAsync_s *async;        /**< Asynchronous output state, see dl_logasync_start() */
+  DLEventHandler event_handler;      /**< Structured event handler, see dl_logevents() */
+  void *event_data;                  /**< Data passed to the event handler */
 } DLLog;
 /** @} */
 
@@ -231,6 +294,23 @@ typedef struct DLLog_s
 
     @{ */
 
+/** Connection statistics, counted since the DLCP was created, see dl_getstats() */
+typedef struct DLStats_s
+{
+  uint64_t    bytesrecv;        /**< Bytes received */
+  uint64_t    bytessent;        /**< Bytes sent */
+  uint64_t    packetsrecv;      /**< Data packets received */
+  uint64_t    packetssent;      /**< Packets written */
+  uint64_t    recvcalls;        /**< Receive system calls, or io_uring receives */
+  uint64_t    sendcalls;        /**< Send system calls, or io_uring submissions */
+  uint64_t    connects;         /**< Connections opened, reconnects are connects - 1 */
+  uint64_t    connfails;        /**< Failed connection attempts */
+  uint64_t    keepalives;       /**< Keepalives sent */
+  uint64_t    timeouts;         /**< Network I/O timeouts */
+  uint64_t    ioerrors;         /**< Network I/O errors */
+  dltime_t    time;             /**< Time of the snapshot, set by dl_getstats() */
+} DLStats;
+
 /** DataLink connection parameters */
 typedef struct DLCP_s
 {
@@ -252,6 +332,33 @@ typedef struct DLCP_s
   int8_t      streaming;        /**< Boolean flag to indicate streaming status, maintained internally */
 
   DLLog      *log;              /**< Logging parameters, maintained internally */
+
+  /* Connection parameters added after 1.8.1, after the earlier fields to keep their layout */
+  int         conntimeout;      /**< Timeout for each connection attempt (milliseconds) */
+  int         resolvettl;       /**< Time to re-use resolved server addresses (seconds), 0 to always resolve */
+  int         rcvbuf;           /**< Socket receive buffer size (bytes), SO_RCVBUF, 0 for system default */
+  int         sndbuf;           /**< Socket send buffer size (bytes), SO_SNDBUF, 0 for system default */
+  int8_t      autobuf;          /**< Flag to size socket buffers from measured RTT and throughput */
+  int8_t      tcpnodelay;       /**< Flag to disable Nagle's algorithm, TCP_NODELAY */
+  int8_t      tcpquickack;      /**< Flag to request immediate ACKs, TCP_QUICKACK */
+  int         tcpusertimeout;   /**< Unacknowledged send timeout (milliseconds), TCP_USER_TIMEOUT, 0 for system default */
+  int         tcpkeepidle;      /**< Kernel TCP keepalive idle time (seconds), 0 to disable kernel keepalive */
+  int         tcpkeepintvl;     /**< Kernel TCP keepalive probe interval (seconds), 0 for system default */
+  int         tcpkeepcnt;       /**< Kernel TCP keepalive probe count, 0 for system default */
+  int         busypoll;         /**< Receive busy poll time (microseconds), SO_BUSY_POLL, 0 to disable */
+  int8_t      iouring;          /**< Flag to use io_uring for socket I/O, if built with DLP_IOURING */
+
+  /* Connection state added after 1.8.1, maintained internally */
+  int64_t     autobuf_sent;     /**< Bytes sent in current buffer sizing interval, maintained internally */
+  int64_t     autobuf_recv;     /**< Bytes received in current buffer sizing interval, maintained internally */
+  dltime_t    autobuf_time;     /**< Start of current buffer sizing interval, maintained internally */
+  struct DLAddrCache_s *addrcache; /**< Resolved server address cache, maintained internally */
+  struct DLUring_s *uring;      /**< Active io_uring I/O state, maintained internally */
+  struct DLSplice_s *splice;    /**< Held packet payload for dl_write_splice(), maintained internally */
+  int         traceid;          /**< Flight recorder connection number, -1 if not assigned, maintained internally */
+  DLStats     stats;            /**< Statistics counters, read with dl_getstats(), maintained internally */
+  uint32_t    statseq;          /**< Statistics sequence count, odd while updating, maintained internally */
+  dltime_t    sendtime;         /**< Time the last packet awaiting a response was sent, maintained internally */
 } DLCP;
 
 /** DataLink packet */
@@ -267,6 +374,7 @@ typedef struct DLPacket_s
 
 extern DLCP *  dl_newdlcp (char *address, char *progname);
 extern void    dl_freedlcp (DLCP *dlconn);
+extern int     dl_getstats (const DLCP *dlconn, DLStats *stats);
 extern int     dl_exchangeIDs (DLCP *dlconn, int parseresp);
 extern int64_t dl_position (DLCP *dlconn, int64_t pktid, dltime_t pkttime);
 extern int64_t dl_position_after (DLCP *dlconn, dltime_t datatime);
@@ -274,6 +382,10 @@ extern int64_t dl_match (DLCP *dlconn, char *matchpattern);
 extern int64_t dl_reject (DLCP *dlconn, char *rejectpattern);
 extern int64_t dl_write (DLCP *dlconn, void *packet, int packetlen, char *streamid,
 			 dltime_t datastart, dltime_t dataend, int ack);
+extern int64_t dl_write_deferack (DLCP *dlconn, void *packet, int packetlen, char *streamid,
+				  dltime_t datastart, dltime_t dataend);
+extern int64_t dl_write_splice (DLCP *dlconn, DLCP *srcconn, DLPacket *packet, int ack);
+extern int     dl_pollack (DLCP *dlconn, int64_t *value);
 extern int     dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet,
 			void *packetdata, size_t maxdatasize);
 extern int     dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
@@ -327,6 +439,245 @@ extern void    dl_loginit_r (DLCP *dlconn, int verbosity,
 extern DLLog  *dl_loginit_rl (DLLog *log, int verbosity,
 			      void (*log_print)(const char*), const char *logprefix,
 			      void (*diag_print)(const char*), const char *errprefix);
+extern void    dl_logthread (DLLog *log);
+extern int     dl_logasync_start (DLLog *log, int fd, const char *timeformat, int slots);
+extern void    dl_logasync_stop (DLLog *log);
+extern void    dl_logevents (DLLog *log, DLEventHandler handler, void *handlerdata);
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((__format__ (__printf__, 7, 8)))
+#endif
+extern int     dl_logevent (const DLCP *dlconn, int level, int verb, int code,
+                            const DLEventField *fields, int nfields, const char *format, ...);
+extern const char *dl_event_name (int code);
+extern int     dl_event_text (const DLEvent *event, char *buffer, size_t size);
+extern int     dl_event_json (const DLEvent *event, char *buffer, size_t size);
+extern void    dl_eventsink_json (const DLEvent *event, void *handlerdata);
+/** @} */
+
+/** @addtogroup trace
+    @brief Flight recorder of recent connection events
+
+    When started with dl_trace_start() the library records compact
+    binary events, packets received and sent, acknowledgements,
+    connections, keepalives, timeouts and I/O errors, in a fixed-size
+    in-memory ring shared by all connections.  The ring can be dumped
+    to a file at any time with dl_trace_dump() or dl_trace_dumpfile(),
+    both are async-signal-safe and can be called from a signal or
+    crash handler.
+
+    A dump starts with a ::DLTraceHeader followed by the ring of
+    ::DLTraceRecord entries in ring order, the connection addresses
+    and the stream IDs, all in host byte order.  The \c dalitrace
+    program decodes dumps.
+
+    Tracing requires C11 atomics and is not available under WIN.
+
+    @{ */
+
+/** @anchor trace-events
+    @name Flight recorder event codes
+    @{ */
+#define DL_TRACE_CONNECT     1  /**< Connected, arg: address family */
+#define DL_TRACE_CONNFAIL    2  /**< Connection attempt failed */
+#define DL_TRACE_DISCONNECT  3  /**< Connection closed */
+#define DL_TRACE_RECV        4  /**< Packet received, value: packet ID, arg: stream index */
+#define DL_TRACE_SEND        5  /**< Packet written, value: data size, arg: stream index */
+#define DL_TRACE_ACK         6  /**< Write acknowledged, value: packet ID */
+#define DL_TRACE_KEEPALIVE   7  /**< Keepalive sent */
+#define DL_TRACE_TIMEOUT     8  /**< Network I/O timeout, arg: timeout in seconds */
+#define DL_TRACE_IOERROR     9  /**< Network I/O error, arg: 0 for send, 1 for receive */
+/** @} */
+
+#define DL_TRACE_MAGIC   "DLTRACE1"  /**< Magic of a flight recorder dump */
+#define DL_TRACE_NOINDEX 0xFFFFFFFF  /**< Stream index when the stream table is full */
+
+/** Flight recorder event record */
+typedef struct DLTraceRecord_s
+{
+  uint64_t time;      /**< Record clock, see DLTraceHeader.tickrate, 0 for unused records */
+  int64_t  value;     /**< Event value, see @ref trace-events */
+  uint32_t arg;       /**< Event argument, see @ref trace-events */
+  uint16_t conn;      /**< Connection number, index of the connection address */
+  uint8_t  event;     /**< Event code, see @ref trace-events */
+  uint8_t  reserved;  /**< Reserved */
+} DLTraceRecord;
+
+/** Flight recorder dump header */
+typedef struct DLTraceHeader_s
+{
+  char     magic[8];    /**< DL_TRACE_MAGIC without terminator */
+  uint32_t recordsize;  /**< Size of each DLTraceRecord */
+  uint32_t records;     /**< Number of records in the ring */
+  uint64_t head;        /**< Total number of events recorded, the next is at head % records */
+  uint64_t ticks;       /**< Record clock at the dump */
+  uint64_t tickrate;    /**< Record clock ticks per second */
+  dltime_t realtime;    /**< Time of the dump, relates the record clock to real time */
+  uint32_t conns;       /**< Number of connection addresses following the records */
+  uint32_t connlen;     /**< Length of each connection address */
+  uint32_t streams;     /**< Number of stream IDs following the connection addresses */
+  uint32_t streamlen;   /**< Length of each stream ID */
+} DLTraceHeader;
+
+extern int     dl_trace_start (int records);
+extern int     dl_trace_dump (int fd);
+extern int     dl_trace_dumpfile (const char *path);
+extern const char *dl_trace_name (int event);
+/** @} */
+
+/** @addtogroup histogram
+    @brief HDR-style histograms of latencies or other values
+
+    A ::DLHistogram counts non-negative integer values, typically
+    latencies in microseconds (dltime_t ticks), in buckets that are
+    linear within each power of two, so every value is resolved to
+    within 1/32 (about 3%) of itself over the whole range up to
+    2^DL_HIST_MAXBITS.  Larger values are counted in the last bucket,
+    negative values as 0.
+
+    Values are recorded by a single thread with relaxed atomic
+    stores and no allocation.  Other threads, or a signal handler,
+    may take a copy at any time with dl_hist_copy(), a copy may miss
+    values being recorded concurrently.  A zeroed histogram is empty.
+
+    @{ */
+
+#define DL_HIST_SUBBITS 5   /**< Linear sub-buckets per power of two are 2^DL_HIST_SUBBITS */
+#define DL_HIST_MAXBITS 40  /**< Values up to 2^DL_HIST_MAXBITS - 1 are resolved */
+/** Number of counts in a histogram */
+#define DL_HIST_COUNTS  ((DL_HIST_MAXBITS - DL_HIST_SUBBITS + 1) << DL_HIST_SUBBITS)
+
+/** HDR-style histogram */
+typedef struct DLHistogram_s
+{
+  uint64_t counts[DL_HIST_COUNTS]; /**< Count of values in each bucket */
+  uint64_t total;       /**< Number of values recorded */
+  int64_t  sum;         /**< Sum of values recorded, after clamping */
+  int64_t  max;         /**< Largest value recorded, after clamping */
+} DLHistogram;
+
+extern void    dl_hist_record (DLHistogram *hist, int64_t value);
+extern void    dl_hist_copy (DLHistogram *copy, const DLHistogram *hist);
+extern int64_t dl_hist_percentile (const DLHistogram *hist, double percentile);
+extern uint64_t dl_hist_countto (const DLHistogram *hist, int64_t value);
+/** @} */
+
+/** @addtogroup pktring
+    @brief In-memory rings of recent packets
+
+    A ::DLRing keeps the most recent packets, headers and payloads,
+    within a fixed memory budget allocated by dl_ring_new(): a number
+    of packets and a data area holding the payloads back to back.
+    When either is full the oldest packets are evicted and counted.
+    Packets are addressed by sequence numbers assigned in the order
+    added, the ring holds the sequence numbers from DLRing.first up to
+    but not including DLRing.next.
+
+    Packets are found by packet ID in constant time with
+    dl_ring_find(), as for POSITION SET and READ, and by data end time
+    with dl_ring_after(), as for POSITION AFTER, in logarithmic time
+    while packets arrive in time order.
+    dl_ring_get() returns a packet with a view of its payload in the
+    ring, no copy is made.
+
+    A ring is not locked, it must be used from one thread at a time.
+    Views are valid until the packet is evicted by a later
+    dl_ring_add() or the ring is cleared.
+
+    @{ */
+
+/** Packet in a ::DLRing */
+typedef struct DLRingPacket_s
+{
+  char     streamid[MAXSTREAMID]; /**< Stream ID */
+  int64_t  pktid;       /**< Packet ID */
+  dltime_t pkttime;     /**< Packet time */
+  dltime_t datastart;   /**< Data start time */
+  dltime_t dataend;     /**< Data end time */
+  int32_t  datasize;    /**< Payload size in bytes */
+  uint64_t offset;      /**< Position of the payload in the data stream of the ring */
+  dltime_t maxend;      /**< Latest data end time of this and earlier packets */
+} DLRingPacket;
+
+/** Ring of recent packets */
+typedef struct DLRing_s
+{
+  DLRingPacket *packets; /**< Packet headers, indexed by sequence number & mask */
+  int64_t *index;       /**< Packet ID index of sequence numbers + 1, 0 when empty */
+  char    *data;        /**< Payload data area */
+  uint64_t mask;        /**< Number of packets - 1, a power of 2 minus 1 */
+  int      indexbits;   /**< Packet ID index has 2^indexbits entries */
+  size_t   databytes;   /**< Size of the payload data area */
+  uint64_t datahead;    /**< Total bytes of payload data area used, including skipped ends */
+  int64_t  first;       /**< Sequence number of the earliest packet */
+  int64_t  next;        /**< Sequence number of the next packet added */
+  uint64_t added;       /**< Number of packets added */
+  uint64_t evicted;     /**< Number of packets evicted to make room */
+  uint64_t evictedbytes; /**< Payload bytes of the packets evicted */
+  uint64_t rejected;    /**< Number of packets too large for the data area */
+} DLRing;
+
+extern DLRing *dl_ring_new (int64_t packets, size_t databytes);
+extern void    dl_ring_free (DLRing *ring);
+extern int64_t dl_ring_add (DLRing *ring, const DLPacket *packet, const void *packetdata);
+extern const DLRingPacket *dl_ring_get (const DLRing *ring, int64_t seq, const void **packetdata);
+extern int64_t dl_ring_find (const DLRing *ring, int64_t pktid);
+extern int64_t dl_ring_after (const DLRing *ring, dltime_t time);
+extern void    dl_ring_clear (DLRing *ring);
+/** @} */
+
+/** @addtogroup profile
+    @brief Time spent in the stages of receiving and sending packets
+
+    When started with dl_prof_start() the library times each stage of
+    collecting and writing packets, waiting for data, receiving and
+    parsing headers, receiving payloads, formatting and sending
+    headers, waiting for acknowledgements and saving state, with the
+    time stamp counter on x86 and the monotonic clock elsewhere.
+    Stages are accumulated per thread without locks and summed by
+    dl_prof_get(), dl_prof_print() writes a table of the stages and
+    is async-signal-safe.
+
+    Until started each stage costs a single test of a global flag.
+
+    Profiling requires C11 atomics and is not available under WIN.
+
+    @{ */
+
+/** @anchor profile-stages
+    @name Profiler stage codes
+    @{ */
+#define DL_PROF_WAIT       0  /**< Waiting for data to arrive */
+#define DL_PROF_RECVHEADER 1  /**< Receiving packet headers */
+#define DL_PROF_PARSE      2  /**< Parsing packet headers */
+#define DL_PROF_RECVDATA   3  /**< Receiving packet payloads */
+#define DL_PROF_FORMAT     4  /**< Formatting packet headers */
+#define DL_PROF_SEND       5  /**< Sending packets and commands */
+#define DL_PROF_ACK        6  /**< Waiting for responses to commands */
+#define DL_PROF_STATE      7  /**< Saving state files */
+#define DL_PROF_STAGES     8  /**< Number of stages */
+/** @} */
+
+/** Time spent in a profiler stage */
+typedef struct DLProfileStage_s
+{
+  uint64_t count;        /**< Number of times the stage was timed */
+  uint64_t nanoseconds;  /**< Total time in the stage */
+  uint64_t maxns;        /**< Longest time in the stage */
+} DLProfileStage;
+
+/** Time spent in all profiler stages, summed over threads */
+typedef struct DLProfile_s
+{
+  DLProfileStage stages[DL_PROF_STAGES]; /**< Stages, indexed by @ref profile-stages */
+  uint64_t elapsed;    /**< Nanoseconds since dl_prof_start() */
+  uint64_t tickrate;   /**< Profiler clock ticks per second */
+  uint32_t threads;    /**< Number of threads profiled */
+} DLProfile;
+
+extern int     dl_prof_start (void);
+extern int     dl_prof_get (DLProfile *profile);
+extern int     dl_prof_print (int fd);
+extern const char *dl_prof_name (int stage);
 /** @} */
 
 /** @addtogroup utility-functions
@@ -338,6 +689,19 @@ extern int     dlp_openfile (const char *filename, char perm);
 extern int64_t dlp_time (void);
 extern void    dlp_usleep (unsigned long int useconds);
 extern int     dlp_genclientid (char *progname, char *clientid, size_t maxsize);
+
+/** Output buffer of the async-signal-safe formatting functions, see dlp_safe_string() */
+typedef struct DLSafeOut_s
+{
+  int         fd;               /**< File descriptor written to when flushed */
+  int         error;            /**< Set when a write failed */
+  size_t      length;           /**< Number of bytes in the buffer */
+  char        buffer[4096];     /**< Output not yet written */
+} DLSafeOut;
+
+extern void    dlp_safe_string (DLSafeOut *out, const char *str, int width);
+extern void    dlp_safe_number (DLSafeOut *out, uint64_t value, int decimals, int width);
+extern void    dlp_safe_flush (DLSafeOut *out);
 extern int     dl_splitstreamid (char *streamid, char *w, char *x, char *y, char *z, char *type);
 extern int     dl_bigendianhost (void);
 extern double  dl_dabs (double value);
@@ -0,0 +1,386 @@
+/***********************************************************************/ /**
+ * @file logevent.c
+ *
+ * Structured log event formatting for libdali.
+ *
+ * Log events delivered to a handler registered with dl_logevents()
+ * carry a code, the connection and typed fields, the text form is
+ * left unformatted.  The routines in this file format the text form
+ * or a JSON representation of an event on demand and provide a
+ * JSON-lines sink handler.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Size of the stack buffer used by dl_eventsink_json() */
+#define EVENT_LINELEN 1024
+
+/* Output buffer tracking the length needed even when truncated */
+typedef struct JSONOut_s
+{
+  char *buffer;
+  size_t size;
+  size_t length;
+} JSONOut;
+
+static void json_raw (JSONOut *out, const char *str, size_t len);
+static void json_string (JSONOut *out, const char *str, size_t len);
+static void json_printf (JSONOut *out, const char *format, ...);
+
+/***********************************************************************/ /**
+ * @brief Return the name of a log event code
+ *
+ * @param code Event code, see @ref event-codes
+ *
+ * @return A static string naming the event, "unknown" for
+ * unrecognized codes.
+ ***************************************************************************/
+const char *
+dl_event_name (int code)
+{
+  switch (code)
+  {
+  case DL_EVENT_MESSAGE:
+    return "message";
+  case DL_EVENT_CONNECT:
+    return "connect";
+  case DL_EVENT_CONNFAIL:
+    return "connfail";
+  case DL_EVENT_DISCONNECT:
+    return "disconnect";
+  case DL_EVENT_SERVERID:
+    return "serverid";
+  case DL_EVENT_TIMEOUT:
+    return "timeout";
+  case DL_EVENT_IOERROR:
+    return "ioerror";
+  }
+
+  return "unknown";
+} /* End of dl_event_name() */
+
+/***********************************************************************/ /**
+ * @brief Format the text form of a log event
+ *
+ * Format the message of an event as it would have been printed
+ * without an event handler, without log or error prefix.  Like
+ * snprintf() the output is truncated to @a size and always
+ * terminated, the full length is returned so a larger buffer can be
+ * used if needed.
+ *
+ * Must only be called from within the event handler.
+ *
+ * @param event The event passed to the handler
+ * @param buffer Destination buffer
+ * @param size Size of @a buffer
+ *
+ * @return The length of the full text, or a negative value on error.
+ ***************************************************************************/
+int
+dl_event_text (const DLEvent *event, char *buffer, size_t size)
+{
+  va_list varlist;
+  int length;
+
+  if (!event || (!buffer && size > 0))
+    return -1;
+
+  if (!event->format || !event->varlist)
+  {
+    if (size > 0)
+      buffer[0] = '\0';
+    return 0;
+  }
+
+  va_copy (varlist, *event->varlist);
+  length = vsnprintf (buffer, size, event->format, varlist);
+  va_end (varlist);
+
+  return length;
+} /* End of dl_event_text() */
+
+/***********************************************************************/ /**
+ * @brief Format a log event as a JSON object
+ *
+ * Format an event as a single line JSON object without a trailing
+ * newline, for example:
+ *
+ * @code
+ * {"time":"2026-10-19T08:00:00.000000Z","level":1,"event":"connect",
+ *  "addr":"localhost:16000","message":"network socket opened (IPv4)",
+ *  "family":"IPv4"}
+ * @endcode
+ *
+ * The \c addr member is included for events of a connection and the
+ * connection address prefix is removed from the message.  Typed
+ * fields follow as members of their type, a NaN or infinite float
+ * field as \c null.  Like snprintf() the output is truncated to @a
+ * size and always terminated, the full length is returned so a larger
+ * buffer can be used if needed.
+ *
+ * Must only be called from within the event handler.
+ *
+ * @param event The event passed to the handler
+ * @param buffer Destination buffer
+ * @param size Size of @a buffer
+ *
+ * @return The length of the full JSON object, or a negative value on
+ * error.
+ ***************************************************************************/
+int
+dl_event_json (const DLEvent *event, char *buffer, size_t size)
+{
+  JSONOut out;
+  char timestr[30];
+  char textbuf[EVENT_LINELEN];
+  char *text = textbuf;
+  const char *msg;
+  size_t addrlen;
+  int textlen;
+  int idx;
+
+  if (!event || (!buffer && size > 0))
+    return -1;
+
+  out.buffer = buffer;
+  out.size   = size;
+  out.length = 0;
+
+  if (size > 0)
+    buffer[0] = '\0';
+
+  /* Format text form, in an allocated buffer if large */
+  if ((textlen = dl_event_text (event, textbuf, sizeof (textbuf))) < 0)
+    return -1;
+
+  if (textlen >= (int)sizeof (textbuf))
+  {
+    if (!(text = (char *)malloc (textlen + 1)))
+      return -1;
+
+    dl_event_text (event, text, textlen + 1);
+  }
+
+  dl_dltime2isotimestr (event->time, timestr, 1);
+
+  json_printf (&out, "{\"time\":\"%sZ\",\"level\":%d,\"event\":\"%s\"",
+               timestr, event->level, dl_event_name (event->code));
+
+  msg = text;
+
+  if (event->dlconn)
+  {
+    json_raw (&out, ",\"addr\":", 8);
+    json_string (&out, event->dlconn->addr, strlen (event->dlconn->addr));
+
+    /* Remove "[addr] " prefix, the address is a member */
+    addrlen = strlen (event->dlconn->addr);
+    if (msg[0] == '[' && !strncmp (msg + 1, event->dlconn->addr, addrlen) &&
+        msg[addrlen + 1] == ']' && msg[addrlen + 2] == ' ')
+      msg += addrlen + 3;
+  }
+
+  /* Message without trailing newline */
+  textlen = strlen (msg);
+  while (textlen > 0 && (msg[textlen - 1] == '\n' || msg[textlen - 1] == '\r'))
+    textlen--;
+
+  json_raw (&out, ",\"message\":", 11);
+  json_string (&out, msg, textlen);
+
+  for (idx = 0; idx < event->nfields; idx++)
+  {
+    json_raw (&out, ",", 1);
+    json_string (&out, event->fields[idx].name, strlen (event->fields[idx].name));
+    json_raw (&out, ":", 1);
+
+    switch (event->fields[idx].type)
+    {
+    case DL_FIELD_INT:
+      json_printf (&out, "%" PRId64, event->fields[idx].value.i);
+      break;
+    case DL_FIELD_FLOAT:
+      /* JSON has no NaN or infinity */
+      if (isfinite (event->fields[idx].value.f))
+        json_printf (&out, "%.17g", event->fields[idx].value.f);
+      else
+        json_raw (&out, "null", 4);
+      break;
+    case DL_FIELD_STRING:
+      if (event->fields[idx].value.s)
+        json_string (&out, event->fields[idx].value.s, strlen (event->fields[idx].value.s));
+      else
+        json_raw (&out, "null", 4);
+      break;
+    default:
+      json_raw (&out, "null", 4);
+    }
+  }
+
+  json_raw (&out, "}", 1);
+
+  if (text != textbuf)
+    free (text);
+
+  return (int)out.length;
+} /* End of dl_event_json() */
+
+/***********************************************************************/ /**
+ * @brief Log event handler writing JSON lines
+ *
+ * An event handler for dl_logevents() writing each event as one line
+ * formatted by dl_event_json() to the stream given as handler data,
+ * standard output if NULL.  Each line is written with a single call
+ * so lines of events logged by multiple threads are not interleaved.
+ *
+ * Example: dl_logevents (NULL, dl_eventsink_json, stderr);
+ *
+ * @param event The event to write
+ * @param handlerdata Output stream (FILE *), standard output if NULL
+ ***************************************************************************/
+void
+dl_eventsink_json (const DLEvent *event, void *handlerdata)
+{
+  FILE *stream = (handlerdata) ? (FILE *)handlerdata : stdout;
+  char linebuf[EVENT_LINELEN];
+  char *line = linebuf;
+  int length;
+
+  if ((length = dl_event_json (event, linebuf, sizeof (linebuf) - 1)) < 0)
+    return;
+
+  if (length >= (int)sizeof (linebuf) - 1)
+  {
+    if (!(line = (char *)malloc (length + 2)))
+      return;
+
+    dl_event_json (event, line, length + 1);
+  }
+
+  line[length] = '\n';
+  fwrite (line, 1, length + 1, stream);
+  fflush (stream);
+
+  if (line != linebuf)
+    free (line);
+} /* End of dl_eventsink_json() */
+
+/***************************************************************************
+ * json_raw:
+ *
+ * Append characters to the output, tracking the full length.
+ ***************************************************************************/
+static void
+json_raw (JSONOut *out, const char *str, size_t len)
+{
+  size_t copy;
+
+  if (out->length + 1 < out->size)
+  {
+    copy = out->size - out->length - 1;
+    if (copy > len)
+      copy = len;
+
+    memcpy (out->buffer + out->length, str, copy);
+    out->buffer[out->length + copy] = '\0';
+  }
+
+  out->length += len;
+} /* End of json_raw() */
+
+/***************************************************************************
+ * json_string:
+ *
+ * Append a quoted JSON string, escaping quotes, backslashes and
+ * control characters.
+ ***************************************************************************/
+static void
+json_string (JSONOut *out, const char *str, size_t len)
+{
+  char escape[8];
+  size_t start = 0;
+  size_t idx;
+  unsigned char c;
+
+  json_raw (out, "\"", 1);
+
+  for (idx = 0; idx < len; idx++)
+  {
+    c = (unsigned char)str[idx];
+
+    if (c != '"' && c != '\\' && c >= 0x20)
+      continue;
+
+    json_raw (out, str + start, idx - start);
+    start = idx + 1;
+
+    if (c == '"' || c == '\\')
+    {
+      escape[0] = '\\';
+      escape[1] = c;
+      json_raw (out, escape, 2);
+    }
+    else if (c == '\n')
+      json_raw (out, "\\n", 2);
+    else if (c == '\r')
+      json_raw (out, "\\r", 2);
+    else if (c == '\t')
+      json_raw (out, "\\t", 2);
+    else
+    {
+      snprintf (escape, sizeof (escape), "\\u%04x", c);
+      json_raw (out, escape, 6);
+    }
+  }
+
+  json_raw (out, str + start, len - start);
+  json_raw (out, "\"", 1);
+} /* End of json_string() */
+
+/***************************************************************************
+ * json_printf:
+ *
+ * Append formatted output, used for short numeric values.
+ ***************************************************************************/
+static void
+json_printf (JSONOut *out, const char *format, ...)
+{
+  char buffer[128];
+  va_list varlist;
+  int length;
+
+  va_start (varlist, format);
+  length = vsnprintf (buffer, sizeof (buffer), format, varlist);
+  va_end (varlist);
+
+  if (length < 0)
+    return;
+
+  if (length >= (int)sizeof (buffer))
+    length = sizeof (buffer) - 1;
+
+  json_raw (out, buffer, length);
+} /* End of json_printf() */
@@ -33,6 +33,7 @@
 #include <string.h>
 
 #include "libdali.h"
+#include "portable.h"
 
 void dl_loginit_main (DLLog *logp, int verbosity,
                       void (*log_print) (const char *), const char *logprefix,
@@ -40,8 +41,17 @@ void dl_loginit_main (DLLog *logp, int verbosity,
 
 int dl_log_main (DLLog *logp, int level, int verb, const char *format, va_list *varlist);
 
+static int dl_log_dispatch (DLLog *logp, const DLCP *dlconn, int level, int verb, int code,
+                            const DLEventField *fields, int nfields,
+                            const char *format, va_list *varlist);
+
 /** Initial global logging parameters */
-DLLog gDLLog = {NULL, NULL, NULL, NULL, 0};
+DLLog gDLLog = {NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL};
+
+/** Logging parameters for the current thread, global parameters if NULL */
+static DLP_TLS DLLog *tDLLog = NULL;
+
+#define DL_DEFAULTLOG ((tDLLog) ? tDLLog : &gDLLog)
 
 /***********************************************************************/ /**
  * @brief Initialize global logging system parameters
@@ -58,6 +68,54 @@ dl_loginit (int verbosity,
   dl_loginit_main (&gDLLog, verbosity, log_print, logprefix, diag_print, errprefix);
 } /* End of dl_loginit() */
 
+/***********************************************************************/ /**
+ * @brief Set the logging parameters for the calling thread
+ *
+ * Set the logging parameters used by dl_log() and by connections
+ * without their own parameters when called from the current thread,
+ * instead of the global parameters.  The parameters are usually
+ * created with dl_loginit_rl() and must remain valid while in use.
+ * Passing NULL reverts the thread to the global parameters.
+ *
+ * @param log DLLog logging parameters for the calling thread
+ ***************************************************************************/
+void
+dl_logthread (DLLog *log)
+{
+  tDLLog = log;
+} /* End of dl_logthread() */
+
+/***********************************************************************/ /**
+ * @brief Register a structured log event handler
+ *
+ * Once a handler is registered messages logged with the parameters
+ * are no longer formatted and printed, each message passing the
+ * verbosity threshold is instead passed to @a handler as a ::DLEvent.
+ * Messages logged with dl_log(), dl_log_r() and dl_log_rl() are
+ * delivered as ::DL_EVENT_MESSAGE events without fields, events
+ * logged by the library with dl_logevent() carry their own code and
+ * typed fields.
+ *
+ * The handler formats the text form of an event only if needed, with
+ * dl_event_text() or dl_event_json().  The handler is called by the
+ * thread logging the message and must be thread-safe if connections
+ * sharing the parameters are used by multiple threads.
+ *
+ * See dl_eventsink_json() for a handler writing JSON lines.
+ *
+ * @param log DLLog logging parameters, NULL for the global parameters
+ * @param handler Event handler, NULL to revert to text output
+ * @param handlerdata Data passed to each call of @a handler
+ ***************************************************************************/
+void
+dl_logevents (DLLog *log, DLEventHandler handler, void *handlerdata)
+{
+  DLLog *logp = (log) ? log : &gDLLog;
+
+  logp->event_handler = handler;
+  logp->event_data    = handlerdata;
+} /* End of dl_logevents() */
+
 /***********************************************************************/ /**
  * @brief Initialize logging parameters specific to a DLCP
  *
@@ -84,6 +142,10 @@ dl_loginit_r (DLCP *dlconn, int verbosity,
     dlconn->log->diag_print = NULL;
     dlconn->log->errprefix  = NULL;
     dlconn->log->verbosity  = 0;
+    dlconn->log->async      = NULL;
+
+    dlconn->log->event_handler = NULL;
+    dlconn->log->event_data    = NULL;
   }
 
   dl_loginit_main (dlconn->log, verbosity, log_print, logprefix, diag_print, errprefix);
@@ -116,6 +178,10 @@ dl_loginit_rl (DLLog *log, int verbosity,
     logp->diag_print = NULL;
     logp->errprefix  = NULL;
     logp->verbosity  = 0;
+    logp->async      = NULL;
+
+    logp->event_handler = NULL;
+    logp->event_data    = NULL;
   }
   else
   {
@@ -202,7 +268,8 @@ dl_loginit_main (DLLog *logp, int verbosity,
 /***********************************************************************/ /**
  * @brief Log a message using the global logging parameters
  *
- * A wrapper to dl_log_main() that uses the global logging parameters.
+ * A wrapper to dl_log_main() that uses the global logging parameters,
+ * or those of the calling thread if set with dl_logthread().
  *
  * @param level Level at which to log the message (1, 2 or 3)
  * @param verb Verbosity threshold at which to log the message
@@ -219,7 +286,8 @@ dl_log (int level, int verb, const char *format, ...)
 
   va_start (varlist, format);
 
-  retval = dl_log_main (&gDLLog, level, verb, format, &varlist);
+  retval = dl_log_dispatch (DL_DEFAULTLOG, NULL, level, verb, DL_EVENT_MESSAGE,
+                            NULL, 0, format, &varlist);
 
   va_end (varlist);
 
@@ -231,7 +299,7 @@ dl_log (int level, int verb, const char *format, ...)
  *
  * A wrapper to dl_log_main() that uses the logging parameters in a
  * supplied DLCP. If the supplied pointer is NULL the global logging
- * parameters will be used.
+ * parameters, or those of the calling thread, will be used.
  *
  * @param dlconn DataLink Connection Parameters with associated logging paramters
  * @param level Level at which to log the message (1, 2 or 3)
@@ -249,15 +317,16 @@ dl_log_r (const DLCP *dlconn, int level, int verb, const char *format, ...)
   DLLog *logp;
 
   if (!dlconn)
-    logp = &gDLLog;
+    logp = DL_DEFAULTLOG;
   else if (!dlconn->log)
-    logp = &gDLLog;
+    logp = DL_DEFAULTLOG;
   else
     logp = dlconn->log;
 
   va_start (varlist, format);
 
-  retval = dl_log_main (logp, level, verb, format, &varlist);
+  retval = dl_log_dispatch (logp, dlconn, level, verb, DL_EVENT_MESSAGE,
+                            NULL, 0, format, &varlist);
 
   va_end (varlist);
 
@@ -269,7 +338,7 @@ dl_log_r (const DLCP *dlconn, int level, int verb, const char *format, ...)
  *
  * A wrapper to dl_log_main() that uses the logging parameters in a
  * supplied DLLog.  If the supplied pointer is NULL the global logging
- * parameters will be used.
+ * parameters, or those of the calling thread, will be used.
  *
  * @param log DLLog logging paramters
  * @param level Level at which to log the message (1, 2 or 3)
@@ -287,19 +356,105 @@ dl_log_rl (DLLog *log, int level, int verb, const char *format, ...)
   DLLog *logp;
 
   if (!log)
-    logp = &gDLLog;
+    logp = DL_DEFAULTLOG;
   else
     logp = log;
 
   va_start (varlist, format);
 
-  retval = dl_log_main (logp, level, verb, format, &varlist);
+  retval = dl_log_dispatch (logp, NULL, level, verb, DL_EVENT_MESSAGE,
+                            NULL, 0, format, &varlist);
 
   va_end (varlist);
 
   return retval;
 } /* End of dl_log_rl() */
 
+/***********************************************************************/ /**
+ * @brief Log a structured event using the log parameters from a DLCP
+ *
+ * Log an event with a code and typed fields.  The @a format and
+ * variables are the text form of the event, formatted and printed
+ * like dl_log_r() when no event handler is registered and otherwise
+ * only formatted if the handler asks for it, see dl_logevents().
+ *
+ * If the supplied DLCP is NULL or has no logging parameters the
+ * global logging parameters, or those of the calling thread, will be
+ * used.
+ *
+ * @param dlconn DataLink Connection Parameters of the event, may be NULL
+ * @param level Level at which to log the event (1, 2 or 3)
+ * @param verb Verbosity threshold at which to log the event
+ * @param code Event code, see @ref event-codes
+ * @param fields Array of typed fields, may be NULL
+ * @param nfields Number of entries in @a fields
+ * @param format Text form in printf() style
+ * @param ... Text form format variables
+ *
+ * @return See dl_log_main() description for return values, 0 when
+ * passed to an event handler.
+ ***************************************************************************/
+int
+dl_logevent (const DLCP *dlconn, int level, int verb, int code,
+             const DLEventField *fields, int nfields, const char *format, ...)
+{
+  int retval;
+  va_list varlist;
+  DLLog *logp;
+
+  if (!dlconn || !dlconn->log)
+    logp = DL_DEFAULTLOG;
+  else
+    logp = dlconn->log;
+
+  va_start (varlist, format);
+
+  retval = dl_log_dispatch (logp, dlconn, level, verb, code,
+                            fields, nfields, format, &varlist);
+
+  va_end (varlist);
+
+  return retval;
+} /* End of dl_logevent() */
+
+/***************************************************************************
+ * dl_log_dispatch:
+ *
+ * Pass a message passing the verbosity threshold to the registered
+ * event handler, without formatting it, or to dl_log_main() for text
+ * output when no handler is registered.
+ *
+ * Returns the dl_log_main() return value or 0.
+ ***************************************************************************/
+static int
+dl_log_dispatch (DLLog *logp, const DLCP *dlconn, int level, int verb, int code,
+                 const DLEventField *fields, int nfields,
+                 const char *format, va_list *varlist)
+{
+  DLEvent event;
+
+  if (logp && logp->event_handler && level >= 0)
+  {
+    if (verb > logp->verbosity)
+      return 0;
+
+    event.level   = level;
+    event.code    = code;
+    event.dlconn  = dlconn;
+    event.time    = dlp_time ();
+    event.fields  = fields;
+    event.nfields = (fields) ? nfields : 0;
+    event.format  = format;
+    event.varlist = varlist;
+
+    logp->event_handler (&event, logp->event_data);
+
+    return 0;
+  }
+
+  return dl_log_main (logp, level, verb, format, varlist);
+} /* End of dl_log_dispatch() */
+
 /***********************************************************************/ /**
  * @brief Primary log message processing routine
  *
@@ -334,6 +489,10 @@ dl_log_rl (DLLog *log, int level, int verb, const char *format, ...)
  * All messages will be truncated to the MAX_LOG_MSG_LENGTH, this includes
  * any set prefix.
  *
+ * Messages are formatted in a buffer local to the call, so concurrent
+ * logging from multiple threads is safe as long as the printing
+ * functions are.
+ *
  * @param logp DLLog logging paramters
  * @param level Level at which to log the message (1, 2 or 3)
  * @param verb Verbosity threshold at which to log the message
@@ -346,7 +505,7 @@ dl_log_rl (DLLog *log, int level, int verb, const char *format, ...)
 int
 dl_log_main (DLLog *logp, int level, int verb, const char *format, va_list *varlist)
 {
-  static char message[MAX_LOG_MSG_LENGTH];
+  char message[MAX_LOG_MSG_LENGTH];
   int retvalue = 0;
   int presize;
 
@@ -360,6 +519,15 @@ dl_log_main (DLLog *logp, int level, int verb, const char *format, va_list *varl
 
   if (verb <= logp->verbosity)
   {
+    /* Hand off to the asynchronous writer if active */
+    if (logp->async && level >= 0)
+    {
+      return dlp_logasync_push (logp->async,
+                                (level >= 2) ? ((logp->errprefix) ? logp->errprefix : "error: ")
+                                             : ((logp->logprefix) ? logp->logprefix : ""),
+                                format, varlist);
+    }
+
     if (level >= 2) /* Error message */
     {
       if (logp->errprefix != NULL)
@@ -20,6 +20,7 @@
  * limitations under the License.
  ***************************************************************************/
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,27 @@
 #include "libdali.h"
 #include "portable.h"
 
+/* Delay between staggered connection attempts (microseconds) */
+#define DL_CONNECT_STAGGER  250000
+
+/* Limits and interval for automatic socket buffer sizing */
+#define DL_AUTOBUF_MIN      65536
+#define DL_AUTOBUF_MAX      16777216
+#define DL_AUTOBUF_INTERVAL DLTMODULUS
+
+/* Address prefix selecting a Unix domain socket */
+#define DL_UNIX_PREFIX      "unix:"
+
+static int dl_resolveaddr (DLCP *dlconn, DLAddr *addrs, int maxaddrs);
+static SOCKET dl_connectaddrs (DLCP *dlconn, DLAddr *addrs, int naddrs, int *family);
+static void dl_tunesocket (DLCP *dlconn, SOCKET sock, int family);
+static int dl_waitio (DLCP *dlconn, int writeflag, dltime_t *deadline);
+static void dl_sendtrack (DLCP *dlconn, size_t nsent);
+static void dl_recvtrack (DLCP *dlconn, int nread);
+static void dl_autobuf (DLCP *dlconn);
+static int dl_autobufsize (int64_t bytes, dltime_t elapsed, int64_t rtt, int cursize,
+                           int maxsize, int autosize);
+
 /***********************************************************************/ /**
  * @brief Connect to a DataLink server
  *
@@ -38,7 +60,23 @@
  * neither is specified (only a separator) then 'localhost' and port
  * '16000' are assumed.
  *
- * If a permanent error is detected (invalid port specified) the
+ * Alternatively 'dlconn->addr' may be 'unix:/path' to connect to a
+ * server listening on a Unix domain socket at '/path', avoiding TCP
+ * overhead for a server on the same host.  TCP-specific socket
+ * options are not applied to such connections.
+ *
+ * Connection attempts are non-blocking and limited to
+ * 'dlconn->conntimeout' milliseconds each.  When a host resolves to
+ * multiple addresses the attempts alternate between address families
+ * and are staggered, a new attempt is started every 250 milliseconds
+ * while earlier ones are pending and the first to complete is used
+ * (the "Happy Eyeballs" algorithm, RFC 8305).
+ *
+ * Resolved addresses are cached for 'dlconn->resolvettl' seconds and
+ * refreshed in the background when expired, so reconnections do not
+ * wait on DNS.  The cache is refreshed after a failed connection.
+ *
+ * If a permanent error is detected (invalid port or socket path) the
  * dlconn->terminate flag will be set so the dl_collect() family of
  * routines will not continue trying to connect.
  *
@@ -50,15 +88,11 @@
 SOCKET
 dl_connect (DLCP *dlconn)
 {
-  struct addrinfo *addr0 = NULL;
-  struct addrinfo *addr = NULL;
-  struct addrinfo hints;
+  DLAddr addrs[DLP_MAXADDRS];
+  DLEventField field;
+  const char *family;
   SOCKET sock;
-  long int nport;
-  char nodename[300] = {0};
-  char nodeport[100] = {0};
-  char *ptr, *tail;
-  int timeout;
+  int naddrs;
   int socket_family = -1;
 
   if (dlp_sockstartup ())
@@ -67,140 +101,83 @@ dl_connect (DLCP *dlconn)
     return -1;
   }
 
-  /* Search address host-port separator, first for '@', then ':' */
-  if ((ptr = strchr (dlconn->addr, '@')) == NULL && (ptr = strchr (dlconn->addr, ':')))
+  /* Unix domain socket path, otherwise resolve host and port */
+  if (!strncmp (dlconn->addr, DL_UNIX_PREFIX, strlen (DL_UNIX_PREFIX)))
   {
-    /* If first ':' is not the last, this is not a separator */
-    if (strrchr (dlconn->addr, ':') != ptr)
-      ptr = NULL;
-  }
-
-  /* If address begins with the separator */
-  if (dlconn->addr == ptr)
-  {
-    if (dlconn->addr[1] == '\0')  /* Only a separator */
-    {
-      strcpy (nodename, LD_DEFAULT_HOST);
-      strcpy (nodeport, LD_DEFAULT_PORT);
-    }
-    else /* Only a port */
+    if ((naddrs = dlp_unixaddr (dlconn->addr + strlen (DL_UNIX_PREFIX), addrs)) <= 0)
     {
-      strcpy (nodename, LD_DEFAULT_HOST);
-      strncpy (nodeport, dlconn->addr + 1, sizeof (nodeport) - 1);
+      dl_log_r (dlconn, 2, 0, "[%s] %s\n", dlconn->addr,
+                (naddrs == 0) ? "Unix domain sockets are not supported" : "socket path specified incorrectly");
+      dlconn->terminate = 1;
+      return -1;
     }
   }
-  /* Otherwise if no separator, use default port */
-  else if (ptr == NULL)
-  {
-    strncpy (nodename, dlconn->addr, sizeof (nodename));
-    strcpy (nodeport, LD_DEFAULT_PORT);
-  }
-  /* Otherwise separate host and port */
-  else if ((ptr - dlconn->addr) < sizeof (nodename))
-  {
-    strncpy (nodename, dlconn->addr, (ptr - dlconn->addr));
-    nodename[(ptr - dlconn->addr)] = '\0';
-    strncpy (nodeport, ptr + 1, sizeof (nodeport) - 1);
-  }
-
-  /* Sanity test the port number */
-  nport = strtoul (nodeport, &tail, 10);
-  if (*tail || (nport <= 0 || nport > 0xffff))
-  {
-    dl_log_r (dlconn, 2, 0, "server port specified incorrectly\n");
-    dlconn->terminate = 1;
-    return -1;
-  }
-
-  /* Resolve for either IPv4 or IPv6 (PF_UNSPEC) for a TCP stream (SOCK_STREAM) */
-  memset (&hints, 0, sizeof (hints));
-  hints.ai_family   = PF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-
-  /* Resolve server address */
-  if (getaddrinfo (nodename, nodeport, &hints, &addr0))
+  else if ((naddrs = dl_resolveaddr (dlconn, addrs, DLP_MAXADDRS)) <= 0)
   {
-    dl_log_r (dlconn, 2, 0, "cannot resolve hostname %s\n", nodename);
     return -1;
   }
 
-  /* Traverse addresses trying to connect */
-  sock = -1;
-  for (addr = addr0; addr != NULL; addr = addr->ai_next)
-  {
-    /* Create socket */
-    if ((sock = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0)
-    {
-      continue;
-    }
-
-    /* Set socket I/O timeouts if possible */
-    if (dlconn->iotimeout)
-    {
-      timeout = (dlconn->iotimeout > 0) ? dlconn->iotimeout : -dlconn->iotimeout;
-
-      if (dlp_setsocktimeo (sock, timeout) == 1)
-      {
-        /* Negate timeout to indicate socket timeouts are set */
-        dlconn->iotimeout = -timeout;
-      }
-    }
-
-    /* Connect socket */
-    if ((dlp_sockconnect (sock, addr->ai_addr, addr->ai_addrlen)))
-    {
-      dlp_sockclose (sock);
-      sock = -1;
-      continue;
-    }
-
-    socket_family = addr->ai_family;
-    break;
-  }
+  /* Attempt connections to resolved addresses */
+  sock = dl_connectaddrs (dlconn, addrs, naddrs, &socket_family);
 
   if (sock < 0)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] Cannot connect: %s\n", dlconn->addr, dlp_strerror ());
-    dlp_sockclose (sock);
-    freeaddrinfo (addr0);
-    return -1;
-  }
-
-  freeaddrinfo(addr0);
-
-  if (dlconn->iotimeout < 0)
-  {
-    dl_log_r (dlconn, 1, 2, "[%s] using system socket timeouts\n", dlconn->addr);
-  }
+    field.name    = "error";
+    field.type    = DL_FIELD_STRING;
+    field.value.s = dlp_strerror ();
+    dl_logevent (dlconn, 2, 0, DL_EVENT_CONNFAIL, &field, 1,
+                 "[%s] Cannot connect: %s\n", dlconn->addr, field.value.s);
+    dlp_trace (dlconn, DL_TRACE_CONNFAIL, 0, 0);
+    dlp_stats (dlconn, connfails, 1);
+    dlp_probe2 (connect__fail, dlconn, dlconn->addr);
 
-  /* Set socket to non-blocking */
-  if (dlp_socknoblock (sock))
-  {
-    dl_log_r (dlconn, 2, 0, "Error setting socket to non-blocking\n");
-    dlp_sockclose (sock);
+    /* Addresses may have changed, refresh them for the next attempt */
+    dlp_resolvestale (dlconn);
     return -1;
   }
 
   /* Socket connected */
-  dl_log_r (dlconn, 1, 1, "[%s] network socket opened ", dlconn->addr);
   switch (socket_family)
   {
   case PF_INET:
-    dl_log_r (dlconn, 1, 1, "(IPv4)\n");
+    family = "IPv4";
     break;
   case PF_INET6:
-    dl_log_r (dlconn, 1, 1, "(IPv6)\n");
+    family = "IPv6";
+    break;
+  case AF_UNIX:
+    family = "Unix domain";
     break;
   default:
-    dl_log_r (dlconn, 1, 1, "(Unknown protocol)\n");
+    family = "Unknown protocol";
   }
 
+  field.name    = "family";
+  field.type    = DL_FIELD_STRING;
+  field.value.s = family;
+  dl_logevent (dlconn, 1, 1, DL_EVENT_CONNECT, &field, 1,
+               "[%s] network socket opened (%s)\n", dlconn->addr, family);
+  dlp_trace (dlconn, DL_TRACE_CONNECT, 0, socket_family);
+  dlp_stats (dlconn, connects, 1);
+  dlp_probe4 (connect, dlconn, dlconn->addr, (int)sock, socket_family);
+
   dlconn->link = sock;
 
+  /* Reset automatic buffer sizing interval */
+  dlconn->autobuf_sent = 0;
+  dlconn->autobuf_recv = 0;
+  dlconn->autobuf_time = 0;
+
+  /* Set up io_uring I/O if requested, otherwise system calls are used */
+  if (dlconn->iouring)
+    dlp_uring_init (dlconn);
+
   /* Everything should be connected, exchange IDs */
   if (dl_exchangeIDs (dlconn, 1) == -1)
   {
+    dlp_uring_free (dlconn);
     dlp_sockclose (sock);
+    dlconn->link = -1;
     return -1;
   }
 
@@ -220,10 +197,14 @@ dl_disconnect (DLCP *dlconn)
 {
   if (dlconn->link >= 0)
   {
+    dlp_uring_free (dlconn);
     dlp_sockclose (dlconn->link);
     dlconn->link = -1;
 
-    dl_log_r (dlconn, 1, 1, "[%s] network socket closed\n", dlconn->addr);
+    dl_logevent (dlconn, 1, 1, DL_EVENT_DISCONNECT, NULL, 0,
+                 "[%s] network socket closed\n", dlconn->addr);
+    dlp_trace (dlconn, DL_TRACE_DISCONNECT, 0, 0);
+    dlp_probe2 (disconnect, dlconn, dlconn->addr);
   }
 } /* End of dl_disconnect() */
 
@@ -231,14 +212,17 @@ dl_disconnect (DLCP *dlconn)
  * @brief Send arbitrary data to a DataLink server
  *
  * This fundamental routine is used by other library routines to send
- * data via a DataLink connection.  Before data is sent the socket to
- * set to blocking mode and back to non-blocking before returning
- * unless there was an error in which case the socket should be
+ * data via a DataLink connection.  The socket remains in non-blocking
+ * mode, when it cannot accept more data this routine waits for it to
+ * become writable.  If there was an error the socket should be
  * disconnected.
  *
- * If a user specified network I/O timeout was not applied at the
- * system socket level this routine will implement the timeout using
- * an alarm timer to interrupt the blocked send.
+ * The user specified network I/O timeout, DLCP.iotimeout, limits the
+ * total time spent waiting.  The deadline is tracked per call, so
+ * connections in different threads do not affect each other.
+ *
+ * If io_uring I/O is active for the connection the data is sent
+ * through io_uring instead.
  *
  * @param dlconn DataLink Connection Parameters
  * @param buffer Buffer containing data to send
@@ -250,48 +234,52 @@ dl_disconnect (DLCP *dlconn)
 int
 dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
 {
-  /* Set socket to blocking */
-  if (dlp_sockblock (dlconn->link))
-  {
-    dl_log_r (dlconn, 2, 0, "[%s] error setting socket to blocking\n",
-              dlconn->addr);
-    return -1;
-  }
+  DLEventField fields[2];
+  dltime_t deadline = 0;
+  size_t nsent      = 0;
+  int rv;
 
-  /* Set timeout alarm if needed */
-  if (dlconn->iotimeout > 0)
+  /* Send through io_uring if active */
+  if (dlconn->uring)
   {
-    if (dlp_setioalarm (dlconn->iotimeout))
+    dlp_stats (dlconn, sendcalls, 1);
+
+    if (dlp_uring_send (dlconn, &buffer, &sendlen, 1))
     {
-      dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
-                dlconn->addr);
+      dlp_stats (dlconn, ioerrors, 1);
+      return -1;
     }
-  }
 
-  /* Send data */
-  if (send (dlconn->link, buffer, sendlen, 0) != (int64_t)sendlen)
-  {
-    dl_log_r (dlconn, 2, 0, "[%s] error sending data\n", dlconn->addr);
-    return -1;
+    dl_sendtrack (dlconn, sendlen);
+    return 0;
   }
 
-  /* Cancel timeout alarm if set */
-  if (dlconn->iotimeout > 0)
+  /* Send data, waiting for the socket to accept more as needed */
+  while (nsent < sendlen)
   {
-    if (dlp_setioalarm (0))
+    dlp_stats (dlconn, sendcalls, 1);
+
+    if ((rv = send (dlconn->link, (char *)buffer + nsent, sendlen - nsent, 0)) > 0)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
-                dlconn->addr);
+      nsent += rv;
+    }
+    else if (rv == 0 || dlp_noblockcheck () || dl_waitio (dlconn, 1, &deadline) <= 0)
+    {
+      fields[0].name    = "operation";
+      fields[0].type    = DL_FIELD_STRING;
+      fields[0].value.s = "send";
+      fields[1].name    = "bytes";
+      fields[1].type    = DL_FIELD_INT;
+      fields[1].value.i = (int64_t)nsent;
+      dl_logevent (dlconn, 2, 0, DL_EVENT_IOERROR, fields, 2,
+                   "[%s] error sending data\n", dlconn->addr);
+      dlp_trace (dlconn, DL_TRACE_IOERROR, (int64_t)nsent, 0);
+      dlp_stats (dlconn, ioerrors, 1);
+      return -1;
     }
   }
 
-  /* Set socket to non-blocking */
-  if (dlp_socknoblock (dlconn->link))
-  {
-    dl_log_r (dlconn, 2, 0, "[%s] error setting socket to non-blocking\n",
-              dlconn->addr);
-    return -1;
-  }
+  dl_sendtrack (dlconn, sendlen);
 
   return 0;
 } /* End of dl_senddata() */
@@ -310,7 +298,8 @@ dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
  * resplen bytes into @a respbuf using dl_recvheader() after sending
  * the packet.  This is only designed for small pieces of data,
  * specifically the server acknowledgement to a command, which are a
- * header-only packets.
+ * header-only packets.  The time the packet was sent, before waiting
+ * for the response, is kept in DLCP.sendtime.
  *
  * @param dlconn DataLink Connection Parameters
  * @param headerbuf Buffer containing DataLink packet header
@@ -331,6 +320,10 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
 {
   int bytesread = 0; /* bytes read into resp buffer */
   char wirepacket[MAXPACKETSIZE];
+  void *buffers[2];
+  size_t lengths[2];
+  int sendrv;
+  uint64_t profstart;
 
   if (!dlconn || !headerbuf)
     return -1;
@@ -351,6 +344,8 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
     return -1;
   }
 
+  profstart = dlp_prof_begin ();
+
   /* Set the synchronization and header size bytes */
   wirepacket[0] = 'D';
   wirepacket[1] = 'L';
@@ -359,12 +354,34 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
   /* Copy header into the wire packet */
   memcpy (wirepacket + 3, headerbuf, headerlen);
 
-  /* Copy packet data into the wire packet if supplied */
-  if (databuf && datalen > 0)
-    memcpy (wirepacket + 3 + headerlen, databuf, datalen);
+  /* With io_uring send header and data as linked operations, avoiding a copy */
+  if (dlconn->uring && databuf && datalen > 0)
+  {
+    buffers[0] = wirepacket;
+    lengths[0] = 3 + headerlen;
+    buffers[1] = databuf;
+    lengths[1] = datalen;
 
-  /* Send data */
-  if (dl_senddata (dlconn, wirepacket, (3 + headerlen + datalen)) < 0)
+    dlp_stats (dlconn, sendcalls, 1);
+
+    if ((sendrv = dlp_uring_send (dlconn, buffers, lengths, 2)) == 0)
+      dl_sendtrack (dlconn, lengths[0] + lengths[1]);
+    else
+      dlp_stats (dlconn, ioerrors, 1);
+  }
+  else
+  {
+    /* Copy packet data into the wire packet if supplied */
+    if (databuf && datalen > 0)
+      memcpy (wirepacket + 3 + headerlen, databuf, datalen);
+
+    sendrv = dl_senddata (dlconn, wirepacket, (3 + headerlen + datalen));
+  }
+
+  dlp_prof_end (DL_PROF_SEND, profstart);
+
+  /* Check send result */
+  if (sendrv < 0)
   {
     /* Check for a message from the server */
     if ((bytesread = dl_recvheader (dlconn, respbuf, resplen, 0)) > 0)
@@ -375,10 +392,17 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
     return -1;
   }
 
-  /* If requested collect the response (packet header only) */
+  /* If requested collect the response (packet header only), separating
+     send and response latencies */
   if (respbuf != NULL)
   {
-    if ((bytesread = dl_recvheader (dlconn, respbuf, resplen, 1)) < 0)
+    dlconn->sendtime = dlp_time ();
+
+    profstart = dlp_prof_begin ();
+    bytesread = dl_recvheader (dlconn, respbuf, resplen, 1);
+    dlp_prof_end (DL_PROF_ACK, profstart);
+
+    if (bytesread < 0)
     {
       if (bytesread < -1)
         dl_log_r (dlconn, 2, 0, "[%s] error receiving data\n", dlconn->addr);
@@ -403,9 +427,13 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
  * return.  If @a blockflag is false and some initial data is received
  * the function will block until @a readlen bytes have been read.
  *
- * If a user specified network I/O timeout was not applied at the
- * system socket level this routine will implement the timeout using
- * an alarm timer to interrupt the blocked send.
+ * The socket remains in non-blocking mode, blocking is implemented by
+ * waiting for the socket to become readable.  The user specified
+ * network I/O timeout, DLCP.iotimeout, limits the total time spent
+ * waiting.
+ *
+ * If io_uring I/O is active for the connection data is received
+ * through io_uring instead.
  *
  * @param dlconn DataLink Connection Parameters
  * @param buffer Buffer for received data
@@ -420,6 +448,8 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
 int
 dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
 {
+  DLEventField fields[2];
+  dltime_t deadline = 0;
   int nrecv;
   int nread  = 0;
   char *bptr = buffer;
@@ -429,49 +459,60 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
     return -2;
   }
 
-  /* Set socket to blocking if requested */
-  if (blockflag)
+  /* Receive through io_uring if active, -3 indicates fall back to system calls */
+  if (dlconn->uring)
   {
-    if (dlp_sockblock (dlconn->link))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to blocking: %s\n",
-                dlconn->addr, dlp_strerror ());
-      return -2;
-    }
-  }
+    dlp_stats (dlconn, recvcalls, 1);
 
-  /* Set timeout alarm if needed */
-  if (dlconn->iotimeout > 0)
-  {
-    if (dlp_setioalarm (dlconn->iotimeout))
+    if ((nread = dlp_uring_recv (dlconn, buffer, readlen, blockflag)) != -3)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
-                dlconn->addr);
+      if (nread == -2)
+        dlp_stats (dlconn, ioerrors, 1);
+
+      dl_recvtrack (dlconn, nread);
+      return nread;
     }
+
+    nread = 0;
   }
 
   /* Recv until readlen bytes have been read */
   while (nread < (int64_t)readlen)
   {
+    dlp_stats (dlconn, recvcalls, 1);
+
     if ((nrecv = recv (dlconn->link, bptr, readlen - nread, 0)) < 0)
     {
-      /* The only acceptable error is no data on non-blocking */
-      if (!blockflag && !dlp_noblockcheck ())
+      /* The only acceptable error is no data available */
+      if (dlp_noblockcheck ())
       {
-        /* Only break out if no data has yet been received */
-        if (nread == 0)
-          break;
-
-        /* Corner case: if some data has been received in non-blocking
-		 mode we will loop forever until readlen bytes are read */
+        fields[0].name    = "operation";
+        fields[0].type    = DL_FIELD_STRING;
+        fields[0].value.s = "recv";
+        fields[1].name    = "error";
+        fields[1].type    = DL_FIELD_STRING;
+        fields[1].value.s = dlp_strerror ();
+        dl_logevent (dlconn, 2, 0, DL_EVENT_IOERROR, fields, 2,
+                     "[%s] recv(%d): %d %s\n",
+                     dlconn->addr, dlconn->link, nrecv, fields[1].value.s);
+        dlp_trace (dlconn, DL_TRACE_IOERROR, nread, 1);
+        dlp_stats (dlconn, ioerrors, 1);
+        nread = -2;
+        break;
       }
-      else
+
+      /* Only return without data if not blocking, once some data has
+         been received wait for the remainder */
+      if (!blockflag && nread == 0)
+        break;
+
+      if (dl_waitio (dlconn, 0, &deadline) <= 0)
       {
-        dl_log_r (dlconn, 2, 0, "[%s] recv(%d): %d %s\n",
-                  dlconn->addr, dlconn->link, nrecv, dlp_strerror ());
         nread = -2;
         break;
       }
+
+      continue;
     }
 
     /* Peer completed an orderly shutdown */
@@ -489,26 +530,7 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
     }
   }
 
-  /* Cancel timeout alarm if set */
-  if (dlconn->iotimeout > 0)
-  {
-    if (dlp_setioalarm (0))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
-                dlconn->addr);
-    }
-  }
-
-  /* Set socket to non-blocking if set to blocking */
-  if (blockflag)
-  {
-    if (dlp_socknoblock (dlconn->link))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to non-blocking: %s\n",
-                dlconn->addr, dlp_strerror ());
-      return -2;
-    }
-  }
+  dl_recvtrack (dlconn, nread);
 
   return nread;
 } /* End of dl_recvdata() */
@@ -586,3 +608,580 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
 
   return bytesread;
 } /* End of dl_recvheader() */
+
+/***********************************************************************/ /**
+ * @brief Resolve the host and port of a DataLink server address
+ *
+ * Separate 'dlconn->addr' into host and port, applying the defaults
+ * described for dl_connect(), and resolve them to network addresses.
+ *
+ * If the port is invalid the dlconn->terminate flag is set.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param addrs Array to fill with resolved addresses
+ * @param maxaddrs Maximum number of addresses to return
+ *
+ * @return the number of addresses resolved.
+ * @retval -1 on errors
+ ***************************************************************************/
+static int
+dl_resolveaddr (DLCP *dlconn, DLAddr *addrs, int maxaddrs)
+{
+  long int nport;
+  char nodename[300] = {0};
+  char nodeport[100] = {0};
+  char *ptr, *tail;
+
+  /* Search address host-port separator, first for '@', then ':' */
+  if ((ptr = strchr (dlconn->addr, '@')) == NULL && (ptr = strchr (dlconn->addr, ':')))
+  {
+    /* If first ':' is not the last, this is not a separator */
+    if (strrchr (dlconn->addr, ':') != ptr)
+      ptr = NULL;
+  }
+
+  /* If address begins with the separator */
+  if (dlconn->addr == ptr)
+  {
+    if (dlconn->addr[1] == '\0')  /* Only a separator */
+    {
+      strcpy (nodename, LD_DEFAULT_HOST);
+      strcpy (nodeport, LD_DEFAULT_PORT);
+    }
+    else /* Only a port */
+    {
+      strcpy (nodename, LD_DEFAULT_HOST);
+      strncpy (nodeport, dlconn->addr + 1, sizeof (nodeport) - 1);
+    }
+  }
+  /* Otherwise if no separator, use default port */
+  else if (ptr == NULL)
+  {
+    strncpy (nodename, dlconn->addr, sizeof (nodename));
+    strcpy (nodeport, LD_DEFAULT_PORT);
+  }
+  /* Otherwise separate host and port */
+  else if ((ptr - dlconn->addr) < sizeof (nodename))
+  {
+    strncpy (nodename, dlconn->addr, (ptr - dlconn->addr));
+    nodename[(ptr - dlconn->addr)] = '\0';
+    strncpy (nodeport, ptr + 1, sizeof (nodeport) - 1);
+  }
+
+  /* Sanity test the port number */
+  nport = strtoul (nodeport, &tail, 10);
+  if (*tail || (nport <= 0 || nport > 0xffff))
+  {
+    dl_log_r (dlconn, 2, 0, "server port specified incorrectly\n");
+    dlconn->terminate = 1;
+    return -1;
+  }
+
+  /* Resolve server address, using cached addresses if available */
+  return dlp_resolve (dlconn, nodename, nodeport, addrs, maxaddrs);
+} /* End of dl_resolveaddr() */
+
+/***********************************************************************/ /**
+ * @brief Connect to the first responsive address of a list
+ *
+ * Attempt non-blocking connections to the addresses in @a addrs.  The
+ * addresses are re-ordered to alternate between address families,
+ * starting with the family of the first address.  A new attempt is
+ * started when the previous one fails or every DL_CONNECT_STAGGER
+ * microseconds while earlier attempts are pending, each attempt is
+ * abandoned after 'dlconn->conntimeout' milliseconds.  The first
+ * attempt to complete wins and all others are closed.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param addrs Array of resolved addresses
+ * @param naddrs Number of addresses in @a addrs
+ * @param family Returned address family of the connected socket
+ *
+ * @return the connected, non-blocking socket descriptor.
+ * @retval -1 when no connection could be made
+ ***************************************************************************/
+static SOCKET
+dl_connectaddrs (DLCP *dlconn, DLAddr *addrs, int naddrs, int *family)
+{
+  DLAddr *order[DLP_MAXADDRS];
+  SOCKET socks[DLP_MAXADDRS];
+  dltime_t deadlines[DLP_MAXADDRS];
+  int ready[DLP_MAXADDRS];
+  DLAddr *addr;
+  dltime_t now;
+  dltime_t nextstart;
+  dltime_t waituntil;
+  dltime_t timeout;
+  SOCKET sock    = -1;
+  int nordered   = 0;
+  int first      = 0;
+  int other      = 0;
+  int next       = 0;
+  int pending    = 0;
+  int wait_ret;
+  int idx;
+
+  if (naddrs > DLP_MAXADDRS)
+    naddrs = DLP_MAXADDRS;
+
+  /* Order addresses alternating between the family of the first address and others */
+  while (first < naddrs || other < naddrs)
+  {
+    while (first < naddrs && addrs[first].family != addrs[0].family)
+      first++;
+    if (first < naddrs)
+      order[nordered++] = &addrs[first++];
+
+    while (other < naddrs && addrs[other].family == addrs[0].family)
+      other++;
+    if (other < naddrs)
+      order[nordered++] = &addrs[other++];
+  }
+
+  for (idx = 0; idx < DLP_MAXADDRS; idx++)
+    socks[idx] = -1;
+
+  timeout   = (dlconn->conntimeout > 0) ? (dltime_t)dlconn->conntimeout * (DLTMODULUS / 1000) : 0;
+  nextstart = dlp_time ();
+
+  while (sock < 0 && !dlconn->terminate)
+  {
+    now = dlp_time ();
+
+    /* Start the next attempt if nothing is pending or the stagger delay has passed */
+    if (next < naddrs && (pending == 0 || now >= nextstart))
+    {
+      addr = order[next];
+
+      if ((socks[next] = socket (addr->family, addr->socktype, addr->protocol)) < 0)
+      {
+        next++;
+        continue;
+      }
+
+      /* Apply socket tuning options, before connecting for buffer sizes */
+      dl_tunesocket (dlconn, socks[next], addr->family);
+
+      if (dlp_socknoblock (socks[next]) ||
+          dlp_sockconnect (socks[next], (struct sockaddr *)&addr->addr, addr->addrlen))
+      {
+        dl_log_r (dlconn, 1, 2, "[%s] connection attempt %d failed: %s\n",
+                  dlconn->addr, next + 1, dlp_strerror ());
+        dlp_sockclose (socks[next]);
+        socks[next] = -1;
+        next++;
+        continue;
+      }
+
+      dl_log_r (dlconn, 1, 3, "[%s] connection attempt %d started (%s)\n",
+                dlconn->addr, next + 1,
+                (addr->family == PF_INET6) ? "IPv6" : (addr->family == PF_INET) ? "IPv4" : "Unix domain");
+
+      deadlines[next] = (timeout) ? now + timeout : 0;
+      nextstart       = now + DL_CONNECT_STAGGER;
+      pending++;
+      next++;
+    }
+
+    /* All attempts failed */
+    if (pending == 0)
+    {
+      if (next >= naddrs)
+        break;
+
+      continue;
+    }
+
+    /* Wait until the next attempt is due or the earliest attempt deadline */
+    waituntil = (next < naddrs) ? nextstart : 0;
+
+    for (idx = 0; idx < next; idx++)
+    {
+      if (socks[idx] >= 0 && deadlines[idx] && (waituntil == 0 || deadlines[idx] < waituntil))
+        waituntil = deadlines[idx];
+    }
+
+    /* Wait in slices of at most 0.5 seconds to check the terminate flag */
+    if (waituntil == 0 || waituntil - now > DLTMODULUS / 2)
+      waituntil = now + DLTMODULUS / 2;
+
+    /* Wait in milliseconds, rounded up so a deadline is not missed by a spin */
+    wait_ret = dlp_sockwaitconnect (socks, ready, next,
+                                    (waituntil > now) ? (int)((waituntil - now + 999) / 1000) : 0);
+
+    if (wait_ret < 0)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] error waiting for connections: %s\n", dlconn->addr, dlp_strerror ());
+      break;
+    }
+
+    now = dlp_time ();
+
+    /* Check pending attempts for completion, failure or expiration */
+    for (idx = 0; idx < next; idx++)
+    {
+      if (socks[idx] < 0)
+        continue;
+
+      if (ready[idx])
+      {
+        if (sock < 0 && dlp_sockerror (socks[idx]) == 0)
+        {
+          sock       = socks[idx];
+          *family    = order[idx]->family;
+          socks[idx] = -1;
+          pending--;
+          continue;
+        }
+
+        dl_log_r (dlconn, 1, 2, "[%s] connection attempt %d failed: %s\n",
+                  dlconn->addr, idx + 1, dlp_strerror ());
+      }
+      else if (deadlines[idx] && now >= deadlines[idx])
+      {
+        dl_log_r (dlconn, 1, 2, "[%s] connection attempt %d timed out\n",
+                  dlconn->addr, idx + 1);
+#if defined(DLP_WIN)
+        WSASetLastError (WSAETIMEDOUT);
+#else
+        errno = ETIMEDOUT;
+#endif
+      }
+      else
+      {
+        continue;
+      }
+
+      /* Close failed or expired attempt and start the next immediately */
+      dlp_sockclose (socks[idx]);
+      socks[idx] = -1;
+      nextstart  = now;
+      pending--;
+    }
+  }
+
+  /* Close any attempts still pending */
+  for (idx = 0; idx < next; idx++)
+  {
+    if (socks[idx] >= 0)
+      dlp_sockclose (socks[idx]);
+  }
+
+  return sock;
+} /* End of dl_connectaddrs() */
+
+/***********************************************************************/ /**
+ * @brief Apply socket tuning options to a new socket
+ *
+ * Set the socket buffer sizes, TCP options, kernel keepalive and busy
+ * polling as configured in the DLCP.  Failures are logged but not
+ * fatal, the connection proceeds with system defaults.  Only buffer
+ * sizes apply to non-IP (Unix domain) sockets.
+ *
+ * Buffers are only set when a size is given, leaving them to the
+ * kernel automatic tuning otherwise.  Sizes above the system limit
+ * are capped by the system and logged.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param sock Network socket descriptor, not yet connected
+ * @param family Address family of the socket
+ ***************************************************************************/
+static void
+dl_tunesocket (DLCP *dlconn, SOCKET sock, int family)
+{
+  int rcvmax;
+  int sndmax;
+  int rcvauto;
+  int sndauto;
+
+  if (dlconn->rcvbuf > 0 || dlconn->sndbuf > 0)
+  {
+    if (dlp_setsockbuf (sock, dlconn->rcvbuf, dlconn->sndbuf))
+      dl_log_r (dlconn, 1, 0, "[%s] cannot set socket buffer sizes: %s\n",
+                dlconn->addr, dlp_strerror ());
+
+    dlp_getsockbuflimits (&rcvmax, &sndmax, &rcvauto, &sndauto);
+
+    if ((rcvmax > 0 && dlconn->rcvbuf > rcvmax) || (sndmax > 0 && dlconn->sndbuf > sndmax))
+      dl_log_r (dlconn, 1, 1, "[%s] socket buffer sizes capped at the system limits, rcv: %d, snd: %d\n",
+                dlconn->addr, rcvmax, sndmax);
+  }
+
+  if (family != PF_INET && family != PF_INET6)
+    return;
+
+  if (dlconn->tcpnodelay)
+  {
+    if (dlp_settcpnodelay (sock, 1) < 0)
+      dl_log_r (dlconn, 1, 0, "[%s] cannot set TCP_NODELAY: %s\n",
+                dlconn->addr, dlp_strerror ());
+  }
+
+  if (dlconn->tcpquickack)
+  {
+    if (dlp_settcpquickack (sock, 1) <= 0)
+      dl_log_r (dlconn, 1, 0, "[%s] cannot set TCP_QUICKACK\n", dlconn->addr);
+  }
+
+  if (dlconn->tcpusertimeout > 0)
+  {
+    if (dlp_settcpusertimeout (sock, dlconn->tcpusertimeout) <= 0)
+      dl_log_r (dlconn, 1, 0, "[%s] cannot set TCP_USER_TIMEOUT\n", dlconn->addr);
+  }
+
+  if (dlconn->tcpkeepidle > 0)
+  {
+    if (dlp_settcpkeepalive (sock, dlconn->tcpkeepidle,
+                             dlconn->tcpkeepintvl, dlconn->tcpkeepcnt) <= 0)
+      dl_log_r (dlconn, 1, 0, "[%s] cannot set kernel TCP keepalive parameters\n",
+                dlconn->addr);
+  }
+
+  if (dlconn->busypoll > 0)
+  {
+    if (dlp_setbusypoll (sock, dlconn->busypoll) <= 0)
+      dl_log_r (dlconn, 1, 0, "[%s] cannot set SO_BUSY_POLL: %s\n",
+                dlconn->addr, dlp_strerror ());
+  }
+} /* End of dl_tunesocket() */
+
+/***********************************************************************/ /**
+ * @brief Wait for the connection socket to become ready for I/O
+ *
+ * Wait for the socket to become readable, or writable if @a writeflag
+ * is true.  When DLCP.iotimeout is set the wait is limited by the
+ * @a deadline of the calling operation, which is set on first use.
+ * Interrupted waits are resumed unless the connection is terminating.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param writeflag Flag to wait for writability instead of readability
+ * @param deadline Deadline of the operation, 0 if not yet set
+ *
+ * @return 1 when ready, 0 on timeout and -1 on error or termination.
+ ***************************************************************************/
+static int
+dl_waitio (DLCP *dlconn, int writeflag, dltime_t *deadline)
+{
+  DLEventField field;
+  dltime_t now;
+  int timeout = -1;
+  int rv;
+
+  for (;;)
+  {
+    if (dlconn->iotimeout > 0)
+    {
+      now = dlp_time ();
+
+      if (*deadline == 0)
+        *deadline = now + (dltime_t)dlconn->iotimeout * DLTMODULUS;
+
+      if (now >= *deadline)
+      {
+        field.name    = "seconds";
+        field.type    = DL_FIELD_INT;
+        field.value.i = dlconn->iotimeout;
+        dl_logevent (dlconn, 2, 0, DL_EVENT_TIMEOUT, &field, 1,
+                     "[%s] network I/O timeout after %d seconds\n",
+                     dlconn->addr, dlconn->iotimeout);
+        dlp_trace (dlconn, DL_TRACE_TIMEOUT, 0, dlconn->iotimeout);
+        dlp_stats (dlconn, timeouts, 1);
+        return 0;
+      }
+
+      timeout = (int)((*deadline - now) / (DLTMODULUS / 1000)) + 1;
+    }
+
+    if ((rv = dlp_sockwait (dlconn->link, writeflag, timeout)) > 0)
+      return 1;
+
+#if !defined(DLP_WIN)
+    if (rv < 0 && errno == EINTR && !dlconn->terminate)
+      continue;
+#endif
+
+    if (rv < 0)
+    {
+      if (!dlconn->terminate)
+        dl_log_r (dlconn, 2, 0, "[%s] error waiting for socket: %s\n",
+                  dlconn->addr, dlp_strerror ());
+      return -1;
+    }
+  }
+} /* End of dl_waitio() */
+
+/***********************************************************************/ /**
+ * @brief Account for data sent on a connection
+ *
+ * Count the bytes in the connection statistics and track throughput
+ * for automatic buffer sizing.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param nsent Number of bytes sent
+ ***************************************************************************/
+static void
+dl_sendtrack (DLCP *dlconn, size_t nsent)
+{
+  dlp_stats (dlconn, bytessent, nsent);
+
+  if (dlconn->autobuf)
+  {
+    dlconn->autobuf_sent += nsent;
+    dl_autobuf (dlconn);
+  }
+} /* End of dl_sendtrack() */
+
+/***********************************************************************/ /**
+ * @brief Account for data received on a connection
+ *
+ * Count the bytes in the connection statistics, re-arm quick ACKs,
+ * which the kernel clears on its own, and track throughput for
+ * automatic buffer sizing.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param nread Number of bytes received, ignored if not positive
+ ***************************************************************************/
+static void
+dl_recvtrack (DLCP *dlconn, int nread)
+{
+  if (nread <= 0)
+    return;
+
+  dlp_stats (dlconn, bytesrecv, nread);
+
+  if (dlconn->tcpquickack)
+    dlp_settcpquickack (dlconn->link, 1);
+
+  if (dlconn->autobuf)
+  {
+    dlconn->autobuf_recv += nread;
+    dl_autobuf (dlconn);
+  }
+} /* End of dl_recvtrack() */
+
+/***********************************************************************/ /**
+ * @brief Resize socket buffers from measured RTT and throughput
+ *
+ * Called after data is transferred when automatic buffer sizing is
+ * enabled.  Once per interval the bytes moved in each direction are
+ * converted to the bytes in flight over one round trip time and the
+ * corresponding socket buffer is grown when it is limiting throughput.
+ *
+ * Buffers are only ever grown, between DL_AUTOBUF_MIN and
+ * DL_AUTOBUF_MAX bytes and up to the system limit.  A buffer not set
+ * with an explicit size is left to the kernel while its own automatic
+ * tuning can grow it as far, setting the buffer would stop the tuning.
+ *
+ * @param dlconn DataLink Connection Parameters
+ ***************************************************************************/
+static void
+dl_autobuf (DLCP *dlconn)
+{
+  dltime_t now = dlp_time ();
+  dltime_t elapsed;
+  int64_t rtt;
+  int currcvbuf = 0;
+  int cursndbuf = 0;
+  int rcvbuf;
+  int sndbuf;
+  int rcvmax;
+  int sndmax;
+  int rcvauto;
+  int sndauto;
+
+  if (dlconn->autobuf_time == 0)
+  {
+    dlconn->autobuf_time = now;
+    dlconn->autobuf_sent = 0;
+    dlconn->autobuf_recv = 0;
+    return;
+  }
+
+  elapsed = now - dlconn->autobuf_time;
+
+  if (elapsed < DL_AUTOBUF_INTERVAL)
+    return;
+
+  if ((rtt = dlp_gettcprtt (dlconn->link)) > 0 &&
+      dlp_getsockbuf (dlconn->link, &currcvbuf, &cursndbuf) == 0)
+  {
+    dlp_getsockbuflimits (&rcvmax, &sndmax, &rcvauto, &sndauto);
+
+    rcvbuf = dl_autobufsize (dlconn->autobuf_recv, elapsed, rtt, currcvbuf,
+                             rcvmax, (dlconn->rcvbuf > 0) ? 0 : rcvauto);
+    sndbuf = dl_autobufsize (dlconn->autobuf_sent, elapsed, rtt, cursndbuf,
+                             sndmax, (dlconn->sndbuf > 0) ? 0 : sndauto);
+
+    if (rcvbuf || sndbuf)
+    {
+      if (dlp_setsockbuf (dlconn->link, rcvbuf, sndbuf))
+      {
+        dl_log_r (dlconn, 1, 0, "[%s] cannot resize socket buffers: %s\n",
+                  dlconn->addr, dlp_strerror ());
+      }
+      else
+      {
+        dl_log_r (dlconn, 1, 2, "[%s] RTT %lld us, socket buffers resized to rcv: %d, snd: %d\n",
+                  dlconn->addr, (long long int)rtt,
+                  (rcvbuf) ? rcvbuf : currcvbuf, (sndbuf) ? sndbuf : cursndbuf);
+      }
+    }
+  }
+
+  dlconn->autobuf_time = now;
+  dlconn->autobuf_sent = 0;
+  dlconn->autobuf_recv = 0;
+} /* End of dl_autobuf() */
+
+/***********************************************************************/ /**
+ * @brief Determine a new socket buffer size from observed throughput
+ *
+ * The bytes in flight per round trip are estimated from the bytes
+ * moved over the elapsed interval.  If that exceeds a quarter of the
+ * current buffer the buffer is considered to be limiting throughput
+ * and a size of four times the in-flight estimate is returned,
+ * doubling the buffer for a saturated connection.
+ *
+ * No size is returned when the kernel tunes the buffer up to that
+ * size by itself or when it is not larger than the current buffer
+ * once capped at the system limit.
+ *
+ * @param bytes Bytes transferred during the interval
+ * @param elapsed Interval duration as a dltime_t value
+ * @param rtt Round trip time in microseconds
+ * @param cursize Current buffer size in bytes
+ * @param maxsize System limit of the buffer size in bytes, 0 if unknown
+ * @param autosize Limit of automatic tuning in bytes, 0 if not tuned
+ *
+ * @return New buffer size in bytes or 0 if no change is needed.
+ ***************************************************************************/
+static int
+dl_autobufsize (int64_t bytes, dltime_t elapsed, int64_t rtt, int cursize,
+                int maxsize, int autosize)
+{
+  int64_t perrtt;
+  int64_t target;
+
+  if (bytes <= 0 || elapsed <= 0)
+    return 0;
+
+  perrtt = (bytes * rtt * (DLTMODULUS / 1000000)) / elapsed;
+
+  if (perrtt * 4 <= cursize || cursize >= DL_AUTOBUF_MAX)
+    return 0;
+
+  target = perrtt * 4;
+
+  if (target < DL_AUTOBUF_MIN)
+    target = DL_AUTOBUF_MIN;
+  if (target > DL_AUTOBUF_MAX)
+    target = DL_AUTOBUF_MAX;
+
+  if (target <= autosize)
+    return 0;
+
+  if (maxsize > 0 && target > maxsize)
+    target = maxsize;
+
+  return (target > cursize) ? (int)target : 0;
+} /* End of dl_autobufsize() */
@@ -0,0 +1,395 @@
+/***********************************************************************/ /**
+ * @file pktring.c
+ *
+ * In-memory rings of recent packets for libdali.
+ *
+ * Packet payloads are stored back to back in a single data area
+ * allocated up front, a payload never wraps around its end, and the
+ * packet headers in a table indexed by a sequence number counting the
+ * packets added.  A packet is found by packet ID through an open
+ * addressing hash table, and by data end time through the running
+ * maximum of the data end times kept with each packet, which is
+ * non-decreasing in sequence and so searched by bisection.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Multiplier of the Fibonacci hash of packet IDs */
+#define RING_HASHMULT 0x9E3779B97F4A7C15ULL
+
+static void ring_evict (DLRing *ring);
+static uint64_t ring_hash (const DLRing *ring, int64_t pktid);
+static void ring_unindex (DLRing *ring, int64_t seq);
+
+/***********************************************************************/ /**
+ * @brief Allocate a packet ring
+ *
+ * All memory is allocated here: a table of @p packets packet headers,
+ * rounded up to a power of 2, a packet ID index of twice that many
+ * entries and a data area of @p databytes bytes for the payloads.
+ * The oldest packets are evicted when either is full.
+ *
+ * @param packets Maximum number of packets kept
+ * @param databytes Size of the payload data area in bytes
+ *
+ * @return Allocated ring on success and NULL on error.
+ ***************************************************************************/
+DLRing *
+dl_ring_new (int64_t packets, size_t databytes)
+{
+  DLRing *ring;
+  uint64_t size = 1;
+
+  if (packets <= 0 || databytes == 0)
+  {
+    dl_log (2, 0, "%s(): Invalid ring size\n", __func__);
+    return NULL;
+  }
+
+  while (size < (uint64_t)packets)
+    size <<= 1;
+
+  if (!(ring = (DLRing *)calloc (1, sizeof (DLRing))))
+  {
+    dl_log (2, 0, "%s(): Cannot allocate memory\n", __func__);
+    return NULL;
+  }
+
+  ring->packets   = (DLRingPacket *)calloc (size, sizeof (DLRingPacket));
+  ring->index     = (int64_t *)calloc (size * 2, sizeof (int64_t));
+  ring->data      = (char *)malloc (databytes);
+  ring->mask      = size - 1;
+  ring->indexbits = 1;
+  ring->databytes = databytes;
+  ring->first     = 1;
+  ring->next      = 1;
+
+  while (((uint64_t)1 << ring->indexbits) < size * 2)
+    ring->indexbits++;
+
+  if (!ring->packets || !ring->index || !ring->data)
+  {
+    dl_log (2, 0, "%s(): Cannot allocate memory for %lld packets and %llu bytes\n",
+            __func__, (long long int)size, (unsigned long long int)databytes);
+    dl_ring_free (ring);
+    return NULL;
+  }
+
+  return ring;
+} /* End of dl_ring_new() */
+
+/***********************************************************************/ /**
+ * @brief Free a packet ring
+ *
+ * @param ring Ring to free, may be NULL
+ ***************************************************************************/
+void
+dl_ring_free (DLRing *ring)
+{
+  if (!ring)
+    return;
+
+  free (ring->packets);
+  free (ring->index);
+  free (ring->data);
+  free (ring);
+} /* End of dl_ring_free() */
+
+/***********************************************************************/ /**
+ * @brief Add a packet to a ring
+ *
+ * The packet header and a copy of its payload are added as the
+ * latest packet, evicting the oldest packets as needed to make room.
+ * A packet ID already in the ring is indexed to the new packet.
+ * Packets larger than the data area are not added and counted in
+ * DLRing.rejected.
+ *
+ * Views returned by dl_ring_get() may be invalidated by this routine.
+ *
+ * @param ring Ring to add to
+ * @param packet Packet header
+ * @param packetdata Packet payload of packet->datasize bytes
+ *
+ * @return Sequence number of the added packet on success and -1 on
+ * error.
+ ***************************************************************************/
+int64_t
+dl_ring_add (DLRing *ring, const DLPacket *packet, const void *packetdata)
+{
+  DLRingPacket *slot;
+  uint64_t offset;
+  uint64_t hash;
+  size_t datasize;
+  int64_t seq;
+
+  if (!ring || !packet || packet->datasize < 0 || (packet->datasize > 0 && !packetdata))
+    return -1;
+
+  datasize = (size_t)packet->datasize;
+
+  if (datasize > ring->databytes)
+  {
+    ring->rejected++;
+    return -1;
+  }
+
+  /* Payloads do not wrap, skip the end of the data area if too short */
+  offset = ring->datahead;
+  if (offset % ring->databytes + datasize > ring->databytes)
+    offset += ring->databytes - offset % ring->databytes;
+
+  /* Evict until there is a free packet slot and room for the payload */
+  while ((uint64_t)(ring->next - ring->first) > ring->mask ||
+         (ring->first < ring->next &&
+          offset + datasize - ring->packets[ring->first & ring->mask].offset > ring->databytes))
+    ring_evict (ring);
+
+  seq  = ring->next;
+  slot = &ring->packets[seq & ring->mask];
+
+  memcpy (slot->streamid, packet->streamid, sizeof (slot->streamid));
+  slot->streamid[sizeof (slot->streamid) - 1] = '\0';
+  slot->pktid     = packet->pktid;
+  slot->pkttime   = packet->pkttime;
+  slot->datastart = packet->datastart;
+  slot->dataend   = packet->dataend;
+  slot->datasize  = packet->datasize;
+  slot->offset    = offset;
+  slot->maxend    = packet->dataend;
+
+  if (ring->first < ring->next && ring->packets[(seq - 1) & ring->mask].maxend > slot->maxend)
+    slot->maxend = ring->packets[(seq - 1) & ring->mask].maxend;
+
+  if (datasize > 0)
+    memcpy (ring->data + offset % ring->databytes, packetdata, datasize);
+
+  /* Index the packet ID, replacing an earlier packet with the same ID */
+  hash = ring_hash (ring, packet->pktid);
+  while (ring->index[hash] &&
+         ring->packets[(ring->index[hash] - 1) & ring->mask].pktid != packet->pktid)
+    hash = (hash + 1) & (((uint64_t)1 << ring->indexbits) - 1);
+
+  ring->index[hash] = seq + 1;
+
+  ring->datahead = offset + datasize;
+  ring->next++;
+  ring->added++;
+
+  return seq;
+} /* End of dl_ring_add() */
+
+/***********************************************************************/ /**
+ * @brief Return a packet in a ring
+ *
+ * The payload is returned as a view into the ring, valid until the
+ * packet is evicted by dl_ring_add() or the ring is cleared.
+ *
+ * @param ring Ring
+ * @param seq Sequence number of the packet
+ * @param packetdata Set to the packet payload if not NULL
+ *
+ * @return Packet header in the ring, NULL if not in the ring.
+ ***************************************************************************/
+const DLRingPacket *
+dl_ring_get (const DLRing *ring, int64_t seq, const void **packetdata)
+{
+  const DLRingPacket *slot;
+
+  if (!ring || seq < ring->first || seq >= ring->next)
+    return NULL;
+
+  slot = &ring->packets[seq & ring->mask];
+
+  if (packetdata)
+    *packetdata = ring->data + slot->offset % ring->databytes;
+
+  return slot;
+} /* End of dl_ring_get() */
+
+/***********************************************************************/ /**
+ * @brief Find a packet in a ring by packet ID
+ *
+ * A hash table lookup, constant time on average.
+ *
+ * @param ring Ring
+ * @param pktid Packet ID
+ *
+ * @return Sequence number of the packet, -1 if not in the ring.
+ ***************************************************************************/
+int64_t
+dl_ring_find (const DLRing *ring, int64_t pktid)
+{
+  uint64_t hash;
+
+  if (!ring)
+    return -1;
+
+  for (hash = ring_hash (ring, pktid); ring->index[hash];
+       hash = (hash + 1) & (((uint64_t)1 << ring->indexbits) - 1))
+  {
+    if (ring->packets[(ring->index[hash] - 1) & ring->mask].pktid == pktid)
+      return ring->index[hash] - 1;
+  }
+
+  return -1;
+} /* End of dl_ring_find() */
+
+/***********************************************************************/ /**
+ * @brief Find the first packet in a ring with data after a time
+ *
+ * Returns the earliest packet, in the order added, with a data end
+ * time after @p time, the packet a DataLink server positions to for
+ * POSITION AFTER.  The search bisects the running maximum of the data
+ * end times in logarithmic time.
+ *
+ * The running maximum is not recomputed when packets are evicted, so
+ * after an evicted packet with a data end later than the packets
+ * following it the bisection may land early and the search then steps
+ * forward packet by packet.  Time is logarithmic only while packets
+ * arrive in data end time order and linear in the number of packets
+ * in the ring in the worst case.
+ *
+ * @param ring Ring
+ * @param time Time to search after
+ *
+ * @return Sequence number of the packet, -1 if no packet has data
+ * after the time.
+ ***************************************************************************/
+int64_t
+dl_ring_after (const DLRing *ring, dltime_t time)
+{
+  int64_t low;
+  int64_t high;
+  int64_t mid;
+
+  if (!ring || ring->first == ring->next ||
+      ring->packets[(ring->next - 1) & ring->mask].maxend <= time)
+    return -1;
+
+  low  = ring->first;
+  high = ring->next - 1;
+
+  while (low < high)
+  {
+    mid = low + (high - low) / 2;
+
+    if (ring->packets[mid & ring->mask].maxend > time)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+
+  /* The running maximum may include evicted packets, step to the first
+   * packet with its own data end after the time */
+  while (low < ring->next && ring->packets[low & ring->mask].dataend <= time)
+    low++;
+
+  return (low < ring->next) ? low : -1;
+} /* End of dl_ring_after() */
+
+/***********************************************************************/ /**
+ * @brief Remove all packets from a ring
+ *
+ * Sequence numbers continue from the latest packet, so sequence
+ * numbers held by callers remain ordered.  Packets removed are not
+ * counted as evicted.
+ *
+ * @param ring Ring to clear
+ ***************************************************************************/
+void
+dl_ring_clear (DLRing *ring)
+{
+  if (!ring)
+    return;
+
+  memset (ring->index, 0, ((size_t)1 << ring->indexbits) * sizeof (int64_t));
+
+  ring->first = ring->next;
+} /* End of dl_ring_clear() */
+
+/***************************************************************************
+ * ring_evict:
+ *
+ * Evict the oldest packet from a non-empty ring.
+ ***************************************************************************/
+static void
+ring_evict (DLRing *ring)
+{
+  ring_unindex (ring, ring->first);
+
+  ring->evicted++;
+  ring->evictedbytes += ring->packets[ring->first & ring->mask].datasize;
+  ring->first++;
+} /* End of ring_evict() */
+
+/***************************************************************************
+ * ring_hash:
+ *
+ * Return the index table position of a packet ID.
+ ***************************************************************************/
+static uint64_t
+ring_hash (const DLRing *ring, int64_t pktid)
+{
+  return ((uint64_t)pktid * RING_HASHMULT) >> (64 - ring->indexbits);
+} /* End of ring_hash() */
+
+/***************************************************************************
+ * ring_unindex:
+ *
+ * Remove a packet from the packet ID index if it is indexed to it,
+ * not when a later packet has the same ID.  Following entries are
+ * shifted back so that lookups need no tombstones.
+ ***************************************************************************/
+static void
+ring_unindex (DLRing *ring, int64_t seq)
+{
+  uint64_t mask = ((uint64_t)1 << ring->indexbits) - 1;
+  uint64_t hole;
+  uint64_t hash;
+  uint64_t home;
+  int64_t pktid = ring->packets[seq & ring->mask].pktid;
+
+  for (hash = ring_hash (ring, pktid); ring->index[hash]; hash = (hash + 1) & mask)
+  {
+    if (ring->packets[(ring->index[hash] - 1) & ring->mask].pktid == pktid)
+      break;
+  }
+
+  if (ring->index[hash] != seq + 1)
+    return;
+
+  /* Shift back entries whose home position is not between the hole and them */
+  hole = hash;
+  for (hash = (hash + 1) & mask; ring->index[hash]; hash = (hash + 1) & mask)
+  {
+    home = ring_hash (ring, ring->packets[(ring->index[hash] - 1) & ring->mask].pktid);
+
+    if (((hash - home) & mask) >= ((hash - hole) & mask))
+    {
+      ring->index[hole] = ring->index[hash];
+      hole              = hash;
+    }
+  }
+
+  ring->index[hole] = 0;
+} /* End of ring_unindex() */
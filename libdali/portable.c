@@ -31,6 +31,12 @@
 #include "libdali.h"
 #include "portable.h"
 
+#if !defined(DLP_WIN)
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/un.h>
+#endif
+
 /************************************************************************/ /**
  * @brief Start up socket subsystem (only does something for WIN)
  *
@@ -88,6 +94,41 @@ dlp_sockconnect (SOCKET socket, struct sockaddr *inetaddr, int addrlen)
   return 0;
 } /* End of dlp_sockconnect() */
 
+/***********************************************************************/ /**
+ * @brief Get the pending error status of a network socket
+ *
+ * Retrieve and clear the pending error on a socket using SO_ERROR,
+ * most useful for determining the result of a non-blocking connect
+ * after the socket is reported writable.  When an error is pending
+ * the system error status is also set so that dlp_strerror() will
+ * describe it.
+ *
+ * @param socket Network socket descriptor
+ *
+ * @return 0 when no error is pending, the error code otherwise and -1
+ * if the status could not be retrieved.
+ ***************************************************************************/
+int
+dlp_sockerror (SOCKET socket)
+{
+  int error        = 0;
+  socklen_t optlen = sizeof (error);
+
+  if (getsockopt (socket, SOL_SOCKET, SO_ERROR, (char *)&error, &optlen))
+    return -1;
+
+  if (error)
+  {
+#if defined(DLP_WIN)
+    WSASetLastError (error);
+#else
+    errno = error;
+#endif
+  }
+
+  return error;
+} /* End of dlp_sockerror() */
+
 /***********************************************************************/ /**
  * @brief Close a network socket
  *
@@ -195,97 +236,514 @@ dlp_noblockcheck (void)
 } /* End of dlp_noblockcheck() */
 
 /***********************************************************************/ /**
- * @brief Set socket I/O timeout
+ * @brief Set socket buffer sizes
+ *
+ * Set the SO_RCVBUF and SO_SNDBUF socket options to the specified
+ * sizes in bytes.  A size of zero leaves the corresponding buffer at
+ * the system default.
+ *
+ * For the receive buffer to influence the TCP window scaling
+ * negotiated with the peer it must be set before the socket is
+ * connected.
+ *
+ * @param socket Network socket descriptor
+ * @param rcvbuf Receive buffer size in bytes, 0 for no change
+ * @param sndbuf Send buffer size in bytes, 0 for no change
+ *
+ * @return -1 on error and 0 on success.
+ ***************************************************************************/
+int
+dlp_setsockbuf (SOCKET socket, int rcvbuf, int sndbuf)
+{
+  if (rcvbuf > 0 &&
+      setsockopt (socket, SOL_SOCKET, SO_RCVBUF, (char *)&rcvbuf, sizeof (rcvbuf)))
+  {
+    return -1;
+  }
+
+  if (sndbuf > 0 &&
+      setsockopt (socket, SOL_SOCKET, SO_SNDBUF, (char *)&sndbuf, sizeof (sndbuf)))
+  {
+    return -1;
+  }
+
+  return 0;
+} /* End of dlp_setsockbuf() */
+
+/***********************************************************************/ /**
+ * @brief Get socket buffer sizes
+ *
+ * Get the current SO_RCVBUF and SO_SNDBUF socket option values.  Note
+ * that Linux reports double the size requested with setsockopt() to
+ * account for bookkeeping overhead, the values returned are halved so
+ * they compare with sizes given to dlp_setsockbuf().
+ *
+ * @param socket Network socket descriptor
+ * @param rcvbuf Returned receive buffer size in bytes, may be NULL
+ * @param sndbuf Returned send buffer size in bytes, may be NULL
+ *
+ * @return -1 on error and 0 on success.
+ ***************************************************************************/
+int
+dlp_getsockbuf (SOCKET socket, int *rcvbuf, int *sndbuf)
+{
+  socklen_t optlen;
+
+  if (rcvbuf)
+  {
+    optlen = sizeof (*rcvbuf);
+    if (getsockopt (socket, SOL_SOCKET, SO_RCVBUF, (char *)rcvbuf, &optlen))
+      return -1;
+  }
+
+  if (sndbuf)
+  {
+    optlen = sizeof (*sndbuf);
+    if (getsockopt (socket, SOL_SOCKET, SO_SNDBUF, (char *)sndbuf, &optlen))
+      return -1;
+  }
+
+#if defined(__linux__)
+  if (rcvbuf)
+    *rcvbuf /= 2;
+  if (sndbuf)
+    *sndbuf /= 2;
+#endif
+
+  return 0;
+} /* End of dlp_getsockbuf() */
+
+/***************************************************************************
+ * dlp_readsysctl:
+ *
+ * Read a field, counting from 0, of the integers in a /proc/sys file.
+ *
+ * Returns the value or 0 if it cannot be read.
+ ***************************************************************************/
+#if defined(__linux__)
+static int
+dlp_readsysctl (const char *path, int field)
+{
+  FILE *fp;
+  long value = 0;
+  int idx;
+
+  if (!(fp = fopen (path, "r")))
+    return 0;
+
+  for (idx = 0; idx <= field; idx++)
+  {
+    if (fscanf (fp, "%ld", &value) != 1)
+    {
+      value = 0;
+      break;
+    }
+  }
+
+  fclose (fp);
+
+  return (value > 0 && value <= INT32_MAX) ? (int)value : 0;
+} /* End of dlp_readsysctl() */
+#endif
+
+/***********************************************************************/ /**
+ * @brief Get the limits of socket buffer sizes
+ *
+ * Get the largest sizes SO_RCVBUF and SO_SNDBUF may be set to, larger
+ * sizes are silently capped by the system, and the largest sizes the
+ * kernel grows TCP buffers to by itself while they are not set.
+ * Setting a buffer disables this automatic tuning for it.
  *
- * Set socket I/O timeout if such an option exists.  On WIN and
- * other platforms where SO_RCVTIMEO and SO_SNDTIMEO are defined this
- * sets the SO_RCVTIMEO and SO_SNDTIMEO socket options using
- * setsockopt() to the @a timeout value (specified in seconds).
+ * On Linux these are net.core.rmem_max, net.core.wmem_max and the
+ * maximums of net.ipv4.tcp_rmem, unless tcp_moderate_rcvbuf is 0, and
+ * net.ipv4.tcp_wmem.
+ *
+ * @param rcvmax Returned receive buffer limit, 0 if unknown
+ * @param sndmax Returned send buffer limit, 0 if unknown
+ * @param rcvauto Returned automatic receive buffer limit, 0 if not tuned
+ * @param sndauto Returned automatic send buffer limit, 0 if not tuned
+ ***************************************************************************/
+void
+dlp_getsockbuflimits (int *rcvmax, int *sndmax, int *rcvauto, int *sndauto)
+{
+#if defined(__linux__)
+  *rcvmax = dlp_readsysctl ("/proc/sys/net/core/rmem_max", 0);
+  *sndmax = dlp_readsysctl ("/proc/sys/net/core/wmem_max", 0);
+  *rcvauto = (dlp_readsysctl ("/proc/sys/net/ipv4/tcp_moderate_rcvbuf", 0)) ?
+    dlp_readsysctl ("/proc/sys/net/ipv4/tcp_rmem", 2) : 0;
+  *sndauto = dlp_readsysctl ("/proc/sys/net/ipv4/tcp_wmem", 2);
+#else
+  *rcvmax = 0;
+  *sndmax = 0;
+  *rcvauto = 0;
+  *sndauto = 0;
+#endif
+} /* End of dlp_getsockbuflimits() */
+
+/***********************************************************************/ /**
+ * @brief Set TCP_NODELAY on a socket
  *
- * Solaris does not implelement socket-level timeout options.
+ * Set or clear the TCP_NODELAY option, when set Nagle's algorithm is
+ * disabled and small segments are sent immediately.
  *
  * @param socket Network socket descriptor
- * @param timeout Alarm timeout in seconds
+ * @param flag Set option when true, clear otherwise
+ *
+ * @return -1 on error and 1 on success.
+ ***************************************************************************/
+int
+dlp_settcpnodelay (SOCKET socket, int flag)
+{
+  flag = (flag) ? 1 : 0;
+
+  if (setsockopt (socket, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof (flag)))
+  {
+    return -1;
+  }
+
+  return 1;
+} /* End of dlp_settcpnodelay() */
+
+/***********************************************************************/ /**
+ * @brief Set TCP_QUICKACK on a socket
+ *
+ * Set the TCP_QUICKACK option requesting that ACKs are sent
+ * immediately instead of delayed.  The option is not permanent on
+ * Linux, the kernel may re-enable delayed ACKs, so it must be re-armed
+ * after each receive to remain effective.
+ *
+ * @param socket Network socket descriptor
+ * @param flag Set option when true, clear otherwise
  *
  * @return -1 on error, 0 when not possible and 1 on success.
  ***************************************************************************/
 int
-dlp_setsocktimeo (SOCKET socket, int timeout)
+dlp_settcpquickack (SOCKET socket, int flag)
 {
-#if defined(DLP_WIN)
-  int tval = timeout * 1000;
+#if defined(TCP_QUICKACK)
+  flag = (flag) ? 1 : 0;
 
-  if (setsockopt (socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tval, sizeof (tval)))
+  if (setsockopt (socket, IPPROTO_TCP, TCP_QUICKACK, (char *)&flag, sizeof (flag)))
   {
     return -1;
   }
-  tval = timeout * 1000;
-  if (setsockopt (socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&tval, sizeof (tval)))
+
+  return 1;
+#else
+  return 0;
+#endif
+} /* End of dlp_settcpquickack() */
+
+/***********************************************************************/ /**
+ * @brief Set TCP_USER_TIMEOUT on a socket
+ *
+ * Set the maximum time in milliseconds that transmitted data may
+ * remain unacknowledged before the connection is forcibly closed.
+ *
+ * @param socket Network socket descriptor
+ * @param timeout Timeout in milliseconds
+ *
+ * @return -1 on error, 0 when not possible and 1 on success.
+ ***************************************************************************/
+int
+dlp_settcpusertimeout (SOCKET socket, int timeout)
+{
+#if defined(TCP_USER_TIMEOUT)
+  unsigned int tval = (timeout > 0) ? (unsigned int)timeout : 0;
+
+  if (setsockopt (socket, IPPROTO_TCP, TCP_USER_TIMEOUT, (char *)&tval, sizeof (tval)))
   {
     return -1;
   }
 
+  return 1;
 #else
-/* Set socket I/O timeouts if socket options are defined */
-#if defined(SO_RCVTIMEO) && defined(SO_SNDTIMEO)
-  struct timeval tval;
+  return 0;
+#endif
+} /* End of dlp_settcpusertimeout() */
 
-  tval.tv_sec  = timeout;
-  tval.tv_usec = 0;
+/***********************************************************************/ /**
+ * @brief Enable kernel TCP keepalive probes on a socket
+ *
+ * Set SO_KEEPALIVE and, where supported, the TCP_KEEPIDLE,
+ * TCP_KEEPINTVL and TCP_KEEPCNT options.  Any of @a intvl or @a cnt
+ * that are zero are left at the system default.
+ *
+ * @param socket Network socket descriptor
+ * @param idle Seconds of idle time before the first probe
+ * @param intvl Seconds between probes
+ * @param cnt Number of unanswered probes before the connection is dropped
+ *
+ * @return -1 on error, 0 when only SO_KEEPALIVE could be set and 1 on
+ * success.
+ ***************************************************************************/
+int
+dlp_settcpkeepalive (SOCKET socket, int idle, int intvl, int cnt)
+{
+  int flag = 1;
+  int rv   = 0;
 
-  if (setsockopt (socket, SOL_SOCKET, SO_RCVTIMEO, &tval, sizeof (tval)))
+  if (setsockopt (socket, SOL_SOCKET, SO_KEEPALIVE, (char *)&flag, sizeof (flag)))
   {
     return -1;
   }
-  if (setsockopt (socket, SOL_SOCKET, SO_SNDTIMEO, &tval, sizeof (tval)))
+
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+  if (idle > 0 &&
+      setsockopt (socket, IPPROTO_TCP, TCP_KEEPIDLE, (char *)&idle, sizeof (idle)))
+  {
+    return -1;
+  }
+  if (intvl > 0 &&
+      setsockopt (socket, IPPROTO_TCP, TCP_KEEPINTVL, (char *)&intvl, sizeof (intvl)))
+  {
+    return -1;
+  }
+  if (cnt > 0 &&
+      setsockopt (socket, IPPROTO_TCP, TCP_KEEPCNT, (char *)&cnt, sizeof (cnt)))
+  {
+    return -1;
+  }
+
+  rv = 1;
+#endif
+
+  return rv;
+} /* End of dlp_settcpkeepalive() */
+
+/***********************************************************************/ /**
+ * @brief Set SO_BUSY_POLL on a socket
+ *
+ * Set the approximate time in microseconds to busy poll on a blocking
+ * receive when there is no data.  Raising this value above the system
+ * default usually requires CAP_NET_ADMIN.
+ *
+ * @param socket Network socket descriptor
+ * @param usecs Busy poll time in microseconds
+ *
+ * @return -1 on error, 0 when not possible and 1 on success.
+ ***************************************************************************/
+int
+dlp_setbusypoll (SOCKET socket, int usecs)
+{
+#if defined(SO_BUSY_POLL)
+  if (setsockopt (socket, SOL_SOCKET, SO_BUSY_POLL, (char *)&usecs, sizeof (usecs)))
   {
     return -1;
   }
+
+  return 1;
 #else
   return 0;
 #endif
+} /* End of dlp_setbusypoll() */
 
+/***********************************************************************/ /**
+ * @brief Get the smoothed round trip time of a TCP connection
+ *
+ * Query the kernel estimate of the round trip time for a connected
+ * TCP socket using TCP_INFO.
+ *
+ * @param socket Network socket descriptor
+ *
+ * @return Round trip time in microseconds, 0 when not possible and -1
+ * on error.
+ ***************************************************************************/
+int64_t
+dlp_gettcprtt (SOCKET socket)
+{
+#if defined(TCP_INFO) && defined(__linux__)
+  struct tcp_info tinfo;
+  socklen_t optlen = sizeof (tinfo);
+
+  if (getsockopt (socket, IPPROTO_TCP, TCP_INFO, &tinfo, &optlen))
+  {
+    return -1;
+  }
+
+  return (int64_t)tinfo.tcpi_rtt;
+#else
+  return 0;
 #endif
+} /* End of dlp_gettcprtt() */
+
+/***********************************************************************/ /**
+ * @brief Build a Unix domain socket address
+ *
+ * Populate @a addr with an AF_UNIX stream socket address for the
+ * file system @a path.
+ *
+ * @param path Path of the Unix domain socket
+ * @param addr Address to populate
+ *
+ * @return 1 on success, 0 when not supported and -1 on error (path
+ * empty or too long).
+ ***************************************************************************/
+int
+dlp_unixaddr (const char *path, DLAddr *addr)
+{
+#if !defined(DLP_WIN)
+  struct sockaddr_un *sun;
+
+  if (!path || !addr)
+    return -1;
+
+  sun = (struct sockaddr_un *)&addr->addr;
+
+  if (*path == '\0' || strlen (path) >= sizeof (sun->sun_path))
+    return -1;
+
+  memset (addr, 0, sizeof (DLAddr));
+  sun->sun_family = AF_UNIX;
+  strcpy (sun->sun_path, path);
+
+  addr->family   = AF_UNIX;
+  addr->socktype = SOCK_STREAM;
+  addr->protocol = 0;
+  addr->addrlen  = (int)sizeof (struct sockaddr_un);
 
   return 1;
-} /* End of dlp_setsocktimeo() */
+#else
+  return 0;
+#endif
+} /* End of dlp_unixaddr() */
 
 /***********************************************************************/ /**
- * @brief Set a network I/O real time alarm
+ * @brief Wait for a network socket to become ready for I/O
  *
- * Set a network I/O alarm timer, the @a timeout is specified in
- * seconds.  The timer is disabled by setting the timeout to zero.  On
- * most platforms this will cause a SIGALARM signal to be sent to the
- * calling process after @a timeout seconds have elapsed.  This
- * function does nothing under WIN.
+ * Wait for a socket to become readable, or writable if @a writeflag
+ * is true, for up to @a timeout milliseconds.  A negative timeout
+ * waits indefinitely.  Only the calling thread is blocked, no signals
+ * or process-wide timers are used.
  *
- * @param timeout Alarm timeout in seconds
+ * @param socket Network socket descriptor
+ * @param writeflag Flag to wait for writability instead of readability
+ * @param timeout Maximum time to wait in milliseconds, negative for no limit
  *
- * @return -1 on error and 0 on success.
+ * @return -1 on error, 0 on timeout and 1 when the socket is ready.
  ***************************************************************************/
 int
-dlp_setioalarm (int timeout)
+dlp_sockwait (SOCKET socket, int writeflag, int timeout)
 {
 #if defined(DLP_WIN)
-/* Non-operation for WIN */
+  struct timeval tv;
+  fd_set fds;
+  int rv;
+
+  FD_ZERO (&fds);
+  FD_SET (socket, &fds);
+  tv.tv_sec  = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+
+  rv = select (0, (writeflag) ? NULL : &fds, (writeflag) ? &fds : NULL, NULL,
+               (timeout < 0) ? NULL : &tv);
+
+  if (rv == SOCKET_ERROR)
+    return -1;
 
 #else
-  struct itimerval itval;
+  struct pollfd pfd;
+  int rv;
+
+  pfd.fd      = socket;
+  pfd.events  = (writeflag) ? POLLOUT : POLLIN;
+  pfd.revents = 0;
+
+  rv = poll (&pfd, 1, timeout);
+
+  if (rv < 0)
+    return -1;
+
+#endif
+
+  return (rv > 0) ? 1 : 0;
+} /* End of dlp_sockwait() */
+
+/***********************************************************************/ /**
+ * @brief Wait for any of several connecting sockets to complete
+ *
+ * Wait for up to @a timeout milliseconds until any of @a count
+ * sockets completes a non-blocking connect, successfully or not.
+ * Sockets that are negative are ignored.  Each entry of @a ready is
+ * set to 1 if the socket completed and 0 otherwise, use
+ * dlp_sockerror() to check the result.  Unlike select() there is no
+ * limit on descriptor values.
+ *
+ * @param sockets Network socket descriptors, negative entries ignored
+ * @param ready Array of @a count flags set for completed sockets
+ * @param count Number of sockets, at most DLP_MAXADDRS
+ * @param timeout Maximum time to wait in milliseconds, negative for no limit
+ *
+ * @return -1 on error, 0 on timeout or interruption and otherwise the
+ * number of completed sockets.
+ ***************************************************************************/
+int
+dlp_sockwaitconnect (SOCKET *sockets, int *ready, int count, int timeout)
+{
+#if defined(DLP_WIN)
+  struct timeval tv;
+  fd_set write_fds;
+  fd_set except_fds;
+  int rv;
+  int idx;
+
+  FD_ZERO (&write_fds);
+  FD_ZERO (&except_fds);
+
+  for (idx = 0; idx < count; idx++)
+  {
+    ready[idx] = 0;
+
+    if (sockets[idx] >= 0)
+    {
+      FD_SET (sockets[idx], &write_fds);
+      FD_SET (sockets[idx], &except_fds);
+    }
+  }
 
-  itval.it_interval.tv_sec  = 0;
-  itval.it_interval.tv_usec = 0;
-  itval.it_value.tv_sec     = timeout;
-  itval.it_value.tv_usec    = 0;
+  tv.tv_sec  = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
 
-  if (setitimer (ITIMER_REAL, &itval, NULL))
+  if ((rv = select (0, NULL, &write_fds, &except_fds, (timeout < 0) ? NULL : &tv)) == SOCKET_ERROR)
+    return (WSAGetLastError () == WSAEINTR) ? 0 : -1;
+
+  for (idx = 0; rv > 0 && idx < count; idx++)
   {
+    if (sockets[idx] >= 0 &&
+        (FD_ISSET (sockets[idx], &write_fds) || FD_ISSET (sockets[idx], &except_fds)))
+      ready[idx] = 1;
+  }
+
+#else
+  struct pollfd pfds[DLP_MAXADDRS];
+  int rv;
+  int idx;
+
+  if (count > DLP_MAXADDRS)
     return -1;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    /* Negative descriptors are ignored by poll() */
+    pfds[idx].fd      = sockets[idx];
+    pfds[idx].events  = POLLOUT;
+    pfds[idx].revents = 0;
+    ready[idx]        = 0;
+  }
+
+  if ((rv = poll (pfds, (nfds_t)count, timeout)) < 0)
+    return (errno == EINTR) ? 0 : -1;
+
+  for (idx = 0; rv > 0 && idx < count; idx++)
+  {
+    if (pfds[idx].fd >= 0 && (pfds[idx].revents & (POLLOUT | POLLERR | POLLHUP)))
+      ready[idx] = 1;
   }
 
 #endif
 
-  return 0;
-} /* End of dlp_setioalarm() */
+  return rv;
+} /* End of dlp_sockwaitconnect() */
 
 /***********************************************************************/ /**
  * @brief Open a file stream
@@ -317,6 +775,103 @@ dlp_openfile (const char *filename, char perm)
   return open (filename, flags, mode);
 } /* End of dlp_openfile() */
 
+/***********************************************************************/ /**
+ * @brief Append a string to an async-signal-safe output buffer
+ *
+ * Append @a str, padded with spaces on the right to @a width, writing
+ * the buffer with dlp_safe_flush() when it fills.  Only
+ * async-signal-safe calls are used, for output from signal handlers.
+ *
+ * @param out Output buffer, @a out->fd set by the caller
+ * @param str String to append
+ * @param width Minimum width, 0 for none
+ ***************************************************************************/
+void
+dlp_safe_string (DLSafeOut *out, const char *str, int width)
+{
+  int length = 0;
+
+  for (; *str || length < width; length++)
+  {
+    if (out->length >= sizeof (out->buffer))
+      dlp_safe_flush (out);
+
+    out->buffer[out->length++] = (*str) ? *str++ : ' ';
+  }
+} /* End of dlp_safe_string() */
+
+/***********************************************************************/ /**
+ * @brief Append a number to an async-signal-safe output buffer
+ *
+ * Append @a value, in units of 10^-decimals, with @a decimals
+ * decimals and padded with spaces on the left to @a width, without
+ * the stdio functions that are not async-signal-safe.
+ *
+ * @param out Output buffer, @a out->fd set by the caller
+ * @param value Value to append
+ * @param decimals Number of decimals, 0 for an integer
+ * @param width Minimum width, 0 for none
+ ***************************************************************************/
+void
+dlp_safe_number (DLSafeOut *out, uint64_t value, int decimals, int width)
+{
+  char digits[32];
+  char padded[64];
+  int count = 0;
+  int idx   = 0;
+
+  do
+  {
+    if (decimals > 0 && count == decimals)
+      digits[count++] = '.';
+
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value || count <= decimals);
+
+  while (idx < width - count && idx < (int)sizeof (padded) - (int)sizeof (digits) - 1)
+    padded[idx++] = ' ';
+
+  while (count > 0)
+    padded[idx++] = digits[--count];
+
+  padded[idx] = '\0';
+
+  dlp_safe_string (out, padded, 0);
+} /* End of dlp_safe_number() */
+
+/***********************************************************************/ /**
+ * @brief Write an async-signal-safe output buffer
+ *
+ * Write the buffered output to @a out->fd with write(), resuming
+ * after interruptions, and empty the buffer.  A failed write sets
+ * @a out->error and the rest of the buffer is discarded.
+ *
+ * @param out Output buffer
+ ***************************************************************************/
+void
+dlp_safe_flush (DLSafeOut *out)
+{
+  size_t written = 0;
+  int rv;
+
+  while (written < out->length)
+  {
+    if ((rv = (int)write (out->fd, out->buffer + written, (unsigned int)(out->length - written))) <= 0)
+    {
+      if (rv < 0 && errno == EINTR)
+        continue;
+
+      out->error = 1;
+      break;
+    }
+
+    written += rv;
+  }
+
+  out->length = 0;
+} /* End of dlp_safe_flush() */
+
 /***********************************************************************/ /**
  * @brief Return a description of the last system error.
  *
@@ -327,7 +882,7 @@ const char *
 dlp_strerror (void)
 {
 #if defined(DLP_WIN)
-  static char errorstr[100];
+  static DLP_TLS char errorstr[100];
 
   snprintf (errorstr, sizeof (errorstr), "%d", WSAGetLastError ());
   return (const char *)errorstr;
@@ -395,6 +950,38 @@ dlp_time (void)
 #endif
 } /* End of dlp_time() */
 
+/***********************************************************************/ /**
+ * @brief Return a monotonic clock in nanoseconds
+ *
+ * The clock is not related to calendar time and is not affected by
+ * changes of the system time, it is suited for measuring intervals.
+ *
+ * @return Monotonic time in nanoseconds.
+ ***************************************************************************/
+uint64_t
+dlp_monotonic (void)
+{
+#if defined(DLP_WIN)
+
+  LARGE_INTEGER count;
+  LARGE_INTEGER frequency;
+
+  QueryPerformanceFrequency (&frequency);
+  QueryPerformanceCounter (&count);
+
+  return (uint64_t)((double)count.QuadPart * 1e9 / (double)frequency.QuadPart);
+
+#else
+
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+#endif
+} /* End of dlp_monotonic() */
+
 /***********************************************************************/ /**
  * @brief Sleep for a specified number of microseconds
  *
@@ -490,7 +1077,9 @@ dlp_genclientid (char *progname, char *clientid, size_t maxsize)
   char *prog = 0;
   char *user = 0;
   pid_t pid  = getpid ();
-  struct passwd *pw;
+  struct passwd pwentry;
+  struct passwd *pw = NULL;
+  char pwstrings[1024];
   struct utsname myname;
 
   /* Do a simple basename() for any supplied progname */
@@ -503,8 +1092,8 @@ dlp_genclientid (char *progname, char *clientid, size_t maxsize)
     prog = progname;
   }
 
-  /* Look up real user name */
-  if ((pw = getpwuid (getuid ())))
+  /* Look up real user name, reentrant for concurrent connections */
+  if (getpwuid_r (getuid (), &pwentry, pwstrings, sizeof (pwstrings), &pw) == 0 && pw)
   {
     user = pw->pw_name;
   }
@@ -29,14 +29,183 @@ extern "C" {
 
 #include "libdali.h"
 
+/** Thread-local storage class for library state that is not per-connection */
+#if defined(_MSC_VER)
+#define DLP_TLS __declspec(thread)
+#else
+#define DLP_TLS __thread
+#endif
+
+/** Maximum number of addresses resolved and attempted for a connection */
+#define DLP_MAXADDRS 16
+
+/** A resolved network address, as from getaddrinfo() */
+typedef struct DLAddr_s
+{
+  int family;                    /**< Address family, e.g. AF_INET */
+  int socktype;                  /**< Socket type, e.g. SOCK_STREAM */
+  int protocol;                  /**< Socket protocol */
+  int addrlen;                   /**< Length of address in @a addr */
+  struct sockaddr_storage addr;  /**< Socket address */
+} DLAddr;
+
 extern int dlp_sockstartup (void);
 extern int dlp_sockconnect (SOCKET socket, struct sockaddr * inetaddr, int addrlen);
+extern int dlp_sockerror (SOCKET socket);
 extern int dlp_sockclose (SOCKET socket);
 extern int dlp_sockblock (SOCKET socket);
 extern int dlp_socknoblock (SOCKET socket);
 extern int dlp_noblockcheck (void);
-extern int dlp_setsocktimeo (SOCKET socket, int timeout);
-extern int dlp_setioalarm (int timeout);
+extern int dlp_sockwait (SOCKET socket, int writeflag, int timeout);
+extern int dlp_sockwaitconnect (SOCKET *sockets, int *ready, int count, int timeout);
+extern int dlp_setsockbuf (SOCKET socket, int rcvbuf, int sndbuf);
+extern int dlp_getsockbuf (SOCKET socket, int *rcvbuf, int *sndbuf);
+extern void dlp_getsockbuflimits (int *rcvmax, int *sndmax, int *rcvauto, int *sndauto);
+extern int dlp_settcpnodelay (SOCKET socket, int flag);
+extern int dlp_settcpquickack (SOCKET socket, int flag);
+extern int dlp_settcpusertimeout (SOCKET socket, int timeout);
+extern int dlp_settcpkeepalive (SOCKET socket, int idle, int intvl, int cnt);
+extern int dlp_setbusypoll (SOCKET socket, int usecs);
+extern int64_t dlp_gettcprtt (SOCKET socket);
+extern uint64_t dlp_monotonic (void);
+extern int dlp_parsepacket (const char *header, DLPacket *packet);
+extern int dlp_formatwrite (char *header, size_t size, const char *streamid,
+                            dltime_t datastart, dltime_t dataend, int ack, int packetlen);
+extern int dlp_unixaddr (const char *path, DLAddr *addr);
+
+extern int dlp_resolve (DLCP *dlconn, const char *nodename, const char *nodeport,
+                        DLAddr *addrs, int maxaddrs);
+extern void dlp_resolvestale (DLCP *dlconn);
+extern void dlp_resolvefree (DLCP *dlconn);
+
+/** Opaque io_uring I/O state, see iouring.c */
+typedef struct DLUring_s DLUring;
+
+extern int dlp_uring_init (DLCP *dlconn);
+extern void dlp_uring_free (DLCP *dlconn);
+extern int dlp_uring_recv (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag);
+extern int dlp_uring_wait (DLCP *dlconn, int timeout_us);
+extern int dlp_uring_send (DLCP *dlconn, void **buffers, size_t *lengths, int count);
+
+/** Opaque asynchronous log output state, see asynclog.c */
+typedef struct DLLogAsync_s DLLogAsync;
+
+extern int dlp_logasync_push (DLLogAsync *async, const char *prefix, const char *format,
+                              va_list *varlist);
+
+/** Opaque payload relay state, see splice.c */
+typedef struct DLSplice_s DLSplice;
+
+extern int dlp_splice_recv (DLCP *dlconn, int32_t datasize);
+extern int dlp_splice_sendpacket (DLCP *dlconn, DLCP *srcconn, void *headerbuf, size_t headerlen,
+                                  void *respbuf, int resplen);
+extern void dlp_splice_free (DLCP *dlconn);
+
+/** Fast clock for timing intervals: the time stamp counter on x86,
+ *  the monotonic clock in nanoseconds elsewhere */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define DLP_TSC 1
+#define dlp_ticks() __rdtsc ()
+#else
+#define dlp_ticks() dlp_monotonic ()
+#endif
+
+/** Opaque flight recorder state, see trace.c */
+typedef struct DLTrace_s DLTrace;
+
+extern DLTrace *dlp_tracering;
+extern void dlp_trace_record (DLCP *dlconn, int event, int64_t value, uint32_t arg);
+extern uint32_t dlp_trace_stream (const char *streamid);
+
+/** Record a flight recorder event if tracing is active, arguments are
+ *  only evaluated when it is */
+#define dlp_trace(dlconn, event, value, arg)                    \
+  do                                                            \
+  {                                                             \
+    if (dlp_tracering)                                          \
+      dlp_trace_record ((dlconn), (event), (value), (arg));     \
+  } while (0)
+
+/* Statistics counters in DLCP.stats are only updated by the thread
+ * using the connection and may be read from any thread with
+ * dl_getstats().  Updates are made inside a sequence lock write
+ * section, see stats.c, with relaxed atomic loads and stores, a
+ * single writer needs no atomic read-modify-write. */
+#if defined(__GNUC__)
+#define DLP_LOAD_RELAXED(P)     __atomic_load_n ((P), __ATOMIC_RELAXED)
+#define DLP_STORE_RELAXED(P, V) __atomic_store_n ((P), (V), __ATOMIC_RELAXED)
+#define DLP_FENCE_RELEASE()     __atomic_thread_fence (__ATOMIC_RELEASE)
+#define DLP_FENCE_ACQUIRE()     __atomic_thread_fence (__ATOMIC_ACQUIRE)
+#else
+/* Aligned accesses are atomic on the x86 and x64 targets of MSVC,
+ * only compiler reordering needs to be prevented */
+#define DLP_LOAD_RELAXED(P)     (*(P))
+#define DLP_STORE_RELAXED(P, V) (*(P) = (V))
+#define DLP_FENCE_RELEASE()     _ReadWriteBarrier ()
+#define DLP_FENCE_ACQUIRE()     _ReadWriteBarrier ()
+#endif
+
+/** Begin a statistics update of a connection */
+#define dlp_stats_begin(dlconn)                                                   \
+  do                                                                              \
+  {                                                                               \
+    DLP_STORE_RELAXED (&(dlconn)->statseq, (dlconn)->statseq + 1);                \
+    DLP_FENCE_RELEASE ();                                                         \
+  } while (0)
+
+/** Add to a statistics counter, between dlp_stats_begin() and dlp_stats_end() */
+#define dlp_stats_add(dlconn, counter, count)                                     \
+  DLP_STORE_RELAXED (&(dlconn)->stats.counter,                                    \
+                     DLP_LOAD_RELAXED (&(dlconn)->stats.counter) + (uint64_t)(count))
+
+/** End a statistics update of a connection */
+#define dlp_stats_end(dlconn)                                                     \
+  do                                                                              \
+  {                                                                               \
+    DLP_FENCE_RELEASE ();                                                         \
+    DLP_STORE_RELAXED (&(dlconn)->statseq, (dlconn)->statseq + 1);                \
+  } while (0)
+
+/** Add to a single statistics counter of a connection */
+#define dlp_stats(dlconn, counter, count)                                         \
+  do                                                                              \
+  {                                                                               \
+    dlp_stats_begin (dlconn);                                                     \
+    dlp_stats_add (dlconn, counter, count);                                       \
+    dlp_stats_end (dlconn);                                                       \
+  } while (0)
+
+/* USDT probes of provider "libdali" for SystemTap, bpftrace and
+ * DTrace, built with DLP_USDT ('make USDT=1') from sys/sdt.h.  A probe
+ * is a nop instruction until a tracer attaches, its arguments are
+ * values already at hand.  Without DLP_USDT probes compile to nothing. */
+#if defined(DLP_USDT)
+#include <sys/sdt.h>
+#define dlp_probe2(name, a1, a2)                 DTRACE_PROBE2 (libdali, name, a1, a2)
+#define dlp_probe3(name, a1, a2, a3)             DTRACE_PROBE3 (libdali, name, a1, a2, a3)
+#define dlp_probe4(name, a1, a2, a3, a4)         DTRACE_PROBE4 (libdali, name, a1, a2, a3, a4)
+#define dlp_probe5(name, a1, a2, a3, a4, a5)     DTRACE_PROBE5 (libdali, name, a1, a2, a3, a4, a5)
+#else
+#define dlp_probe2(name, a1, a2)             do { } while (0)
+#define dlp_probe3(name, a1, a2, a3)         do { } while (0)
+#define dlp_probe4(name, a1, a2, a3, a4)     do { } while (0)
+#define dlp_probe5(name, a1, a2, a3, a4, a5) do { } while (0)
+#endif
+
+extern int dlp_profiling;
+extern void dlp_prof_record (int stage, uint64_t start);
+
+/** Return the start of a profiler stage, 0 when not profiling */
+#define dlp_prof_begin() ((dlp_profiling) ? dlp_ticks () : 0)
+
+/** End a profiler stage started with dlp_prof_begin() */
+#define dlp_prof_end(stage, start)                                                \
+  do                                                                              \
+  {                                                                               \
+    if (start)                                                                    \
+      dlp_prof_record ((stage), (start));                                         \
+  } while (0)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,314 @@
+/***********************************************************************/ /**
+ * @file profile.c
+ *
+ * Stage profiler of packet collection and writing for libdali.
+ *
+ * Once started with dl_prof_start() the library times each stage of
+ * collecting and writing packets, see @ref profile-stages.  A stage is
+ * timed by reading the tick clock, the time stamp counter on x86,
+ * before and after it and adding the difference to accumulators of
+ * the calling thread.  Each thread claims a slot of a fixed table on
+ * its first stage with a single atomic increment, after that
+ * recording is a few relaxed stores to memory only the thread
+ * writes.  Until started a stage costs a test of dlp_profiling.
+ *
+ * Accumulators are read with relaxed loads and summed over threads
+ * by dl_prof_get(), which converts ticks to nanoseconds with the tick
+ * rate calibrated against the monotonic clock since the start.  Both
+ * dl_prof_get() and dl_prof_print() are async-signal-safe.
+ *
+ * Profiling requires C11 atomics and is not available under WIN.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/** Profiling flag, tested before timing each stage */
+int dlp_profiling = 0;
+
+#if !defined(DLP_WIN)
+#include <stdatomic.h>
+
+/* Number of thread slots, later threads are not profiled */
+#define PROF_THREADS 64
+
+/* Stage accumulators of one thread, only written by that thread */
+typedef struct ProfThread_s
+{
+  uint64_t ticks[DL_PROF_STAGES]; /**< Total ticks in each stage */
+  uint64_t count[DL_PROF_STAGES]; /**< Number of times each stage was timed */
+  uint64_t max[DL_PROF_STAGES];   /**< Most ticks in each stage */
+} ProfThread;
+
+static ProfThread profthreads[PROF_THREADS];
+static atomic_uint profslots;
+static uint64_t startticks;
+static uint64_t startmonotonic;
+
+/* Accumulators of the thread, NULL until its first stage */
+static DLP_TLS ProfThread *tProf = NULL;
+
+/* Set when the thread found no free slot and is not profiled */
+static DLP_TLS int tUnprofiled = 0;
+
+#endif
+
+static const char *stagenames[DL_PROF_STAGES] = {
+    "wait", "recvheader", "parse", "recvdata", "format", "send", "ack", "state"};
+
+/***********************************************************************/ /**
+ * @brief Start the stage profiler
+ *
+ * Start timing the stages of collecting and writing packets in all
+ * threads.  Profiling cannot be stopped or reset once started.
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_prof_start (void)
+{
+#if defined(DLP_WIN)
+  dl_log (2, 0, "%s(): Profiling is not supported on this platform\n", __func__);
+  return -1;
+#else
+  if (dlp_profiling)
+    return 0;
+
+  startticks     = dlp_ticks ();
+  startmonotonic = dlp_monotonic ();
+  atomic_init (&profslots, 0);
+
+  /* Publish the start before any stage is timed */
+  atomic_thread_fence (memory_order_release);
+  dlp_profiling = 1;
+
+  return 0;
+#endif
+} /* End of dl_prof_start() */
+
+/***********************************************************************/ /**
+ * @brief Record the end of a profiler stage
+ *
+ * Add the ticks since @a start to the accumulators of the calling
+ * thread, claiming a slot on the first call.  A thread finding no
+ * free slot is not profiled.  Called through dlp_prof_end().
+ *
+ * @param stage Stage code, see @ref profile-stages
+ * @param start Tick clock at the start of the stage
+ ***************************************************************************/
+void
+dlp_prof_record (int stage, uint64_t start)
+{
+#if !defined(DLP_WIN)
+  uint64_t ticks = dlp_ticks () - start;
+  ProfThread *prof = tProf;
+  unsigned int slot;
+
+  if (stage < 0 || stage >= DL_PROF_STAGES)
+    return;
+
+  /* The clock may step back when a thread moves between cores */
+  if ((int64_t)ticks < 0)
+    ticks = 0;
+
+  if (!prof)
+  {
+    if (tUnprofiled)
+      return;
+
+    slot = atomic_fetch_add_explicit (&profslots, 1, memory_order_relaxed);
+
+    if (slot >= PROF_THREADS)
+    {
+      tUnprofiled = 1;
+      return;
+    }
+
+    prof = tProf = &profthreads[slot];
+  }
+
+  /* Single writer, relaxed loads and stores are enough for readers */
+  DLP_STORE_RELAXED (&prof->ticks[stage], DLP_LOAD_RELAXED (&prof->ticks[stage]) + ticks);
+  DLP_STORE_RELAXED (&prof->count[stage], DLP_LOAD_RELAXED (&prof->count[stage]) + 1);
+
+  if (ticks > DLP_LOAD_RELAXED (&prof->max[stage]))
+    DLP_STORE_RELAXED (&prof->max[stage], ticks);
+#endif
+} /* End of dlp_prof_record() */
+
+/***********************************************************************/ /**
+ * @brief Get the time spent in each profiler stage
+ *
+ * Sum the stage accumulators of all threads and convert them to
+ * nanoseconds.  Stages being recorded concurrently may be missed.
+ * This function is async-signal-safe.
+ *
+ * @param profile Profile to fill
+ *
+ * @return 0 on success and -1 on error or if profiling is not started.
+ ***************************************************************************/
+int
+dl_prof_get (DLProfile *profile)
+{
+#if defined(DLP_WIN)
+  return -1;
+#else
+  DLProfileStage *st;
+  ProfThread *prof;
+  uint64_t ticks;
+  uint64_t monotonic;
+  unsigned int slots;
+  unsigned int slot;
+  double nspertick = 1.0;
+  int stage;
+
+  if (!profile || !dlp_profiling)
+    return -1;
+
+  atomic_thread_fence (memory_order_acquire);
+
+  memset (profile, 0, sizeof (DLProfile));
+
+  ticks     = dlp_ticks ();
+  monotonic = dlp_monotonic ();
+
+  profile->elapsed  = (monotonic > startmonotonic) ? monotonic - startmonotonic : 0;
+  profile->tickrate = 1000000000;
+
+  /* Calibrate the time stamp counter against the monotonic clock */
+#if defined(DLP_TSC)
+  if (profile->elapsed > 0 && ticks > startticks)
+  {
+    nspertick         = (double)profile->elapsed / (double)(ticks - startticks);
+    profile->tickrate = (uint64_t)(1e9 / nspertick);
+  }
+#else
+  (void)ticks;
+#endif
+
+  slots = atomic_load_explicit (&profslots, memory_order_relaxed);
+  if (slots > PROF_THREADS)
+    slots = PROF_THREADS;
+
+  profile->threads = slots;
+
+  for (slot = 0; slot < slots; slot++)
+  {
+    prof = &profthreads[slot];
+
+    for (stage = 0; stage < DL_PROF_STAGES; stage++)
+    {
+      st = &profile->stages[stage];
+
+      st->count += DLP_LOAD_RELAXED (&prof->count[stage]);
+      st->nanoseconds += (uint64_t)(DLP_LOAD_RELAXED (&prof->ticks[stage]) * nspertick);
+
+      ticks = (uint64_t)(DLP_LOAD_RELAXED (&prof->max[stage]) * nspertick);
+      if (ticks > st->maxns)
+        st->maxns = ticks;
+    }
+  }
+
+  return 0;
+#endif
+} /* End of dl_prof_get() */
+
+/***********************************************************************/ /**
+ * @brief Print a table of the time spent in each profiler stage
+ *
+ * Write the count, total, share of the elapsed time, mean and
+ * maximum of each stage that was timed.  Only write() is used so
+ * this function is async-signal-safe.
+ *
+ * @param fd File descriptor to write to
+ *
+ * @return 0 on success and -1 on error or if profiling is not started.
+ ***************************************************************************/
+int
+dl_prof_print (int fd)
+{
+#if defined(DLP_WIN)
+  return -1;
+#else
+  static DLProfile profile;
+  static DLSafeOut out;
+  DLProfileStage *st;
+  uint64_t total = 0;
+  int stage;
+
+  if (fd < 0 || dl_prof_get (&profile))
+    return -1;
+
+  out.fd     = fd;
+  out.error  = 0;
+  out.length = 0;
+
+  dlp_safe_string (&out, "Stage profile over ", 0);
+  dlp_safe_number (&out, profile.elapsed / 1000000, 3, 0);
+  dlp_safe_string (&out, " seconds in ", 0);
+  dlp_safe_number (&out, profile.threads, 0, 0);
+  dlp_safe_string (&out, " thread(s)\n", 0);
+  dlp_safe_string (&out, "stage            count    total ms  % elapsed    mean ns      max ns\n", 0);
+
+  for (stage = 0; stage < DL_PROF_STAGES; stage++)
+  {
+    st = &profile.stages[stage];
+
+    if (!st->count)
+      continue;
+
+    total += st->nanoseconds;
+
+    dlp_safe_string (&out, stagenames[stage], 10);
+    dlp_safe_number (&out, st->count, 0, 11);
+    dlp_safe_number (&out, st->nanoseconds / 1000, 3, 12);
+    dlp_safe_number (&out, (profile.elapsed) ? st->nanoseconds * 1000 / profile.elapsed : 0, 1, 11);
+    dlp_safe_number (&out, st->nanoseconds / st->count, 0, 11);
+    dlp_safe_number (&out, st->maxns, 0, 12);
+    dlp_safe_string (&out, "\n", 0);
+  }
+
+  dlp_safe_string (&out, "(all)", 21);
+  dlp_safe_number (&out, total / 1000, 3, 12);
+  dlp_safe_number (&out, (profile.elapsed) ? total * 1000 / profile.elapsed : 0, 1, 11);
+  dlp_safe_string (&out, "\n", 0);
+
+  dlp_safe_flush (&out);
+
+  return (out.error) ? -1 : 0;
+#endif
+} /* End of dl_prof_print() */
+
+/***********************************************************************/ /**
+ * @brief Return the name of a profiler stage
+ *
+ * @param stage Stage code, see @ref profile-stages
+ *
+ * @return a static string naming the stage, "unknown" for unknown codes.
+ ***************************************************************************/
+const char *
+dl_prof_name (int stage)
+{
+  if (stage < 0 || stage >= DL_PROF_STAGES)
+    return "unknown";
+
+  return stagenames[stage];
+} /* End of dl_prof_name() */
@@ -0,0 +1,393 @@
+/***********************************************************************/ /**
+ * @file resolve.c
+ *
+ * Cached and background host name resolution for DataLink connections.
+ *
+ * Resolved addresses are cached per connection and re-used for
+ * DLCP.resolvettl seconds.  After the TTL expires, or when a
+ * connection to the cached addresses fails, the cached addresses are
+ * still used immediately while a background thread refreshes them so
+ * that re-connections never wait on the resolver.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#if !defined(DLP_WIN)
+#include <pthread.h>
+#endif
+
+/** Resolved address cache for a connection */
+struct DLAddrCache_s
+{
+  char nodename[300];            /**< Host name the addresses were resolved for */
+  char nodeport[100];            /**< Port the addresses were resolved for */
+  DLAddr addrs[DLP_MAXADDRS];    /**< Resolved addresses */
+  int naddrs;                    /**< Count of resolved addresses */
+  dltime_t resolved;             /**< Time of last successful resolution */
+  int8_t stale;                  /**< Flag to refresh before the TTL expires */
+  int lasterror;                 /**< getaddrinfo() error from background refresh */
+#if !defined(DLP_WIN)
+  pthread_mutex_t lock;          /**< Lock protecting all fields */
+  pthread_t thread;              /**< Background refresh thread */
+  int8_t threadactive;           /**< Flag: refresh thread created and not joined */
+  int8_t threaddone;             /**< Flag: refresh thread has finished */
+#endif
+};
+
+static int dlp_getaddrs (const char *nodename, const char *nodeport,
+                         DLAddr *addrs, int maxaddrs, int *gaierror);
+static void dlp_refreshstart (DLCP *dlconn, struct DLAddrCache_s *cache);
+
+#if !defined(DLP_WIN)
+static void *dlp_refreshthread (void *arg);
+#define CACHE_LOCK(C) pthread_mutex_lock (&(C)->lock)
+#define CACHE_UNLOCK(C) pthread_mutex_unlock (&(C)->lock)
+#else
+#define CACHE_LOCK(C)
+#define CACHE_UNLOCK(C)
+#endif
+
+/***********************************************************************/ /**
+ * @brief Resolve a host and port using the connection address cache
+ *
+ * Return the addresses for @a nodename and @a nodeport, using the
+ * addresses cached in the DLCP when available.  Only when nothing is
+ * cached for the host and port, or caching is disabled with
+ * DLCP.resolvettl set to 0, is the resolver called synchronously.
+ *
+ * Cached addresses older than DLCP.resolvettl seconds, or marked stale
+ * with dlp_resolvestale(), are returned immediately while a background
+ * refresh is started.  On platforms without thread support the refresh
+ * is performed synchronously.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param nodename Host name or numeric address to resolve
+ * @param nodeport Port to resolve
+ * @param addrs Array to fill with resolved addresses
+ * @param maxaddrs Maximum number of addresses to return
+ *
+ * @return the number of addresses returned.
+ * @retval -1 on error
+ ***************************************************************************/
+int
+dlp_resolve (DLCP *dlconn, const char *nodename, const char *nodeport,
+             DLAddr *addrs, int maxaddrs)
+{
+  struct DLAddrCache_s *cache;
+  dltime_t now = dlp_time ();
+  int gaierror = 0;
+  int naddrs   = 0;
+
+  if (!dlconn || !nodename || !nodeport || !addrs)
+    return -1;
+
+  if (maxaddrs > DLP_MAXADDRS)
+    maxaddrs = DLP_MAXADDRS;
+
+  /* Allocate cache on first use */
+  if (!dlconn->addrcache && dlconn->resolvettl > 0)
+  {
+    if (!(cache = (struct DLAddrCache_s *)calloc (1, sizeof (struct DLAddrCache_s))))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] cannot allocate address cache\n", dlconn->addr);
+      return -1;
+    }
+
+#if !defined(DLP_WIN)
+    pthread_mutex_init (&cache->lock, NULL);
+#endif
+
+    dlconn->addrcache = cache;
+  }
+
+  if ((cache = dlconn->addrcache) && dlconn->resolvettl > 0)
+  {
+    CACHE_LOCK (cache);
+
+    /* Report any failure of a background refresh */
+    if (cache->lasterror)
+    {
+      dl_log_r (dlconn, 1, 0, "[%s] background resolution of %s failed: %s, using cached addresses\n",
+                dlconn->addr, cache->nodename, gai_strerror (cache->lasterror));
+      cache->lasterror = 0;
+    }
+
+    /* Use cached addresses if resolved for the same host and port */
+    if (cache->naddrs > 0 &&
+        !strcmp (cache->nodename, nodename) &&
+        !strcmp (cache->nodeport, nodeport))
+    {
+      naddrs = (cache->naddrs < maxaddrs) ? cache->naddrs : maxaddrs;
+      memcpy (addrs, cache->addrs, naddrs * sizeof (DLAddr));
+
+      /* Refresh in the background when expired or marked stale */
+      if (cache->stale ||
+          (now - cache->resolved) >= (dltime_t)dlconn->resolvettl * DLTMODULUS)
+      {
+        dlp_refreshstart (dlconn, cache);
+      }
+    }
+
+    CACHE_UNLOCK (cache);
+
+    if (naddrs > 0)
+      return naddrs;
+  }
+
+  /* Nothing usable cached, resolve synchronously */
+  if ((naddrs = dlp_getaddrs (nodename, nodeport, addrs, maxaddrs, &gaierror)) <= 0)
+  {
+    dl_log_r (dlconn, 2, 0, "cannot resolve hostname %s: %s\n", nodename,
+              (gaierror) ? gai_strerror (gaierror) : "no addresses");
+    return -1;
+  }
+
+  if ((cache = dlconn->addrcache) && dlconn->resolvettl > 0)
+  {
+    CACHE_LOCK (cache);
+
+    strncpy (cache->nodename, nodename, sizeof (cache->nodename) - 1);
+    strncpy (cache->nodeport, nodeport, sizeof (cache->nodeport) - 1);
+    memcpy (cache->addrs, addrs, naddrs * sizeof (DLAddr));
+    cache->naddrs   = naddrs;
+    cache->resolved = now;
+    cache->stale    = 0;
+
+    CACHE_UNLOCK (cache);
+  }
+
+  return naddrs;
+} /* End of dlp_resolve() */
+
+/***********************************************************************/ /**
+ * @brief Mark the cached addresses of a connection as stale
+ *
+ * Mark cached addresses for refresh on the next dlp_resolve() call,
+ * typically because no connection could be made to any of them.  The
+ * stale addresses continue to be used until the refresh completes.
+ *
+ * @param dlconn DataLink Connection Parameters
+ ***************************************************************************/
+void
+dlp_resolvestale (DLCP *dlconn)
+{
+  struct DLAddrCache_s *cache;
+
+  if (!dlconn || !(cache = dlconn->addrcache))
+    return;
+
+  CACHE_LOCK (cache);
+  cache->stale = 1;
+  CACHE_UNLOCK (cache);
+} /* End of dlp_resolvestale() */
+
+/***********************************************************************/ /**
+ * @brief Free the address cache of a connection
+ *
+ * Wait for any background refresh to complete and free the address
+ * cache.
+ *
+ * @param dlconn DataLink Connection Parameters
+ ***************************************************************************/
+void
+dlp_resolvefree (DLCP *dlconn)
+{
+  struct DLAddrCache_s *cache;
+
+  if (!dlconn || !(cache = dlconn->addrcache))
+    return;
+
+#if !defined(DLP_WIN)
+  if (cache->threadactive)
+    pthread_join (cache->thread, NULL);
+
+  pthread_mutex_destroy (&cache->lock);
+#endif
+
+  free (cache);
+  dlconn->addrcache = NULL;
+} /* End of dlp_resolvefree() */
+
+/***********************************************************************/ /**
+ * @brief Start a background refresh of cached addresses
+ *
+ * Start a thread to refresh the cached addresses unless one is
+ * already running, joining a previously finished thread first.  Must
+ * be called with the cache locked.
+ *
+ * Without thread support the addresses are refreshed synchronously.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param cache Address cache to refresh
+ ***************************************************************************/
+static void
+dlp_refreshstart (DLCP *dlconn, struct DLAddrCache_s *cache)
+{
+#if !defined(DLP_WIN)
+  /* Reap a finished refresh thread */
+  if (cache->threadactive && cache->threaddone)
+  {
+    pthread_join (cache->thread, NULL);
+    cache->threadactive = 0;
+  }
+
+  if (cache->threadactive)
+    return;
+
+  cache->threaddone = 0;
+
+  if (pthread_create (&cache->thread, NULL, dlp_refreshthread, cache))
+  {
+    dl_log_r (dlconn, 1, 0, "[%s] cannot start background resolution thread\n",
+              dlconn->addr);
+    return;
+  }
+
+  cache->threadactive = 1;
+  dl_log_r (dlconn, 1, 2, "[%s] refreshing addresses for %s in background\n",
+            dlconn->addr, cache->nodename);
+#else
+  DLAddr addrs[DLP_MAXADDRS];
+  int gaierror = 0;
+  int naddrs;
+
+  if ((naddrs = dlp_getaddrs (cache->nodename, cache->nodeport,
+                              addrs, DLP_MAXADDRS, &gaierror)) > 0)
+  {
+    memcpy (cache->addrs, addrs, naddrs * sizeof (DLAddr));
+    cache->naddrs   = naddrs;
+    cache->resolved = dlp_time ();
+    cache->stale    = 0;
+  }
+  else
+  {
+    cache->lasterror = (gaierror) ? gaierror : EAI_NONAME;
+  }
+#endif
+} /* End of dlp_refreshstart() */
+
+#if !defined(DLP_WIN)
+/***********************************************************************/ /**
+ * @brief Background address refresh thread
+ *
+ * Resolve the cached host and port without holding the cache lock and
+ * replace the cached addresses on success.  On failure the previous
+ * addresses are retained and the error is saved to be reported by the
+ * next dlp_resolve() call, this thread does not log.
+ *
+ * @param arg Address cache to refresh
+ ***************************************************************************/
+static void *
+dlp_refreshthread (void *arg)
+{
+  struct DLAddrCache_s *cache = arg;
+  DLAddr addrs[DLP_MAXADDRS];
+  char nodename[300];
+  char nodeport[100];
+  int gaierror = 0;
+  int naddrs;
+
+  CACHE_LOCK (cache);
+  memcpy (nodename, cache->nodename, sizeof (nodename));
+  memcpy (nodeport, cache->nodeport, sizeof (nodeport));
+  CACHE_UNLOCK (cache);
+
+  naddrs = dlp_getaddrs (nodename, nodeport, addrs, DLP_MAXADDRS, &gaierror);
+
+  CACHE_LOCK (cache);
+
+  /* Only update if the cache was not re-targeted during resolution */
+  if (!strcmp (cache->nodename, nodename) && !strcmp (cache->nodeport, nodeport))
+  {
+    if (naddrs > 0)
+    {
+      memcpy (cache->addrs, addrs, naddrs * sizeof (DLAddr));
+      cache->naddrs   = naddrs;
+      cache->resolved = dlp_time ();
+      cache->stale    = 0;
+    }
+    else
+    {
+      cache->lasterror = (gaierror) ? gaierror : EAI_NONAME;
+    }
+  }
+
+  cache->threaddone = 1;
+
+  CACHE_UNLOCK (cache);
+
+  return NULL;
+} /* End of dlp_refreshthread() */
+#endif
+
+/***********************************************************************/ /**
+ * @brief Resolve a host and port into an address array
+ *
+ * Resolve for either IPv4 or IPv6 (PF_UNSPEC) TCP stream addresses
+ * (SOCK_STREAM) using getaddrinfo() and copy the results into @a
+ * addrs.
+ *
+ * @param nodename Host name or numeric address to resolve
+ * @param nodeport Port to resolve
+ * @param addrs Array to fill with resolved addresses
+ * @param maxaddrs Maximum number of addresses to return
+ * @param gaierror Returned getaddrinfo() error code on failure
+ *
+ * @return the number of addresses resolved, 0 on error.
+ ***************************************************************************/
+static int
+dlp_getaddrs (const char *nodename, const char *nodeport,
+              DLAddr *addrs, int maxaddrs, int *gaierror)
+{
+  struct addrinfo *addr0 = NULL;
+  struct addrinfo *addr;
+  struct addrinfo hints;
+  int naddrs = 0;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family   = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if ((*gaierror = getaddrinfo (nodename, nodeport, &hints, &addr0)))
+  {
+    return 0;
+  }
+
+  for (addr = addr0; addr != NULL && naddrs < maxaddrs; addr = addr->ai_next)
+  {
+    if (addr->ai_addrlen > sizeof (addrs[naddrs].addr))
+      continue;
+
+    addrs[naddrs].family   = addr->ai_family;
+    addrs[naddrs].socktype = addr->ai_socktype;
+    addrs[naddrs].protocol = addr->ai_protocol;
+    addrs[naddrs].addrlen  = (int)addr->ai_addrlen;
+    memcpy (&addrs[naddrs].addr, addr->ai_addr, addr->ai_addrlen);
+    naddrs++;
+  }
+
+  freeaddrinfo (addr0);
+
+  return naddrs;
+} /* End of dlp_getaddrs() */
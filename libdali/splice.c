@@ -0,0 +1,536 @@
+/***********************************************************************/ /**
+ * @file splice.c
+ *
+ * Relay of packet payloads between connections without copying them
+ * through user space.
+ *
+ * When dl_collect() is called without a packet data buffer the
+ * payload of a received packet is held for the connection instead of
+ * being returned.  On Linux the payload is moved from the socket into
+ * a pipe with splice(), then dl_write_splice() sends a duplicate of
+ * the pipe contents, made with tee(), to the destination socket with
+ * splice().  The payload is retained until the next packet is
+ * collected, so a failed write can be retried, e.g. after
+ * re-connecting to the destination.
+ *
+ * When pipes are not available (other platforms) or the connection
+ * uses io_uring the payload is held in a buffer instead.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#define DLP_SPLICE 1
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#if defined(DLP_SPLICE)
+#include <fcntl.h>
+#endif
+
+struct DLSplice_s
+{
+  int inpipe[2];                 /**< Pipe holding the payload of the current packet */
+  int outpipe[2];                /**< Pipe carrying a duplicate of the payload to a destination */
+  int nullfd;                    /**< Descriptor for /dev/null to discard payloads */
+  int8_t usepipe;                /**< Flag indicating pipes are available */
+  int8_t inbuffer;               /**< Flag indicating the held payload is in @a buffer */
+  int32_t held;                  /**< Number of payload bytes held */
+  char *buffer;                  /**< Buffer for payload when pipes cannot be used */
+};
+
+static DLSplice *dlp_splice_get (DLCP *dlconn);
+static void dlp_splice_discard (DLSplice *dls, int *pipefd, int32_t count);
+static int dlp_splice_tobuffer (DLCP *dlconn, DLSplice *dls);
+static int dlp_splice_wait (DLCP *dlconn, int writeflag);
+
+/***********************************************************************/ /**
+ * @brief Receive and hold the payload of a packet
+ *
+ * Receive @a datasize bytes of packet payload from the connection and
+ * hold them for dl_write_splice(), replacing any previously held
+ * payload.  On Linux, and when the connection does not use io_uring,
+ * the payload is moved into a pipe with splice() without copying it
+ * into user space, otherwise it is received into a buffer.
+ *
+ * The socket remains in non-blocking mode, readiness is waited for
+ * with dlp_sockwait() limited by the DLCP.iotimeout interval.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param datasize Size of the payload to receive
+ *
+ * @return number of bytes held on success
+ * @retval -1 on connection shutdown
+ * @retval -2 on error
+ ***************************************************************************/
+int
+dlp_splice_recv (DLCP *dlconn, int32_t datasize)
+{
+  DLSplice *dls;
+  int32_t nheld = 0;
+  int rv        = 0;
+
+  if (!(dls = dlp_splice_get (dlconn)))
+    return -2;
+
+  /* Discard previously held payload */
+  if (dls->held > 0 && !dls->inbuffer)
+    dlp_splice_discard (dls, dls->inpipe, dls->held);
+  dls->held = 0;
+
+  if (datasize < 0 || datasize > MAXPACKETSIZE)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] cannot hold packet payload of %d bytes\n",
+              dlconn->addr, datasize);
+    return -2;
+  }
+
+  if (datasize == 0)
+    return 0;
+
+  /* Receive into buffer when pipes are not available */
+  if (!dls->usepipe || dlconn->uring)
+  {
+    if ((rv = dl_recvdata (dlconn, dls->buffer, datasize, 1)) != datasize)
+      return (rv == -1) ? -1 : -2;
+
+    dls->inbuffer = 1;
+    dls->held     = datasize;
+    return datasize;
+  }
+
+#if defined(DLP_SPLICE)
+  /* Move payload from the non-blocking socket into pipe */
+  while (nheld < datasize)
+  {
+    dlp_stats (dlconn, recvcalls, 1);
+
+    if ((rv = (int)splice (dlconn->link, NULL, dls->inpipe[1], NULL, datasize - nheld,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0)
+    {
+      nheld += rv;
+    }
+    else if (rv == 0)
+    {
+      rv = -1;
+      break;
+    }
+    else if (errno == EAGAIN)
+    {
+      if (dlp_splice_wait (dlconn, 0) <= 0)
+      {
+        rv = -2;
+        break;
+      }
+    }
+    else if (errno != EINTR || dlconn->terminate)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] splice() from socket: %s\n",
+                dlconn->addr, strerror (errno));
+      dlp_stats (dlconn, ioerrors, 1);
+      rv = -2;
+      break;
+    }
+  }
+
+  if (nheld < datasize || rv < 0)
+  {
+    dlp_splice_discard (dls, dls->inpipe, nheld);
+    return (rv == -1) ? -1 : -2;
+  }
+
+  dls->inbuffer = 0;
+  dls->held     = datasize;
+
+  dlp_stats (dlconn, bytesrecv, datasize);
+#endif
+
+  return datasize;
+} /* End of dlp_splice_recv() */
+
+/***********************************************************************/ /**
+ * @brief Send a DataLink packet with the payload held by another connection
+ *
+ * Equivalent to dl_sendpacket() with the packet data being the
+ * payload held by @a srcconn from dlp_splice_recv().  When the
+ * payload is in a pipe and the destination does not use io_uring,
+ * the header is sent with MSG_MORE and a duplicate of the payload is
+ * spliced to the destination socket.  The held payload is retained.
+ *
+ * @param dlconn DataLink Connection Parameters of the destination
+ * @param srcconn DataLink Connection Parameters holding the payload
+ * @param headerbuf Buffer containing DataLink packet header
+ * @param headerlen Length of header buffer to send
+ * @param respbuf Buffer to place response from server
+ * @param resplen Length of response buffer
+ *
+ * @return number of bytes of response received
+ * @retval 0 on success and @a respbuf is NULL
+ * @retval -1 on error
+ ***************************************************************************/
+int
+dlp_splice_sendpacket (DLCP *dlconn, DLCP *srcconn, void *headerbuf, size_t headerlen,
+                       void *respbuf, int resplen)
+{
+  DLSplice *dls = srcconn->splice;
+  DLEventField fields[2];
+  char wireheader[258];
+  int32_t nsent = 0;
+  int bytesread = 0;
+  int rv        = 0;
+  uint64_t profstart;
+
+  if (!dls || dls->held <= 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] no packet payload held for sending\n", dlconn->addr);
+    return -1;
+  }
+
+  if (headerlen > 255 || headerlen == 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] packet header size is invalid: %" PRIsize_t "\n",
+              dlconn->addr, headerlen);
+    return -1;
+  }
+
+  /* Sanity check that the header + packet data is not too large */
+  if ((3 + headerlen + dls->held) > MAXPACKETSIZE)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] packet is too large (%" PRIsize_t "), max is %d\n",
+              dlconn->addr, (headerlen + dls->held), MAXPACKETSIZE);
+    return -1;
+  }
+
+  /* Copy payload into buffer if it cannot be spliced to the destination */
+  if (!dls->inbuffer && dlconn->uring)
+  {
+    if (dlp_splice_tobuffer (srcconn, dls))
+      return -1;
+  }
+
+  if (dls->inbuffer)
+  {
+    return dl_sendpacket (dlconn, headerbuf, headerlen, dls->buffer, dls->held,
+                          respbuf, resplen);
+  }
+
+#if defined(DLP_SPLICE)
+  profstart = dlp_prof_begin ();
+
+  wireheader[0] = 'D';
+  wireheader[1] = 'L';
+  wireheader[2] = (uint8_t)headerlen;
+  memcpy (wireheader + 3, headerbuf, headerlen);
+
+  /* Send header, more data to follow */
+  while (nsent < (int32_t)(3 + headerlen))
+  {
+    dlp_stats (dlconn, sendcalls, 1);
+
+    if ((rv = (int)send (dlconn->link, wireheader + nsent, 3 + headerlen - nsent, MSG_MORE)) > 0)
+    {
+      nsent += rv;
+    }
+    else if (rv < 0 && errno == EAGAIN)
+    {
+      if (dlp_splice_wait (dlconn, 1) <= 0)
+        break;
+    }
+    else if (rv == 0 || errno != EINTR || dlconn->terminate)
+    {
+      break;
+    }
+  }
+
+  if (nsent < (int32_t)(3 + headerlen))
+  {
+    fields[0].name    = "operation";
+    fields[0].type    = DL_FIELD_STRING;
+    fields[0].value.s = "send";
+    fields[1].name    = "bytes";
+    fields[1].type    = DL_FIELD_INT;
+    fields[1].value.i = nsent;
+    dl_logevent (dlconn, 2, 0, DL_EVENT_IOERROR, fields, 2,
+                 "[%s] error sending data\n", dlconn->addr);
+    dlp_stats (dlconn, ioerrors, 1);
+    rv = -1;
+  }
+  /* Duplicate held payload, a pipe to pipe tee() does not consume the source */
+  else if ((rv = (int)tee (dls->inpipe[0], dls->outpipe[1], dls->held,
+                           SPLICE_F_NONBLOCK)) != dls->held)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] tee() of payload: %s\n", dlconn->addr,
+              (rv < 0) ? strerror (errno) : "short duplicate");
+    if (rv > 0)
+      dlp_splice_discard (dls, dls->outpipe, rv);
+    rv = -1;
+  }
+  else
+  {
+    rv    = 0;
+    nsent = 0;
+
+    /* Move duplicate payload to the non-blocking socket */
+    while (nsent < dls->held)
+    {
+      dlp_stats (dlconn, sendcalls, 1);
+
+      if ((rv = (int)splice (dls->outpipe[0], NULL, dlconn->link, NULL, dls->held - nsent,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0)
+      {
+        nsent += rv;
+        rv = 0;
+      }
+      else if (rv < 0 && errno == EAGAIN && dlp_splice_wait (dlconn, 1) > 0)
+      {
+        continue;
+      }
+      else if (rv < 0 && errno == EINTR && !dlconn->terminate)
+      {
+        continue;
+      }
+      else
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] splice() to socket: %s\n", dlconn->addr,
+                  (rv < 0) ? strerror (errno) : "no progress");
+        dlp_splice_discard (dls, dls->outpipe, dls->held - nsent);
+        dlp_stats (dlconn, ioerrors, 1);
+        rv = -1;
+        break;
+      }
+    }
+  }
+
+  dlp_prof_end (DL_PROF_SEND, profstart);
+
+  if (rv < 0)
+  {
+    /* Check for a message from the server */
+    if (respbuf && (bytesread = dl_recvheader (dlconn, respbuf, resplen, 0)) > 0)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] %*s", dlconn->addr, bytesread, (char *)respbuf);
+    }
+
+    return -1;
+  }
+
+  dlp_stats (dlconn, bytessent, 3 + headerlen + dls->held);
+
+  /* If requested collect the response (packet header only) */
+  if (respbuf != NULL)
+  {
+    dlconn->sendtime = dlp_time ();
+
+    profstart = dlp_prof_begin ();
+    bytesread = dl_recvheader (dlconn, respbuf, resplen, 1);
+    dlp_prof_end (DL_PROF_ACK, profstart);
+
+    if (bytesread < 0)
+    {
+      if (bytesread < -1)
+        dl_log_r (dlconn, 2, 0, "[%s] error receiving data\n", dlconn->addr);
+
+      return -1;
+    }
+  }
+#endif
+
+  return bytesread;
+} /* End of dlp_splice_sendpacket() */
+
+/***********************************************************************/ /**
+ * @brief Free payload relay resources of a connection
+ *
+ * @param dlconn DataLink Connection Parameters
+ ***************************************************************************/
+void
+dlp_splice_free (DLCP *dlconn)
+{
+  DLSplice *dls;
+
+  if (!dlconn || !(dls = dlconn->splice))
+    return;
+
+#if defined(DLP_SPLICE)
+  if (dls->usepipe)
+  {
+    close (dls->inpipe[0]);
+    close (dls->inpipe[1]);
+    close (dls->outpipe[0]);
+    close (dls->outpipe[1]);
+  }
+
+  if (dls->nullfd >= 0)
+    close (dls->nullfd);
+#endif
+
+  free (dls->buffer);
+  free (dls);
+  dlconn->splice = NULL;
+} /* End of dlp_splice_free() */
+
+/***************************************************************************
+ * Return the payload relay state of a connection, allocating it and
+ * creating pipes on first use.  Returns NULL on error.
+ ***************************************************************************/
+static DLSplice *
+dlp_splice_get (DLCP *dlconn)
+{
+  DLSplice *dls;
+
+  if (dlconn->splice)
+    return dlconn->splice;
+
+  if (!(dls = (DLSplice *)calloc (1, sizeof (DLSplice))) ||
+      !(dls->buffer = (char *)malloc (MAXPACKETSIZE)))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] cannot allocate memory\n", dlconn->addr);
+    free (dls);
+    return NULL;
+  }
+
+  dls->nullfd = -1;
+
+#if defined(DLP_SPLICE)
+  if (pipe2 (dls->inpipe, O_CLOEXEC) == 0)
+  {
+    if (pipe2 (dls->outpipe, O_CLOEXEC) == 0)
+    {
+      /* A whole payload must fit in each pipe for tee() */
+      if (fcntl (dls->inpipe[0], F_GETPIPE_SZ) >= MAXPACKETSIZE &&
+          fcntl (dls->outpipe[0], F_GETPIPE_SZ) >= MAXPACKETSIZE &&
+          (dls->nullfd = open ("/dev/null", O_WRONLY | O_CLOEXEC)) >= 0)
+      {
+        dls->usepipe = 1;
+      }
+      else
+      {
+        close (dls->outpipe[0]);
+        close (dls->outpipe[1]);
+      }
+    }
+
+    if (!dls->usepipe)
+    {
+      close (dls->inpipe[0]);
+      close (dls->inpipe[1]);
+    }
+  }
+
+  if (!dls->usepipe)
+    dl_log_r (dlconn, 1, 1, "[%s] cannot create pipes for splice, payloads will be copied\n",
+              dlconn->addr);
+#endif
+
+  dlconn->splice = dls;
+
+  return dls;
+} /* End of dlp_splice_get() */
+
+/***************************************************************************
+ * Discard @a count bytes from the read end of a pipe by splicing them
+ * to /dev/null.
+ ***************************************************************************/
+static void
+dlp_splice_discard (DLSplice *dls, int *pipefd, int32_t count)
+{
+#if defined(DLP_SPLICE)
+  char discard[4096];
+  ssize_t rv;
+
+  while (count > 0)
+  {
+    if ((rv = splice (pipefd[0], NULL, dls->nullfd, NULL, count, SPLICE_F_MOVE)) <= 0 &&
+        (rv = read (pipefd[0], discard, (count < (int32_t)sizeof (discard)) ? count : sizeof (discard))) <= 0)
+    {
+      if (rv < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+
+    count -= rv;
+  }
+#endif
+} /* End of dlp_splice_discard() */
+
+/***************************************************************************
+ * Move the held payload from the pipe into the buffer, used when the
+ * destination cannot be spliced to.  Returns 0 on success and -1 on
+ * error.
+ ***************************************************************************/
+static int
+dlp_splice_tobuffer (DLCP *dlconn, DLSplice *dls)
+{
+#if defined(DLP_SPLICE)
+  int32_t nread = 0;
+  ssize_t rv;
+
+  while (nread < dls->held)
+  {
+    if ((rv = read (dls->inpipe[0], dls->buffer + nread, dls->held - nread)) <= 0)
+    {
+      if (rv < 0 && errno == EINTR)
+        continue;
+
+      dl_log_r (dlconn, 2, 0, "[%s] cannot read held payload: %s\n",
+                dlconn->addr, (rv < 0) ? strerror (errno) : "pipe empty");
+      dls->held = 0;
+      return -1;
+    }
+
+    nread += rv;
+  }
+
+  dls->inbuffer = 1;
+#endif
+
+  return 0;
+} /* End of dlp_splice_tobuffer() */
+
+/***************************************************************************
+ * Wait for the connection socket to become readable, or writable if
+ * writeflag is set, limited by the I/O timeout of the connection.
+ * Returns 1 when ready, 0 on timeout and -1 on error.
+ ***************************************************************************/
+static int
+dlp_splice_wait (DLCP *dlconn, int writeflag)
+{
+  int rv = 1;
+#if defined(DLP_SPLICE)
+  int timeout = (dlconn->iotimeout > 0) ? dlconn->iotimeout * 1000 : -1;
+
+  while ((rv = dlp_sockwait (dlconn->link, writeflag, timeout)) < 0 &&
+         errno == EINTR && !dlconn->terminate)
+    ;
+
+  if (rv == 0)
+    dl_log_r (dlconn, 2, 0, "[%s] network I/O timed out after %d seconds\n",
+              dlconn->addr, timeout / 1000);
+  else if (rv < 0)
+    dl_log_r (dlconn, 2, 0, "[%s] poll() of socket: %s\n", dlconn->addr, strerror (errno));
+#endif
+
+  return rv;
+} /* End of dlp_splice_wait() */
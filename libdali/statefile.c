@@ -45,10 +45,13 @@ dl_savestate (DLCP *dlconn, const char *statefile)
   char line[200];
   int linelen;
   int statefd;
+  uint64_t profstart;
 
   if (!dlconn || !statefile)
     return -1;
 
+  profstart = dlp_prof_begin ();
+
   /* Open the state file */
   if ((statefd = dlp_openfile (statefile, 'w')) < 0)
   {
@@ -75,6 +78,9 @@ dl_savestate (DLCP *dlconn, const char *statefile)
     return -1;
   }
 
+  dlp_prof_end (DL_PROF_STATE, profstart);
+  dlp_probe4 (state__save, dlconn, dlconn->pktid, dlconn->pkttime, statefile);
+
   return 0;
 } /* End of dl_savestate() */
 
@@ -145,6 +151,8 @@ dl_recoverstate (DLCP *dlconn, const char *statefile)
       dlconn->pktid   = spktid;
       dlconn->pkttime = spkttime;
 
+      dlp_probe4 (state__recover, dlconn, dlconn->pktid, dlconn->pkttime, statefile);
+
       found = 1;
       break;
     }
@@ -0,0 +1,104 @@
+/***********************************************************************/ /**
+ * @file stats.c
+ *
+ * Connection statistics for libdali.
+ *
+ * Each DLCP carries a block of counters, bytes and packets in each
+ * direction, system calls, connections, keepalives, timeouts and
+ * errors, updated by the library on the I/O paths of the connection.
+ *
+ * The counters are protected by a sequence lock: the thread using
+ * the connection, the only writer, makes the sequence count odd,
+ * updates counters with relaxed atomic stores and makes the count
+ * even again, see the dlp_stats macros in portable.h.  Readers in any
+ * thread copy the counters and retry if the count was odd or changed,
+ * so a snapshot is consistent without the writer ever waiting.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Number of snapshot attempts before yielding to a preempted writer */
+#define STATS_SPINS 100
+
+/***********************************************************************/ /**
+ * @brief Get a consistent snapshot of the statistics of a connection
+ *
+ * Copy the statistics counters of @a dlconn into @a stats.  This may
+ * be called from any thread, including while another thread is using
+ * the connection, the snapshot reflects a single point between
+ * counter updates.  The DLStats.time of the snapshot is set to the
+ * current time so that rates can be derived from two snapshots.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param stats Snapshot to fill
+ *
+ * @retval 0 on success
+ * @retval -1 on error
+ ***************************************************************************/
+int
+dl_getstats (const DLCP *dlconn, DLStats *stats)
+{
+  const DLStats *counters;
+  uint32_t start;
+  int attempts = 0;
+
+  if (!dlconn || !stats)
+    return -1;
+
+  counters = &dlconn->stats;
+
+  for (;;)
+  {
+    start = DLP_LOAD_RELAXED (&dlconn->statseq);
+    DLP_FENCE_ACQUIRE ();
+
+    if ((start & 1) == 0)
+    {
+      stats->bytesrecv   = DLP_LOAD_RELAXED (&counters->bytesrecv);
+      stats->bytessent   = DLP_LOAD_RELAXED (&counters->bytessent);
+      stats->packetsrecv = DLP_LOAD_RELAXED (&counters->packetsrecv);
+      stats->packetssent = DLP_LOAD_RELAXED (&counters->packetssent);
+      stats->recvcalls   = DLP_LOAD_RELAXED (&counters->recvcalls);
+      stats->sendcalls   = DLP_LOAD_RELAXED (&counters->sendcalls);
+      stats->connects    = DLP_LOAD_RELAXED (&counters->connects);
+      stats->connfails   = DLP_LOAD_RELAXED (&counters->connfails);
+      stats->keepalives  = DLP_LOAD_RELAXED (&counters->keepalives);
+      stats->timeouts    = DLP_LOAD_RELAXED (&counters->timeouts);
+      stats->ioerrors    = DLP_LOAD_RELAXED (&counters->ioerrors);
+
+      /* Counters must be read before the sequence is checked again */
+      DLP_FENCE_ACQUIRE ();
+
+      if (DLP_LOAD_RELAXED (&dlconn->statseq) == start)
+        break;
+    }
+
+    /* Writer sections are short, only a preempted writer needs a yield */
+    if (++attempts >= STATS_SPINS)
+    {
+      dlp_usleep (1);
+      attempts = 0;
+    }
+  }
+
+  stats->time = dlp_time ();
+
+  return 0;
+} /* End of dl_getstats() */
@@ -0,0 +1,248 @@
+/***************************************************************************
+ * connstresstest.c
+ *
+ * Stress test of independent connections in parallel threads: each
+ * thread drives its own DLCP against its own test peer with
+ * dl_connect(), acknowledged dl_write() and dl_collect().  Some peers
+ * stall after the ID exchange, so the acknowledgement never comes and
+ * the connection's iotimeout must end the write.
+ *
+ * Each stalled thread must time out after its own iotimeout, and the
+ * other threads must keep writing and collecting without timeouts or
+ * errors meanwhile, as timeouts are per connection and not a process
+ * wide timer.  The test is built both normally and with
+ * ThreadSanitizer (-fsanitize=thread, see the Makefile), which reports
+ * data races on state shared between connections.
+ *
+ * This program requires POSIX threads.
+ ***************************************************************************/
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "testpeer.h"
+#include "testutil.h"
+
+#define PACKETSIZE 256
+#define WORKERS    6   /* Threads with responsive peers */
+#define WRITES     200 /* Fewest acknowledged writes of a responsive thread */
+#define COLLECTS   200 /* Packets streamed to a responsive thread */
+
+/* Timeout of the responsive threads, longer than the shortest stall */
+#define WORKER_TIMEOUT 2
+
+/* Allowed lateness of a timeout, microseconds */
+#define TIMEOUT_SLACK 1000000
+
+/* Connection driven by a thread and its results */
+typedef struct Worker_s
+{
+  pthread_t thread;
+  TestPeer *peer;
+  char address[100];
+  int stall;           /* Peer stalls, the first write must time out */
+  int iotimeout;       /* Seconds */
+  int connected;
+  int writes;          /* Acknowledged writes */
+  int writeerrors;     /* Failed writes */
+  int collected;       /* Packets collected */
+  dltime_t maxwrite;   /* Longest acknowledged write */
+  dltime_t timedout;   /* Time to the timeout of a stalled write */
+  DLStats stats;
+} Worker;
+
+static void *drive (void *arg);
+static void stall_done (void);
+static void quiet_print (const char *message);
+
+/* Stalled threads, responsive threads write until all have timed out */
+static Worker stalled[] = {
+    {.stall = 1, .iotimeout = 1},
+    {.stall = 1, .iotimeout = 3}};
+
+#define STALLED (int)(sizeof (stalled) / sizeof (stalled[0]))
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int stallsdone       = 0;
+
+int
+main (void)
+{
+  Worker workers[WORKERS];
+  Worker *worker;
+  int idx;
+
+  /* Expected errors are not shown */
+  dl_loginit (0, NULL, NULL, quiet_print, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  memset (workers, 0, sizeof (workers));
+
+  for (idx = 0; idx < WORKERS + STALLED; idx++)
+  {
+    worker = (idx < WORKERS) ? &workers[idx] : &stalled[idx - WORKERS];
+
+    if (!worker->stall)
+      worker->iotimeout = WORKER_TIMEOUT;
+
+    if (!(worker->peer = peer_start (PACKETSIZE, (worker->stall) ? 0 : COLLECTS, worker->stall,
+                                     worker->address, sizeof (worker->address))) ||
+        pthread_create (&worker->thread, NULL, drive, worker))
+    {
+      fprintf (stderr, "connstresstest: cannot start thread %d\n", idx);
+      return 1;
+    }
+  }
+
+  for (idx = 0; idx < WORKERS + STALLED; idx++)
+  {
+    worker = (idx < WORKERS) ? &workers[idx] : &stalled[idx - WORKERS];
+
+    pthread_join (worker->thread, NULL);
+    CHECK_EQ (peer_stop (worker->peer, NULL, NULL), 0);
+    CHECK (worker->connected);
+    CHECK_EQ (worker->stats.connects, 1);
+  }
+
+  /* Responsive connections were not disturbed by the stalled ones */
+  for (idx = 0; idx < WORKERS; idx++)
+  {
+    worker = &workers[idx];
+
+    CHECK (worker->writes >= WRITES);
+    CHECK_EQ (worker->writeerrors, 0);
+    CHECK_EQ (worker->collected, COLLECTS);
+    CHECK_EQ (worker->stats.packetssent, worker->writes);
+    CHECK_EQ (worker->stats.packetsrecv, worker->collected);
+    CHECK_EQ (worker->stats.timeouts, 0);
+    CHECK_EQ (worker->stats.ioerrors, 0);
+    CHECK (worker->maxwrite < DLTMODULUS);
+  }
+
+  /* Each stalled connection timed out on its own schedule */
+  for (idx = 0; idx < STALLED; idx++)
+  {
+    worker = &stalled[idx];
+
+    CHECK_EQ (worker->writes, 0);
+    CHECK_EQ (worker->writeerrors, 1);
+    CHECK_EQ (worker->stats.timeouts, 1);
+    CHECK (worker->timedout >= (dltime_t)worker->iotimeout * DLTMODULUS);
+    CHECK (worker->timedout < (dltime_t)worker->iotimeout * DLTMODULUS + TIMEOUT_SLACK);
+
+    if (worker->timedout < (dltime_t)worker->iotimeout * DLTMODULUS ||
+        worker->timedout >= (dltime_t)worker->iotimeout * DLTMODULUS + TIMEOUT_SLACK)
+      fprintf (stderr, "connstresstest: %d second timeout after %.3f seconds\n",
+               worker->iotimeout, (double)worker->timedout / DLTMODULUS);
+  }
+
+  if (testfailures)
+    fprintf (stderr, "connstresstest: %d checks failed\n", testfailures);
+
+  return testfailures ? 1 : 0;
+}
+
+/***************************************************************************
+ * Connect and write with acknowledgements.  A stalled thread makes a
+ * single write that must time out.  A responsive thread writes until
+ * all stalled threads have timed out, then collects the packets its
+ * peer streams.  Results are only checked by the main thread.
+ ***************************************************************************/
+static void *
+drive (void *arg)
+{
+  Worker *worker = (Worker *)arg;
+  char data[PACKETSIZE];
+  DLPacket packet;
+  DLCP *dlconn;
+  dltime_t start;
+  dltime_t elapsed;
+  int done = 0;
+
+  memset (data, 0x5a, sizeof (data));
+
+  if (!(dlconn = dl_newdlcp (worker->address, "connstresstest")))
+  {
+    if (worker->stall)
+      stall_done ();
+    return NULL;
+  }
+
+  dlconn->iotimeout = worker->iotimeout;
+
+  if (dl_connect (dlconn) < 0)
+  {
+    if (worker->stall)
+      stall_done ();
+    dl_freedlcp (dlconn);
+    return NULL;
+  }
+
+  worker->connected = 1;
+
+  while (!done)
+  {
+    start = dlp_time ();
+
+    if (dl_write (dlconn, data, PACKETSIZE, "XX_TEST_00_BHZ/MSEED", 0, 1000, 1) > 0)
+    {
+      worker->writes++;
+    }
+    else
+    {
+      worker->writeerrors++;
+      if (worker->stall)
+        worker->timedout = dlp_time () - start;
+      break;
+    }
+
+    if ((elapsed = dlp_time () - start) > worker->maxwrite)
+      worker->maxwrite = elapsed;
+
+    if (worker->writes >= WRITES)
+    {
+      pthread_mutex_lock (&lock);
+      done = (stallsdone == STALLED);
+      pthread_mutex_unlock (&lock);
+    }
+  }
+
+  if (worker->stall)
+    stall_done ();
+  else
+  {
+    while (worker->collected < COLLECTS &&
+           dl_collect (dlconn, &packet, data, sizeof (data), 0) == DLPACKET)
+      worker->collected++;
+  }
+
+  dl_getstats (dlconn, &worker->stats);
+  dl_disconnect (dlconn);
+  dl_freedlcp (dlconn);
+
+  return NULL;
+}
+
+/***************************************************************************
+ * Count a stalled thread as finished.
+ ***************************************************************************/
+static void
+stall_done (void)
+{
+  pthread_mutex_lock (&lock);
+  stallsdone++;
+  pthread_mutex_unlock (&lock);
+}
+
+/***************************************************************************
+ * Discard a log message.
+ ***************************************************************************/
+static void
+quiet_print (const char *message)
+{
+  (void)message;
+}
@@ -0,0 +1,190 @@
+/***************************************************************************
+ * logstresstest.c
+ *
+ * Stress test of logging from many threads at once: producers log
+ * concurrently with dl_log(), dl_log_r() and dl_log_rl() through the
+ * global parameters, per-thread parameters set with dl_logthread() and
+ * a shared DLLog, while background writers of asynchronous output
+ * consume the messages.  The global ring is kept small so producers
+ * also race to drop messages when it is full.
+ *
+ * Every message must be written once and intact or be counted in a
+ * dropped report.  The test is built both normally and with
+ * ThreadSanitizer (-fsanitize=thread, see the Makefile), which reports
+ * data races between the producers and the writer threads.
+ *
+ * This program requires POSIX threads.
+ ***************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "testutil.h"
+
+#define THREADS  8
+#define MESSAGES 5000
+
+static void *produce (void *arg);
+static void check_output (FILE *output, int nlogs, const int *logs, unsigned char *seen);
+
+static DLLog *shared = NULL;
+
+int
+main (void)
+{
+  pthread_t threads[THREADS];
+  unsigned char *seen;
+  FILE *globalout;
+  FILE *sharedout;
+  long idx;
+  int globallogs[THREADS];
+  int sharedlogs[THREADS];
+  int nglobal = 0;
+  int nshared = 0;
+
+  if (!(globalout = tmpfile ()) || !(sharedout = tmpfile ()) ||
+      !(seen = (unsigned char *)calloc (THREADS * MESSAGES, 1)))
+  {
+    fprintf (stderr, "logstresstest: cannot create output files\n");
+    return 1;
+  }
+
+  /* Global parameters with a small ring, a shared DLLog with the default */
+  dl_loginit (3, NULL, "global: ", NULL, "global error: ");
+  shared = dl_loginit_rl (NULL, 3, NULL, "shared: ", NULL, "shared error: ");
+
+  CHECK_EQ (dl_logasync_start (NULL, fileno (globalout), "%H:%M:%S - ", 64), 0);
+  CHECK_EQ (dl_logasync_start (shared, fileno (sharedout), NULL, 0), 0);
+
+  for (idx = 0; idx < THREADS; idx++)
+  {
+    if (pthread_create (&threads[idx], NULL, produce, (void *)idx))
+    {
+      fprintf (stderr, "logstresstest: cannot create thread\n");
+      return 1;
+    }
+
+    /* Odd threads log to the shared DLLog, even threads to the global */
+    if (idx & 1)
+      sharedlogs[nshared++] = (int)idx;
+    else
+      globallogs[nglobal++] = (int)idx;
+  }
+
+  for (idx = 0; idx < THREADS; idx++)
+    pthread_join (threads[idx], NULL);
+
+  dl_logasync_stop (NULL);
+  dl_logasync_stop (shared);
+
+  check_output (globalout, nglobal, globallogs, seen);
+  check_output (sharedout, nshared, sharedlogs, seen);
+
+  fclose (globalout);
+  fclose (sharedout);
+  free (seen);
+  free (shared);
+
+  if (testfailures)
+    fprintf (stderr, "logstresstest: %d checks failed\n", testfailures);
+
+  return testfailures ? 1 : 0;
+}
+
+/***************************************************************************
+ * Log MESSAGES messages at all levels, cycling through the logging
+ * entry points.  Odd threads select the shared DLLog for the thread
+ * with dl_logthread() and pass it to dl_log_rl().
+ ***************************************************************************/
+static void *
+produce (void *arg)
+{
+  int id = (int)(long)arg;
+  DLCP *dlconn;
+  int level;
+  int idx;
+
+  if (!(dlconn = dl_newdlcp ("localhost:16000", "logstresstest")))
+    return NULL;
+
+  /* dl_log() and dl_log_r() without DLCP parameters use the thread's */
+  if (id & 1)
+    dl_logthread (shared);
+
+  for (idx = 0; idx < MESSAGES; idx++)
+  {
+    level = idx % 3;
+
+    switch (idx % 3)
+    {
+    case 0:
+      dl_log (level, 1, "thread %d message %d\n", id, idx);
+      break;
+    case 1:
+      dl_log_r (dlconn, level, 2, "thread %d message %d\n", id, idx);
+      break;
+    default:
+      dl_log_rl ((id & 1) ? shared : NULL, level, 3, "thread %d message %d\n", id, idx);
+      break;
+    }
+  }
+
+  dl_logthread (NULL);
+  dl_freedlcp (dlconn);
+
+  return NULL;
+}
+
+/***************************************************************************
+ * Check that every message of the threads logging to an output was
+ * written once and intact or counted as dropped, marking messages
+ * seen.
+ ***************************************************************************/
+static void
+check_output (FILE *output, int nlogs, const int *logs, unsigned char *seen)
+{
+  char line[MAX_LOG_MSG_LENGTH + 100];
+  unsigned long dropped = 0;
+  unsigned long count;
+  long int written = 0;
+  char *message;
+  int thread;
+  int idx;
+
+  rewind (output);
+
+  while (fgets (line, sizeof (line), output))
+  {
+    if ((message = strstr (line, "log messages dropped")))
+    {
+      if (sscanf (strstr (line, "- ") ? strstr (line, "- ") + 2 : line, "%lu", &count) == 1)
+        dropped += count;
+      else
+        CHECK (!"unparsed dropped report");
+      continue;
+    }
+
+    if (!(message = strstr (line, "thread ")) ||
+        sscanf (message, "thread %d message %d\n", &thread, &idx) != 2 ||
+        thread < 0 || thread >= THREADS || idx < 0 || idx >= MESSAGES ||
+        line[strlen (line) - 1] != '\n')
+    {
+      fprintf (stderr, "malformed line: %s", line);
+      CHECK (!"malformed line");
+      continue;
+    }
+
+    CHECK (seen[thread * MESSAGES + idx] == 0);
+    seen[thread * MESSAGES + idx] = 1;
+    written++;
+  }
+
+  for (idx = 0; idx < nlogs; idx++)
+    CHECK (logs[idx] >= 0 && logs[idx] < THREADS);
+
+  CHECK_EQ (written + (long int)dropped, (long int)nlogs * MESSAGES);
+}
@@ -0,0 +1,135 @@
+/***************************************************************************
+ * protocoltest.c
+ *
+ * Tests of DataLink protocol header parsing and formatting and of the
+ * time conversions used for packet times: dlp_parsepacket(),
+ * dlp_formatwrite() and the dltime_t string conversions.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <portable.h>
+
+#include "testutil.h"
+
+static void test_parsepacket (void);
+static void test_formatwrite (void);
+static void test_timeconv (void);
+static void quiet_print (const char *message);
+
+int
+main (void)
+{
+  /* Expected errors are not shown */
+  dl_loginit (0, NULL, NULL, quiet_print, NULL);
+
+  test_parsepacket ();
+  test_formatwrite ();
+  test_timeconv ();
+
+  if (testfailures)
+    fprintf (stderr, "protocoltest: %d checks failed\n", testfailures);
+
+  return testfailures ? 1 : 0;
+}
+
+/***************************************************************************
+ * PACKET headers, including the longest accepted stream ID.
+ ***************************************************************************/
+static void
+test_parsepacket (void)
+{
+  DLPacket packet;
+  char header[300];
+  char streamid[MAXSTREAMID + 1];
+
+  memset (&packet, 0, sizeof (packet));
+  CHECK_EQ (dlp_parsepacket ("PACKET XX_TEST_00_BHZ/MSEED 42 1709210096789012 "
+                             "1709210000000000 1709210010000000 512", &packet), 0);
+  CHECK (strcmp (packet.streamid, "XX_TEST_00_BHZ/MSEED") == 0);
+  CHECK_EQ (packet.pktid, 42);
+  CHECK_EQ (packet.pkttime, 1709210096789012LL);
+  CHECK_EQ (packet.datastart, 1709210000000000LL);
+  CHECK_EQ (packet.dataend, 1709210010000000LL);
+  CHECK_EQ (packet.datasize, 512);
+
+  /* Missing fields and other commands are rejected */
+  CHECK_EQ (dlp_parsepacket ("PACKET XX_TEST_00_BHZ/MSEED 42 1 2 3", &packet), -1);
+  CHECK_EQ (dlp_parsepacket ("ERROR 0 :: no packet", &packet), -1);
+  CHECK_EQ (dlp_parsepacket ("", &packet), -1);
+  CHECK_EQ (dlp_parsepacket (NULL, &packet), -1);
+
+  /* A stream ID of MAXSTREAMID - 1 characters fits, a longer one is
+   * truncated by the field width and the remaining fields fail */
+  memset (streamid, 'S', MAXSTREAMID - 1);
+  streamid[MAXSTREAMID - 1] = '\0';
+  snprintf (header, sizeof (header), "PACKET %s 1 2 3 4 5", streamid);
+  CHECK_EQ (dlp_parsepacket (header, &packet), 0);
+  CHECK (strcmp (packet.streamid, streamid) == 0);
+
+  streamid[MAXSTREAMID - 1] = 'S';
+  streamid[MAXSTREAMID]     = '\0';
+  snprintf (header, sizeof (header), "PACKET %s 1 2 3 4 5", streamid);
+  CHECK_EQ (dlp_parsepacket (header, &packet), -1);
+}
+
+/***************************************************************************
+ * WRITE headers with and without acknowledgement.
+ ***************************************************************************/
+static void
+test_formatwrite (void)
+{
+  char header[255];
+  int length;
+
+  length = dlp_formatwrite (header, sizeof (header), "XX_TEST_00_BHZ/MSEED",
+                            1709210000000000LL, 1709210010000000LL, 1, 512);
+  CHECK (strcmp (header, "WRITE XX_TEST_00_BHZ/MSEED 1709210000000000 1709210010000000 A 512") == 0);
+  CHECK_EQ (length, strlen (header));
+
+  dlp_formatwrite (header, sizeof (header), "XX_TEST_00_BHZ/MSEED", -1, 0, 0, 0);
+  CHECK (strcmp (header, "WRITE XX_TEST_00_BHZ/MSEED -1 0 N 0") == 0);
+
+  /* Truncated to the buffer, the full length is returned */
+  length = dlp_formatwrite (header, 10, "XX_TEST_00_BHZ/MSEED", 0, 0, 0, 0);
+  CHECK_EQ (strlen (header), 9);
+  CHECK (length > 9);
+}
+
+/***************************************************************************
+ * Conversions between dltime_t and time strings.
+ ***************************************************************************/
+static void
+test_timeconv (void)
+{
+  char timestr[64];
+  dltime_t dltime;
+
+  /* 2024-02-29 is day 60 of a leap year */
+  dltime = dl_time2dltime (2024, 60, 12, 34, 56, 789012);
+  CHECK_EQ (dltime, 1709210096789012LL);
+  CHECK_EQ (dl_time2dltime (1970, 1, 0, 0, 0, 0), 0);
+
+  CHECK (strcmp (dl_dltime2isotimestr (dltime, timestr, 1), "2024-02-29T12:34:56.789012") == 0);
+  CHECK (strcmp (dl_dltime2seedtimestr (dltime, timestr, 1), "2024,060,12:34:56.789012") == 0);
+
+  CHECK_EQ (dl_timestr2dltime ("2024-02-29T12:34:56.789012"), dltime);
+  CHECK_EQ (dl_timestr2dltime ("2024/02/29 12:34:56.789012"), dltime);
+  CHECK_EQ (dl_seedtimestr2dltime ("2024,060,12:34:56.789012"), dltime);
+  CHECK_EQ (dl_timestr2dltime ("2024-02-29"), dl_time2dltime (2024, 60, 0, 0, 0, 0));
+
+  CHECK_EQ (dl_timestr2dltime ("garbage"), DLTERROR);
+  CHECK_EQ (dl_timestr2dltime ("2023-02-29"), DLTERROR);
+  CHECK_EQ (dl_seedtimestr2dltime ("2024,367"), DLTERROR);
+}
+
+/***************************************************************************
+ * Discard a log message.
+ ***************************************************************************/
+static void
+quiet_print (const char *message)
+{
+  (void)message;
+}
@@ -0,0 +1,300 @@
+/***************************************************************************
+ * ringtest.c
+ *
+ * Tests of the packet ring (pktring.c): eviction within the packet and
+ * data budgets, intact payloads, lookups by packet ID and data end
+ * time, clearing and rejection of oversized packets.
+ *
+ * Random sequences of packets are added to rings of random sizes and
+ * every lookup is compared to a simple model of the packets the ring
+ * should hold.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+#include "testutil.h"
+
+#define TRIALS  100
+#define PACKETS 2000
+
+/* Model of a packet added to the ring */
+typedef struct ModelPacket_s
+{
+  int64_t seq;
+  int64_t pktid;
+  dltime_t dataend;
+  int32_t datasize;
+  unsigned char fill;
+} ModelPacket;
+
+static void test_basic (void);
+static void test_random (unsigned int seed);
+static void check_model (const DLRing *ring, const ModelPacket *model,
+                         int first, int count, size_t databytes);
+static void quiet_print (const char *message);
+
+int
+main (void)
+{
+  unsigned int seed;
+
+  /* Expected errors are not shown */
+  dl_loginit (0, NULL, NULL, quiet_print, NULL);
+
+  test_basic ();
+
+  for (seed = 1; seed <= TRIALS && !testfailures; seed++)
+    test_random (seed);
+
+  if (testfailures)
+    fprintf (stderr, "ringtest: %d checks failed\n", testfailures);
+
+  return testfailures ? 1 : 0;
+}
+
+/***************************************************************************
+ * Deterministic checks of sizes, eviction and rejection.
+ ***************************************************************************/
+static void
+test_basic (void)
+{
+  const DLRingPacket *rpacket;
+  const void *data;
+  DLPacket packet;
+  DLRing *ring;
+  char payload[300];
+  int idx;
+
+  CHECK (dl_ring_new (0, 100) == NULL);
+  CHECK (dl_ring_new (4, 0) == NULL);
+
+  if (!(ring = dl_ring_new (4, 250)))
+  {
+    CHECK (ring != NULL);
+    return;
+  }
+
+  /* Number of packets is rounded up to a power of 2 */
+  CHECK_EQ (ring->mask, 3);
+  CHECK_EQ (dl_ring_find (ring, 1), -1);
+  CHECK_EQ (dl_ring_after (ring, 0), -1);
+
+  memset (&packet, 0, sizeof (packet));
+  strcpy (packet.streamid, "XX_TEST_00_BHZ/MSEED");
+  packet.datasize = 100;
+
+  /* Sequence numbers start at 1, three 100 byte payloads do not fit in
+   * 250 bytes and the first is evicted */
+  for (idx = 0; idx < 3; idx++)
+  {
+    memset (payload, 'a' + idx, packet.datasize);
+    packet.pktid   = 10 + idx;
+    packet.dataend = 1000 * (idx + 1);
+    CHECK_EQ (dl_ring_add (ring, &packet, payload), idx + 1);
+  }
+
+  CHECK_EQ (ring->first, 2);
+  CHECK_EQ (ring->next, 4);
+  CHECK_EQ (ring->evicted, 1);
+  CHECK_EQ (ring->evictedbytes, 100);
+  CHECK (dl_ring_get (ring, 1, &data) == NULL);
+  CHECK_EQ (dl_ring_find (ring, 10), -1);
+  CHECK_EQ (dl_ring_find (ring, 12), 3);
+  CHECK_EQ (dl_ring_after (ring, 1500), 2);
+  CHECK_EQ (dl_ring_after (ring, 2000), 3);
+  CHECK_EQ (dl_ring_after (ring, 3000), -1);
+
+  if ((rpacket = dl_ring_get (ring, 3, &data)))
+  {
+    CHECK_EQ (rpacket->pktid, 12);
+    CHECK_EQ (rpacket->datasize, 100);
+    CHECK (strcmp (rpacket->streamid, packet.streamid) == 0);
+    CHECK (((const char *)data)[0] == 'c' && ((const char *)data)[99] == 'c');
+  }
+  else
+  {
+    CHECK (rpacket != NULL);
+  }
+
+  /* A payload larger than the data area is rejected and changes nothing */
+  packet.datasize = 251;
+  CHECK_EQ (dl_ring_add (ring, &packet, payload), -1);
+  CHECK_EQ (ring->rejected, 1);
+  CHECK_EQ (ring->next, 4);
+
+  /* Empty payloads only use packet slots */
+  packet.datasize = 0;
+  for (idx = 0; idx < 4; idx++)
+  {
+    packet.pktid = 20 + idx;
+    CHECK_EQ (dl_ring_add (ring, &packet, NULL), 4 + idx);
+  }
+  CHECK_EQ (ring->first, 4);
+
+  dl_ring_clear (ring);
+  CHECK_EQ (ring->first, ring->next);
+  CHECK_EQ (dl_ring_find (ring, 23), -1);
+  CHECK_EQ (dl_ring_add (ring, &packet, NULL), 8);
+
+  dl_ring_free (ring);
+}
+
+/***************************************************************************
+ * Add random packets to a ring of random size and compare the ring to
+ * a model after every addition.  Packet IDs mostly increase but may
+ * repeat or go back, data end times are random.
+ ***************************************************************************/
+static void
+test_random (unsigned int seed)
+{
+  ModelPacket *model;
+  DLPacket packet;
+  DLRing *ring;
+  char payload[5000];
+  int64_t packets;
+  int64_t seq;
+  size_t databytes;
+  int first = 0;
+  int count = 0;
+  int idx;
+
+  srand (seed);
+  packets   = 1 + rand () % 64;
+  databytes = 1 + rand () % 4000;
+
+  if (!(ring = dl_ring_new (packets, databytes)) ||
+      !(model = (ModelPacket *)calloc (PACKETS, sizeof (ModelPacket))))
+  {
+    CHECK (!"allocation failed");
+    dl_ring_free (ring);
+    return;
+  }
+
+  memset (&packet, 0, sizeof (packet));
+
+  for (idx = 0; idx < PACKETS && !testfailures; idx++)
+  {
+    snprintf (packet.streamid, sizeof (packet.streamid), "XX_S%d_00_BHZ/MSEED", idx % 7);
+    packet.pktid += (rand () % 5 == 0) ? -(rand () % 3) : 1 + rand () % 3;
+    packet.dataend = rand () % 100000;
+    packet.datasize = rand () % ((rand () % 4) ? 200 : (int)databytes + 10);
+    memset (payload, idx & 0xff, packet.datasize);
+
+    if (rand () % 500 == 0)
+    {
+      dl_ring_clear (ring);
+      first = count;
+    }
+
+    seq = dl_ring_add (ring, &packet, payload);
+
+    if ((size_t)packet.datasize > databytes)
+    {
+      CHECK_EQ (seq, -1);
+      continue;
+    }
+
+    CHECK (seq >= 0);
+    model[count].seq      = seq;
+    model[count].pktid    = packet.pktid;
+    model[count].dataend  = packet.dataend;
+    model[count].datasize = packet.datasize;
+    model[count].fill     = (unsigned char)(idx & 0xff);
+    count++;
+
+    /* Drop evicted packets from the model */
+    while (first < count && model[first].seq < ring->first)
+      first++;
+
+    check_model (ring, model, first, count, databytes);
+  }
+
+  dl_ring_free (ring);
+  free (model);
+}
+
+/***************************************************************************
+ * Check that the ring holds exactly the model packets from first to
+ * count - 1 with intact payloads and that lookups match the model.
+ ***************************************************************************/
+static void
+check_model (const DLRing *ring, const ModelPacket *model,
+             int first, int count, size_t databytes)
+{
+  const DLRingPacket *rpacket;
+  const unsigned char *data;
+  const void *view;
+  size_t total = 0;
+  int64_t want;
+  dltime_t time;
+  int idx;
+  int jdx;
+  int32_t byte;
+
+  CHECK_EQ (ring->next - ring->first, count - first);
+
+  for (idx = first; idx < count; idx++)
+  {
+    if (!(rpacket = dl_ring_get (ring, model[idx].seq, &view)))
+    {
+      CHECK (rpacket != NULL);
+      return;
+    }
+
+    CHECK_EQ (rpacket->pktid, model[idx].pktid);
+    CHECK_EQ (rpacket->datasize, model[idx].datasize);
+
+    data = (const unsigned char *)view;
+    for (byte = 0; byte < model[idx].datasize; byte++)
+    {
+      if (data[byte] != model[idx].fill)
+      {
+        CHECK (data[byte] == model[idx].fill);
+        break;
+      }
+    }
+
+    total += model[idx].datasize;
+
+    /* The newest packet with a packet ID is found */
+    want = -1;
+    for (jdx = count - 1; jdx >= first; jdx--)
+    {
+      if (model[jdx].pktid == model[idx].pktid)
+      {
+        want = model[jdx].seq;
+        break;
+      }
+    }
+    CHECK_EQ (dl_ring_find (ring, model[idx].pktid), want);
+  }
+
+  CHECK (total <= databytes);
+  CHECK_EQ (dl_ring_find (ring, -99999999), -1);
+
+  /* The earliest packet with a later data end time is found */
+  time = rand () % 100000;
+  want = -1;
+  for (idx = first; idx < count; idx++)
+  {
+    if (model[idx].dataend > time)
+    {
+      want = model[idx].seq;
+      break;
+    }
+  }
+  CHECK_EQ (dl_ring_after (ring, time), want);
+}
+
+/***************************************************************************
+ * Discard a log message.
+ ***************************************************************************/
+static void
+quiet_print (const char *message)
+{
+  (void)message;
+}
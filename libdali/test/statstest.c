@@ -0,0 +1,130 @@
+/***************************************************************************
+ * statstest.c
+ *
+ * Tests of the connection statistics from dl_getstats(): packets and
+ * bytes counted by dl_write(), dl_read(), dl_collect() and
+ * dl_collect_nb() against a test peer, which counts the bytes on its
+ * side of the connection.
+ ***************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libdali.h>
+#include <portable.h>
+
+#include "testpeer.h"
+#include "testutil.h"
+
+#define PACKETSIZE 512
+#define WRITES     100 /* Packets written, every other one acknowledged */
+#define READS      10  /* Packets requested with dl_read() */
+#define COLLECTS   100 /* Packets streamed, half with dl_collect_nb() */
+
+static void quiet_print (const char *message);
+
+int
+main (void)
+{
+  TestPeer *peer;
+  DLCP *dlconn;
+  DLPacket packet;
+  DLStats stats;
+  char address[100];
+  char data[PACKETSIZE];
+  uint64_t peerin  = 0;
+  uint64_t peerout = 0;
+  int collected;
+  int rv;
+  int idx;
+
+  /* Expected errors are not shown */
+  dl_loginit (0, NULL, NULL, quiet_print, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  memset (data, 0x5a, sizeof (data));
+
+  if (!(peer = peer_start (PACKETSIZE, COLLECTS, 0, address, sizeof (address))))
+    return 1;
+
+  dlconn            = dl_newdlcp (address, "statstest");
+  dlconn->iotimeout = 10;
+
+  CHECK (dl_connect (dlconn) >= 0);
+
+  for (idx = 0; idx < WRITES; idx++)
+    CHECK (dl_write (dlconn, data, PACKETSIZE, "XX_TEST_00_BHZ/MSEED",
+                     0, 1000, idx % 2) >= 0);
+
+  CHECK (dl_getstats (dlconn, &stats) == 0);
+  CHECK_EQ (stats.packetssent, WRITES);
+  CHECK_EQ (stats.packetsrecv, 0);
+  CHECK (stats.bytessent >= (uint64_t)WRITES * PACKETSIZE);
+
+  for (idx = 0; idx < READS; idx++)
+  {
+    CHECK_EQ (dl_read (dlconn, idx + 1, &packet, data, sizeof (data)), PACKETSIZE);
+    CHECK_EQ (packet.pktid, idx + 1);
+  }
+
+  CHECK (dl_getstats (dlconn, &stats) == 0);
+  CHECK_EQ (stats.packetsrecv, READS);
+
+  /* Streamed packets, half blocking and half polled */
+  for (collected = 0; collected < COLLECTS / 2; collected++)
+  {
+    rv = dl_collect (dlconn, &packet, data, sizeof (data), 0);
+    CHECK_EQ (rv, DLPACKET);
+    if (rv != DLPACKET)
+      break;
+    CHECK_EQ (packet.datasize, PACKETSIZE);
+  }
+
+  while (collected < COLLECTS)
+  {
+    if ((rv = dl_collect_nb (dlconn, &packet, data, sizeof (data), 0)) == DLNOPACKET)
+    {
+      dlp_usleep (1000);
+      continue;
+    }
+
+    CHECK_EQ (rv, DLPACKET);
+    if (rv != DLPACKET)
+      break;
+    CHECK_EQ (packet.datasize, PACKETSIZE);
+    collected++;
+  }
+
+  CHECK (dl_getstats (dlconn, &stats) == 0);
+  CHECK_EQ (stats.packetssent, WRITES);
+  CHECK_EQ (stats.packetsrecv, READS + COLLECTS);
+  CHECK_EQ (stats.connects, 1);
+  CHECK_EQ (stats.connfails, 0);
+  CHECK_EQ (stats.timeouts, 0);
+  CHECK_EQ (stats.ioerrors, 0);
+  CHECK (stats.bytesrecv >= (uint64_t)(READS + COLLECTS) * PACKETSIZE);
+
+  dl_disconnect (dlconn);
+
+  /* Every byte is counted once, on both sides */
+  CHECK_EQ (peer_stop (peer, &peerin, &peerout), 0);
+  CHECK_EQ (stats.bytessent, peerin);
+  CHECK_EQ (stats.bytesrecv, peerout);
+
+  dl_freedlcp (dlconn);
+
+  if (testfailures)
+    fprintf (stderr, "statstest: %d checks failed\n", testfailures);
+
+  return testfailures ? 1 : 0;
+}
+
+/***************************************************************************
+ * Discard a log message.
+ ***************************************************************************/
+static void
+quiet_print (const char *message)
+{
+  (void)message;
+}
@@ -0,0 +1,349 @@
+/***************************************************************************
+ * testpeer.c
+ *
+ * Minimal DataLink server thread used by the libdali test programs.
+ *
+ * A peer listens on an ephemeral loopback port, accepts a single
+ * connection and serves the ID exchange, WRITE commands (acknowledged
+ * when requested), READ and STREAM, which is answered with a fixed
+ * number of packets.  Other commands are acknowledged with OK.  A stalled
+ * peer answers the ID exchange and then reads commands without ever
+ * replying, for testing timeouts.  The bytes read and written are
+ * counted for comparison with the client's statistics.
+ *
+ * The peer serves until the client disconnects, or gives up after
+ * PEER_TIMEOUT seconds without a connection or a command so a broken
+ * test does not hang.
+ *
+ * This code requires a POSIX system.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "testpeer.h"
+
+#define PEER_TIMEOUT 10
+
+struct TestPeer_s
+{
+  pthread_t thread;
+  int listener;
+  int packetsize;
+  int streampackets;
+  int stall;
+  uint64_t bytesin;  /* Bytes read from the client */
+  uint64_t bytesout; /* Bytes written to the client */
+};
+
+static void *peer_thread (void *arg);
+static void serve_connection (TestPeer *peer, int sock);
+static int peer_read (TestPeer *peer, int sock, void *buffer, size_t size);
+static int peer_reply (TestPeer *peer, int sock, const char *header,
+                       const void *data, size_t datasize);
+
+/***************************************************************************
+ * peer_start:
+ *
+ * Listen on an ephemeral loopback port, write the libdali address to
+ * connect to into address and start a thread serving one connection.
+ *
+ * Returns the peer on success and NULL on error.
+ ***************************************************************************/
+TestPeer *
+peer_start (int packetsize, int streampackets, int stall,
+            char *address, size_t addresssize)
+{
+  struct sockaddr_in sin;
+  socklen_t addrlen = sizeof (sin);
+  struct timeval timeout;
+  TestPeer *peer;
+
+  if (!(peer = (TestPeer *)calloc (1, sizeof (TestPeer))))
+    return NULL;
+
+  peer->packetsize    = packetsize;
+  peer->streampackets = streampackets;
+  peer->stall         = stall;
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family      = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  timeout.tv_sec  = PEER_TIMEOUT;
+  timeout.tv_usec = 0;
+
+  if ((peer->listener = socket (AF_INET, SOCK_STREAM, 0)) < 0 ||
+      setsockopt (peer->listener, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout)) ||
+      bind (peer->listener, (struct sockaddr *)&sin, sizeof (sin)) ||
+      getsockname (peer->listener, (struct sockaddr *)&sin, &addrlen) ||
+      listen (peer->listener, 1))
+  {
+    fprintf (stderr, "Cannot listen on loopback: %s\n", strerror (errno));
+    if (peer->listener >= 0)
+      close (peer->listener);
+    free (peer);
+    return NULL;
+  }
+
+  snprintf (address, addresssize, "127.0.0.1:%d", ntohs (sin.sin_port));
+
+  if (pthread_create (&peer->thread, NULL, peer_thread, peer))
+  {
+    fprintf (stderr, "Cannot start peer thread\n");
+    close (peer->listener);
+    free (peer);
+    return NULL;
+  }
+
+  return peer;
+} /* End of peer_start() */
+
+/***************************************************************************
+ * peer_stop:
+ *
+ * Wait for the peer to finish serving, after the client has
+ * disconnected, and return the bytes it read and wrote.
+ *
+ * Returns 0 on success and -1 if the peer did not serve a connection.
+ ***************************************************************************/
+int
+peer_stop (TestPeer *peer, uint64_t *bytesin, uint64_t *bytesout)
+{
+  void *served = NULL;
+
+  if (!peer)
+    return -1;
+
+  pthread_join (peer->thread, &served);
+  close (peer->listener);
+
+  if (bytesin)
+    *bytesin = peer->bytesin;
+  if (bytesout)
+    *bytesout = peer->bytesout;
+
+  free (peer);
+
+  return (served) ? 0 : -1;
+} /* End of peer_stop() */
+
+/***************************************************************************
+ * peer_thread:
+ *
+ * Accept and serve a single connection, returning non-NULL if one
+ * was served.
+ ***************************************************************************/
+static void *
+peer_thread (void *arg)
+{
+  TestPeer *peer = (TestPeer *)arg;
+  struct timeval timeout;
+  int sock;
+
+  if ((sock = accept (peer->listener, NULL, NULL)) < 0)
+    return NULL;
+
+  timeout.tv_sec  = PEER_TIMEOUT;
+  timeout.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+
+  serve_connection (peer, sock);
+
+  close (sock);
+
+  return peer;
+} /* End of peer_thread() */
+
+/***************************************************************************
+ * serve_connection:
+ *
+ * Serve DataLink commands until the client disconnects.
+ ***************************************************************************/
+static void
+serve_connection (TestPeer *peer, int sock)
+{
+  char header[256];
+  char reply[256];
+  char flag[10];
+  char *data;
+  long long int pktid = 0;
+  long long int readid;
+  long long int time  = 1700000000000000LL;
+  int headerlen;
+  int size;
+  int idx;
+
+  if (!(data = (char *)calloc (1, peer->packetsize)))
+    return;
+
+  for (idx = 0; idx < peer->packetsize; idx++)
+    data[idx] = (char)(idx * 31 + 7);
+
+  for (;;)
+  {
+    if (peer_read (peer, sock, header, 3) || header[0] != 'D' || header[1] != 'L')
+      break;
+
+    headerlen = (unsigned char)header[2];
+    if (peer_read (peer, sock, header, headerlen))
+      break;
+    header[headerlen] = '\0';
+
+    /* Commands with a data payload */
+    size = 0;
+    if (!strncmp (header, "WRITE", 5))
+    {
+      if (sscanf (header, "WRITE %*s %*s %*s %9s %d", flag, &size) != 2)
+        break;
+    }
+    else if (!strncmp (header, "MATCH", 5) || !strncmp (header, "REJECT", 6))
+    {
+      if (sscanf (header, "%*s %d", &size) != 1)
+        break;
+    }
+
+    if (size < 0 || size > peer->packetsize || peer_read (peer, sock, data, size))
+      break;
+
+    if (!strncmp (header, "ID", 2))
+    {
+      snprintf (reply, sizeof (reply),
+                "ID DataLink testpeer :: DLPROTO:1.0 PACKETSIZE:%d WRITE",
+                peer->packetsize);
+      if (peer_reply (peer, sock, reply, NULL, 0))
+        break;
+    }
+    else if (peer->stall)
+    {
+      continue;
+    }
+    else if (!strncmp (header, "WRITE", 5))
+    {
+      pktid++;
+
+      if (flag[0] == 'A')
+      {
+        snprintf (reply, sizeof (reply), "OK %lld 0", pktid);
+        if (peer_reply (peer, sock, reply, NULL, 0))
+          break;
+      }
+    }
+    else if (!strncmp (header, "READ", 4))
+    {
+      if (sscanf (header, "READ %lld", &readid) != 1)
+        break;
+
+      snprintf (reply, sizeof (reply), "PACKET XX_TEST_00_BHZ/MSEED %lld %lld %lld %lld %d",
+                readid, time, time, time + 1000, peer->packetsize);
+      if (peer_reply (peer, sock, reply, data, peer->packetsize))
+        break;
+    }
+    else if (!strncmp (header, "STREAM", 6))
+    {
+      for (idx = 0; idx < peer->streampackets; idx++)
+      {
+        pktid++;
+        snprintf (reply, sizeof (reply), "PACKET XX_TEST_00_BHZ/MSEED %lld %lld %lld %lld %d",
+                  pktid, time, time, time + 1000, peer->packetsize);
+        if (peer_reply (peer, sock, reply, data, peer->packetsize))
+          break;
+      }
+    }
+    else if (!strncmp (header, "ENDSTREAM", 9))
+    {
+      if (peer_reply (peer, sock, "ENDSTREAM", NULL, 0))
+        break;
+    }
+    else if (peer_reply (peer, sock, "OK 0 0", NULL, 0))
+    {
+      break;
+    }
+  }
+
+  free (data);
+} /* End of serve_connection() */
+
+/***************************************************************************
+ * peer_read:
+ *
+ * Read exactly size bytes.
+ *
+ * Returns 0 on success and -1 on error, timeout or disconnect.
+ ***************************************************************************/
+static int
+peer_read (TestPeer *peer, int sock, void *buffer, size_t size)
+{
+  char *bptr = (char *)buffer;
+  ssize_t rv;
+
+  while (size > 0)
+  {
+    if ((rv = recv (sock, bptr, size, 0)) <= 0)
+    {
+      if (rv < 0 && errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    peer->bytesin += rv;
+    bptr += rv;
+    size -= rv;
+  }
+
+  return 0;
+} /* End of peer_read() */
+
+/***************************************************************************
+ * peer_reply:
+ *
+ * Send a DataLink packet with header and optional data.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+peer_reply (TestPeer *peer, int sock, const char *header,
+            const void *data, size_t datasize)
+{
+  char buffer[3 + 255];
+  size_t headerlen = strlen (header);
+  const char *bptr;
+  size_t size;
+  ssize_t rv;
+  int part;
+
+  buffer[0] = 'D';
+  buffer[1] = 'L';
+  buffer[2] = (char)headerlen;
+  memcpy (buffer + 3, header, headerlen);
+
+  for (part = 0; part < 2; part++)
+  {
+    bptr = (part) ? (const char *)data : buffer;
+    size = (part) ? ((data) ? datasize : 0) : 3 + headerlen;
+
+    while (size > 0)
+    {
+      if ((rv = send (sock, bptr, size, 0)) < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+
+      peer->bytesout += rv;
+      bptr += rv;
+      size -= rv;
+    }
+  }
+
+  return 0;
+} /* End of peer_reply() */
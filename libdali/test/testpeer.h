@@ -0,0 +1,19 @@
+/***************************************************************************
+ * testpeer.h
+ *
+ * Minimal DataLink server thread used by the libdali test programs.
+ ***************************************************************************/
+
+#ifndef TESTPEER_H
+#define TESTPEER_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct TestPeer_s TestPeer;
+
+extern TestPeer *peer_start (int packetsize, int streampackets, int stall,
+                             char *address, size_t addresssize);
+extern int       peer_stop (TestPeer *peer, uint64_t *bytesin, uint64_t *bytesout);
+
+#endif /* TESTPEER_H */
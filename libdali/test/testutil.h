@@ -0,0 +1,42 @@
+/***************************************************************************
+ * testutil.h
+ *
+ * Minimal checking macros shared by the libdali test programs.  A
+ * failed check is reported with its location and counted, each
+ * program returns the number of failures from main().
+ ***************************************************************************/
+
+#ifndef TESTUTIL_H
+#define TESTUTIL_H 1
+
+#include <stdio.h>
+
+static int testfailures = 0;
+
+/* Check that a condition is true, report it if not */
+#define CHECK(COND)                                                  \
+  do                                                                 \
+  {                                                                  \
+    if (!(COND))                                                     \
+    {                                                                \
+      fprintf (stderr, "%s:%d: check failed: %s\n",                  \
+               __FILE__, __LINE__, #COND);                           \
+      testfailures++;                                                \
+    }                                                                \
+  } while (0)
+
+/* Check that two integer values are equal, report both if not */
+#define CHECK_EQ(A, B)                                               \
+  do                                                                 \
+  {                                                                  \
+    long long int a_ = (long long int)(A);                           \
+    long long int b_ = (long long int)(B);                           \
+    if (a_ != b_)                                                    \
+    {                                                                \
+      fprintf (stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", \
+               __FILE__, __LINE__, #A, #B, a_, b_);                  \
+      testfailures++;                                                \
+    }                                                                \
+  } while (0)
+
+#endif /* TESTUTIL_H */
@@ -0,0 +1,461 @@
+/***********************************************************************/ /**
+ * @file trace.c
+ *
+ * Flight recorder of recent connection events for libdali.
+ *
+ * Once started with dl_trace_start() connection events are recorded
+ * as compact binary records in a fixed-size ring shared by all
+ * connections and threads.  Recording an event reserves a ring
+ * position with a single relaxed atomic increment and stores the
+ * record, the oldest records are overwritten.  Connections are
+ * numbered on their first event and stream IDs are indexed in a
+ * lock-free table so records carry small integers instead of strings.
+ *
+ * Records are time stamped with the time stamp counter on x86, which
+ * is calibrated against the monotonic clock when dumping, and with
+ * the monotonic clock elsewhere.
+ *
+ * The ring and the name tables can be dumped to a file descriptor
+ * with only write() calls, so dumping is async-signal-safe and can be
+ * done from a signal or crash handler.  Records being written while
+ * dumping may be incomplete.
+ *
+ * Tracing requires C11 atomics and is not available under WIN.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/** Active flight recorder, NULL when tracing is not started */
+DLTrace *dlp_tracering = NULL;
+
+#if !defined(DLP_WIN)
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Default number of ring records */
+#define TRACE_RECORDS 65536
+
+/* Number of connection addresses, later connections are not numbered */
+#define TRACE_CONNS 1024
+
+/* Length of each connection address, as DLCP.addr */
+#define TRACE_CONNLEN 100
+
+/* Number of stream table entries, a power of 2 */
+#define TRACE_STREAMS 4096
+
+/* Connection number of connections beyond TRACE_CONNS */
+#define TRACE_NOCONN 0xFFFF
+
+/* Stream table entry states */
+#define STREAM_EMPTY   0
+#define STREAM_WRITING 1
+#define STREAM_READY   2
+
+struct DLTrace_s
+{
+  DLTraceRecord *ring;             /**< Ring of records */
+  uint64_t mask;                   /**< Number of records - 1, a power of 2 minus 1 */
+  atomic_uint_fast64_t head;       /**< Total number of records reserved */
+  atomic_uint conns;               /**< Number of connection numbers assigned */
+  char (*connaddr)[TRACE_CONNLEN]; /**< Address of each connection number */
+  atomic_int *streamstate;         /**< State of each stream table entry */
+  uint32_t *streamhash;            /**< Hash of each stream table entry */
+  char (*streamid)[MAXSTREAMID];   /**< Stream ID of each stream table entry */
+  uint64_t startticks;             /**< Record clock when started */
+  uint64_t startmonotonic;         /**< Monotonic time when started (nanoseconds) */
+};
+
+/* Stream table index of the last stream looked up by the thread */
+static DLP_TLS uint32_t tLastStream = DL_TRACE_NOINDEX;
+
+static int trace_write (int fd, const void *buffer, size_t length);
+
+#endif
+
+/***********************************************************************/ /**
+ * @brief Start the flight recorder
+ *
+ * Allocate the event ring and start recording connection events.
+ * The number of records is rounded up to a power of 2.  Each record
+ * is 24 bytes, the default of 65536 records uses 1.5 MiB.
+ *
+ * Tracing cannot be stopped or resized once started.  It should be
+ * started before connections are used by other threads.
+ *
+ * @param records Number of records in the ring, 0 for the default
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_trace_start (int records)
+{
+#if defined(DLP_WIN)
+  dl_log (2, 0, "%s(): Tracing is not supported on this platform\n", __func__);
+  return -1;
+#else
+  DLTrace *trace;
+  uint64_t size = 1;
+
+  if (dlp_tracering)
+    return 0;
+
+  if (records <= 0)
+    records = TRACE_RECORDS;
+
+  while (size < (uint64_t)records)
+    size <<= 1;
+
+  if (!(trace = (DLTrace *)calloc (1, sizeof (DLTrace))))
+  {
+    dl_log (2, 0, "%s(): Cannot allocate memory\n", __func__);
+    return -1;
+  }
+
+  trace->ring        = (DLTraceRecord *)calloc (size, sizeof (DLTraceRecord));
+  trace->connaddr    = calloc (TRACE_CONNS, TRACE_CONNLEN);
+  trace->streamstate = (atomic_int *)calloc (TRACE_STREAMS, sizeof (atomic_int));
+  trace->streamhash  = (uint32_t *)calloc (TRACE_STREAMS, sizeof (uint32_t));
+  trace->streamid    = calloc (TRACE_STREAMS, MAXSTREAMID);
+
+  if (!trace->ring || !trace->connaddr || !trace->streamstate ||
+      !trace->streamhash || !trace->streamid)
+  {
+    dl_log (2, 0, "%s(): Cannot allocate memory for %llu records\n",
+            __func__, (unsigned long long int)size);
+    free (trace->ring);
+    free (trace->connaddr);
+    free (trace->streamstate);
+    free (trace->streamhash);
+    free (trace->streamid);
+    free (trace);
+    return -1;
+  }
+
+  trace->mask           = size - 1;
+  trace->startticks     = dlp_ticks ();
+  trace->startmonotonic = dlp_monotonic ();
+  atomic_init (&trace->head, 0);
+  atomic_init (&trace->conns, 0);
+
+  dlp_tracering = trace;
+
+  return 0;
+#endif
+} /* End of dl_trace_start() */
+
+/***********************************************************************/ /**
+ * @brief Dump the flight recorder to a file descriptor
+ *
+ * Write a ::DLTraceHeader, the ring of records, the connection
+ * addresses and the stream ID table.  Only write() is used so this
+ * function is async-signal-safe.
+ *
+ * @param fd File descriptor to write to
+ *
+ * @return 0 on success and -1 on error or if tracing is not started.
+ ***************************************************************************/
+int
+dl_trace_dump (int fd)
+{
+#if defined(DLP_WIN)
+  return -1;
+#else
+  DLTrace *trace = dlp_tracering;
+  DLTraceHeader header;
+  struct timespec ts;
+  uint64_t monotonic;
+  uint32_t conns;
+
+  if (!trace || fd < 0)
+    return -1;
+
+  conns = atomic_load_explicit (&trace->conns, memory_order_acquire);
+  if (conns > TRACE_CONNS)
+    conns = TRACE_CONNS;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, DL_TRACE_MAGIC, sizeof (header.magic));
+  header.recordsize = sizeof (DLTraceRecord);
+  header.records    = (uint32_t)(trace->mask + 1);
+  header.head       = atomic_load_explicit (&trace->head, memory_order_relaxed);
+  header.conns      = conns;
+  header.connlen    = TRACE_CONNLEN;
+  header.streams    = TRACE_STREAMS;
+  header.streamlen  = MAXSTREAMID;
+
+  /* Relate the record clock to real time, calibrating its rate */
+  header.ticks = dlp_ticks ();
+  monotonic    = dlp_monotonic ();
+  clock_gettime (CLOCK_REALTIME, &ts);
+
+#if defined(DLP_TSC)
+  if (monotonic > trace->startmonotonic && header.ticks > trace->startticks)
+    header.tickrate = (uint64_t)((double)(header.ticks - trace->startticks) * 1e9 /
+                                 (double)(monotonic - trace->startmonotonic));
+  else
+    header.tickrate = 1000000000;
+#else
+  header.tickrate = 1000000000;
+#endif
+
+  header.realtime = (dltime_t)ts.tv_sec * DLTMODULUS + ts.tv_nsec / (1000000000 / DLTMODULUS);
+
+  if (trace_write (fd, &header, sizeof (header)) ||
+      trace_write (fd, trace->ring, (trace->mask + 1) * sizeof (DLTraceRecord)) ||
+      trace_write (fd, trace->connaddr, (size_t)conns * TRACE_CONNLEN) ||
+      trace_write (fd, trace->streamid, (size_t)TRACE_STREAMS * MAXSTREAMID))
+    return -1;
+
+  return 0;
+#endif
+} /* End of dl_trace_dump() */
+
+/***********************************************************************/ /**
+ * @brief Dump the flight recorder to a file
+ *
+ * Create or truncate @a path and write the flight recorder to it with
+ * dl_trace_dump().  This function is async-signal-safe.
+ *
+ * @param path File to write
+ *
+ * @return 0 on success and -1 on error or if tracing is not started.
+ ***************************************************************************/
+int
+dl_trace_dumpfile (const char *path)
+{
+#if defined(DLP_WIN)
+  return -1;
+#else
+  int fd;
+  int rv;
+
+  if (!dlp_tracering || !path)
+    return -1;
+
+  if ((fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+
+  rv = dl_trace_dump (fd);
+
+  if (close (fd))
+    rv = -1;
+
+  return rv;
+#endif
+} /* End of dl_trace_dumpfile() */
+
+/***********************************************************************/ /**
+ * @brief Record a flight recorder event
+ *
+ * Internal routine used through the dlp_trace() macro, which skips
+ * the call when tracing is not started.  The connection is numbered
+ * on its first event.
+ *
+ * @param dlconn DataLink Connection Parameters, may be NULL
+ * @param event Event code, see @ref trace-events
+ * @param value Event value
+ * @param arg Event argument
+ ***************************************************************************/
+void
+dlp_trace_record (DLCP *dlconn, int event, int64_t value, uint32_t arg)
+{
+#if !defined(DLP_WIN)
+  DLTrace *trace = dlp_tracering;
+  DLTraceRecord *record;
+  uint64_t position;
+  unsigned int conn;
+
+  if (!trace)
+    return;
+
+  if (dlconn && dlconn->traceid < 0)
+  {
+    conn = atomic_fetch_add_explicit (&trace->conns, 1, memory_order_acq_rel);
+
+    if (conn < TRACE_CONNS)
+    {
+      /* Same size as DLCP.addr, the table is zeroed so it stays terminated */
+      memcpy (trace->connaddr[conn], dlconn->addr, TRACE_CONNLEN - 1);
+      dlconn->traceid = (int)conn;
+    }
+    else
+    {
+      dlconn->traceid = TRACE_NOCONN;
+    }
+  }
+
+  position = atomic_fetch_add_explicit (&trace->head, 1, memory_order_relaxed);
+  record   = &trace->ring[position & trace->mask];
+
+  record->time     = dlp_ticks ();
+  record->value    = value;
+  record->arg      = arg;
+  record->conn     = (dlconn) ? (uint16_t)dlconn->traceid : TRACE_NOCONN;
+  record->event    = (uint8_t)event;
+  record->reserved = 0;
+#endif
+} /* End of dlp_trace_record() */
+
+/***********************************************************************/ /**
+ * @brief Return the stream table index of a stream ID
+ *
+ * Look up, or add, a stream ID in the lock-free stream table.  New
+ * entries are claimed with a compare and exchange and published once
+ * the stream ID is stored.  The last stream looked up by the thread is
+ * checked first, consecutive packets are often of the same stream.
+ *
+ * @param streamid Stream ID
+ *
+ * @return The stream index or DL_TRACE_NOINDEX if the table is full
+ * or tracing is not started.
+ ***************************************************************************/
+uint32_t
+dlp_trace_stream (const char *streamid)
+{
+#if defined(DLP_WIN)
+  return DL_TRACE_NOINDEX;
+#else
+  DLTrace *trace = dlp_tracering;
+  uint32_t hash = 2166136261u;
+  uint32_t idx;
+  const char *cp;
+  int probes;
+  int state;
+
+  if (!trace || !streamid)
+    return DL_TRACE_NOINDEX;
+
+  if (tLastStream != DL_TRACE_NOINDEX &&
+      !strncmp (trace->streamid[tLastStream], streamid, MAXSTREAMID - 1))
+    return tLastStream;
+
+  /* FNV-1a hash of the stream ID */
+  for (cp = streamid; *cp; cp++)
+    hash = (hash ^ (unsigned char)*cp) * 16777619u;
+
+  idx = hash & (TRACE_STREAMS - 1);
+
+  for (probes = 0; probes < TRACE_STREAMS; probes++, idx = (idx + 1) & (TRACE_STREAMS - 1))
+  {
+    state = atomic_load_explicit (&trace->streamstate[idx], memory_order_acquire);
+
+    /* Claim an empty entry for the stream */
+    if (state == STREAM_EMPTY)
+    {
+      if (atomic_compare_exchange_strong_explicit (&trace->streamstate[idx], &state, STREAM_WRITING,
+                                                   memory_order_acquire, memory_order_acquire))
+      {
+        trace->streamhash[idx] = hash;
+        strncpy (trace->streamid[idx], streamid, MAXSTREAMID - 1);
+        atomic_store_explicit (&trace->streamstate[idx], STREAM_READY, memory_order_release);
+        return (tLastStream = idx);
+      }
+    }
+
+    /* Wait for an entry being added by another thread */
+    while (state == STREAM_WRITING)
+      state = atomic_load_explicit (&trace->streamstate[idx], memory_order_acquire);
+
+    if (trace->streamhash[idx] == hash &&
+        !strncmp (trace->streamid[idx], streamid, MAXSTREAMID - 1))
+      return (tLastStream = idx);
+  }
+
+  return DL_TRACE_NOINDEX;
+#endif
+} /* End of dlp_trace_stream() */
+
+
+/***********************************************************************/ /**
+ * @brief Return the name of a flight recorder event code
+ *
+ * @param event Event code, see @ref trace-events
+ *
+ * @return A static string naming the event, "unknown" for
+ * unrecognized codes.
+ ***************************************************************************/
+const char *
+dl_trace_name (int event)
+{
+  switch (event)
+  {
+  case DL_TRACE_CONNECT:
+    return "connect";
+  case DL_TRACE_CONNFAIL:
+    return "connfail";
+  case DL_TRACE_DISCONNECT:
+    return "disconnect";
+  case DL_TRACE_RECV:
+    return "recv";
+  case DL_TRACE_SEND:
+    return "send";
+  case DL_TRACE_ACK:
+    return "ack";
+  case DL_TRACE_KEEPALIVE:
+    return "keepalive";
+  case DL_TRACE_TIMEOUT:
+    return "timeout";
+  case DL_TRACE_IOERROR:
+    return "ioerror";
+  }
+
+  return "unknown";
+} /* End of dl_trace_name() */
+
+#if !defined(DLP_WIN)
+/***************************************************************************
+ * trace_write:
+ *
+ * Write all of a buffer, resuming after interruptions.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+trace_write (int fd, const void *buffer, size_t length)
+{
+  const char *bptr = (const char *)buffer;
+  ssize_t rv;
+
+  while (length > 0)
+  {
+    if ((rv = write (fd, bptr, length)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+
+    bptr += rv;
+    length -= rv;
+  }
+
+  return 0;
+} /* End of trace_write() */
+
+#endif
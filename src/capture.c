@@ -0,0 +1,328 @@
+/***************************************************************************
+ * capture.c
+ *
+ * Capture files of received DataLink packets for dali2dali.
+ *
+ * A capture holds every packet received from the source: the fields
+ * of its PACKET header, from which the wire header is reproduced
+ * exactly, the payload and the time it was received.  Captures are
+ * replayed into a destination to reproduce the original stream.
+ *
+ * The file starts with the 8 byte magic "DALICAP1" followed by a
+ * record for each packet, all integers are little-endian:
+ *
+ *   uint32  record length, not including this field
+ *   int64   receive time, dltime_t
+ *   int64   packet ID
+ *   int64   packet time, dltime_t
+ *   int64   data start time, dltime_t
+ *   int64   data end time, dltime_t
+ *   uint32  data size
+ *   uint8   stream ID length
+ *   char    stream ID, not terminated
+ *   char    data
+ *
+ * Records are written through a large stdio buffer, a capture is
+ * only complete after capture_close().
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+#define CAPTURE_MAGIC   "DALICAP1"
+#define CAPTURE_BUFSIZE (1024 * 1024)
+
+/* Size of the fixed fields of a record after the length */
+#define CAPTURE_FIXED   (5 * 8 + 4 + 1)
+
+static Capture *capture_new (const char *path, FILE *fp, int writing);
+static void put_uint32 (unsigned char *ptr, uint32_t value);
+static void put_int64 (unsigned char *ptr, int64_t value);
+static uint32_t get_uint32 (const unsigned char *ptr);
+static int64_t get_int64 (const unsigned char *ptr);
+
+
+/***************************************************************************
+ * capture_create:
+ *
+ * Create a capture file for writing, replacing an existing file.
+ *
+ * Returns the capture on success and NULL on error.
+ ***************************************************************************/
+Capture *
+capture_create (const char *path)
+{
+  Capture *capture;
+  FILE *fp;
+
+  if ( ! (fp = fopen (path, "wb")) )
+    {
+      dl_log (2, 0, "Cannot create capture file %s: %s\n", path, strerror (errno));
+      return NULL;
+    }
+
+  if ( ! (capture = capture_new (path, fp, 1)) )
+    return NULL;
+
+  if ( fwrite (CAPTURE_MAGIC, 8, 1, fp) != 1 )
+    {
+      dl_log (2, 0, "Cannot write capture file %s: %s\n", path, strerror (errno));
+      capture_close (capture);
+      return NULL;
+    }
+
+  return capture;
+}  /* End of capture_create() */
+
+
+/***************************************************************************
+ * capture_open:
+ *
+ * Open a capture file for reading.
+ *
+ * Returns the capture on success and NULL on error.
+ ***************************************************************************/
+Capture *
+capture_open (const char *path)
+{
+  Capture *capture;
+  char magic[8];
+  FILE *fp;
+
+  if ( ! (fp = fopen (path, "rb")) )
+    {
+      dl_log (2, 0, "Cannot open capture file %s: %s\n", path, strerror (errno));
+      return NULL;
+    }
+
+  if ( ! (capture = capture_new (path, fp, 0)) )
+    return NULL;
+
+  if ( fread (magic, 8, 1, fp) != 1 || memcmp (magic, CAPTURE_MAGIC, 8) )
+    {
+      dl_log (2, 0, "%s is not a capture file\n", path);
+      capture_close (capture);
+      return NULL;
+    }
+
+  return capture;
+}  /* End of capture_open() */
+
+
+/***************************************************************************
+ * capture_write:
+ *
+ * Write a received packet to a capture.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+capture_write (Capture *capture, const DLPacket *packet,
+	       const void *packetdata, dltime_t received)
+{
+  unsigned char record[4 + CAPTURE_FIXED + MAXSTREAMID];
+  size_t idlen = strlen (packet->streamid);
+  size_t length;
+
+  if ( ! capture || ! capture->writing || packet->datasize < 0 )
+    return -1;
+
+  length = 4 + CAPTURE_FIXED + idlen;
+
+  put_uint32 (record, (uint32_t) (length - 4 + packet->datasize));
+  put_int64 (record + 4, received);
+  put_int64 (record + 12, packet->pktid);
+  put_int64 (record + 20, packet->pkttime);
+  put_int64 (record + 28, packet->datastart);
+  put_int64 (record + 36, packet->dataend);
+  put_uint32 (record + 44, (uint32_t) packet->datasize);
+  record[48] = (unsigned char) idlen;
+  memcpy (record + 49, packet->streamid, idlen);
+
+  if ( fwrite (record, length, 1, capture->fp) != 1 ||
+       (packet->datasize > 0 && fwrite (packetdata, packet->datasize, 1, capture->fp) != 1) )
+    {
+      dl_log (2, 0, "Cannot write capture file %s: %s\n", capture->path, strerror (errno));
+      return -1;
+    }
+
+  capture->packets++;
+
+  return 0;
+}  /* End of capture_write() */
+
+
+/***************************************************************************
+ * capture_read:
+ *
+ * Read the next packet of a capture, the data into packetdata of
+ * maxdatasize bytes.
+ *
+ * Returns 1 when a packet is read, 0 at the end of the capture and
+ * -1 on error.
+ ***************************************************************************/
+int
+capture_read (Capture *capture, DLPacket *packet, void *packetdata,
+	      size_t maxdatasize, dltime_t *received)
+{
+  unsigned char record[CAPTURE_FIXED + MAXSTREAMID];
+  uint32_t length;
+  uint32_t datasize;
+  size_t idlen;
+
+  if ( ! capture || capture->writing )
+    return -1;
+
+  if ( fread (record, 4, 1, capture->fp) != 1 )
+    {
+      if ( ferror (capture->fp) )
+	{
+	  dl_log (2, 0, "Cannot read capture file %s: %s\n", capture->path, strerror (errno));
+	  return -1;
+	}
+
+      return 0;
+    }
+
+  length = get_uint32 (record);
+
+  if ( length < CAPTURE_FIXED || fread (record, CAPTURE_FIXED, 1, capture->fp) != 1 )
+    goto truncated;
+
+  datasize = get_uint32 (record + 40);
+  idlen    = record[44];
+
+  if ( idlen >= MAXSTREAMID || length != CAPTURE_FIXED + idlen + datasize ||
+       datasize > maxdatasize || datasize > INT32_MAX )
+    {
+      dl_log (2, 0, "Invalid record %llu in capture file %s\n",
+	      (unsigned long long int) capture->packets + 1, capture->path);
+      return -1;
+    }
+
+  if ( fread (packet->streamid, 1, idlen, capture->fp) != idlen ||
+       (datasize > 0 && fread (packetdata, datasize, 1, capture->fp) != 1) )
+    goto truncated;
+
+  packet->streamid[idlen] = '\0';
+  packet->pktid     = get_int64 (record + 8);
+  packet->pkttime   = get_int64 (record + 16);
+  packet->datastart = get_int64 (record + 24);
+  packet->dataend   = get_int64 (record + 32);
+  packet->datasize  = (int32_t) datasize;
+
+  if ( received )
+    *received = get_int64 (record);
+
+  capture->packets++;
+
+  return 1;
+
+ truncated:
+  dl_log (2, 0, "Capture file %s is truncated after %llu packets\n",
+	  capture->path, (unsigned long long int) capture->packets);
+  return 0;
+}  /* End of capture_read() */
+
+
+/***************************************************************************
+ * capture_close:
+ *
+ * Close a capture and free it, flushing written packets.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+capture_close (Capture *capture)
+{
+  int rv = 0;
+
+  if ( ! capture )
+    return -1;
+
+  if ( fclose (capture->fp) )
+    {
+      dl_log (2, 0, "Cannot close capture file %s: %s\n", capture->path, strerror (errno));
+      rv = -1;
+    }
+
+  free (capture->path);
+  free (capture);
+
+  return rv;
+}  /* End of capture_close() */
+
+
+/***************************************************************************
+ * capture_new:
+ *
+ * Allocate a capture for an open file, closing the file on error.
+ ***************************************************************************/
+static Capture *
+capture_new (const char *path, FILE *fp, int writing)
+{
+  Capture *capture;
+
+  if ( ! (capture = (Capture *) calloc (1, sizeof(Capture))) ||
+       ! (capture->path = strdup (path)) )
+    {
+      dl_log (2, 0, "Cannot allocate capture\n");
+      free (capture);
+      fclose (fp);
+      return NULL;
+    }
+
+  capture->fp = fp;
+  capture->writing = writing;
+
+  setvbuf (fp, NULL, _IOFBF, CAPTURE_BUFSIZE);
+
+  return capture;
+}  /* End of capture_new() */
+
+
+static void
+put_uint32 (unsigned char *ptr, uint32_t value)
+{
+  int idx;
+
+  for (idx = 0; idx < 4; idx++)
+    ptr[idx] = (unsigned char) (value >> (8 * idx));
+}
+
+static void
+put_int64 (unsigned char *ptr, int64_t value)
+{
+  int idx;
+
+  for (idx = 0; idx < 8; idx++)
+    ptr[idx] = (unsigned char) ((uint64_t) value >> (8 * idx));
+}
+
+static uint32_t
+get_uint32 (const unsigned char *ptr)
+{
+  uint32_t value = 0;
+  int idx;
+
+  for (idx = 3; idx >= 0; idx--)
+    value = (value << 8) | ptr[idx];
+
+  return value;
+}
+
+static int64_t
+get_int64 (const unsigned char *ptr)
+{
+  uint64_t value = 0;
+  int idx;
+
+  for (idx = 7; idx >= 0; idx--)
+    value = (value << 8) | ptr[idx];
+
+  return (int64_t) value;
+}
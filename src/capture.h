@@ -0,0 +1,30 @@
+/***************************************************************************
+ * capture.h
+ *
+ * Capture files of received DataLink packets for dali2dali.
+ ***************************************************************************/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H 1
+
+#include <stdio.h>
+
+#include <libdali.h>
+
+/* Capture file, opened for writing or reading */
+typedef struct Capture_s {
+  FILE    *fp;
+  char    *path;
+  int      writing;
+  uint64_t packets;    /* Packets written or read */
+} Capture;
+
+extern Capture *capture_create (const char *path);
+extern Capture *capture_open (const char *path);
+extern int  capture_write (Capture *capture, const DLPacket *packet,
+			   const void *packetdata, dltime_t received);
+extern int  capture_read (Capture *capture, DLPacket *packet, void *packetdata,
+			  size_t maxdatasize, dltime_t *received);
+extern int  capture_close (Capture *capture);
+
+#endif /* CAPTURE_H */
@@ -14,18 +14,64 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <signal.h>
 #include <time.h>
 
 #include <libdali.h>
 
+#include "capture.h"
+#include "latency.h"
+#include "metrics.h"
+#include "serve.h"
+
 #define PACKAGE   "dali2dali"
-#define VERSION   "0.3"
+#define VERSION   "0.4"
+
+/* Minimum and maximum delay between destination re-connection attempts (microseconds) */
+#define RETRYDELAY_MIN 100000
+#define RETRYDELAY_MAX 10000000
+
+/* Interval between summaries of rate limited log messages (seconds) */
+#define LOGSUMMARY_INTERVAL 60
+
+/* Token bucket limiting a class of log messages */
+typedef struct RateLimit_s {
+  const char *what;      /* Description of the messages for summaries */
+  double      tokens;    /* Messages currently allowed */
+  dltime_t    refilled;  /* Time tokens were last added */
+  dltime_t    summarized;/* Time of the last summary */
+  uint64_t    suppressed;/* Messages suppressed since the last summary */
+} RateLimit;
+
+/* Forwarded packet count of a stream for sampling */
+typedef struct StreamSample_s {
+  char     streamid[MAXSTREAMID];
+  uint64_t count;
+} StreamSample;
 
 static int  parameter_proc (int argcount, char **argvec);
 static char *getoptval (int argcount, char **argvec, int argopt);
+static int  getoptint (int argcount, char **argvec, int argopt);
+static void setsockopts (DLCP *dlconn);
 static void term_handler (int sig);
+static void trace_handler (int sig);
+static void report_handler (int sig);
+static void crash_handler (int sig);
 static void print_timelog (const char *msg);
+static void stop_asynclog (void);
+static int  sample_stream (const char *streamid);
+static int  ratelimit_allow (RateLimit *limit);
+static void ratelimit_summary (RateLimit *limit, int force);
+static void log_stats (DLCP *dlconn, const char *role);
+static void forward_packet (DLPacket *packet, char *packetdata, dltime_t received);
+static int  replay_capture (Capture *replay, char *packetdata, size_t maxdatasize);
+static int  write_packet (DLPacket *packet, char *packetdata,
+			  dltime_t received, dltime_t enqueued, int ack, int defer);
+static void window_add (DLPacket *packet, char *packetdata, int confirm);
+static void window_confirm (void);
+static int  window_resend (void);
 static void usage (void);
 
 static short int verbose   = 0;  /* Flag to control general verbosity */
@@ -34,6 +80,57 @@ static char *statefile     = 0;	 /* State file for saving/restoring stream state
 static char *matchpattern  = 0;  /* Source ID matching expression */
 static char *rejectpattern = 0;  /* Source ID rejecting expression */
 static int   writeack      = 0;  /* Flag to control the request for write acks */
+static char *jsonlog       = 0;  /* File for JSON-lines log events, '-' for stdout */
+static int   logsample     = 1;  /* Log one of every logsample packets per stream */
+static double lograte      = 0;  /* Limit of messages per second, 0 for unlimited */
+static double logburst     = 0;  /* Maximum burst of messages above lograte */
+
+/* Rate limits for per-packet and repeated error messages */
+static RateLimit packetlimit = { "per-packet", 0, 0, 0, 0 };
+static RateLimit errorlimit  = { "repeated error", 0, 0, 0, 0 };
+
+/* Open addressing table of per-stream sample counts */
+static StreamSample *samples   = 0;
+static size_t        samplemax = 0;
+static size_t        samplecnt = 0;
+
+/* Socket tuning parameters applied to both connections */
+static int   rcvbuf        = 0;  /* Socket receive buffer size in bytes */
+static int   sndbuf        = 0;  /* Socket send buffer size in bytes */
+static int   autobuf       = 0;  /* Flag to size buffers from RTT and throughput */
+static int   tcpnodelay    = 0;  /* Flag to disable Nagle's algorithm */
+static int   tcpquickack   = 0;  /* Flag to request immediate ACKs */
+static int   usertimeout   = 0;  /* TCP_USER_TIMEOUT in milliseconds */
+static int   keepidle      = 0;  /* Kernel TCP keepalive idle seconds */
+static int   keepintvl     = 0;  /* Kernel TCP keepalive interval seconds */
+static int   keepcnt       = 0;  /* Kernel TCP keepalive probe count */
+static int   busypoll      = 0;  /* SO_BUSY_POLL in microseconds */
+static int   conntimeout   = -1; /* Connection attempt timeout in milliseconds */
+static int   resolvettl    = -1; /* Lifetime of cached resolved addresses in seconds */
+static int   iouring       = 0;  /* Flag to use io_uring for socket I/O */
+static int   splicemode    = 0;  /* Flag to relay packet payloads with splice() */
+static int   tracerecords  = 65536; /* Flight recorder ring records, 0 to disable */
+static char *tracefile     = "dali2dali.trace"; /* Flight recorder dump file */
+static char *metricsaddr   = 0;  /* Prometheus metrics listen address, [host:]port */
+static int   latency       = 0;  /* Latency histograms, 1 for the route, 2 also per stream */
+static int   profile       = 0;  /* Profile the stages of collecting and writing packets */
+static char *capturefile   = 0;  /* File to capture received packets to */
+static char *replayfile    = 0;  /* Capture file to replay instead of a source server */
+static double replayspeed  = 1.0; /* Replay speed factor, 0 for as fast as possible */
+static char *serveaddr     = 0;  /* DataLink server listen address, [host:]port */
+static int   servering     = 65536; /* Packets kept in the served ring */
+static int   servemem      = 33554432; /* Packet data bytes kept in the served ring */
+static int   serveclients  = 100;   /* Clients served at a time */
+static int   windowsize    = 0;  /* Written packets kept to resend after reconnecting */
+static int   confirmint    = 0;  /* Packets between confirming acks, 0 for the default */
+static Capture *capture    = 0;
+
+/* Retransmit window of packets written to the destination */
+static DLRing  *window     = 0;
+static int64_t  confirmed  = 0;  /* Sequence number of the last confirmed packet */
+static int64_t  confirming = 0;  /* Sequence number of the packet awaiting its ack, 0 if none */
+static uint64_t resent     = 0;  /* Packets resent after reconnecting */
+static uint64_t unconfirmedevicted = 0; /* Unconfirmed packets evicted from the window */
 
 static DLCP *srcdlcp;
 static DLCP *destdlcp;
@@ -44,6 +141,7 @@ main (int argc, char **argv)
 {
   DLPacket dlpacket;
   char packetdata[MAXPACKETSIZE];
+  Capture *replay = 0;
   int packetcnt = 0;
 
 #ifndef WIN32
@@ -71,13 +169,58 @@ main (int argc, char **argv)
       return -1;
     }
 
+#ifndef WIN32
+  /* Start the flight recorder, dumped to a file on SIGUSR2 and on crashes */
+  if ( tracerecords > 0 && dl_trace_start (tracerecords) == 0 )
+    {
+      sa.sa_handler = trace_handler;
+      sigaction (SIGUSR2, &sa, NULL);
+
+      sa.sa_flags   = SA_RESETHAND | SA_NODEFER;
+      sa.sa_handler = crash_handler;
+      sigaction (SIGSEGV, &sa, NULL);
+      sigaction (SIGBUS, &sa, NULL);
+      sigaction (SIGILL, &sa, NULL);
+      sigaction (SIGFPE, &sa, NULL);
+      sigaction (SIGABRT, &sa, NULL);
+    }
+
+  /* Record latency histograms and profile stages, reported on SIGUSR1 */
+  if ( latency && latency_init (latency > 1) )
+    return -1;
+
+  if ( profile && dl_prof_start () )
+    return -1;
+
+  if ( latency || profile )
+    {
+      sa.sa_flags   = SA_RESTART;
+      sa.sa_handler = report_handler;
+      sigaction (SIGUSR1, &sa, NULL);
+    }
+
+  /* Serve Prometheus metrics from a listener thread */
+  if ( metricsaddr && metrics_start (metricsaddr, srcdlcp, destdlcp) )
+    return -1;
+#endif
+
+  /* Open a capture to replay instead of connecting to a source */
+  if ( replayfile && ! (replay = capture_open (replayfile)) )
+    return -1;
+
   /* Connect to source DataLink server */
-  if ( dl_connect (srcdlcp) < 0 )
+  if ( ! replay && dl_connect (srcdlcp) < 0 )
     {
       dl_log (2, 0, "Error connecting to source DataLink server: %s\n", srcdlcp->addr);
       return -1;
     }
 
+  /* Serve received packets to DataLink clients, sized by the source packet size */
+  if ( serveaddr &&
+       serve_start (serveaddr, servering, servemem,
+		    (srcdlcp->maxpktsize > 0) ? srcdlcp->maxpktsize : MAXPACKETSIZE, serveclients) )
+    return -1;
+
   /* Connect to destination DataLink server */
   if ( dl_connect (destdlcp) < 0 )
     {
@@ -85,6 +228,12 @@ main (int argc, char **argv)
       return -1;
     }
 
+  /* Keep written packets to resend those not confirmed when reconnecting */
+  if ( windowsize &&
+       ! (window = dl_ring_new (windowsize, (size_t) windowsize *
+				((srcdlcp->maxpktsize > 0) ? srcdlcp->maxpktsize : MAXPACKETSIZE))) )
+    return -1;
+
   /* Reposition connection */
   if ( srcdlcp->pktid > 0 )
     {
@@ -108,36 +257,16 @@ main (int argc, char **argv)
         return -1;
     }
 
+  /* Replay a capture instead of collecting from a source server */
+  if ( replay )
+    replay_capture (replay, packetdata, sizeof(packetdata));
+
   /* Collect packets in streaming mode */
-  while ( dl_collect (srcdlcp, &dlpacket, packetdata, sizeof(packetdata), 0) == DLPACKET )
+  while ( ! replay &&
+	  dl_collect (srcdlcp, &dlpacket, (splicemode) ? NULL : packetdata,
+		      sizeof(packetdata), 0) == DLPACKET )
     {
-      if ( verbose > 1 )
-	{
-	  char timestr[50];
-
-	  dl_dltime2seedtimestr (dlpacket.datastart, timestr, 1);
-
-	  dl_log (1, 0, "Forwarding packet %s, %s, %d bytes\n",
-		  dlpacket.streamid, timestr, dlpacket.datasize);
-	}
-
-      /* Send packet to the destination DataLink server, reconnecting if needed */
-      while ( dl_write (destdlcp, packetdata, dlpacket.datasize, dlpacket.streamid,
-			dlpacket.datastart, dlpacket.dataend, writeack) < 0 )
-	{
-	  if ( verbose )
-	    dl_log (2, 0, "Re-connecting to destination DataLink server\n");
-
-	  /* Re-connect to destination DataLink server and sleep if error connecting */
-	  if ( destdlcp->link != -1 )
-	    dl_disconnect (destdlcp);
-
-	  if ( dl_connect (destdlcp) < 0 )
-	    {
-	      dl_log (2, 0, "Error re-connecting to destination DataLink server, sleeping 10 seconds\n");
-	      sleep (10);
-	    }
-	}
+      forward_packet (&dlpacket, packetdata, (latency || capture) ? dlp_time () : 0);
 
       /* Save intermediate state files */
       if ( statefile && stateint )
@@ -164,6 +293,44 @@ main (int argc, char **argv)
   if ( statefile )
     dl_savestate (srcdlcp, statefile);
 
+  /* Report messages suppressed since the last summary */
+  ratelimit_summary (&packetlimit, 1);
+  ratelimit_summary (&errorlimit, 1);
+
+  /* Report served clients */
+  if ( serveaddr )
+    serve_report ();
+
+  /* Report resent packets */
+  if ( window )
+    {
+      dl_log (1, 1, "Resent %llu packets not confirmed by the destination\n",
+	      (unsigned long long int) resent);
+
+      if ( unconfirmedevicted )
+	dl_log (2, 0, "%llu packets were evicted from the window before being confirmed\n",
+		(unsigned long long int) unconfirmedevicted);
+
+      dl_ring_free (window);
+    }
+
+  /* Write captured packets */
+  if ( capture )
+    {
+      dl_log (1, 1, "Captured %llu packets to %s\n",
+	      (unsigned long long int) capture->packets, capturefile);
+      capture_close (capture);
+    }
+
+  /* Report connection statistics */
+  if ( ! replayfile )
+    log_stats (srcdlcp, "source");
+  log_stats (destdlcp, "destination");
+
+  /* Report the stage profile */
+  if ( profile )
+    dl_prof_print (2);
+
   return 0;
 }  /* End of main() */
 
@@ -181,6 +348,7 @@ parameter_proc (int argcount, char **argvec)
   char *srcaddress = 0;
   char *destaddress = 0;
   char *tptr;
+  FILE *jsonfp;
   int error = 0;
 
   if (argcount <= 1)
@@ -207,6 +375,35 @@ parameter_proc (int argcount, char **argvec)
 	{
 	  statefile = getoptval(argcount, argvec, optind++);
 	}
+      else if (strcmp (argvec[optind], "-jsonlog") == 0)
+	{
+	  jsonlog = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-logsample") == 0)
+	{
+	  logsample = getoptint(argcount, argvec, optind++);
+
+	  if ( logsample < 1 )
+	    {
+	      fprintf (stderr, "Option -logsample requires a value of at least 1\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-lograte") == 0)
+	{
+	  tptr = getoptval(argcount, argvec, optind++);
+
+	  if ( sscanf (tptr, "%lf:%lf", &lograte, &logburst) < 1 ||
+	       lograte <= 0 || logburst < 0 )
+	    {
+	      fprintf (stderr, "Option -lograte requires rate[:burst], not '%s'\n", tptr);
+	      exit (1);
+	    }
+
+	  /* Default burst is one second of messages */
+	  if ( logburst < 1 )
+	    logburst = (lograte > 1) ? lograte : 1;
+	}
       else if (strcmp (argvec[optind], "-m") == 0)
 	{
 	  matchpattern = getoptval(argcount, argvec, optind++);
@@ -215,6 +412,150 @@ parameter_proc (int argcount, char **argvec)
 	{
 	  rejectpattern = getoptval(argcount, argvec, optind++);
 	}
+      else if (strcmp (argvec[optind], "-rcvbuf") == 0)
+	{
+	  rcvbuf = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-sndbuf") == 0)
+	{
+	  sndbuf = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-autobuf") == 0)
+	{
+	  autobuf = 1;
+	}
+      else if (strcmp (argvec[optind], "-nodelay") == 0)
+	{
+	  tcpnodelay = 1;
+	}
+      else if (strcmp (argvec[optind], "-quickack") == 0)
+	{
+	  tcpquickack = 1;
+	}
+      else if (strcmp (argvec[optind], "-usertimeout") == 0)
+	{
+	  usertimeout = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-tcpka") == 0)
+	{
+	  tptr = getoptval(argcount, argvec, optind++);
+
+	  if ( sscanf (tptr, "%d:%d:%d", &keepidle, &keepintvl, &keepcnt) < 1 ||
+	       keepidle <= 0 || keepintvl < 0 || keepcnt < 0 )
+	    {
+	      fprintf (stderr, "Option -tcpka requires idle[:interval[:count]], not '%s'\n", tptr);
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-busypoll") == 0)
+	{
+	  busypoll = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-conntimeout") == 0)
+	{
+	  conntimeout = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-resolvettl") == 0)
+	{
+	  resolvettl = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-iouring") == 0)
+	{
+	  iouring = 1;
+	}
+      else if (strcmp (argvec[optind], "-splice") == 0)
+	{
+	  splicemode = 1;
+	}
+      else if (strcmp (argvec[optind], "-trace") == 0)
+	{
+	  tracerecords = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-tracefile") == 0)
+	{
+	  tracefile = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-metrics") == 0)
+	{
+	  metricsaddr = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-ack") == 0)
+	{
+	  writeack = 1;
+	}
+      else if (strcmp (argvec[optind], "-latency") == 0)
+	{
+	  if ( ! latency )
+	    latency = 1;
+	}
+      else if (strcmp (argvec[optind], "-streamlatency") == 0)
+	{
+	  latency = 2;
+	}
+      else if (strcmp (argvec[optind], "-profile") == 0)
+	{
+	  profile = 1;
+	}
+      else if (strcmp (argvec[optind], "-capture") == 0)
+	{
+	  capturefile = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-replay") == 0)
+	{
+	  replayfile = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-serve") == 0)
+	{
+	  serveaddr = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-servering") == 0)
+	{
+	  if ( (servering = getoptint(argcount, argvec, optind++)) <= 0 )
+	    {
+	      fprintf (stderr, "Option -servering requires a positive number of packets\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-servemem") == 0)
+	{
+	  if ( (servemem = getoptint(argcount, argvec, optind++)) < MAXPACKETSIZE )
+	    {
+	      fprintf (stderr, "Option -servemem requires at least %d bytes\n", MAXPACKETSIZE);
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-serveclients") == 0)
+	{
+	  if ( (serveclients = getoptint(argcount, argvec, optind++)) <= 0 )
+	    {
+	      fprintf (stderr, "Option -serveclients requires a positive number of clients\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-window") == 0)
+	{
+	  windowsize = getoptint(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-confirm") == 0)
+	{
+	  if ( (confirmint = getoptint(argcount, argvec, optind++)) <= 0 )
+	    {
+	      fprintf (stderr, "Option -confirm requires a positive number of packets\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-speed") == 0)
+	{
+	  tptr = getoptval(argcount, argvec, optind++);
+
+	  if ( strcmp (tptr, "max") == 0 )
+	    replayspeed = 0;
+	  else if ( (replayspeed = strtod (tptr, NULL)) <= 0 )
+	    {
+	      fprintf (stderr, "Option -speed requires a positive factor or 'max', not '%s'\n", tptr);
+	      exit (1);
+	    }
+	}
       else if (strncmp (argvec[optind], "-", 1) == 0)
 	{
 	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
@@ -235,6 +576,53 @@ parameter_proc (int argcount, char **argvec)
 	}
     }
 
+  /* A replayed capture replaces the source, the only address is the destination */
+  if ( replayfile )
+    {
+      if ( destaddress )
+	{
+	  fprintf (stderr, "Only a destination DataLink server is used with -replay\n");
+	  exit (1);
+	}
+
+      if ( capturefile || serveaddr || splicemode || statefile || matchpattern || rejectpattern )
+	{
+	  fprintf (stderr, "Options -capture, -serve, -splice, -x, -m and -r cannot be used with -replay\n");
+	  exit (1);
+	}
+
+      destaddress = srcaddress;
+      srcaddress = replayfile;
+    }
+
+  if ( capturefile && splicemode )
+    {
+      fprintf (stderr, "Option -capture cannot be used with -splice\n");
+      exit (1);
+    }
+
+  if ( serveaddr && splicemode )
+    {
+      fprintf (stderr, "Option -serve cannot be used with -splice\n");
+      exit (1);
+    }
+
+  /* Every packet is confirmed with -ack, payloads are not buffered with -splice */
+  if ( windowsize && (writeack || splicemode) )
+    {
+      fprintf (stderr, "Option -window cannot be used with -ack or -splice\n");
+      exit (1);
+    }
+
+  /* Confirm every 1000 packets by default, at least twice per window */
+  if ( ! confirmint )
+    confirmint = (windowsize / 2 < 1000) ? ((windowsize > 1) ? windowsize / 2 : 1) : 1000;
+  else if ( windowsize && confirmint > windowsize )
+    {
+      fprintf (stderr, "Option -confirm cannot be more than the -window size\n");
+      exit (1);
+    }
+
   /* Make sure a source DataLink server was specified */
   if ( ! srcaddress )
     {
@@ -258,8 +646,30 @@ parameter_proc (int argcount, char **argvec)
   /* Initialize the verbosity for the dl_log function */
   dl_loginit (verbose, &print_timelog, "", &print_timelog, "");
 
-  /* Set stdout (where logs go) to always flush after a newline */
-  setvbuf(stdout, NULL, _IOLBF, 0);
+  /* Write log messages as JSON-lines structured events if requested */
+  if ( jsonlog )
+    {
+      if ( strcmp (jsonlog, "-") == 0 )
+        jsonfp = stdout;
+      else if ( ! (jsonfp = fopen (jsonlog, "a")) )
+	{
+	  fprintf (stderr, "Cannot open JSON log file %s: %s\n", jsonlog, strerror(errno));
+	  exit (1);
+	}
+
+      dl_logevents (NULL, dl_eventsink_json, jsonfp);
+    }
+  /* Write log messages to stdout from a background thread, with the
+   * same time stamp as print_timelog(), if possible */
+  else if ( dl_logasync_start (NULL, fileno(stdout), "%a %b %e %H:%M:%S %Y - ", 0) == 0 )
+    {
+      atexit (stop_asynclog);
+    }
+  else
+    {
+      /* Set stdout (where logs go) to always flush after a newline */
+      setvbuf(stdout, NULL, _IOLBF, 0);
+    }
 
   /* Allocate and initialize DataLink connection description */
   if ( ! (srcdlcp = dl_newdlcp (srcaddress, argvec[0])) )
@@ -275,6 +685,10 @@ parameter_proc (int argcount, char **argvec)
       exit (1);
     }
 
+  /* Apply socket tuning to both connections */
+  setsockopts (srcdlcp);
+  setsockopts (destdlcp);
+
   /* Load the match stream list from a file if the argument starts with '@' */
   if ( matchpattern && *matchpattern == '@' )
     {
@@ -302,6 +716,10 @@ parameter_proc (int argcount, char **argvec)
   /* Report the program version */
   dl_log (1, 0, "%s version: %s\n", PACKAGE, VERSION);
 
+  /* Capture received packets */
+  if ( capturefile && ! (capture = capture_create (capturefile)) )
+    exit (1);
+
   /* If errors then report the usage message and quit */
   if ( error )
     {
@@ -359,7 +777,8 @@ getoptval (int argcount, char **argvec, int argopt)
     exit (1);
   }
 
-  if ( (argopt+1) < argcount && *argvec[argopt+1] != '-' )
+  if ( (argopt+1) < argcount &&
+       (*argvec[argopt+1] != '-' || strcmp (argvec[argopt+1], "-") == 0) )
     return argvec[argopt+1];
 
   fprintf (stderr, "Option %s requires a value\n", argvec[argopt]);
@@ -367,6 +786,82 @@ getoptval (int argcount, char **argvec, int argopt)
 }  /* End of getoptval() */
 
 
+/***************************************************************************
+ * getoptint:
+ *
+ * Return the value to a command line option as a non-negative integer
+ * using getoptval().  A 'k' or 'm' suffix multiplies the value by 1024
+ * or 1048576 respectively.  The value must be all digits apart from
+ * the suffix, empty values and trailing characters are rejected.
+ *
+ * Returns value on success and exits with error message on failure
+ ***************************************************************************/
+static int
+getoptint (int argcount, char **argvec, int argopt)
+{
+  char *value = getoptval (argcount, argvec, argopt);
+  char *tail = value;
+  long long int ival = -1;
+
+  if ( isdigit ((unsigned char) *value) )
+    {
+      errno = 0;
+      ival = strtoll (value, &tail, 10);
+
+      if ( errno || ival > 0x7fffffff )
+	ival = -1;
+      else if ( *tail == 'k' || *tail == 'K' )
+	{
+	  ival *= 1024;
+	  tail++;
+	}
+      else if ( *tail == 'm' || *tail == 'M' )
+	{
+	  ival *= 1048576;
+	  tail++;
+	}
+    }
+
+  if ( *tail || ival < 0 || ival > 0x7fffffff )
+    {
+      fprintf (stderr, "Option %s requires a non-negative integer, not '%s'\n",
+	       argvec[argopt], value);
+      exit (1);
+    }
+
+  return (int) ival;
+}  /* End of getoptint() */
+
+
+/***************************************************************************
+ * setsockopts:
+ *
+ * Set the socket tuning parameters of a DataLink connection description
+ * from the command line options.
+ ***************************************************************************/
+static void
+setsockopts (DLCP *dlconn)
+{
+  dlconn->rcvbuf         = rcvbuf;
+  dlconn->sndbuf         = sndbuf;
+  dlconn->autobuf        = autobuf;
+  dlconn->tcpnodelay     = tcpnodelay;
+  dlconn->tcpquickack    = tcpquickack;
+  dlconn->tcpusertimeout = usertimeout;
+  dlconn->tcpkeepidle    = keepidle;
+  dlconn->tcpkeepintvl   = keepintvl;
+  dlconn->tcpkeepcnt     = keepcnt;
+  dlconn->busypoll       = busypoll;
+  dlconn->iouring        = iouring;
+
+  if ( conntimeout >= 0 )
+    dlconn->conntimeout = conntimeout;
+
+  if ( resolvettl >= 0 )
+    dlconn->resolvettl = resolvettl;
+}  /* End of setsockopts() */
+
+
 /***************************************************************************
  * term_handler:
  * Signal handler routine to control termination.
@@ -378,6 +873,53 @@ term_handler (int sig)
 }
 
 
+/***************************************************************************
+ * trace_handler:
+ * Signal handler routine to dump the flight recorder.
+ ***************************************************************************/
+static void
+trace_handler (int sig)
+{
+  int saved_errno = errno;
+
+  dl_trace_dumpfile (tracefile);
+
+  errno = saved_errno;
+}
+
+
+/***************************************************************************
+ * report_handler:
+ * Signal handler routine to write the latency histograms and the
+ * stage profile to stderr.
+ ***************************************************************************/
+static void
+report_handler (int sig)
+{
+  int saved_errno = errno;
+
+  latency_dump (2);
+
+  if ( profile )
+    dl_prof_print (2);
+
+  errno = saved_errno;
+}
+
+
+/***************************************************************************
+ * crash_handler:
+ * Signal handler routine to dump the flight recorder on a crash and
+ * re-raise the signal with the default action, restored by SA_RESETHAND.
+ ***************************************************************************/
+static void
+crash_handler (int sig)
+{
+  dl_trace_dumpfile (tracefile);
+  raise (sig);
+}
+
+
 /***************************************************************************
  * print_timelog:
  *
@@ -399,6 +941,505 @@ print_timelog (const char *msg)
 }
 
 
+/***************************************************************************
+ * sample_stream:
+ *
+ * Count a forwarded packet of a stream and determine if it is sampled
+ * for logging, the first of every logsample packets of each stream is.
+ * Counts are kept in an open addressing table that is doubled when
+ * more than half full.
+ *
+ * Returns 1 if the packet should be logged, otherwise 0.
+ ***************************************************************************/
+static int
+sample_stream (const char *streamid)
+{
+  StreamSample *oldsamples;
+  size_t oldmax;
+  size_t idx;
+  uint32_t hash = 2166136261u;
+  const char *cp;
+
+  if ( logsample <= 1 )
+    return 1;
+
+  /* Grow table, re-inserting existing streams */
+  if ( (samplecnt + 1) * 2 > samplemax )
+    {
+      oldsamples = samples;
+      oldmax = samplemax;
+
+      samplemax = (samplemax) ? samplemax * 2 : 1024;
+      if ( ! (samples = (StreamSample *) calloc (samplemax, sizeof(StreamSample))) )
+	{
+	  samples = oldsamples;
+	  samplemax = oldmax;
+	  return 1;
+	}
+
+      samplecnt = 0;
+      for ( idx = 0; idx < oldmax; idx++ )
+	{
+	  if ( oldsamples[idx].streamid[0] )
+	    {
+	      StreamSample *entry;
+	      uint32_t rehash = 2166136261u;
+
+	      for ( cp = oldsamples[idx].streamid; *cp; cp++ )
+		rehash = (rehash ^ (unsigned char) *cp) * 16777619u;
+
+	      for ( entry = &samples[rehash & (samplemax - 1)]; entry->streamid[0]; )
+		entry = (entry == &samples[samplemax - 1]) ? samples : entry + 1;
+
+	      *entry = oldsamples[idx];
+	      samplecnt++;
+	    }
+	}
+
+      free (oldsamples);
+    }
+
+  /* FNV-1a hash of the stream ID */
+  for ( cp = streamid; *cp; cp++ )
+    hash = (hash ^ (unsigned char) *cp) * 16777619u;
+
+  for ( idx = hash & (samplemax - 1); samples[idx].streamid[0];
+	idx = (idx + 1) & (samplemax - 1) )
+    {
+      if ( ! strncmp (samples[idx].streamid, streamid, MAXSTREAMID - 1) )
+	return ( samples[idx].count++ % logsample ) == 0;
+    }
+
+  /* New stream, the first packet is logged */
+  snprintf (samples[idx].streamid, sizeof(samples[idx].streamid), "%s", streamid);
+  samples[idx].count = 1;
+  samplecnt++;
+
+  return 1;
+}  /* End of sample_stream() */
+
+
+/***************************************************************************
+ * ratelimit_allow:
+ *
+ * Determine if a message limited by a token bucket is allowed.  The
+ * bucket is refilled at lograte tokens per second up to logburst and
+ * each allowed message takes one token.  Suppressed messages are
+ * counted and summarized at most every LOGSUMMARY_INTERVAL seconds.
+ *
+ * Returns 1 if the message should be logged, otherwise 0.
+ ***************************************************************************/
+static int
+ratelimit_allow (RateLimit *limit)
+{
+  dltime_t now;
+
+  if ( lograte <= 0 )
+    return 1;
+
+  now = dlp_time ();
+
+  if ( limit->refilled == 0 )
+    {
+      limit->tokens = logburst;
+      limit->summarized = now;
+    }
+  else
+    {
+      limit->tokens += lograte * (double)(now - limit->refilled) / DLTMODULUS;
+      if ( limit->tokens > logburst )
+	limit->tokens = logburst;
+    }
+  limit->refilled = now;
+
+  if ( limit->suppressed &&
+       (now - limit->summarized) >= (dltime_t) LOGSUMMARY_INTERVAL * DLTMODULUS )
+    ratelimit_summary (limit, 1);
+
+  if ( limit->tokens >= 1.0 )
+    {
+      limit->tokens -= 1.0;
+      return 1;
+    }
+
+  limit->suppressed++;
+
+  return 0;
+}  /* End of ratelimit_allow() */
+
+
+/***************************************************************************
+ * ratelimit_summary:
+ *
+ * Log the number of messages suppressed by a rate limit since the last
+ * summary, if any, and reset the count.
+ ***************************************************************************/
+static void
+ratelimit_summary (RateLimit *limit, int force)
+{
+  dltime_t now = dlp_time ();
+
+  if ( ! limit->suppressed )
+    return;
+
+  if ( ! force && (now - limit->summarized) < (dltime_t) LOGSUMMARY_INTERVAL * DLTMODULUS )
+    return;
+
+  dl_log (1, 0, "Suppressed %llu %s messages in the last %.0f seconds\n",
+	  (unsigned long long int) limit->suppressed, limit->what,
+	  (double)(now - limit->summarized) / DLTMODULUS);
+
+  limit->suppressed = 0;
+  limit->summarized = now;
+}  /* End of ratelimit_summary() */
+
+
+/***************************************************************************
+ * forward_packet:
+ *
+ * Log, capture, serve and write a packet received at the given time, 0 when
+ * not needed, to the destination, re-connecting until written.
+ *
+ * With a retransmit window every confirmint-th packet is written with
+ * a deferred acknowledgement, confirming it and the packets before it
+ * when it arrives, and after re-connecting the unconfirmed packets in
+ * the window are resent before the packet.
+ ***************************************************************************/
+static void
+forward_packet (DLPacket *packet, char *packetdata, dltime_t received)
+{
+  dltime_t enqueued = 0;
+  unsigned long int retrydelay;
+  int confirm = 0;
+
+  /* Log a sample of packets per stream, limited to the message rate */
+  if ( verbose > 1 && sample_stream (packet->streamid) &&
+       ratelimit_allow (&packetlimit) )
+    {
+      char timestr[50];
+
+      dl_dltime2seedtimestr (packet->datastart, timestr, 1);
+
+      dl_log (1, 0, "Forwarding packet %s, %s, %d bytes\n",
+	      packet->streamid, timestr, packet->datasize);
+    }
+
+  metrics_received ();
+
+  /* Stop capturing after an error, forwarding continues */
+  if ( capture && capture_write (capture, packet, packetdata, received) )
+    {
+      capture_close (capture);
+      capture = 0;
+    }
+
+  if ( serveaddr )
+    serve_packet (packet, packetdata);
+
+  if ( latency )
+    enqueued = dlp_time ();
+
+  /* Confirm the window every confirmint packets, one acknowledgement at a time */
+  if ( window )
+    {
+      if ( confirming )
+	window_confirm ();
+
+      if ( ! confirming && window->next - confirmed >= confirmint )
+	confirm = 1;
+    }
+
+  /* Send packet to the destination DataLink server, reconnecting if needed */
+  retrydelay = RETRYDELAY_MIN;
+  while ( write_packet (packet, packetdata, received, enqueued,
+			writeack, confirm) < 0 )
+    {
+      if ( verbose && ratelimit_allow (&errorlimit) )
+	dl_log (2, 0, "Re-connecting to destination DataLink server\n");
+
+      /* Re-connect to destination DataLink server and resend packets the
+       * failed connection may have lost, sleep if either fails */
+      if ( destdlcp->link != -1 )
+	dl_disconnect (destdlcp);
+
+      if ( dl_connect (destdlcp) < 0 )
+	{
+	  if ( ratelimit_allow (&errorlimit) )
+	    dl_log (2, 0, "Error re-connecting to destination DataLink server, retrying in %.2f seconds\n",
+		    retrydelay / 1e6);
+	}
+      else if ( window && window_resend () < 0 )
+	{
+	  if ( ratelimit_allow (&errorlimit) )
+	    dl_log (2, 0, "Error resending to destination DataLink server, retrying in %.2f seconds\n",
+		    retrydelay / 1e6);
+	}
+      else
+	{
+	  continue;
+	}
+
+      dlp_usleep (retrydelay);
+
+      /* Back off exponentially up to the maximum delay */
+      retrydelay *= 2;
+      if ( retrydelay > RETRYDELAY_MAX )
+	retrydelay = RETRYDELAY_MAX;
+    }
+
+  if ( window )
+    window_add (packet, packetdata, confirm);
+}  /* End of forward_packet() */
+
+
+/***************************************************************************
+ * window_add:
+ *
+ * Add a written packet to the retransmit window, awaiting an
+ * acknowledgement if one was requested.  Unconfirmed packets evicted
+ * to make room are counted, they are not resent.
+ ***************************************************************************/
+static void
+window_add (DLPacket *packet, char *packetdata, int confirm)
+{
+  int64_t first = window->first;
+
+  dl_ring_add (window, packet, packetdata);
+
+  if ( window->first > confirmed + 1 )
+    unconfirmedevicted += window->first - ((first > confirmed + 1) ? first : confirmed + 1);
+
+  if ( confirm )
+    confirming = window->next - 1;
+}  /* End of window_add() */
+
+
+/***************************************************************************
+ * window_confirm:
+ *
+ * Check for the acknowledgement of the packet awaiting one, which
+ * confirms it and all earlier packets.  On error the destination is
+ * disconnected, the next write re-connects and resends.
+ ***************************************************************************/
+static void
+window_confirm (void)
+{
+  int rv = dl_pollack (destdlcp, NULL);
+
+  if ( rv > 0 )
+    {
+      confirmed = confirming;
+      confirming = 0;
+    }
+  else if ( rv < 0 )
+    {
+      if ( destdlcp->link != -1 )
+	dl_disconnect (destdlcp);
+      confirming = 0;
+    }
+}  /* End of window_confirm() */
+
+
+/***************************************************************************
+ * window_resend:
+ *
+ * Resend the unconfirmed packets in the retransmit window after
+ * re-connecting, the last with an acknowledgement confirming them
+ * and replacing one awaited on the failed connection.
+ * The destination may receive some of them twice.  On error the
+ * destination is disconnected so the pending packet is not written
+ * after a gap.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+window_resend (void)
+{
+  const DLRingPacket *packet;
+  const void *data;
+  int64_t seq;
+  int64_t last = window->next - 1;
+
+  confirming = 0;
+  seq = (confirmed + 1 > window->first) ? confirmed + 1 : window->first;
+
+  if ( seq > last )
+    return 0;
+
+  dl_log (1, 1, "Resending %lld packets not confirmed by the destination\n",
+	  (long long int) (last - seq + 1));
+
+  for (; seq <= last; seq++)
+    {
+      packet = dl_ring_get (window, seq, &data);
+
+      if ( dl_write (destdlcp, (void *) data, packet->datasize, (char *) packet->streamid,
+		     packet->datastart, packet->dataend, seq == last) < 0 )
+	{
+	  dl_disconnect (destdlcp);
+	  return -1;
+	}
+
+      resent++;
+    }
+
+  confirmed = last;
+
+  return 0;
+}  /* End of window_resend() */
+
+
+/***************************************************************************
+ * replay_capture:
+ *
+ * Forward the packets of a capture to the destination, paced by their
+ * receive times at replayspeed times the original rate, or as fast
+ * as possible when replayspeed is 0, and close the capture.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+replay_capture (Capture *replay, char *packetdata, size_t maxdatasize)
+{
+  DLPacket packet;
+  dltime_t received;
+  dltime_t first = 0;
+  dltime_t start = 0;
+  dltime_t due;
+  dltime_t now;
+  int rv = 0;
+
+  while ( ! srcdlcp->terminate &&
+	  (rv = capture_read (replay, &packet, packetdata, maxdatasize, &received)) == 1 )
+    {
+      if ( ! start )
+	{
+	  first = received;
+	  start = dlp_time ();
+	}
+
+      /* Sleep until due, waking at least every 0.1 seconds to check for termination */
+      if ( replayspeed > 0 )
+	{
+	  due = start + (dltime_t) ((received - first) / replayspeed);
+
+	  while ( ! srcdlcp->terminate && (now = dlp_time ()) < due )
+	    dlp_usleep ((due - now > 100000) ? 100000 : (unsigned long int) (due - now));
+
+	  if ( srcdlcp->terminate )
+	    break;
+	}
+
+      forward_packet (&packet, packetdata, (latency) ? dlp_time () : 0);
+    }
+
+  dl_log (1, 1, "Replayed %llu packets from %s in %.3f seconds\n",
+	  (unsigned long long int) replay->packets, replayfile,
+	  (start) ? (double) (dlp_time () - start) / DLTMODULUS : 0.0);
+
+  capture_close (replay);
+
+  return (rv < 0) ? -1 : 0;
+}  /* End of replay_capture() */
+
+
+/***************************************************************************
+ * write_packet:
+ *
+ * Write a packet to the destination, with an acknowledgement if ack is
+ * true or a deferred one if defer is true, never with -splice as
+ * -window excludes it, and count it in the metrics and the latency
+ * histograms.  With acknowledgements the time the packet was sent,
+ * before waiting for the acknowledgement, is taken from the
+ * destination connection.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+write_packet (DLPacket *packet, char *packetdata, dltime_t received, dltime_t enqueued,
+	      int ack, int defer)
+{
+  dltime_t start = 0;
+  dltime_t end = 0;
+  dltime_t sent = 0;
+  int64_t rv;
+
+  if ( latency || (metricsaddr && writeack) )
+    start = dlp_time ();
+
+  if ( splicemode )
+    rv = dl_write_splice (destdlcp, srcdlcp, packet, ack);
+  else if ( defer )
+    rv = dl_write_deferack (destdlcp, packetdata, packet->datasize, packet->streamid,
+			    packet->datastart, packet->dataend);
+  else
+    rv = dl_write (destdlcp, packetdata, packet->datasize, packet->streamid,
+		   packet->datastart, packet->dataend, ack);
+
+  if ( rv < 0 )
+    return -1;
+
+  if ( start )
+    {
+      end  = dlp_time ();
+      sent = (writeack && destdlcp->sendtime >= start) ? destdlcp->sendtime : end;
+    }
+
+  metrics_forwarded (packet, (writeack && start) ? end - sent : 0);
+
+  if ( latency )
+    latency_record (packet, received, enqueued, sent, (writeack) ? end : 0);
+
+  return 0;
+}  /* End of write_packet() */
+
+
+/***************************************************************************
+ * log_stats:
+ *
+ * Log the statistics counters of a connection, in verbose mode.
+ ***************************************************************************/
+static void
+log_stats (DLCP *dlconn, const char *role)
+{
+  DLStats stats;
+
+  if ( verbose < 1 || dl_getstats (dlconn, &stats) )
+    return;
+
+  dl_log (1, 1, "[%s] %s: received %llu packets, %llu bytes in %llu calls, "
+	  "sent %llu packets, %llu bytes in %llu calls\n",
+	  dlconn->addr, role,
+	  (unsigned long long int) stats.packetsrecv,
+	  (unsigned long long int) stats.bytesrecv,
+	  (unsigned long long int) stats.recvcalls,
+	  (unsigned long long int) stats.packetssent,
+	  (unsigned long long int) stats.bytessent,
+	  (unsigned long long int) stats.sendcalls);
+  dl_log (1, 1, "[%s] %s: %llu connects, %llu failed, %llu keepalives, "
+	  "%llu timeouts, %llu I/O errors\n",
+	  dlconn->addr, role,
+	  (unsigned long long int) stats.connects,
+	  (unsigned long long int) stats.connfails,
+	  (unsigned long long int) stats.keepalives,
+	  (unsigned long long int) stats.timeouts,
+	  (unsigned long long int) stats.ioerrors);
+}  /* End of log_stats() */
+
+
+/***************************************************************************
+ * stop_asynclog:
+ *
+ * Write pending log messages and stop the background log writer,
+ * registered with atexit().
+ ***************************************************************************/
+static void
+stop_asynclog (void)
+{
+  dl_logasync_stop (NULL);
+}
+
+
 /***************************************************************************
  * usage:
  * Print the usage message and exit.
@@ -408,21 +1449,74 @@ usage (void)
 {
   fprintf (stderr, "%s version %s\n\n", PACKAGE, VERSION);
   fprintf (stderr, "Copy selected data from one DataLink server to another\n\n");
-  fprintf (stderr, "Usage: %s [options] srchost desthost\n\n", PACKAGE);
+  fprintf (stderr, "Usage: %s [options] srchost desthost\n", PACKAGE);
+  fprintf (stderr, "       %s [options] -replay file desthost\n\n", PACKAGE);
   fprintf (stderr,
 	   " ## General options ##\n"
 	   " -V              Report program version\n"
 	   " -h              Print this usage message\n"
 	   " -v              Be more verbose, multiple flags can be used\n"
 	   " -x sfile[:int]  Save/restore stream state information to this file\n"
+	   " -jsonlog file   Write log messages as JSON lines to file, '-' for stdout\n"
+	   " -logsample N    Log one of every N forwarded packets per stream with -vv\n"
+	   " -lograte rate[:burst]  Limit per-packet and repeated error messages to\n"
+	   "                   rate per second, bursts up to burst, default unlimited\n"
 	   "\n"
 	   " ## Data stream selection ##\n"
 	   " -m match        Specify stream ID matching pattern\n"
 	   " -r reject       Specify stream ID rejecting pattern\n"
 	   "                   Default is all data streams\n"
 	   "\n"
-	   " srchost   Address of the source DataLink server in host:port format\n\n"
-	   " desthost  Address of the destination DataLink server in host:port format\n\n"
+	   " ## Socket tuning, applied to both connections ##\n"
+	   " -rcvbuf bytes   Set socket receive buffer size, 'k' and 'm' suffixes allowed\n"
+	   " -sndbuf bytes   Set socket send buffer size, 'k' and 'm' suffixes allowed\n"
+	   " -autobuf        Grow socket buffers from measured RTT and throughput\n"
+	   " -nodelay        Disable Nagle's algorithm (TCP_NODELAY)\n"
+	   " -quickack       Request immediate TCP ACKs (TCP_QUICKACK)\n"
+	   " -usertimeout ms Drop connection if sent data is unacknowledged for ms\n"
+	   " -tcpka idle[:intvl[:cnt]]  Enable kernel TCP keepalive probes\n"
+	   " -busypoll us    Busy poll for up to us microseconds on receive\n"
+	   " -conntimeout ms Abandon each connection attempt after ms, default 10000\n"
+	   " -resolvettl secs  Re-use resolved addresses for secs, default 300, 0 disables\n"
+	   " -iouring        Use io_uring for socket I/O if libdali was built with it\n"
+	   " -splice         Relay packet payloads between sockets with splice()\n"
+	   " -ack            Request and wait for write acknowledgements from desthost\n"
+	   " -window packets Keep packets written to desthost and resend those not\n"
+	   "                   confirmed after re-connecting, without -ack\n"
+	   " -confirm packets  Confirm the window with an acknowledgement every\n"
+	   "                   packets packets, default 1000 or half the window\n"
+	   "\n"
+	   " ## Flight recorder ##\n"
+	   " -trace records  Number of recent events to record, default 65536, 0 disables\n"
+	   " -tracefile file Write recorded events to file on SIGUSR2 or a crash,\n"
+	   "                   default dali2dali.trace, decode with dalitrace\n"
+	   "\n"
+	   " ## Monitoring ##\n"
+	   " -metrics [host:]port  Serve Prometheus metrics over HTTP at /metrics,\n"
+	   "                   localhost unless a host is given\n"
+	   " -latency        Record latency histograms of the forwarding stages,\n"
+	   "                   written to stderr on SIGUSR1 and served with -metrics\n"
+	   " -streamlatency  Also record latency histograms per stream\n"
+	   " -profile        Time the stages of collecting and writing packets,\n"
+	   "                   written to stderr on SIGUSR1 and at exit\n"
+	   "\n"
+	   " ## Capture and replay ##\n"
+	   " -capture file   Write received packets with their receive times to file\n"
+	   " -replay file    Forward the packets of a capture file instead of collecting\n"
+	   "                   from srchost, only desthost is given\n"
+	   " -speed factor   Replay at factor times the captured rate, default 1,\n"
+	   "                   'max' for as fast as possible\n"
+	   "\n"
+	   " ## Embedded server ##\n"
+	   " -serve [host:]port  Serve received packets to DataLink clients from a ring,\n"
+	   "                       localhost unless a host is given\n"
+	   " -servering packets  Number of packets kept in the ring, default 65536\n"
+	   " -servemem bytes     Packet data kept in the ring, default 32m, 'k' and\n"
+	   "                       'm' suffixes allowed\n"
+	   " -serveclients count Clients served at a time, default 100\n"
+	   "\n"
+	   " srchost   Address of the source DataLink server in host:port or unix:/path format\n\n"
+	   " desthost  Address of the destination DataLink server in host:port or unix:/path format\n\n"
 	   "             Default host is 'localhost' and default port is '16000'\n\n");
 
 }  /* End of usage() */
@@ -0,0 +1,597 @@
+/***************************************************************************
+ * daliload.c
+ *
+ * A synthetic load generator for DataLink servers and relays.
+ *
+ * Packets of a fixed size are written for a number of stream IDs at a
+ * target aggregate rate over one or more connections, each written by
+ * its own thread.  Pacing is open-loop: every packet has a scheduled
+ * send time derived from the rate and a slow server does not slow
+ * the schedule, packets that fall behind are sent as soon as
+ * possible.  Write latency is measured from the scheduled time, so
+ * queueing behind a slow server is included, and the time spent in
+ * each write is measured separately.  Packets can be sent in bursts
+ * with the same scheduled time.
+ *
+ * This code requires a POSIX system and C11 atomics.
+ ***************************************************************************/
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libdali.h>
+
+#define PACKAGE   "daliload"
+#define VERSION   "0.4"
+
+#define LOAD_MAXCONNS 256     /* Most connections */
+#define LOAD_MAXSLEEP 100000  /* Longest sleep in microseconds, for termination checks */
+
+/* Writing thread and its connection */
+typedef struct LoadWorker_s {
+  pthread_t   thread;
+  int         id;
+  DLCP       *dlconn;
+  int64_t     quota;          /* Packets to write, 0 for no limit */
+  atomic_uint_fast64_t sent;  /* Packets written */
+  atomic_uint_fast64_t errors; /* Write and connection errors */
+  atomic_int  done;
+  dltime_t    finished;       /* Time of the last write, set before done */
+  DLHistogram latency;        /* Scheduled time to write completion */
+  DLHistogram service;        /* Time in the write */
+} LoadWorker;
+
+static int   parameter_proc (int argcount, char **argvec);
+static char *getoptval (int argcount, char **argvec, int argopt);
+static void *write_thread (void *arg);
+static int   reconnect (LoadWorker *worker);
+static void  report (LoadWorker *workers, double seconds);
+static void  report_latency (const char *name, const DLHistogram *hist);
+static void  hist_add (DLHistogram *total, const DLHistogram *hist);
+static void  term_handler (int sig);
+static void  usage (void);
+
+static volatile sig_atomic_t terminate = 0;
+
+static short int verbose   = 0;
+static char  *destaddr     = NULL;
+static int    streams      = 1000;    /* Number of stream IDs */
+static double rate         = 1000.0;  /* Aggregate packets per second */
+static int    burst        = 1;       /* Packets scheduled together */
+static int    packetsize   = 512;     /* Packet data size */
+static int64_t count       = 0;       /* Packets to write, 0 for no limit */
+static double duration     = 0.0;     /* Seconds to write, 0 for no limit */
+static int    ack          = 0;       /* Request write acknowledgements */
+static int    connections  = 1;       /* Number of connections */
+static int    interval     = 10;      /* Seconds between progress reports, 0 to disable */
+
+static dltime_t starttime  = 0;       /* Scheduled time of the first packet */
+
+
+int
+main (int argc, char **argv)
+{
+  struct sigaction sa;
+  LoadWorker *workers;
+  dltime_t now;
+  dltime_t nextreport;
+  uint64_t sent;
+  uint64_t lastsent = 0;
+  uint64_t errors;
+  int running;
+  int idx;
+
+  /* Process specified parameters */
+  if ( parameter_proc (argc, argv) < 0 )
+    {
+      fprintf (stderr, "Argument processing failed\n");
+      fprintf (stderr, "Try '-h' for detailed help\n");
+      return 1;
+    }
+
+  dl_loginit (verbose, NULL, NULL, NULL, NULL);
+
+  sa.sa_flags = 0;
+  sigemptyset (&sa.sa_mask);
+
+  sa.sa_handler = term_handler;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  sa.sa_handler = SIG_IGN;
+  sigaction (SIGPIPE, &sa, NULL);
+
+  if ( ! (workers = (LoadWorker *) calloc (connections, sizeof(LoadWorker))) )
+    {
+      fprintf (stderr, "Cannot allocate connections\n");
+      return 1;
+    }
+
+  /* Connect all before any packet is scheduled */
+  for (idx = 0; idx < connections; idx++)
+    {
+      workers[idx].id = idx;
+
+      if ( count > 0 )
+	workers[idx].quota = count / connections + ((idx < count % connections) ? 1 : 0);
+
+      if ( ! (workers[idx].dlconn = dl_newdlcp (destaddr, PACKAGE)) )
+	{
+	  fprintf (stderr, "Cannot allocate DataLink descriptor\n");
+	  return 1;
+	}
+
+      if ( dl_connect (workers[idx].dlconn) < 0 )
+	{
+	  fprintf (stderr, "Error connecting to server: %s\n", destaddr);
+	  return 1;
+	}
+    }
+
+  starttime = dlp_time ();
+
+  for (idx = 0; idx < connections; idx++)
+    {
+      if ( pthread_create (&workers[idx].thread, NULL, write_thread, &workers[idx]) )
+	{
+	  fprintf (stderr, "Cannot start writing thread\n");
+	  return 1;
+	}
+    }
+
+  /* Report progress until all threads are done */
+  nextreport = starttime + (dltime_t) interval * DLTMODULUS;
+  running = connections;
+
+  while ( running )
+    {
+      dlp_usleep (LOAD_MAXSLEEP);
+
+      sent = errors = 0;
+      running = 0;
+
+      for (idx = 0; idx < connections; idx++)
+	{
+	  sent += atomic_load_explicit (&workers[idx].sent, memory_order_relaxed);
+	  errors += atomic_load_explicit (&workers[idx].errors, memory_order_relaxed);
+	  running += ! atomic_load_explicit (&workers[idx].done, memory_order_acquire);
+	}
+
+      now = dlp_time ();
+
+      if ( interval > 0 && now >= nextreport && running )
+	{
+	  fprintf (stderr, "%s: %.0f s, %llu packets, %.1f packets/s, %llu errors\n", PACKAGE,
+		   (double) (now - starttime) / DLTMODULUS, (unsigned long long int) sent,
+		   (double) (sent - lastsent) / interval, (unsigned long long int) errors);
+
+	  lastsent = sent;
+	  nextreport += (dltime_t) interval * DLTMODULUS;
+	}
+    }
+
+  /* The run ends with the last write of any thread */
+  now = starttime;
+
+  for (idx = 0; idx < connections; idx++)
+    {
+      pthread_join (workers[idx].thread, NULL);
+
+      if ( workers[idx].finished > now )
+	now = workers[idx].finished;
+
+      if ( workers[idx].dlconn->link != -1 )
+	dl_disconnect (workers[idx].dlconn);
+    }
+
+  report (workers, (double) (now - starttime) / DLTMODULUS);
+
+  for (idx = 0; idx < connections; idx++)
+    dl_freedlcp (workers[idx].dlconn);
+
+  free (workers);
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * write_thread:
+ *
+ * Write packets on the schedule of a worker until its quota, the
+ * duration or termination.  Packets of all workers are interleaved
+ * on one schedule at the aggregate rate: packet K of worker N is
+ * packet K * connections + N of the schedule, so workers are offset
+ * from each other by 1 / rate, and worker N writes streams N,
+ * N + connections, N + 2 * connections and so on.
+ ***************************************************************************/
+static void *
+write_thread (void *arg)
+{
+  LoadWorker *worker = (LoadWorker *) arg;
+  char streamid[MAXSTREAMID];
+  char *data;
+  dltime_t span = (dltime_t) ((double) streams * DLTMODULUS / rate);
+  dltime_t endtime = (duration > 0.0) ? starttime + (dltime_t) (duration * DLTMODULUS) : 0;
+  dltime_t scheduled;
+  dltime_t now;
+  dltime_t written;
+  int64_t packet = 0;
+  int stream;
+  int idx;
+
+  if ( ! (data = (char *) malloc (packetsize)) )
+    {
+      worker->finished = dlp_time ();
+      atomic_store_explicit (&worker->done, 1, memory_order_release);
+      return NULL;
+    }
+
+  /* Deterministic payload */
+  for (idx = 0; idx < packetsize; idx++)
+    data[idx] = (char) (idx * 31 + 7);
+
+  while ( ! terminate && (! worker->quota || packet < worker->quota) )
+    {
+      /* All packets of a burst share the scheduled time of its first */
+      scheduled = starttime + (dltime_t) (((double) (packet - packet % burst) * connections + worker->id)
+					  * DLTMODULUS / rate);
+
+      if ( endtime && scheduled >= endtime )
+	break;
+
+      /* Sleep until scheduled, sending immediately when behind */
+      while ( ! terminate && (now = dlp_time ()) < scheduled )
+	dlp_usleep ((scheduled - now > LOAD_MAXSLEEP) ? LOAD_MAXSLEEP : (unsigned long) (scheduled - now));
+
+      if ( terminate )
+	break;
+
+      now = dlp_time ();
+
+      stream = (int) ((worker->id + packet * connections) % streams);
+      snprintf (streamid, sizeof(streamid), "XX_S%04d_%02d_HHZ/MSEED",
+		stream % 10000, (stream / 10000) % 100);
+
+      /* Data ends now and spans the interval between packets of the stream */
+      if ( dl_write (worker->dlconn, data, packetsize, streamid, now - span, now, ack) < 0 )
+	{
+	  atomic_fetch_add_explicit (&worker->errors, 1, memory_order_relaxed);
+
+	  if ( reconnect (worker) )
+	    break;
+	}
+      else
+	{
+	  written = dlp_time ();
+
+	  dl_hist_record (&worker->latency, written - scheduled);
+	  dl_hist_record (&worker->service, written - now);
+	  atomic_fetch_add_explicit (&worker->sent, 1, memory_order_relaxed);
+	}
+
+      packet++;
+    }
+
+  free (data);
+
+  worker->finished = dlp_time ();
+  atomic_store_explicit (&worker->done, 1, memory_order_release);
+
+  return NULL;
+}  /* End of write_thread() */
+
+
+/***************************************************************************
+ * reconnect:
+ *
+ * Re-connect a worker after an error, retrying every second.  The
+ * schedule continues meanwhile, packets due are sent late.
+ *
+ * Returns 0 on success and -1 on termination.
+ ***************************************************************************/
+static int
+reconnect (LoadWorker *worker)
+{
+  if ( worker->dlconn->link != -1 )
+    dl_disconnect (worker->dlconn);
+
+  while ( ! terminate )
+    {
+      if ( dl_connect (worker->dlconn) >= 0 )
+	return 0;
+
+      atomic_fetch_add_explicit (&worker->errors, 1, memory_order_relaxed);
+      dlp_usleep (1000000);
+    }
+
+  return -1;
+}  /* End of reconnect() */
+
+
+/***************************************************************************
+ * report:
+ *
+ * Print the achieved rate and the latency percentiles of all
+ * workers.
+ ***************************************************************************/
+static void
+report (LoadWorker *workers, double seconds)
+{
+  static DLHistogram latency;
+  static DLHistogram service;
+  uint64_t sent = 0;
+  uint64_t errors = 0;
+  double achieved;
+  int idx;
+
+  for (idx = 0; idx < connections; idx++)
+    {
+      sent += atomic_load_explicit (&workers[idx].sent, memory_order_relaxed);
+      errors += atomic_load_explicit (&workers[idx].errors, memory_order_relaxed);
+      hist_add (&latency, &workers[idx].latency);
+      hist_add (&service, &workers[idx].service);
+    }
+
+  achieved = (seconds > 0.0) ? sent / seconds : 0.0;
+
+  printf ("%s: %llu packets of %d bytes for %d streams to %s over %d connection(s)%s\n",
+	  PACKAGE, (unsigned long long int) sent, packetsize, streams, destaddr,
+	  connections, (ack) ? " with acknowledgements" : "");
+  printf ("Rate: target %.1f, achieved %.1f packets/s, %.2f MB/s in %.3f seconds, %llu errors\n",
+	  rate, achieved, achieved * packetsize / 1048576.0, seconds,
+	  (unsigned long long int) errors);
+  printf ("Write latency in microseconds       count        p50        p90        p99      p99.9        max\n");
+
+  report_latency ("from schedule", &latency);
+  report_latency ("in write", &service);
+}  /* End of report() */
+
+
+/***************************************************************************
+ * report_latency:
+ *
+ * Print the count, percentiles and maximum of a histogram.
+ ***************************************************************************/
+static void
+report_latency (const char *name, const DLHistogram *hist)
+{
+  printf ("%-30s %11llu %10lld %10lld %10lld %10lld %10lld\n", name,
+	  (unsigned long long int) hist->total,
+	  (long long int) dl_hist_percentile (hist, 50.0),
+	  (long long int) dl_hist_percentile (hist, 90.0),
+	  (long long int) dl_hist_percentile (hist, 99.0),
+	  (long long int) dl_hist_percentile (hist, 99.9),
+	  (long long int) hist->max);
+}  /* End of report_latency() */
+
+
+/***************************************************************************
+ * hist_add:
+ *
+ * Add the values of a histogram to a total, the recording thread
+ * must be done.
+ ***************************************************************************/
+static void
+hist_add (DLHistogram *total, const DLHistogram *hist)
+{
+  int idx;
+
+  for (idx = 0; idx < DL_HIST_COUNTS; idx++)
+    total->counts[idx] += hist->counts[idx];
+
+  total->total += hist->total;
+  total->sum += hist->sum;
+
+  if ( hist->max > total->max )
+    total->max = hist->max;
+}  /* End of hist_add() */
+
+
+/***************************************************************************
+ * parameter_proc:
+ *
+ * Process the command line parameters.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+parameter_proc (int argcount, char **argvec)
+{
+  int optind;
+
+  /* Process all command line arguments */
+  for (optind = 1; optind < argcount; optind++)
+    {
+      if (strcmp (argvec[optind], "-V") == 0)
+	{
+	  fprintf (stderr, "%s version: %s\n", PACKAGE, VERSION);
+	  exit (0);
+	}
+      else if (strcmp (argvec[optind], "-h") == 0)
+	{
+	  usage ();
+	  exit (0);
+	}
+      else if (strncmp (argvec[optind], "-v", 2) == 0)
+	{
+	  verbose += strspn (&argvec[optind][1], "v");
+	}
+      else if (strcmp (argvec[optind], "-streams") == 0)
+	{
+	  streams = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-rate") == 0)
+	{
+	  rate = atof (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-burst") == 0)
+	{
+	  burst = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-size") == 0)
+	{
+	  packetsize = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-count") == 0)
+	{
+	  count = atoll (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-duration") == 0)
+	{
+	  duration = atof (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-conns") == 0)
+	{
+	  connections = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-interval") == 0)
+	{
+	  interval = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-ack") == 0)
+	{
+	  ack = 1;
+	}
+      else if (strncmp (argvec[optind], "-", 1) == 0 &&
+	       strlen (argvec[optind]) > 1 )
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  exit (1);
+	}
+      else if ( ! destaddr )
+	{
+	  destaddr = argvec[optind];
+	}
+      else
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  exit (1);
+	}
+    }
+
+  if ( ! destaddr )
+    {
+      fprintf (stderr, "No destination DataLink server specified\n\n");
+      usage ();
+      return -1;
+    }
+
+  if ( streams <= 0 || streams > 1000000 )
+    {
+      fprintf (stderr, "Streams must be between 1 and 1000000\n");
+      return -1;
+    }
+
+  if ( rate <= 0.0 )
+    {
+      fprintf (stderr, "Rate must be positive\n");
+      return -1;
+    }
+
+  if ( burst <= 0 )
+    {
+      fprintf (stderr, "Burst must be at least 1 packet\n");
+      return -1;
+    }
+
+  if ( packetsize <= 0 || packetsize > MAXPACKETSIZE - 258 )
+    {
+      fprintf (stderr, "Packet size must be between 1 and %d\n", MAXPACKETSIZE - 258);
+      return -1;
+    }
+
+  if ( count < 0 || duration < 0.0 || interval < 0 )
+    {
+      fprintf (stderr, "Count, duration and interval cannot be negative\n");
+      return -1;
+    }
+
+  if ( connections <= 0 || connections > LOAD_MAXCONNS )
+    {
+      fprintf (stderr, "Connections must be between 1 and %d\n", LOAD_MAXCONNS);
+      return -1;
+    }
+
+  return 0;
+}  /* End of parameter_proc() */
+
+
+/***************************************************************************
+ * getoptval:
+ * Return the value to a command line option; checking that the value is
+ * itself not an option (starting with '-') and is not past the end of
+ * the argument list.
+ *
+ * argcount: total arguments in argvec
+ * argvec: argument list
+ * argopt: index of option to process, value is expected to be at +1
+ *
+ * Returns value on success and exits with error message on failure
+ ***************************************************************************/
+static char *
+getoptval (int argcount, char **argvec, int argopt)
+{
+  if ( argvec == NULL || argvec[argopt] == NULL ) {
+    fprintf (stderr, "getoptval(): NULL option requested\n");
+    exit (1);
+  }
+
+  if ( (argopt+1) < argcount && *argvec[argopt+1] != '-' )
+    return argvec[argopt+1];
+
+  fprintf (stderr, "Option %s requires a value\n", argvec[argopt]);
+  exit (1);
+}  /* End of getoptval() */
+
+
+/***************************************************************************
+ * term_handler:
+ * Signal handler routine.
+ ***************************************************************************/
+static void
+term_handler (int sig)
+{
+  terminate = 1;
+}
+
+
+/***************************************************************************
+ * usage:
+ * Print the usage message and exit.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "%s version: %s\n\n", PACKAGE, VERSION);
+  fprintf (stderr, "Write synthetic packets to a DataLink server at a target rate\n\n");
+  fprintf (stderr, "Usage: %s [options] desthost\n\n", PACKAGE);
+  fprintf (stderr,
+	   " ## General options ##\n"
+	   " -V             Report program version\n"
+	   " -h             Show this usage message\n"
+	   " -v             Be more verbose, multiple flags can be used\n"
+	   " -interval secs Seconds between progress reports to stderr, default 10,\n"
+	   "                  0 disables\n"
+	   "\n"
+	   " ## Load options ##\n"
+	   " -streams count Number of stream IDs, default 1000\n"
+	   " -rate pps      Aggregate packets per second, default 1000\n"
+	   " -burst count   Packets sent together at each scheduled time, default 1\n"
+	   " -size bytes    Packet data size, default 512\n"
+	   " -count packets Stop after this many packets, default no limit\n"
+	   " -duration secs Stop after this many seconds, default no limit\n"
+	   " -conns count   Number of connections, each written by a thread, default 1\n"
+	   " -ack           Request and wait for write acknowledgements\n"
+	   "\n"
+	   " desthost  Address of the destination DataLink server in host:port or unix:/path format\n"
+	   "\n"
+	   "Packets are scheduled open-loop at the rate, latency is measured from\n"
+	   "the scheduled time so it includes time spent behind schedule\n"
+	   "\n");
+}  /* End of usage() */
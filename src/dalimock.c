@@ -0,0 +1,555 @@
+/***************************************************************************
+ * dalimock.c
+ *
+ * A mock DataLink server for testing and benchmarking on one machine.
+ *
+ * Packets written by clients, or generated at a fixed rate, are kept
+ * in an in-memory ring and served with the DataLink commands ID,
+ * POSITION SET/AFTER, MATCH, REJECT, WRITE, READ, STREAM, ENDSTREAM
+ * and INFO by the shared DataLink server in server.c.  Each
+ * connection is served by its own thread, streaming connections wait
+ * on a condition variable for new packets.  Replies to commands may
+ * be delayed to model a slower server.
+ *
+ * This code requires a POSIX system.
+ ***************************************************************************/
+
+#include <regex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <libdali.h>
+
+#include "server.h"
+
+#define PACKAGE   "dalimock"
+#define VERSION   "0.4"
+
+#define MOCK_STREAMS 4096    /* Stream table size for INFO STREAMS, a power of 2 */
+
+static int   parameter_proc (int argcount, char **argvec);
+static char *getoptval (int argcount, char **argvec, int argopt);
+static int   send_info (Server *server, ServerClient *client, const char *type, const char *match);
+static void *generate_thread (void *arg);
+static void  term_handler (int sig);
+static void  usage (void);
+
+static volatile sig_atomic_t terminate = 0;
+
+static short int verbose     = 0;
+static char  *listenaddr     = "localhost:16000";
+static int    packetsize     = 512;     /* Maximum packet data size */
+static int64_t ringpackets   = 65536;   /* Packets in the ring */
+static int    maxclients     = 1000;    /* Clients served at a time */
+static unsigned long replydelay = 0;    /* Delay before each command reply, microseconds */
+static double genrate        = 0.0;     /* Generated packets per second, 0 to disable */
+static int    genstreams     = 1;       /* Number of generated streams */
+static int    gensize        = 512;     /* Data size of generated packets */
+static int64_t gencount      = 0;       /* Packets to generate, 0 for no limit */
+static int    genwait        = 0;       /* Start generating when a client streams */
+static dltime_t starttime    = 0;
+
+static Server *server;
+
+
+int
+main (int argc, char **argv)
+{
+  struct sigaction sa;
+  char serverid[100];
+  char bound[300];
+  int listener;
+
+  /* Process specified parameters */
+  if ( parameter_proc (argc, argv) < 0 )
+    {
+      fprintf (stderr, "Argument processing failed\n");
+      fprintf (stderr, "Try '-h' for detailed help\n");
+      return 1;
+    }
+
+  /* Log to stderr, stdout is for the address listened on */
+  dl_loginit (verbose, NULL, PACKAGE ": ", NULL, PACKAGE ": ");
+
+  sa.sa_flags = 0;
+  sigemptyset (&sa.sa_mask);
+
+  sa.sa_handler = term_handler;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  sa.sa_handler = SIG_IGN;
+  sigaction (SIGPIPE, &sa, NULL);
+
+  /* Allocate the server and its ring, writable with INFO */
+  snprintf (serverid, sizeof(serverid), "%s/%s", PACKAGE, VERSION);
+
+  if ( ! (server = server_new (serverid, ringpackets, (size_t) ringpackets * packetsize, packetsize)) )
+    {
+      fprintf (stderr, "Cannot allocate a ring of %lld packets of %d bytes\n",
+	       (long long int) ringpackets, packetsize);
+      return 1;
+    }
+
+  server->writable   = 1;
+  server->replydelay = replydelay;
+  server->info       = send_info;
+
+  starttime = dlp_time ();
+
+  if ( (listener = server_listen (listenaddr, 64, bound, sizeof(bound))) < 0 )
+    return 1;
+
+  /* Print the address to connect to for scripts, an ephemeral port 0 resolved */
+  printf ("%s listening on %s\n", PACKAGE, bound);
+  fflush (stdout);
+
+  if ( server_start (server, listener, maxclients) )
+    return 1;
+
+  /* Generate packets from a separate thread */
+  if ( genrate > 0.0 && server_spawn (generate_thread, NULL) )
+    return 1;
+
+  /* Server threads have signals blocked, wait for termination here */
+  while ( ! terminate )
+    dlp_usleep (100000);
+
+  close (listener);
+
+  if ( ! strncmp (listenaddr, "unix:", 5) )
+    unlink (listenaddr + 5);
+
+  if ( verbose )
+    {
+      pthread_mutex_lock (&server->lock);
+      fprintf (stderr, "%s: %lld packets in ring, %llu connections served, %llu refused\n", PACKAGE,
+	       (long long int) (server->ring->next - server->ring->first),
+	       (unsigned long long int) server->totalclients,
+	       (unsigned long long int) server->refused);
+      pthread_mutex_unlock (&server->lock);
+    }
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * send_info:
+ *
+ * Send an INFO reply with an XML document for STATUS, STREAMS or
+ * CONNECTIONS.  Streams are found by scanning the ring and may be
+ * limited to those matching a pattern.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+send_info (Server *server, ServerClient *client, const char *type, const char *match)
+{
+  typedef struct InfoStream_s {
+    char    streamid[MAXSTREAMID];
+    int64_t earliest;
+    int64_t latest;
+  } InfoStream;
+
+  InfoStream *streams = NULL;
+  const DLRingPacket *packet;
+  regex_t regex;
+  char header[256];
+  char starttimestr[40];
+  char *xml = NULL;
+  size_t xmlsize = 4096;
+  size_t length = 0;
+  uint32_t hash;
+  const char *cp;
+  int64_t earliest;
+  int64_t latest;
+  int64_t idx;
+  int nstreams = 0;
+  int probe;
+  int slot;
+  int rv;
+
+  if ( strcasecmp (type, "STATUS") && strcasecmp (type, "STREAMS") &&
+       strcasecmp (type, "CONNECTIONS") )
+    return server_reply (client, "ERROR", 0, "Unsupported INFO type");
+
+  if ( *match && regcomp (&regex, match, REG_EXTENDED | REG_NOSUB) )
+    return server_reply (client, "ERROR", 0, "Cannot compile pattern");
+
+  if ( ! strcasecmp (type, "STREAMS") &&
+       ! (streams = (InfoStream *) calloc (MOCK_STREAMS, sizeof(InfoStream))) )
+    return -1;
+
+  pthread_mutex_lock (&server->lock);
+
+  earliest = (server->ring->first < server->ring->next) ? server->ring->first : 0;
+  latest   = server->ring->next - 1;
+
+  /* Collect the earliest and latest packet of each stream */
+  for (idx = earliest; streams && idx && idx <= latest; idx++)
+    {
+      packet = dl_ring_get (server->ring, idx, NULL);
+
+      for (hash = 2166136261u, cp = packet->streamid; *cp; cp++)
+	hash = (hash ^ (unsigned char) *cp) * 16777619u;
+
+      for (probe = 0; probe < MOCK_STREAMS; probe++)
+	{
+	  slot = (hash + probe) & (MOCK_STREAMS - 1);
+
+	  if ( ! streams[slot].latest )
+	    {
+	      if ( *match && regexec (&regex, packet->streamid, 0, NULL, 0) )
+		break;
+
+	      snprintf (streams[slot].streamid, MAXSTREAMID, "%s", packet->streamid);
+	      streams[slot].earliest = idx;
+	      streams[slot].latest = idx;
+	      nstreams++;
+	      break;
+	    }
+
+	  if ( ! strcmp (streams[slot].streamid, packet->streamid) )
+	    {
+	      streams[slot].latest = idx;
+	      break;
+	    }
+	}
+    }
+
+  if ( ! (xml = (char *) malloc (xmlsize + (size_t) nstreams * 256)) )
+    {
+      pthread_mutex_unlock (&server->lock);
+      free (streams);
+      return -1;
+    }
+
+  xmlsize += (size_t) nstreams * 256;
+
+  dl_dltime2isotimestr (starttime, starttimestr, 0);
+
+  length += snprintf (xml + length, xmlsize - length,
+		      "<DataLink Version=\"%s\" ServerID=\"%s\" Capabilities=\"DLPROTO:1.0 PACKETSIZE:%d WRITE\">"
+		      "<Status StartTime=\"%s\" RingVersion=\"1\" RingSize=\"%lld\" PacketSize=\"%d\""
+		      " MaximumPacketID=\"%lld\" MaximumPackets=\"%lld\" MemoryMappedRing=\"FALSE\""
+		      " VolatileRing=\"TRUE\" TotalConnections=\"%d\" EarliestPacketID=\"%lld\""
+		      " LatestPacketID=\"%lld\"/>",
+		      VERSION, PACKAGE, packetsize, starttimestr,
+		      (long long int) server->ring->databytes, packetsize,
+		      (long long int) INT64_MAX, (long long int) (server->ring->mask + 1),
+		      server->clients, (long long int) earliest, (long long int) latest);
+
+  if ( streams )
+    {
+      length += snprintf (xml + length, xmlsize - length,
+			  "<StreamList TotalStreams=\"%d\" SelectedStreams=\"%d\">",
+			  nstreams, nstreams);
+
+      for (slot = 0; slot < MOCK_STREAMS; slot++)
+	{
+	  if ( ! streams[slot].latest )
+	    continue;
+
+	  length += snprintf (xml + length, xmlsize - length,
+			      "<Stream Name=\"%s\" EarliestPacketID=\"%lld\" LatestPacketID=\"%lld\""
+			      " LatestPacketDataEndTime=\"%lld\"/>",
+			      streams[slot].streamid, (long long int) streams[slot].earliest,
+			      (long long int) streams[slot].latest,
+			      (long long int) dl_ring_get (server->ring, streams[slot].latest, NULL)->dataend);
+	}
+
+      length += snprintf (xml + length, xmlsize - length, "</StreamList>");
+    }
+  else if ( ! strcasecmp (type, "CONNECTIONS") )
+    {
+      length += snprintf (xml + length, xmlsize - length,
+			  "<ConnectionList TotalConnections=\"%d\" SelectedConnections=\"%d\"/>",
+			  server->clients, server->clients);
+    }
+
+  length += snprintf (xml + length, xmlsize - length, "</DataLink>");
+
+  pthread_mutex_unlock (&server->lock);
+
+  snprintf (header, sizeof(header), "INFO %s %d", type, (int) length + 1);
+  rv = server_send (client, header, xml, length + 1);
+
+  if ( *match )
+    regfree (&regex);
+  free (streams);
+  free (xml);
+
+  return rv;
+}  /* End of send_info() */
+
+
+/***************************************************************************
+ * generate_thread:
+ *
+ * Add packets to the ring at genrate packets per second, cycling
+ * through genstreams streams, until gencount packets are generated.
+ ***************************************************************************/
+static void *
+generate_thread (void *arg)
+{
+  DLPacket packet;
+  char *data;
+  dltime_t start;
+  dltime_t now;
+  dltime_t next;
+  int64_t generated = 0;
+  int64_t due;
+  int idx;
+
+  if ( ! (data = (char *) malloc (gensize)) )
+    return NULL;
+
+  memset (&packet, 0, sizeof(packet));
+  packet.datasize = gensize;
+
+  /* Deterministic payload */
+  for (idx = 0; idx < gensize; idx++)
+    data[idx] = (char) (idx * 31 + 7);
+
+  /* Wait for a client to start streaming if requested */
+  while ( genwait && ! terminate )
+    {
+      pthread_mutex_lock (&server->lock);
+      genwait = ! server->streamed;
+      pthread_mutex_unlock (&server->lock);
+
+      if ( genwait )
+	dlp_usleep (1000);
+    }
+
+  start = dlp_time ();
+
+  while ( ! terminate && (! gencount || generated < gencount) )
+    {
+      now = dlp_time ();
+      due = (int64_t) ((double) (now - start) * genrate / DLTMODULUS) + 1;
+
+      while ( generated < due && (! gencount || generated < gencount) )
+	{
+	  snprintf (packet.streamid, sizeof(packet.streamid), "XX_MK%03d_00_HHZ/MSEED",
+		    (int) (generated % genstreams));
+
+	  /* Data ends at generation, a reference for end-to-end latency */
+	  now = dlp_time ();
+	  packet.datastart = now - DLTMODULUS;
+	  packet.dataend   = now;
+	  server_add (server, &packet, data);
+	  generated++;
+	}
+
+      /* Sleep until the next packet is due, at most 0.1 seconds */
+      next = start + (dltime_t) ((double) generated * DLTMODULUS / genrate);
+      now = dlp_time ();
+
+      if ( next > now )
+	dlp_usleep ((next - now > 100000) ? 100000 : (unsigned long) (next - now));
+    }
+
+  if ( verbose )
+    fprintf (stderr, "%s: generated %lld packets\n", PACKAGE, (long long int) generated);
+
+  free (data);
+
+  return NULL;
+}  /* End of generate_thread() */
+
+
+/***************************************************************************
+ * parameter_proc:
+ *
+ * Process the command line parameters.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+parameter_proc (int argcount, char **argvec)
+{
+  int optind;
+
+  /* Process all command line arguments */
+  for (optind = 1; optind < argcount; optind++)
+    {
+      if (strcmp (argvec[optind], "-V") == 0)
+	{
+	  fprintf (stderr, "%s version: %s\n", PACKAGE, VERSION);
+	  exit (0);
+	}
+      else if (strcmp (argvec[optind], "-h") == 0)
+	{
+	  usage ();
+	  exit (0);
+	}
+      else if (strncmp (argvec[optind], "-v", 2) == 0)
+	{
+	  verbose += strspn (&argvec[optind][1], "v");
+	}
+      else if (strcmp (argvec[optind], "-p") == 0)
+	{
+	  listenaddr = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-packetsize") == 0)
+	{
+	  packetsize = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-ring") == 0)
+	{
+	  ringpackets = atoll (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-clients") == 0)
+	{
+	  maxclients = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-delay") == 0)
+	{
+	  replydelay = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	}
+      else if (strcmp (argvec[optind], "-rate") == 0)
+	{
+	  genrate = atof (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-streams") == 0)
+	{
+	  genstreams = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-size") == 0)
+	{
+	  gensize = atoi (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-count") == 0)
+	{
+	  gencount = atoll (getoptval(argcount, argvec, optind++));
+	}
+      else if (strcmp (argvec[optind], "-waitstream") == 0)
+	{
+	  genwait = 1;
+	}
+      else
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  exit (1);
+	}
+    }
+
+  if ( packetsize <= 0 || packetsize > MAXPACKETSIZE - 258 )
+    {
+      fprintf (stderr, "Packet size must be between 1 and %d\n", MAXPACKETSIZE - 258);
+      return -1;
+    }
+
+  if ( ringpackets <= 0 )
+    {
+      fprintf (stderr, "Ring size must be at least 1 packet\n");
+      return -1;
+    }
+
+  if ( maxclients <= 0 )
+    {
+      fprintf (stderr, "Client limit must be at least 1\n");
+      return -1;
+    }
+
+  if ( genstreams <= 0 || genstreams > 1000 )
+    {
+      fprintf (stderr, "Generated streams must be between 1 and 1000\n");
+      return -1;
+    }
+
+  if ( gensize < 0 || gensize > packetsize )
+    {
+      fprintf (stderr, "Generated packet size must be between 0 and the packet size, %d\n",
+	       packetsize);
+      return -1;
+    }
+
+  if ( genrate < 0.0 )
+    {
+      fprintf (stderr, "Generation rate cannot be negative\n");
+      return -1;
+    }
+
+  return 0;
+}  /* End of parameter_proc() */
+
+
+/***************************************************************************
+ * getoptval:
+ * Return the value to a command line option; checking that the value is
+ * itself not an option (starting with '-') and is not past the end of
+ * the argument list.
+ *
+ * argcount: total arguments in argvec
+ * argvec: argument list
+ * argopt: index of option to process, value is expected to be at +1
+ *
+ * Returns value on success and exits with error message on failure
+ ***************************************************************************/
+static char *
+getoptval (int argcount, char **argvec, int argopt)
+{
+  if ( argvec == NULL || argvec[argopt] == NULL ) {
+    fprintf (stderr, "getoptval(): NULL option requested\n");
+    exit (1);
+  }
+
+  if ( (argopt+1) < argcount && *argvec[argopt+1] != '-' )
+    return argvec[argopt+1];
+
+  fprintf (stderr, "Option %s requires a value\n", argvec[argopt]);
+  exit (1);
+}  /* End of getoptval() */
+
+
+/***************************************************************************
+ * term_handler:
+ * Signal handler routine.
+ ***************************************************************************/
+static void
+term_handler (int sig)
+{
+  terminate = 1;
+}
+
+
+/***************************************************************************
+ * usage:
+ * Print the usage message and exit.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "%s version: %s\n\n", PACKAGE, VERSION);
+  fprintf (stderr, "A mock DataLink server for testing and benchmarking\n\n");
+  fprintf (stderr, "Usage: %s [options]\n\n", PACKAGE);
+  fprintf (stderr,
+	   " ## General options ##\n"
+	   " -V             Report program version\n"
+	   " -h             Show this usage message\n"
+	   " -v             Be more verbose, multiple flags can be used\n"
+	   " -p [host:]port Listen address, default localhost:16000, port 0 for any\n"
+	   "                  free port, or unix:/path for a Unix domain socket;\n"
+	   "                  the address listened on is printed to stdout\n"
+	   "\n"
+	   " ## Server options ##\n"
+	   " -packetsize bytes  Maximum packet data size, default 512\n"
+	   " -ring packets  Number of packets kept in the ring, default 65536\n"
+	   " -clients count Clients served at a time, default 1000\n"
+	   " -delay us      Delay each command reply and write acknowledgement\n"
+	   "\n"
+	   " ## Packet generation ##\n"
+	   " -rate pps      Generate packets at this rate, default 0 (disabled)\n"
+	   " -streams count Number of generated streams, default 1\n"
+	   " -size bytes    Data size of generated packets, default 512\n"
+	   " -count packets Stop generating after this many packets, default no limit\n"
+	   " -waitstream    Start generating when a client starts streaming\n"
+	   "\n");
+}  /* End of usage() */
@@ -0,0 +1,937 @@
+/***************************************************************************
+ * daliproxy.c
+ *
+ * A fault-injecting TCP proxy for testing and benchmarking recovery.
+ *
+ * Connections accepted on the listen address are relayed to an
+ * upstream server, each by its own thread.  Faults are applied on a
+ * schedule relative to the start of the proxy: added delay, a
+ * bandwidth cap and partial writes degrade the link, resets close
+ * both sides of every connection with a TCP RST and half-open windows
+ * stop relaying, leaving the sockets open, until the end of the window
+ * when the held connections are reset.  New connections are not
+ * accepted during a half-open window.
+ *
+ * Relayed data is queued in chunks released at their due time, the
+ * queue bounds the data in flight in each direction and stops reading
+ * when full so the peers see back-pressure.
+ *
+ * This code requires a POSIX system.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <libdali.h>
+
+#include "server.h"
+
+#define PACKAGE   "daliproxy"
+#define VERSION   "0.4"
+
+#define PROXY_CHUNK   16384   /* Largest relayed read */
+#define PROXY_CHUNKS  64      /* Chunks queued in each direction */
+#define PROXY_WAITMS  50      /* Longest wait between checks for faults */
+#define PROXY_FAULTS  32      /* Maximum number of scheduled faults */
+
+/* Types of faults */
+typedef enum {
+  FAULT_DELAY,
+  FAULT_BANDWIDTH,
+  FAULT_PARTIAL,
+  FAULT_RESET,
+  FAULT_HALFOPEN
+} FaultType;
+
+/* Scheduled fault, times relative to the start of the schedule */
+typedef struct Fault_s {
+  FaultType type;
+  double    value;           /* Delay in us, bytes per second or largest write */
+  dltime_t  start;
+  dltime_t  duration;        /* 0 for no end */
+} Fault;
+
+/* Faults in effect at a point of the schedule */
+typedef struct FaultState_s {
+  dltime_t delay;            /* Added delay, microseconds */
+  double   bandwidth;        /* Bytes per second, 0 for no limit */
+  int      partial;          /* Largest write in bytes, 0 for no limit */
+  int      halfopen;         /* Set when relaying is stopped */
+} FaultState;
+
+/* Data read from a peer, written to the other at its due time */
+typedef struct ProxyChunk_s {
+  dltime_t due;
+  size_t   length;
+  size_t   offset;           /* Bytes already written */
+  char     data[PROXY_CHUNK];
+} ProxyChunk;
+
+/* One direction of a relayed connection */
+typedef struct ProxyPipe_s {
+  int         from;
+  int         to;
+  ProxyChunk  chunks[PROXY_CHUNKS];
+  int         head;          /* Index of the oldest queued chunk */
+  int         count;         /* Number of queued chunks */
+  int         eof;           /* Set when the reading side closed */
+  int         done;          /* Set when EOF is passed on */
+  double      tokens;        /* Bandwidth bucket in bytes */
+  dltime_t    refilled;      /* Time of the last bucket refill */
+} ProxyPipe;
+
+/* Relayed connection, pipe 0 from client to server, pipe 1 back */
+typedef struct ProxyConn_s {
+  int        client;
+  int        server;
+  char       addr[100];
+  unsigned int seed;         /* Random sizes of partial writes */
+  ProxyPipe  pipes[2];
+} ProxyConn;
+
+static int   parameter_proc (int argcount, char **argvec);
+static char *getoptval (int argcount, char **argvec, int argopt);
+static int   parse_fault (const char *spec);
+static int   proxy_connect (const char *address);
+static void *relay_thread (void *arg);
+static int   relay_read (ProxyPipe *pipe, dltime_t now, const FaultState *state);
+static int   relay_write (ProxyConn *conn, ProxyPipe *pipe, dltime_t now,
+			  const FaultState *state);
+static void  fault_state (dltime_t now, FaultState *state);
+static dltime_t schedule_time (dltime_t now);
+static void  fire_resets (dltime_t last, dltime_t now);
+static void  reset_close (int sock);
+static void  term_handler (int sig);
+static void  usage (void);
+
+static volatile sig_atomic_t terminate = 0;
+
+static short int verbose     = 0;
+static char  *listenaddr     = "localhost:16001";
+static char  *upstreamaddr   = NULL;
+static Fault  faults[PROXY_FAULTS];
+static int    faultcount     = 0;
+static dltime_t repeat       = 0;       /* Schedule period, 0 to run it once */
+static dltime_t starttime    = 0;
+
+/* Shared counters, the reset generation is advanced by each reset fault */
+static pthread_mutex_t proxylock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t resetgen     = 0;
+static int      connections  = 0;
+static uint64_t totalconns   = 0;
+static uint64_t resetconns   = 0;
+static uint64_t relayed[2]   = { 0, 0 };
+
+
+int
+main (int argc, char **argv)
+{
+  struct sigaction sa;
+  pthread_attr_t attr;
+  pthread_t thread;
+  struct pollfd pfd;
+  FaultState state;
+  ProxyConn *conn;
+  dltime_t last;
+  dltime_t now;
+  char bound[300];
+  int listener;
+  int sock;
+
+  /* Process specified parameters */
+  if ( parameter_proc (argc, argv) < 0 )
+    {
+      fprintf (stderr, "Argument processing failed\n");
+      fprintf (stderr, "Try '-h' for detailed help\n");
+      return 1;
+    }
+
+  sa.sa_flags = 0;
+  sigemptyset (&sa.sa_mask);
+
+  sa.sa_handler = term_handler;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  sa.sa_handler = SIG_IGN;
+  sigaction (SIGPIPE, &sa, NULL);
+
+  if ( (listener = server_listen (listenaddr, 64, bound, sizeof(bound))) < 0 )
+    return 1;
+
+  /* Print the address to connect to for scripts, an ephemeral port 0 resolved */
+  printf ("%s listening on %s\n", PACKAGE, bound);
+  fflush (stdout);
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  starttime = last = dlp_time ();
+
+  /* Accept connections, firing scheduled resets between */
+  pfd.fd = listener;
+  pfd.events = POLLIN;
+
+  while ( ! terminate )
+    {
+      now = dlp_time ();
+      fire_resets (schedule_time (last), schedule_time (now));
+      last = now;
+
+      /* Leave connections in the backlog while half-open */
+      fault_state (now, &state);
+
+      if ( state.halfopen )
+	{
+	  dlp_usleep (PROXY_WAITMS * 1000);
+	  continue;
+	}
+
+      if ( poll (&pfd, 1, PROXY_WAITMS) <= 0 )
+	continue;
+
+      if ( (sock = accept (listener, NULL, NULL)) < 0 )
+	continue;
+
+      if ( ! (conn = (ProxyConn *) calloc (1, sizeof(ProxyConn))) )
+	{
+	  fprintf (stderr, "Cannot allocate connection\n");
+	  close (sock);
+	  continue;
+	}
+
+      conn->client = sock;
+      conn->server = -1;
+
+      pthread_mutex_lock (&proxylock);
+      snprintf (conn->addr, sizeof(conn->addr), "client %llu",
+		(unsigned long long int) ++totalconns);
+      conn->seed = (unsigned int) totalconns;
+      connections++;
+      pthread_mutex_unlock (&proxylock);
+
+      if ( pthread_create (&thread, &attr, relay_thread, conn) )
+	{
+	  fprintf (stderr, "Cannot start connection thread\n");
+	  close (sock);
+	  free (conn);
+
+	  pthread_mutex_lock (&proxylock);
+	  connections--;
+	  pthread_mutex_unlock (&proxylock);
+	}
+    }
+
+  close (listener);
+
+  if ( verbose )
+    fprintf (stderr, "%s: %llu connections, %llu reset, %llu bytes upstream, "
+	     "%llu bytes downstream\n", PACKAGE,
+	     (unsigned long long int) totalconns, (unsigned long long int) resetconns,
+	     (unsigned long long int) relayed[0], (unsigned long long int) relayed[1]);
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * relay_thread:
+ *
+ * Connect to the upstream server and relay a connection in both
+ * directions, applying the faults in effect, until either peer closes
+ * or the connection is reset by a fault.
+ ***************************************************************************/
+static void *
+relay_thread (void *arg)
+{
+  ProxyConn *conn = (ProxyConn *) arg;
+  ProxyPipe *pipe;
+  struct pollfd pfds[2];
+  FaultState state;
+  uint64_t generation;
+  dltime_t now;
+  dltime_t wait;
+  int halfopen = 0;
+  int reset = 0;
+  int one = 1;
+  int timeout;
+  int idx;
+
+  pthread_mutex_lock (&proxylock);
+  generation = resetgen;
+  pthread_mutex_unlock (&proxylock);
+
+  if ( (conn->server = proxy_connect (upstreamaddr)) < 0 )
+    {
+      reset = 1;
+      goto finish;
+    }
+
+  setsockopt (conn->client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt (conn->server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  conn->pipes[0].from = conn->client;
+  conn->pipes[0].to   = conn->server;
+  conn->pipes[1].from = conn->server;
+  conn->pipes[1].to   = conn->client;
+  conn->pipes[0].refilled = conn->pipes[1].refilled = dlp_time ();
+
+  if ( verbose > 1 )
+    fprintf (stderr, "%s: relaying %s to %s\n", PACKAGE, conn->addr, upstreamaddr);
+
+  while ( ! terminate && ! (conn->pipes[0].done && conn->pipes[1].done) )
+    {
+      pthread_mutex_lock (&proxylock);
+      reset = ( generation != resetgen );
+      pthread_mutex_unlock (&proxylock);
+
+      if ( reset )
+	break;
+
+      now = dlp_time ();
+      fault_state (now, &state);
+
+      /* Hold the connection without relaying, reset when the window ends */
+      if ( state.halfopen )
+	{
+	  halfopen = 1;
+	  dlp_usleep (PROXY_WAITMS * 1000);
+	  continue;
+	}
+      else if ( halfopen )
+	{
+	  reset = 1;
+	  break;
+	}
+
+      pfds[0].fd = conn->client;
+      pfds[1].fd = conn->server;
+      pfds[0].events = pfds[1].events = 0;
+      timeout = PROXY_WAITMS;
+
+      for (idx = 0; idx < 2; idx++)
+	{
+	  pipe = &conn->pipes[idx];
+
+	  if ( ! pipe->eof && pipe->count < PROXY_CHUNKS )
+	    pfds[idx].events |= POLLIN;
+
+	  if ( ! pipe->count )
+	    continue;
+
+	  /* Wait for the oldest chunk to be due and for bandwidth */
+	  wait = pipe->chunks[pipe->head].due - now;
+
+	  if ( state.bandwidth > 0 && pipe->tokens < 1.0 &&
+	       (dltime_t) ((1.0 - pipe->tokens) * DLTMODULUS / state.bandwidth) > wait )
+	    wait = (dltime_t) ((1.0 - pipe->tokens) * DLTMODULUS / state.bandwidth);
+
+	  if ( wait <= 0 )
+	    pfds[1 - idx].events |= POLLOUT;
+	  else if ( wait / 1000 + 1 < timeout )
+	    timeout = (int) (wait / 1000 + 1);
+	}
+
+      if ( poll (pfds, 2, timeout) < 0 && errno != EINTR )
+	break;
+
+      now = dlp_time ();
+
+      for (idx = 0; idx < 2; idx++)
+	{
+	  pipe = &conn->pipes[idx];
+
+	  if ( (pfds[idx].revents & (POLLIN | POLLHUP | POLLERR)) && ! pipe->eof &&
+	       pipe->count < PROXY_CHUNKS && relay_read (pipe, now, &state) < 0 )
+	    reset = 1;
+
+	  if ( (pfds[1 - idx].revents & (POLLOUT | POLLERR)) &&
+	       relay_write (conn, pipe, now, &state) < 0 )
+	    reset = 1;
+
+	  /* Pass on EOF once the queued data is written */
+	  if ( pipe->eof && ! pipe->count && ! pipe->done )
+	    {
+	      shutdown (pipe->to, SHUT_WR);
+	      pipe->done = 1;
+	    }
+	}
+
+      if ( reset )
+	break;
+    }
+
+ finish:
+  if ( reset )
+    {
+      if ( verbose > 1 )
+	fprintf (stderr, "%s: resetting %s\n", PACKAGE, conn->addr);
+
+      reset_close (conn->client);
+      if ( conn->server >= 0 )
+	reset_close (conn->server);
+    }
+  else
+    {
+      close (conn->client);
+      close (conn->server);
+    }
+
+  pthread_mutex_lock (&proxylock);
+  connections--;
+  if ( reset )
+    resetconns++;
+  pthread_mutex_unlock (&proxylock);
+
+  free (conn);
+
+  return NULL;
+}  /* End of relay_thread() */
+
+
+/***************************************************************************
+ * relay_read:
+ *
+ * Read available data from a pipe's source into a new chunk, due
+ * after the delay in effect.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+relay_read (ProxyPipe *pipe, dltime_t now, const FaultState *state)
+{
+  ProxyChunk *chunk;
+  ssize_t nread;
+
+  chunk = &pipe->chunks[(pipe->head + pipe->count) % PROXY_CHUNKS];
+
+  if ( (nread = recv (pipe->from, chunk->data, PROXY_CHUNK, 0)) < 0 )
+    return ( errno == EINTR || errno == EAGAIN ) ? 0 : -1;
+
+  if ( nread == 0 )
+    {
+      pipe->eof = 1;
+      return 0;
+    }
+
+  chunk->due    = now + state->delay;
+  chunk->length = (size_t) nread;
+  chunk->offset = 0;
+  pipe->count++;
+
+  return 0;
+}  /* End of relay_read() */
+
+
+/***************************************************************************
+ * relay_write:
+ *
+ * Write the due chunks of a pipe to its destination within the
+ * bandwidth bucket, one write of a random size up to the partial
+ * write limit when in effect.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+relay_write (ProxyConn *conn, ProxyPipe *pipe, dltime_t now, const FaultState *state)
+{
+  ProxyChunk *chunk;
+  double burst;
+  size_t length;
+  ssize_t nsent;
+
+  /* Refill the bandwidth bucket, holding at most 20 milliseconds of data */
+  if ( state->bandwidth > 0 )
+    {
+      burst = ( state->bandwidth / 50 > 1024 ) ? state->bandwidth / 50 : 1024;
+      pipe->tokens += (double) (now - pipe->refilled) * state->bandwidth / DLTMODULUS;
+      if ( pipe->tokens > burst )
+	pipe->tokens = burst;
+    }
+  pipe->refilled = now;
+
+  while ( pipe->count )
+    {
+      chunk = &pipe->chunks[pipe->head];
+
+      if ( chunk->due > now )
+	break;
+
+      length = chunk->length - chunk->offset;
+
+      if ( state->bandwidth > 0 )
+	{
+	  if ( pipe->tokens < 1.0 )
+	    break;
+	  if ( length > (size_t) pipe->tokens )
+	    length = (size_t) pipe->tokens;
+	}
+
+      if ( state->partial > 0 && length > (size_t) state->partial )
+	length = 1 + rand_r (&conn->seed) % state->partial;
+
+      if ( (nsent = send (pipe->to, chunk->data + chunk->offset, length,
+			  MSG_NOSIGNAL | MSG_DONTWAIT)) < 0 )
+	return ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) ? 0 : -1;
+
+      chunk->offset += (size_t) nsent;
+
+      if ( state->bandwidth > 0 )
+	pipe->tokens -= (double) nsent;
+
+      pthread_mutex_lock (&proxylock);
+      relayed[(pipe == &conn->pipes[0]) ? 0 : 1] += (uint64_t) nsent;
+      pthread_mutex_unlock (&proxylock);
+
+      if ( chunk->offset == chunk->length )
+	{
+	  pipe->head = (pipe->head + 1) % PROXY_CHUNKS;
+	  pipe->count--;
+	}
+
+      /* One write at a time so partial writes reach the peer separately */
+      if ( state->partial > 0 || (size_t) nsent < length )
+	break;
+    }
+
+  return 0;
+}  /* End of relay_write() */
+
+
+/***************************************************************************
+ * schedule_time:
+ *
+ * Return the time in the fault schedule, from the start of the proxy
+ * and wrapped by the repeat period.
+ ***************************************************************************/
+static dltime_t
+schedule_time (dltime_t now)
+{
+  dltime_t elapsed = now - starttime;
+
+  if ( elapsed < 0 )
+    elapsed = 0;
+
+  return ( repeat > 0 ) ? elapsed % repeat : elapsed;
+}  /* End of schedule_time() */
+
+
+/***************************************************************************
+ * fault_state:
+ *
+ * Combine the faults in effect at a time into a fault state: the
+ * longest delay, the lowest bandwidth and the smallest partial write
+ * limit apply.
+ ***************************************************************************/
+static void
+fault_state (dltime_t now, FaultState *state)
+{
+  dltime_t elapsed = schedule_time (now);
+  Fault *fault;
+  int idx;
+
+  memset (state, 0, sizeof(FaultState));
+
+  for (idx = 0; idx < faultcount; idx++)
+    {
+      fault = &faults[idx];
+
+      if ( elapsed < fault->start ||
+	   (fault->duration > 0 && elapsed >= fault->start + fault->duration) )
+	continue;
+
+      switch ( fault->type )
+	{
+	case FAULT_DELAY:
+	  if ( (dltime_t) fault->value > state->delay )
+	    state->delay = (dltime_t) fault->value;
+	  break;
+	case FAULT_BANDWIDTH:
+	  if ( ! state->bandwidth || fault->value < state->bandwidth )
+	    state->bandwidth = fault->value;
+	  break;
+	case FAULT_PARTIAL:
+	  if ( ! state->partial || (int) fault->value < state->partial )
+	    state->partial = (int) fault->value;
+	  break;
+	case FAULT_HALFOPEN:
+	  state->halfopen = 1;
+	  break;
+	case FAULT_RESET:
+	  break;
+	}
+    }
+}  /* End of fault_state() */
+
+
+/***************************************************************************
+ * fire_resets:
+ *
+ * Reset all connections if a reset fault is scheduled after the
+ * schedule time last and up to now, allowing for the schedule to
+ * wrap between them.
+ ***************************************************************************/
+static void
+fire_resets (dltime_t last, dltime_t now)
+{
+  dltime_t start;
+  int idx;
+
+  for (idx = 0; idx < faultcount; idx++)
+    {
+      if ( faults[idx].type != FAULT_RESET )
+	continue;
+
+      start = faults[idx].start;
+
+      if ( (last < now && start > last && start <= now) ||
+	   (last > now && (start > last || start <= now)) )
+	{
+	  pthread_mutex_lock (&proxylock);
+	  resetgen++;
+	  if ( verbose )
+	    fprintf (stderr, "%s: resetting %d connections\n", PACKAGE, connections);
+	  pthread_mutex_unlock (&proxylock);
+	}
+    }
+}  /* End of fire_resets() */
+
+
+/***************************************************************************
+ * reset_close:
+ *
+ * Close a socket with a TCP RST instead of an orderly shutdown.
+ ***************************************************************************/
+static void
+reset_close (int sock)
+{
+  struct linger linger;
+
+  linger.l_onoff = 1;
+  linger.l_linger = 0;
+  setsockopt (sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+  close (sock);
+}  /* End of reset_close() */
+
+
+/***************************************************************************
+ * parse_fault:
+ *
+ * Parse a fault in type[=value][@start[/duration]] format and add it
+ * to the schedule.  Start and duration are in seconds, a fault
+ * without a duration lasts to the end of the schedule.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+parse_fault (const char *spec)
+{
+  Fault *fault;
+  char type[20];
+  char *endptr;
+  const char *cp;
+  double value = 0.0;
+  double start = 0.0;
+  double duration = 0.0;
+  size_t length;
+
+  if ( faultcount >= PROXY_FAULTS )
+    {
+      fprintf (stderr, "Too many faults, maximum is %d\n", PROXY_FAULTS);
+      return -1;
+    }
+
+  fault = &faults[faultcount];
+  length = strcspn (spec, "=@");
+
+  if ( length >= sizeof(type) )
+    length = sizeof(type) - 1;
+
+  snprintf (type, sizeof(type), "%.*s", (int) length, spec);
+  cp = spec + strcspn (spec, "=@");
+
+  if ( ! strcasecmp (type, "delay") )
+    fault->type = FAULT_DELAY;
+  else if ( ! strcasecmp (type, "bandwidth") )
+    fault->type = FAULT_BANDWIDTH;
+  else if ( ! strcasecmp (type, "partial") )
+    fault->type = FAULT_PARTIAL;
+  else if ( ! strcasecmp (type, "reset") )
+    fault->type = FAULT_RESET;
+  else if ( ! strcasecmp (type, "halfopen") )
+    fault->type = FAULT_HALFOPEN;
+  else
+    {
+      fprintf (stderr, "Unknown fault type in %s\n", spec);
+      return -1;
+    }
+
+  /* Value with a k or m suffix for bandwidth */
+  if ( *cp == '=' )
+    {
+      value = strtod (cp + 1, &endptr);
+
+      if ( *endptr == 'k' || *endptr == 'K' )
+	value *= 1024, endptr++;
+      else if ( *endptr == 'm' || *endptr == 'M' )
+	value *= 1048576, endptr++;
+
+      if ( endptr == cp + 1 || (*endptr && *endptr != '@') || value <= 0.0 )
+	{
+	  fprintf (stderr, "Invalid fault value in %s\n", spec);
+	  return -1;
+	}
+
+      cp = endptr;
+    }
+  else if ( fault->type == FAULT_DELAY || fault->type == FAULT_BANDWIDTH ||
+	    fault->type == FAULT_PARTIAL )
+    {
+      fprintf (stderr, "Fault requires a value: %s\n", spec);
+      return -1;
+    }
+
+  if ( *cp == '@' )
+    {
+      start = strtod (cp + 1, &endptr);
+
+      if ( *endptr == '/' )
+	duration = strtod (endptr + 1, &endptr);
+
+      if ( endptr == cp + 1 || *endptr || start < 0.0 || duration < 0.0 )
+	{
+	  fprintf (stderr, "Invalid fault time in %s\n", spec);
+	  return -1;
+	}
+    }
+
+  if ( fault->type == FAULT_DELAY )
+    value *= 1000.0;
+
+  fault->value    = value;
+  fault->start    = (dltime_t) (start * DLTMODULUS);
+  fault->duration = (dltime_t) (duration * DLTMODULUS);
+  faultcount++;
+
+  return 0;
+}  /* End of parse_fault() */
+
+
+/***************************************************************************
+ * proxy_connect:
+ *
+ * Connect to the upstream server at an address in [host:]port format,
+ * trying each resolved address in turn.
+ *
+ * Returns the connected socket on success and -1 on error.
+ ***************************************************************************/
+static int
+proxy_connect (const char *address)
+{
+  struct addrinfo hints;
+  struct addrinfo *result = NULL;
+  struct addrinfo *addr;
+  char host[100];
+  char port[20];
+  int sock = -1;
+  int rv;
+
+  if ( server_splitaddr (address, host, sizeof(host), port, sizeof(port)) )
+    return -1;
+
+  memset (&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if ( (rv = getaddrinfo ((*host) ? host : "localhost", port, &hints, &result)) )
+    {
+      fprintf (stderr, "Cannot resolve %s: %s\n", address, gai_strerror (rv));
+      return -1;
+    }
+
+  for (addr = result; addr; addr = addr->ai_next)
+    {
+      if ( (sock = socket (addr->ai_family, SOCK_STREAM, 0)) < 0 )
+	continue;
+
+      if ( connect (sock, addr->ai_addr, addr->ai_addrlen) == 0 )
+	break;
+
+      close (sock);
+      sock = -1;
+    }
+
+  freeaddrinfo (result);
+
+  if ( sock < 0 && verbose )
+    fprintf (stderr, "%s: cannot connect to %s: %s\n", PACKAGE, address, strerror(errno));
+
+  return sock;
+}  /* End of proxy_connect() */
+
+
+/***************************************************************************
+ * parameter_proc:
+ *
+ * Process the command line parameters.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+parameter_proc (int argcount, char **argvec)
+{
+  int optind;
+
+  /* Process all command line arguments */
+  for (optind = 1; optind < argcount; optind++)
+    {
+      if (strcmp (argvec[optind], "-V") == 0)
+	{
+	  fprintf (stderr, "%s version: %s\n", PACKAGE, VERSION);
+	  exit (0);
+	}
+      else if (strcmp (argvec[optind], "-h") == 0)
+	{
+	  usage ();
+	  exit (0);
+	}
+      else if (strncmp (argvec[optind], "-v", 2) == 0)
+	{
+	  verbose += strspn (&argvec[optind][1], "v");
+	}
+      else if (strcmp (argvec[optind], "-p") == 0)
+	{
+	  listenaddr = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-fault") == 0)
+	{
+	  if ( parse_fault (getoptval(argcount, argvec, optind++)) )
+	    return -1;
+	}
+      else if (strcmp (argvec[optind], "-repeat") == 0)
+	{
+	  repeat = (dltime_t) (atof (getoptval(argcount, argvec, optind++)) * DLTMODULUS);
+	}
+      else if (strncmp (argvec[optind], "-", 1) == 0 &&
+	       strlen (argvec[optind]) > 1 )
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  exit (1);
+	}
+      else if ( ! upstreamaddr )
+	{
+	  upstreamaddr = argvec[optind];
+	}
+      else
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  exit (1);
+	}
+    }
+
+  if ( ! upstreamaddr )
+    {
+      fprintf (stderr, "No upstream server specified\n\n");
+      fprintf (stderr, "%s version %s\n\n", PACKAGE, VERSION);
+      fprintf (stderr, "Usage: %s [options] [host]:port\n\n", PACKAGE);
+      fprintf (stderr, "Try '-h' for detailed help\n");
+      exit (1);
+    }
+
+  if ( repeat < 0 )
+    {
+      fprintf (stderr, "Repeat period cannot be negative\n");
+      return -1;
+    }
+
+  return 0;
+}  /* End of parameter_proc() */
+
+
+/***************************************************************************
+ * getoptval:
+ * Return the value to a command line option; checking that the value is
+ * itself not an option (starting with '-') and is not past the end of
+ * the argument list.
+ *
+ * argcount: total arguments in argvec
+ * argvec: argument list
+ * argopt: index of option to process, value is expected to be at +1
+ *
+ * Returns value on success and exits with error message on failure
+ ***************************************************************************/
+static char *
+getoptval (int argcount, char **argvec, int argopt)
+{
+  if ( argvec == NULL || argvec[argopt] == NULL ) {
+    fprintf (stderr, "getoptval(): NULL option requested\n");
+    exit (1);
+  }
+
+  if ( (argopt+1) < argcount && *argvec[argopt+1] != '-' )
+    return argvec[argopt+1];
+
+  fprintf (stderr, "Option %s requires a value\n", argvec[argopt]);
+  exit (1);
+}  /* End of getoptval() */
+
+
+/***************************************************************************
+ * term_handler:
+ * Signal handler routine.
+ ***************************************************************************/
+static void
+term_handler (int sig)
+{
+  terminate = 1;
+}
+
+
+/***************************************************************************
+ * usage:
+ * Print the usage message and exit.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "%s version: %s\n\n", PACKAGE, VERSION);
+  fprintf (stderr, "A fault-injecting TCP proxy for testing recovery\n\n");
+  fprintf (stderr, "Usage: %s [options] [host]:port\n\n", PACKAGE);
+  fprintf (stderr,
+	   " ## General options ##\n"
+	   " -V             Report program version\n"
+	   " -h             Show this usage message\n"
+	   " -v             Be more verbose, multiple flags can be used\n"
+	   " -p [host:]port Listen address, default localhost:16001, port 0 for any\n"
+	   "                  free port; the address listened on is printed to stdout\n"
+	   "\n"
+	   " ## Fault options ##\n"
+	   " -fault type[=value][@start[/duration]]\n"
+	   "                Schedule a fault, times in seconds from the start, a\n"
+	   "                  fault without a duration lasts to the end; repeat\n"
+	   "                  for multiple faults, types are:\n"
+	   "                  delay=ms         Delay relayed data\n"
+	   "                  bandwidth=bytes  Limit bytes per second in each\n"
+	   "                                     direction, k and m suffixes\n"
+	   "                  partial=bytes    Write at most a random 1 to bytes\n"
+	   "                                     at a time\n"
+	   "                  reset            Reset all connections at start\n"
+	   "                  halfopen         Stop relaying and accepting, reset\n"
+	   "                                     held connections at the end\n"
+	   " -repeat secs   Repeat the fault schedule with this period\n"
+	   "\n"
+	   " [host]:port    Address of the upstream server\n"
+	   "\n");
+}  /* End of usage() */
@@ -0,0 +1,219 @@
+/***************************************************************************
+ * dalitrace.c
+ *
+ * Decode a libdali flight recorder dump.
+ *
+ * Print the events recorded by libdali before a flight recorder dump
+ * (see dl_trace_dump()), for example as written by dali2dali on
+ * SIGUSR2 or a crash, oldest first.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libdali.h>
+
+#define PACKAGE   "dalitrace"
+#define VERSION   "0.4"
+
+static void print_record (DLTraceHeader *header, DLTraceRecord *record,
+			  uint64_t previous, char *conns, char *streams);
+static void usage (void);
+
+int
+main (int argc, char **argv)
+{
+  DLTraceHeader header;
+  DLTraceRecord *ring = NULL;
+  char *conns = NULL;
+  char *streams = NULL;
+  char *filename = NULL;
+  FILE *fp;
+  uint64_t first;
+  uint64_t position;
+  uint64_t previous = 0;
+  long int last = 0;
+  int conn = -1;
+  int idx;
+
+  for (idx = 1; idx < argc; idx++)
+    {
+      if (strcmp (argv[idx], "-n") == 0 && (idx + 1) < argc)
+	last = strtol (argv[++idx], NULL, 10);
+      else if (strcmp (argv[idx], "-c") == 0 && (idx + 1) < argc)
+	conn = (int) strtol (argv[++idx], NULL, 10);
+      else if (strcmp (argv[idx], "-h") == 0)
+	{
+	  usage ();
+	  return 0;
+	}
+      else if (*argv[idx] != '-' && ! filename)
+	filename = argv[idx];
+      else
+	{
+	  usage ();
+	  return 1;
+	}
+    }
+
+  if ( ! filename )
+    {
+      usage ();
+      return 1;
+    }
+
+  if ( ! (fp = fopen (filename, "rb")) )
+    {
+      fprintf (stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+      return 1;
+    }
+
+  if ( fread (&header, sizeof(header), 1, fp) != 1 ||
+       memcmp (header.magic, DL_TRACE_MAGIC, sizeof(header.magic)) )
+    {
+      fprintf (stderr, "%s is not a flight recorder dump\n", filename);
+      return 1;
+    }
+
+  if ( header.recordsize != sizeof(DLTraceRecord) || header.records == 0 ||
+       (header.records & (header.records - 1)) || header.tickrate == 0 )
+    {
+      fprintf (stderr, "%s has unsupported records of %u bytes\n", filename, header.recordsize);
+      return 1;
+    }
+
+  ring    = (DLTraceRecord *) malloc ((size_t) header.records * sizeof(DLTraceRecord));
+  conns   = (char *) calloc ((size_t) header.conns + 1, header.connlen);
+  streams = (char *) calloc ((size_t) header.streams + 1, header.streamlen);
+
+  if ( ! ring || ! conns || ! streams )
+    {
+      fprintf (stderr, "Cannot allocate memory\n");
+      return 1;
+    }
+
+  if ( fread (ring, sizeof(DLTraceRecord), header.records, fp) != header.records ||
+       fread (conns, header.connlen, header.conns, fp) != header.conns ||
+       fread (streams, header.streamlen, header.streams, fp) != header.streams )
+    {
+      fprintf (stderr, "%s is truncated\n", filename);
+      return 1;
+    }
+
+  fclose (fp);
+
+  /* The ring holds the most recent records, oldest at head */
+  first = (header.head > header.records) ? header.head - header.records : 0;
+  if ( last > 0 && header.head - first > (uint64_t) last )
+    first = header.head - last;
+
+  printf ("%llu events recorded, %llu in dump\n",
+	  (unsigned long long int) header.head,
+	  (unsigned long long int) (header.head - first));
+
+  for (position = first; position < header.head; position++)
+    {
+      DLTraceRecord *record = &ring[position & (header.records - 1)];
+
+      /* Skip records not completed when dumped */
+      if ( record->time == 0 || record->time > header.ticks )
+	continue;
+
+      if ( conn >= 0 && record->conn != conn )
+	continue;
+
+      print_record (&header, record, previous, conns, streams);
+      previous = record->time;
+    }
+
+  free (ring);
+  free (conns);
+  free (streams);
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * print_record:
+ *
+ * Print a record as the real time of the event, the time since the
+ * previous printed event, the connection, the event and its details.
+ ***************************************************************************/
+static void
+print_record (DLTraceHeader *header, DLTraceRecord *record,
+	      uint64_t previous, char *conns, char *streams)
+{
+  char timestr[30];
+  char connstr[120];
+  char details[120];
+  const char *stream = "-";
+  dltime_t eventtime;
+
+  eventtime = header->realtime -
+    (dltime_t) ((double) (header->ticks - record->time) * DLTMODULUS / header->tickrate);
+  dl_dltime2isotimestr (eventtime, timestr, 1);
+
+  if ( record->conn < header->conns )
+    snprintf (connstr, sizeof(connstr), "%u:%s", record->conn,
+	      conns + (size_t) record->conn * header->connlen);
+  else
+    snprintf (connstr, sizeof(connstr), "-");
+
+  if ( (record->event == DL_TRACE_RECV || record->event == DL_TRACE_SEND) &&
+       record->arg < header->streams )
+    stream = streams + (size_t) record->arg * header->streamlen;
+
+  switch (record->event)
+    {
+    case DL_TRACE_CONNECT:
+      snprintf (details, sizeof(details), "family %u", record->arg);
+      break;
+    case DL_TRACE_RECV:
+      snprintf (details, sizeof(details), "pktid %lld %s",
+		(long long int) record->value, stream);
+      break;
+    case DL_TRACE_SEND:
+      snprintf (details, sizeof(details), "%lld bytes %s",
+		(long long int) record->value, stream);
+      break;
+    case DL_TRACE_ACK:
+      snprintf (details, sizeof(details), "pktid %lld", (long long int) record->value);
+      break;
+    case DL_TRACE_TIMEOUT:
+      snprintf (details, sizeof(details), "after %u seconds", record->arg);
+      break;
+    case DL_TRACE_IOERROR:
+      snprintf (details, sizeof(details), "%s after %lld bytes",
+		(record->arg) ? "recv" : "send", (long long int) record->value);
+      break;
+    default:
+      details[0] = '\0';
+    }
+
+  printf ("%sZ %+12.6f %-24s %-10s %s\n", timestr,
+	  (previous) ? (double) (record->time - previous) / header->tickrate : 0.0,
+	  connstr, dl_trace_name (record->event), details);
+}  /* End of print_record() */
+
+
+/***************************************************************************
+ * usage:
+ * Print the usage message.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "%s version %s\n\n", PACKAGE, VERSION);
+  fprintf (stderr, "Decode a libdali flight recorder dump\n\n");
+  fprintf (stderr, "Usage: %s [options] file\n\n", PACKAGE);
+  fprintf (stderr,
+	   " -h         Print this usage message\n"
+	   " -n count   Print only the last count events\n"
+	   " -c conn    Print only events of connection number conn\n"
+	   "\n"
+	   " Each event is printed with its time, the seconds since the previous\n"
+	   " event, the connection number and address, the event and details.\n\n");
+}  /* End of usage() */
@@ -0,0 +1,269 @@
+/***************************************************************************
+ * latency.c
+ *
+ * Latency histograms of the dali2dali forwarding stages.
+ *
+ * For each forwarded packet the interval of each stage, from the
+ * packet time at the source server through reception, handing to the
+ * destination writer, sending and acknowledgement, is recorded in a
+ * libdali HDR-style histogram for the route and, optionally, for the
+ * stream of the packet.
+ *
+ * Histograms are only recorded by the forwarding thread.  Stream
+ * entries are allocated by it and published with a release store, so
+ * the metrics thread and latency_dump(), which is async-signal-safe,
+ * can read them at any time.
+ *
+ * Requires C11 atomics.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "latency.h"
+
+/* Maximum number of streams with their own histograms, a power of 2 */
+#define LATENCY_STREAMS 4096
+
+/* Histograms of one stream */
+typedef struct StreamLatency_s {
+  char streamid[MAXSTREAMID];
+  DLHistogram hist[LATENCY_STAGES];
+} StreamLatency;
+
+static StreamLatency *stream_lookup (const char *streamid);
+static void dump_histograms (DLSafeOut *out, const char *scope, const DLHistogram *hist);
+
+static const char *stagenames[LATENCY_STAGES] = { "source", "relay", "send", "ack" };
+
+static int enabled = 0;
+static DLHistogram route[LATENCY_STAGES];
+static _Atomic (StreamLatency *) *streams = NULL;
+static StreamLatency *laststream = NULL;
+static int streamsfull = 0;
+
+
+/***************************************************************************
+ * latency_init:
+ *
+ * Enable recording of the route histograms and, if perstream is
+ * true, of histograms per stream.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+latency_init (int perstream)
+{
+  size_t idx;
+
+  if ( perstream )
+    {
+      if ( ! (streams = malloc (LATENCY_STREAMS * sizeof(*streams))) )
+	{
+	  dl_log (2, 0, "Cannot allocate stream latency table\n");
+	  return -1;
+	}
+
+      for (idx = 0; idx < LATENCY_STREAMS; idx++)
+	atomic_init (&streams[idx], NULL);
+    }
+
+  enabled = 1;
+
+  return 0;
+}  /* End of latency_init() */
+
+
+/***************************************************************************
+ * latency_record:
+ *
+ * Record the stage intervals of a forwarded packet from the times it
+ * was received, handed to the destination writer, sent and
+ * acknowledged.  The acknowledgement time is 0 when not requested.
+ ***************************************************************************/
+void
+latency_record (const DLPacket *packet, dltime_t received, dltime_t enqueued,
+		dltime_t sent, dltime_t acked)
+{
+  StreamLatency *stream = NULL;
+  dltime_t intervals[LATENCY_STAGES];
+  int stages = (acked) ? LATENCY_STAGES : LATENCY_ACK;
+  int stage;
+
+  if ( ! enabled )
+    return;
+
+  intervals[LATENCY_SOURCE] = received - packet->pkttime;
+  intervals[LATENCY_RELAY]  = enqueued - received;
+  intervals[LATENCY_SEND]   = sent - enqueued;
+  intervals[LATENCY_ACK]    = acked - sent;
+
+  if ( streams )
+    stream = stream_lookup (packet->streamid);
+
+  for (stage = 0; stage < stages; stage++)
+    {
+      dl_hist_record (&route[stage], intervals[stage]);
+
+      if ( stream )
+	dl_hist_record (&stream->hist[stage], intervals[stage]);
+    }
+}  /* End of latency_record() */
+
+
+/***************************************************************************
+ * latency_route:
+ *
+ * Return the route histogram of a stage, NULL when not recording.
+ ***************************************************************************/
+const DLHistogram *
+latency_route (int stage)
+{
+  if ( ! enabled || stage < 0 || stage >= LATENCY_STAGES )
+    return NULL;
+
+  return &route[stage];
+}  /* End of latency_route() */
+
+
+/***************************************************************************
+ * latency_stagename:
+ *
+ * Return the name of a stage.
+ ***************************************************************************/
+const char *
+latency_stagename (int stage)
+{
+  if ( stage < 0 || stage >= LATENCY_STAGES )
+    return "unknown";
+
+  return stagenames[stage];
+}  /* End of latency_stagename() */
+
+
+/***************************************************************************
+ * latency_dump:
+ *
+ * Write the count, percentiles and maximum of each stage for the
+ * route and each stream to a file descriptor.  Only uses
+ * async-signal-safe calls, for use in a signal handler.
+ ***************************************************************************/
+void
+latency_dump (int fd)
+{
+  static DLSafeOut out;
+  StreamLatency *stream;
+  size_t idx;
+
+  if ( ! enabled )
+    return;
+
+  out.fd = fd;
+  out.error = 0;
+  out.length = 0;
+
+  dlp_safe_string (&out, "Forwarding latency in microseconds\n", 0);
+  dlp_safe_string (&out, "stream                           stage       count        p50        p90        p99      p99.9        max\n", 0);
+
+  dump_histograms (&out, "(route)", route);
+
+  if ( streams )
+    {
+      for (idx = 0; idx < LATENCY_STREAMS; idx++)
+	if ( (stream = atomic_load_explicit (&streams[idx], memory_order_acquire)) )
+	  dump_histograms (&out, stream->streamid, stream->hist);
+
+      if ( streamsfull )
+	dlp_safe_string (&out, "Stream table full, later streams are only in the route\n", 0);
+    }
+
+  dlp_safe_flush (&out);
+}  /* End of latency_dump() */
+
+
+/***************************************************************************
+ * stream_lookup:
+ *
+ * Find or add the histograms of a stream, NULL when the table is full
+ * or memory cannot be allocated.  Consecutive packets of a stream are
+ * common, the last stream found is checked first.
+ ***************************************************************************/
+static StreamLatency *
+stream_lookup (const char *streamid)
+{
+  StreamLatency *stream;
+  uint32_t hash = 2166136261u;
+  const char *cp;
+  size_t idx;
+  size_t probe;
+
+  if ( laststream && ! strcmp (laststream->streamid, streamid) )
+    return laststream;
+
+  /* FNV-1a hash of the stream ID, open addressing */
+  for (cp = streamid; *cp; cp++)
+    hash = (hash ^ (unsigned char) *cp) * 16777619u;
+
+  for (probe = 0; probe < LATENCY_STREAMS; probe++)
+    {
+      idx = (hash + probe) & (LATENCY_STREAMS - 1);
+      stream = atomic_load_explicit (&streams[idx], memory_order_relaxed);
+
+      if ( ! stream )
+	{
+	  if ( ! (stream = calloc (1, sizeof(StreamLatency))) )
+	    return NULL;
+
+	  snprintf (stream->streamid, sizeof(stream->streamid), "%s", streamid);
+
+	  /* Publish the initialized entry to readers */
+	  atomic_store_explicit (&streams[idx], stream, memory_order_release);
+	  return (laststream = stream);
+	}
+
+      if ( ! strcmp (stream->streamid, streamid) )
+	return (laststream = stream);
+    }
+
+  streamsfull = 1;
+
+  return NULL;
+}  /* End of stream_lookup() */
+
+
+/***************************************************************************
+ * dump_histograms:
+ *
+ * Write a line for each stage with values, from copies of the
+ * histograms.
+ ***************************************************************************/
+static void
+dump_histograms (DLSafeOut *out, const char *scope, const DLHistogram *hist)
+{
+  static DLHistogram copy;
+  static const double percentiles[4] = { 50.0, 90.0, 99.0, 99.9 };
+  int stage;
+  int idx;
+
+  for (stage = 0; stage < LATENCY_STAGES; stage++)
+    {
+      dl_hist_copy (&copy, &hist[stage]);
+
+      if ( ! copy.total )
+	continue;
+
+      dlp_safe_string (out, scope, 32);
+      dlp_safe_string (out, " ", 0);
+      dlp_safe_string (out, stagenames[stage], 6);
+      dlp_safe_number (out, copy.total, 0, 11);
+
+      for (idx = 0; idx < 4; idx++)
+	dlp_safe_number (out, dl_hist_percentile (&copy, percentiles[idx]), 0, 11);
+
+      dlp_safe_number (out, copy.max, 0, 11);
+      dlp_safe_string (out, "\n", 0);
+    }
+}  /* End of dump_histograms() */
+
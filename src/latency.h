@@ -0,0 +1,26 @@
+/***************************************************************************
+ * latency.h
+ *
+ * Latency histograms of the dali2dali forwarding stages.
+ ***************************************************************************/
+
+#ifndef LATENCY_H
+#define LATENCY_H 1
+
+#include <libdali.h>
+
+/* Forwarding stages, intervals between the times of a packet */
+#define LATENCY_SOURCE 0  /* Packet time at the source server to received */
+#define LATENCY_RELAY  1  /* Received to handed to the destination writer */
+#define LATENCY_SEND   2  /* Handed to the writer to sent, including reconnects */
+#define LATENCY_ACK    3  /* Sent to acknowledged, only with acknowledgements */
+#define LATENCY_STAGES 4
+
+extern int  latency_init (int perstream);
+extern void latency_record (const DLPacket *packet, dltime_t received, dltime_t enqueued,
+			    dltime_t sent, dltime_t acked);
+extern void latency_dump (int fd);
+extern const DLHistogram *latency_route (int stage);
+extern const char *latency_stagename (int stage);
+
+#endif /* LATENCY_H */
@@ -0,0 +1,600 @@
+/***************************************************************************
+ * metrics.c
+ *
+ * Prometheus metrics endpoint for dali2dali.
+ *
+ * An HTTP listener thread serves the Prometheus text exposition
+ * format on request.  The forwarding thread only updates counters in
+ * a small block protected by a sequence lock, it never waits for the
+ * listener; the listener copies a consistent snapshot of the block
+ * and of the libdali connection statistics, see dl_getstats(), and
+ * renders it.
+ *
+ * Requires POSIX threads and C11 atomics.
+ ***************************************************************************/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "latency.h"
+#include "metrics.h"
+#include "server.h"
+
+/* Initial size of the rendered metrics, grown as needed, and size of
+ * the request buffer */
+#define METRICS_BODYSIZE    16384
+#define METRICS_REQUESTSIZE 2048
+
+/* Seconds to wait for a scraper to send its request */
+#define METRICS_REQUESTTIMEOUT 5
+
+/* Route counters, written only by the forwarding thread */
+typedef struct RouteCounters_s {
+  atomic_uint seq;                    /* Sequence count, odd while updating */
+  atomic_uint_fast64_t packets;       /* Packets forwarded */
+  atomic_uint_fast64_t bytes;         /* Payload bytes forwarded */
+  atomic_uint_fast64_t pending;       /* Packets received and not yet forwarded */
+  atomic_uint_fast64_t acks;          /* Acknowledged writes timed */
+  atomic_int_fast64_t  acklatency;    /* Sum of acknowledgement latencies, dltime ticks */
+  atomic_int_fast64_t  pkttime;       /* Packet time of last forwarded packet */
+  atomic_int_fast64_t  dataend;       /* Data end time of last forwarded packet */
+} RouteCounters;
+
+/* Snapshot of the route counters */
+typedef struct RouteSnapshot_s {
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t pending;
+  uint64_t acks;
+  int64_t  acklatency;
+  int64_t  pkttime;
+  int64_t  dataend;
+} RouteSnapshot;
+
+/* Output buffer for rendering */
+typedef struct MetricsOut_s {
+  char  *buffer;
+  size_t size;
+  size_t length;
+  int    failed;   /* Set when the buffer could not be grown */
+} MetricsOut;
+
+static void *metrics_thread (void *arg);
+static void  metrics_serve (int client);
+static void  metrics_render (MetricsOut *out);
+static void  metrics_connections (MetricsOut *out);
+static void  metrics_latency (MetricsOut *out);
+static void  metrics_printf (MetricsOut *out, const char *format, ...);
+static void  metrics_escape (char *label, size_t size, const char *value);
+static void  snapshot_route (RouteSnapshot *snapshot);
+
+static RouteCounters route;
+static int   metricsfd = -1;
+static DLCP *srcconn   = 0;
+static DLCP *destconn  = 0;
+static char  srclabel[256];
+static char  destlabel[256];
+static char  routelabels[600];
+
+
+/***************************************************************************
+ * metrics_start:
+ *
+ * Listen on [host:]port, localhost when no host is given, and start a
+ * thread serving metrics of the route from the source to the
+ * destination connection.  Signals are blocked in the thread so
+ * handlers run in the forwarding thread.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+metrics_start (const char *listenaddr, DLCP *source, DLCP *destination)
+{
+  char bound[300];
+
+  if ( ! listenaddr || ! source || ! destination )
+    return -1;
+
+  if ( (metricsfd = server_listen (listenaddr, 16, bound, sizeof(bound))) < 0 )
+    return -1;
+
+  srcconn  = source;
+  destconn = destination;
+  metrics_escape (srclabel, sizeof(srclabel), source->addr);
+  metrics_escape (destlabel, sizeof(destlabel), destination->addr);
+  snprintf (routelabels, sizeof(routelabels), "source=\"%s\",destination=\"%s\"",
+	    srclabel, destlabel);
+
+  if ( server_spawn (metrics_thread, NULL) )
+    {
+      close (metricsfd);
+      metricsfd = -1;
+      return -1;
+    }
+
+  dl_log (1, 1, "Serving metrics on %s\n", bound);
+
+  return 0;
+}  /* End of metrics_start() */
+
+
+/***************************************************************************
+ * metrics_received:
+ *
+ * Count a packet received from the source and not yet forwarded.
+ ***************************************************************************/
+void
+metrics_received (void)
+{
+  unsigned int seq;
+
+  if ( metricsfd < 0 )
+    return;
+
+  seq = atomic_load_explicit (&route.seq, memory_order_relaxed);
+  atomic_store_explicit (&route.seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+
+  atomic_store_explicit (&route.pending, 1, memory_order_relaxed);
+
+  atomic_store_explicit (&route.seq, seq + 2, memory_order_release);
+}  /* End of metrics_received() */
+
+
+/***************************************************************************
+ * metrics_forwarded:
+ *
+ * Count a packet written to the destination.  The acknowledgement
+ * latency is only recorded when positive, when acknowledgements were
+ * requested.
+ ***************************************************************************/
+void
+metrics_forwarded (const DLPacket *packet, dltime_t acklatency)
+{
+  unsigned int seq;
+
+  if ( metricsfd < 0 )
+    return;
+
+  /* Single writer, relaxed loads and stores inside the sequence lock */
+  seq = atomic_load_explicit (&route.seq, memory_order_relaxed);
+  atomic_store_explicit (&route.seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+
+  atomic_store_explicit (&route.packets,
+			 atomic_load_explicit (&route.packets, memory_order_relaxed) + 1,
+			 memory_order_relaxed);
+  atomic_store_explicit (&route.bytes,
+			 atomic_load_explicit (&route.bytes, memory_order_relaxed) + packet->datasize,
+			 memory_order_relaxed);
+  atomic_store_explicit (&route.pending, 0, memory_order_relaxed);
+  atomic_store_explicit (&route.pkttime, packet->pkttime, memory_order_relaxed);
+  atomic_store_explicit (&route.dataend, packet->dataend, memory_order_relaxed);
+
+  if ( acklatency > 0 )
+    {
+      atomic_store_explicit (&route.acks,
+			     atomic_load_explicit (&route.acks, memory_order_relaxed) + 1,
+			     memory_order_relaxed);
+      atomic_store_explicit (&route.acklatency,
+			     atomic_load_explicit (&route.acklatency, memory_order_relaxed) + acklatency,
+			     memory_order_relaxed);
+    }
+
+  atomic_store_explicit (&route.seq, seq + 2, memory_order_release);
+}  /* End of metrics_forwarded() */
+
+
+/***************************************************************************
+ * snapshot_route:
+ *
+ * Copy the route counters, retrying while the forwarding thread is
+ * updating them.
+ ***************************************************************************/
+static void
+snapshot_route (RouteSnapshot *snapshot)
+{
+  unsigned int start;
+
+  for (;;)
+    {
+      start = atomic_load_explicit (&route.seq, memory_order_acquire);
+
+      if ( start & 1 )
+	{
+	  sched_yield ();
+	  continue;
+	}
+
+      snapshot->packets    = atomic_load_explicit (&route.packets, memory_order_relaxed);
+      snapshot->bytes      = atomic_load_explicit (&route.bytes, memory_order_relaxed);
+      snapshot->pending    = atomic_load_explicit (&route.pending, memory_order_relaxed);
+      snapshot->acks       = atomic_load_explicit (&route.acks, memory_order_relaxed);
+      snapshot->acklatency = atomic_load_explicit (&route.acklatency, memory_order_relaxed);
+      snapshot->pkttime    = atomic_load_explicit (&route.pkttime, memory_order_relaxed);
+      snapshot->dataend    = atomic_load_explicit (&route.dataend, memory_order_relaxed);
+
+      atomic_thread_fence (memory_order_acquire);
+
+      if ( atomic_load_explicit (&route.seq, memory_order_relaxed) == start )
+	return;
+    }
+}  /* End of snapshot_route() */
+
+
+/***************************************************************************
+ * metrics_thread:
+ *
+ * Accept and serve scrape requests one at a time.
+ ***************************************************************************/
+static void *
+metrics_thread (void *arg)
+{
+  struct timeval timeout;
+  int client;
+
+  (void) arg;
+
+  for (;;)
+    {
+      if ( (client = accept (metricsfd, NULL, NULL)) < 0 )
+	{
+	  if ( errno != EINTR && errno != ECONNABORTED )
+	    dlp_usleep (100000);
+	  continue;
+	}
+
+      /* Do not let a stalled scraper block others */
+      timeout.tv_sec  = METRICS_REQUESTTIMEOUT;
+      timeout.tv_usec = 0;
+      setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt (client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+      metrics_serve (client);
+      close (client);
+    }
+
+  return NULL;
+}  /* End of metrics_thread() */
+
+
+/***************************************************************************
+ * metrics_serve:
+ *
+ * Read an HTTP request and respond with the metrics for GET /metrics
+ * (or /), 404 for other paths and 405 for other methods.
+ ***************************************************************************/
+static void
+metrics_serve (int client)
+{
+  char request[METRICS_REQUESTSIZE];
+  char header[256];
+  MetricsOut out;
+  const char *status = "200 OK";
+  size_t received = 0;
+  size_t sent;
+  ssize_t rv;
+  int headerlen;
+
+  /* Read until the end of the request headers */
+  while ( received < sizeof(request) - 1 )
+    {
+      if ( (rv = recv (client, request + received, sizeof(request) - 1 - received, 0)) <= 0 )
+	{
+	  if ( rv < 0 && errno == EINTR )
+	    continue;
+	  return;
+	}
+
+      received += rv;
+      request[received] = '\0';
+
+      if ( strstr (request, "\r\n\r\n") || strstr (request, "\n\n") )
+	break;
+    }
+
+  request[received] = '\0';
+
+  if ( ! (out.buffer = (char *) malloc (METRICS_BODYSIZE)) )
+    return;
+
+  out.size   = METRICS_BODYSIZE;
+  out.length = 0;
+  out.failed = 0;
+
+  if ( strncmp (request, "GET ", 4) && strncmp (request, "HEAD ", 5) )
+    {
+      status = "405 Method Not Allowed";
+      metrics_printf (&out, "Method not allowed\n");
+    }
+  else if ( strncmp (strchr (request, ' ') + 1, "/metrics ", 9) &&
+	    strncmp (strchr (request, ' ') + 1, "/ ", 2) )
+    {
+      status = "404 Not Found";
+      metrics_printf (&out, "Not found, metrics are served at /metrics\n");
+    }
+  else
+    {
+      metrics_render (&out);
+    }
+
+  /* Never serve truncated metrics, a partial line is invalid exposition */
+  if ( out.failed )
+    {
+      dl_log (2, 0, "Cannot allocate %llu bytes to render metrics\n",
+	      (unsigned long long int) out.size * 2);
+      status = "500 Internal Server Error";
+      out.length = 0;
+      out.failed = 0;
+      metrics_printf (&out, "Cannot render metrics\n");
+    }
+
+  headerlen = snprintf (header, sizeof(header),
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: %lu\r\n"
+			"Connection: close\r\n\r\n",
+			status, (unsigned long int) out.length);
+
+  if ( send (client, header, headerlen, MSG_NOSIGNAL) == headerlen &&
+       strncmp (request, "HEAD ", 5) )
+    {
+      for (sent = 0; sent < out.length; sent += rv)
+	if ( (rv = send (client, out.buffer + sent, out.length - sent, MSG_NOSIGNAL)) <= 0 )
+	  break;
+    }
+
+  free (out.buffer);
+}  /* End of metrics_serve() */
+
+
+/***************************************************************************
+ * metrics_render:
+ *
+ * Render the route and connection metrics in Prometheus text format.
+ ***************************************************************************/
+static void
+metrics_render (MetricsOut *out)
+{
+  RouteSnapshot snapshot;
+  dltime_t now = dlp_time ();
+
+  snapshot_route (&snapshot);
+
+  metrics_printf (out, "# HELP dali2dali_packets_forwarded_total Packets forwarded to the destination.\n"
+		  "# TYPE dali2dali_packets_forwarded_total counter\n"
+		  "dali2dali_packets_forwarded_total{%s} %llu\n",
+		  routelabels, (unsigned long long int) snapshot.packets);
+
+  metrics_printf (out, "# HELP dali2dali_bytes_forwarded_total Packet payload bytes forwarded to the destination.\n"
+		  "# TYPE dali2dali_bytes_forwarded_total counter\n"
+		  "dali2dali_bytes_forwarded_total{%s} %llu\n",
+		  routelabels, (unsigned long long int) snapshot.bytes);
+
+  metrics_printf (out, "# HELP dali2dali_queue_depth Packets received from the source and not yet forwarded.\n"
+		  "# TYPE dali2dali_queue_depth gauge\n"
+		  "dali2dali_queue_depth{%s} %llu\n",
+		  routelabels, (unsigned long long int) snapshot.pending);
+
+  metrics_printf (out, "# HELP dali2dali_ack_latency_seconds Time from writing a packet to its acknowledgement.\n"
+		  "# TYPE dali2dali_ack_latency_seconds summary\n"
+		  "dali2dali_ack_latency_seconds_sum{%s} %.6f\n"
+		  "dali2dali_ack_latency_seconds_count{%s} %llu\n",
+		  routelabels, (double) snapshot.acklatency / DLTMODULUS,
+		  routelabels, (unsigned long long int) snapshot.acks);
+
+  /* Lags are only known once a packet has been forwarded */
+  if ( snapshot.packets )
+    {
+      metrics_printf (out, "# HELP dali2dali_source_lag_seconds Time since the packet time of the last forwarded packet.\n"
+		      "# TYPE dali2dali_source_lag_seconds gauge\n"
+		      "dali2dali_source_lag_seconds{%s} %.6f\n",
+		      routelabels, (double) (now - snapshot.pkttime) / DLTMODULUS);
+
+      metrics_printf (out, "# HELP dali2dali_data_latency_seconds Time since the data end time of the last forwarded packet.\n"
+		      "# TYPE dali2dali_data_latency_seconds gauge\n"
+		      "dali2dali_data_latency_seconds{%s} %.6f\n",
+		      routelabels, (double) (now - snapshot.dataend) / DLTMODULUS);
+    }
+
+  metrics_connections (out);
+  metrics_latency (out);
+}  /* End of metrics_render() */
+
+
+/***************************************************************************
+ * metrics_latency:
+ *
+ * Render the route latency histograms of the forwarding stages, when
+ * recorded, with cumulative buckets from copies of the histograms.
+ ***************************************************************************/
+static void
+metrics_latency (MetricsOut *out)
+{
+  /* Bucket upper bounds in microseconds */
+  static const int64_t bounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+  };
+  static DLHistogram copy;
+  const DLHistogram *hist;
+  size_t idx;
+  int stage;
+
+  if ( ! latency_route (0) )
+    return;
+
+  metrics_printf (out, "# HELP dali2dali_latency_seconds Latency of the forwarding stages: "
+		  "source is packet time to received, relay is received to writing, "
+		  "send is writing to sent and ack is sent to acknowledged.\n"
+		  "# TYPE dali2dali_latency_seconds histogram\n");
+
+  for (stage = 0; stage < LATENCY_STAGES; stage++)
+    {
+      if ( ! (hist = latency_route (stage)) )
+	continue;
+
+      /* Only this thread renders, a static copy keeps it off the stack */
+      dl_hist_copy (&copy, hist);
+
+      for (idx = 0; idx < sizeof(bounds) / sizeof(bounds[0]); idx++)
+	metrics_printf (out, "dali2dali_latency_seconds_bucket{%s,stage=\"%s\",le=\"%g\"} %llu\n",
+			routelabels, latency_stagename (stage), (double) bounds[idx] / DLTMODULUS,
+			(unsigned long long int) dl_hist_countto (&copy, bounds[idx]));
+
+      metrics_printf (out, "dali2dali_latency_seconds_bucket{%s,stage=\"%s\",le=\"+Inf\"} %llu\n"
+		      "dali2dali_latency_seconds_sum{%s,stage=\"%s\"} %.6f\n"
+		      "dali2dali_latency_seconds_count{%s,stage=\"%s\"} %llu\n",
+		      routelabels, latency_stagename (stage), (unsigned long long int) copy.total,
+		      routelabels, latency_stagename (stage), (double) copy.sum / DLTMODULUS,
+		      routelabels, latency_stagename (stage), (unsigned long long int) copy.total);
+    }
+}  /* End of metrics_latency() */
+
+
+/***************************************************************************
+ * metrics_connections:
+ *
+ * Render the libdali statistics of the source and destination
+ * connections, grouped by metric as the text format requires.
+ ***************************************************************************/
+static void
+metrics_connections (MetricsOut *out)
+{
+  static const struct {
+    const char *metric;
+    const char *help;
+    size_t offset;
+  } counters[] = {
+    { "bytes_received_total", "Bytes received on the connection.", offsetof (DLStats, bytesrecv) },
+    { "bytes_sent_total", "Bytes sent on the connection.", offsetof (DLStats, bytessent) },
+    { "recv_calls_total", "Receive system calls on the connection.", offsetof (DLStats, recvcalls) },
+    { "send_calls_total", "Send system calls on the connection.", offsetof (DLStats, sendcalls) },
+    { "connects_total", "Connections opened.", offsetof (DLStats, connects) },
+    { "connect_failures_total", "Failed connection attempts.", offsetof (DLStats, connfails) },
+    { "keepalives_total", "Keepalives sent.", offsetof (DLStats, keepalives) },
+    { "timeouts_total", "Network I/O timeouts.", offsetof (DLStats, timeouts) },
+    { "io_errors_total", "Network I/O errors.", offsetof (DLStats, ioerrors) },
+  };
+  const char *names[2] = { "source", "destination" };
+  const char *labels[2];
+  DLCP *conns[2];
+  DLStats stats[2];
+  size_t idx;
+  int conn;
+
+  conns[0] = srcconn;
+  conns[1] = destconn;
+  labels[0] = srclabel;
+  labels[1] = destlabel;
+
+  if ( dl_getstats (conns[0], &stats[0]) || dl_getstats (conns[1], &stats[1]) )
+    return;
+
+  for (idx = 0; idx < sizeof(counters) / sizeof(counters[0]); idx++)
+    {
+      metrics_printf (out, "# HELP dali2dali_connection_%s %s\n"
+		      "# TYPE dali2dali_connection_%s counter\n",
+		      counters[idx].metric, counters[idx].help, counters[idx].metric);
+
+      for (conn = 0; conn < 2; conn++)
+	metrics_printf (out, "dali2dali_connection_%s{connection=\"%s\",address=\"%s\"} %llu\n",
+			counters[idx].metric, names[conn], labels[conn],
+			(unsigned long long int) *(uint64_t *)((char *)&stats[conn] + counters[idx].offset));
+    }
+
+  metrics_printf (out, "# HELP dali2dali_reconnects_total Connections opened after the first.\n"
+		  "# TYPE dali2dali_reconnects_total counter\n");
+
+  for (conn = 0; conn < 2; conn++)
+    metrics_printf (out, "dali2dali_reconnects_total{connection=\"%s\",address=\"%s\"} %llu\n",
+		    names[conn], labels[conn],
+		    (unsigned long long int) ((stats[conn].connects > 1) ? stats[conn].connects - 1 : 0));
+}  /* End of metrics_connections() */
+
+
+/***************************************************************************
+ * metrics_printf:
+ *
+ * Append formatted text to the output buffer, doubling it as needed.
+ * When it cannot be grown the output is marked failed and further
+ * output dropped.
+ ***************************************************************************/
+static void
+metrics_printf (MetricsOut *out, const char *format, ...)
+{
+  va_list argptr;
+  char *buffer;
+  int rv;
+
+  if ( out->failed )
+    return;
+
+  for (;;)
+    {
+      va_start (argptr, format);
+      rv = vsnprintf (out->buffer + out->length, out->size - out->length, format, argptr);
+      va_end (argptr);
+
+      if ( rv < 0 )
+	return;
+
+      if ( (size_t) rv < out->size - out->length )
+	break;
+
+      if ( ! (buffer = (char *) realloc (out->buffer, out->size * 2)) )
+	{
+	  out->failed = 1;
+	  return;
+	}
+
+      out->buffer = buffer;
+      out->size  *= 2;
+    }
+
+  out->length += rv;
+}  /* End of metrics_printf() */
+
+
+/***************************************************************************
+ * metrics_escape:
+ *
+ * Copy a label value escaping backslash, double quote and newline as
+ * the text format requires, truncated at a whole character.
+ ***************************************************************************/
+static void
+metrics_escape (char *label, size_t size, const char *value)
+{
+  size_t length = 0;
+
+  for (; *value; value++)
+    {
+      if ( *value == '\\' || *value == '"' || *value == '\n' )
+	{
+	  if ( length + 2 >= size )
+	    break;
+
+	  label[length++] = '\\';
+	  label[length++] = (*value == '\n') ? 'n' : *value;
+	}
+      else
+	{
+	  if ( length + 1 >= size )
+	    break;
+
+	  label[length++] = *value;
+	}
+    }
+
+  label[length] = '\0';
+}  /* End of metrics_escape() */
@@ -0,0 +1,16 @@
+/***************************************************************************
+ * metrics.h
+ *
+ * Prometheus metrics endpoint for dali2dali.
+ ***************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H 1
+
+#include <libdali.h>
+
+extern int  metrics_start (const char *listenaddr, DLCP *source, DLCP *destination);
+extern void metrics_received (void);
+extern void metrics_forwarded (const DLPacket *packet, dltime_t acklatency);
+
+#endif /* METRICS_H */
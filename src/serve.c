@@ -0,0 +1,105 @@
+/***************************************************************************
+ * serve.c
+ *
+ * Embedded DataLink server for dali2dali.
+ *
+ * Packets received from the source are added to a libdali packet
+ * ring, keeping their source packet IDs, and served to downstream clients,
+ * so many clients are fed by the one upstream connection.  Clients
+ * may use ID, POSITION SET (a packet ID, EARLIEST or LATEST),
+ * POSITION AFTER, MATCH, REJECT, READ, STREAM and ENDSTREAM; the
+ * server is read-only and refuses WRITE and INFO.
+ *
+ * The protocol, client threads and listener are those of the shared
+ * DataLink server in server.c.  The forwarding thread only copies each
+ * packet into the ring and never waits for clients, a client falling
+ * behind by more than the ring skips the evicted packets.  Packets are
+ * kept in the order received, which is packet ID order unless the
+ * source server restarts its IDs, when the ring is emptied.
+ *
+ * Requires POSIX threads.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "serve.h"
+
+static Server *server = NULL;
+
+
+/***************************************************************************
+ * serve_start:
+ *
+ * Allocate a ring of up to packets packets within databytes of packet
+ * data, packets of up to packetsize bytes, listen on [host:]port,
+ * localhost when no host is given, and start a thread accepting up
+ * to maxclients clients at a time.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+serve_start (const char *listenaddr, int packets, size_t databytes, int packetsize,
+	     int maxclients)
+{
+  char bound[300];
+  int listenfd;
+
+  if ( ! listenaddr || packets <= 0 || packetsize <= 0 || maxclients <= 0 )
+    return -1;
+
+  if ( ! (server = server_new ("dali2dali", packets, databytes, packetsize)) )
+    return -1;
+
+  if ( (listenfd = server_listen (listenaddr, 64, bound, sizeof(bound))) < 0 )
+    return -1;
+
+  if ( server_start (server, listenfd, maxclients) )
+    {
+      close (listenfd);
+      return -1;
+    }
+
+  dl_log (1, 1, "Serving up to %d DataLink clients on %s from a ring of %d packets and %llu bytes\n",
+	  maxclients, bound, packets, (unsigned long long int) databytes);
+
+  return 0;
+}  /* End of serve_start() */
+
+
+/***************************************************************************
+ * serve_packet:
+ *
+ * Add a packet received from the source to the served ring.
+ ***************************************************************************/
+void
+serve_packet (const DLPacket *packet, const void *packetdata)
+{
+  if ( server && server->listenfd >= 0 )
+    server_add (server, packet, packetdata);
+}  /* End of serve_packet() */
+
+
+/***************************************************************************
+ * serve_report:
+ *
+ * Log the clients served and refused, the packets cached and evicted
+ * and packets skipped by slow clients.
+ ***************************************************************************/
+void
+serve_report (void)
+{
+  if ( ! server || server->listenfd < 0 )
+    return;
+
+  pthread_mutex_lock (&server->lock);
+  dl_log (1, 1, "Served %llu DataLink clients, %d connected, %llu refused, %lld packets cached, "
+	  "%llu evicted, %llu skipped by slow clients\n",
+	  (unsigned long long int) server->totalclients, server->clients,
+	  (unsigned long long int) server->refused,
+	  (long long int) (server->ring->next - server->ring->first),
+	  (unsigned long long int) server->ring->evicted,
+	  (unsigned long long int) server->skipped);
+  pthread_mutex_unlock (&server->lock);
+}  /* End of serve_report() */
@@ -0,0 +1,17 @@
+/***************************************************************************
+ * serve.h
+ *
+ * Embedded DataLink server for dali2dali.
+ ***************************************************************************/
+
+#ifndef SERVE_H
+#define SERVE_H 1
+
+#include <libdali.h>
+
+extern int  serve_start (const char *listenaddr, int packets, size_t databytes, int packetsize,
+			 int maxclients);
+extern void serve_packet (const DLPacket *packet, const void *packetdata);
+extern void serve_report (void);
+
+#endif /* SERVE_H */
@@ -0,0 +1,1079 @@
+/***************************************************************************
+ * server.c
+ *
+ * DataLink server protocol and listener setup shared by dalimock, the
+ * embedded server of dali2dali and the metrics endpoint.
+ *
+ * Packets added to a server are kept in a libdali packet ring and
+ * served to clients with the DataLink commands ID, POSITION SET (a
+ * packet ID, EARLIEST or LATEST), POSITION AFTER, MATCH, REJECT, READ,
+ * STREAM and ENDSTREAM, with WRITE when the server is writable and
+ * INFO when the program provides a handler.
+ *
+ * A listener thread accepts clients, up to a limit, and each client is
+ * served by its own thread, waiting on a condition variable for new
+ * packets when streaming.  Adding a packet only copies it into the
+ * ring and never waits for clients, a client falling behind by more
+ * than the ring skips the evicted packets.  Packets are kept in the
+ * order added, which is packet ID order: a writable server numbers the
+ * packets itself, otherwise the ring is emptied when the packet IDs
+ * added restart.
+ *
+ * Requires POSIX threads.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <regex.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+
+#define SERVER_BUFSIZE 65536   /* Client read and write buffer sizes */
+#define SERVER_BATCH   256     /* Packets streamed between checks for commands */
+#define SERVER_WAITMS  10      /* Longest wait for new packets when streaming */
+
+/* Client connection */
+struct ServerClient_s {
+  Server  *server;
+  int      sock;
+  char     addr[100];
+  regex_t  match;
+  regex_t  reject;
+  int      matching;
+  int      rejecting;
+  int      streaming;
+  int64_t  nextseq;          /* Next sequence number to stream, 0 for the next new packet */
+  char    *data;             /* Packet data buffer, packetsize bytes */
+  char     readbuf[SERVER_BUFSIZE];
+  size_t   readlen;
+  size_t   readpos;
+  char     writebuf[SERVER_BUFSIZE];
+  size_t   writelen;
+};
+
+static void   *accept_thread (void *arg);
+static void   *client_thread (void *arg);
+static int     client_command (ServerClient *client, char *header);
+static int     client_write (ServerClient *client, char *header);
+static int     client_stream (ServerClient *client);
+static int64_t client_copy (ServerClient *client, int64_t seq, DLRingPacket *packet);
+static int     client_selected (ServerClient *client, const char *streamid);
+static int     client_pattern (ServerClient *client, regex_t *regex, int *active, int size);
+static int     client_packet (ServerClient *client, const DLRingPacket *packet);
+static int     client_pending (ServerClient *client);
+static int     client_recv (ServerClient *client, void *buffer, size_t size);
+static int     client_queue (ServerClient *client, const void *buffer, size_t size);
+static int     client_flush (ServerClient *client);
+
+
+/***************************************************************************
+ * server_splitaddr:
+ *
+ * Split an address in [host:]port format, the host may be enclosed in
+ * brackets, an empty host is returned for a port alone.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+server_splitaddr (const char *address, char *host, size_t hostsize,
+		  char *port, size_t portsize)
+{
+  const char *colon;
+  size_t length;
+
+  *host = '\0';
+
+  if ( ! (colon = strrchr (address, ':')) )
+    {
+      snprintf (port, portsize, "%s", address);
+      return ( *port ) ? 0 : -1;
+    }
+
+  length = (size_t) (colon - address);
+
+  if ( length >= 2 && address[0] == '[' && address[length - 1] == ']' )
+    snprintf (host, hostsize, "%.*s", (int) (length - 2), address + 1);
+  else
+    snprintf (host, hostsize, "%.*s", (int) length, address);
+
+  snprintf (port, portsize, "%s", colon + 1);
+
+  return ( *port ) ? 0 : -1;
+}  /* End of server_splitaddr() */
+
+
+/***************************************************************************
+ * server_listen:
+ *
+ * Create a listening socket for an address in [host:]port format,
+ * localhost when no host is given, or unix:/path for a Unix domain
+ * socket, replacing an existing socket file.  The address listened on
+ * is written to bound, with an ephemeral port 0 resolved.
+ *
+ * Returns the listening socket on success and -1 on error.
+ ***************************************************************************/
+int
+server_listen (const char *address, int backlog, char *bound, size_t boundsize)
+{
+  struct addrinfo hints;
+  struct addrinfo *addrlist = NULL;
+  struct addrinfo *addr;
+  struct sockaddr_storage local;
+  struct sockaddr_un sun;
+  socklen_t locallen = sizeof(local);
+  char host[256];
+  char port[32];
+  char localhost[NI_MAXHOST];
+  char localport[NI_MAXSERV];
+  int sock = -1;
+  int optval = 1;
+  int rv;
+
+  if ( ! strncmp (address, "unix:", 5) )
+    {
+      memset (&sun, 0, sizeof(sun));
+      sun.sun_family = AF_UNIX;
+      snprintf (sun.sun_path, sizeof(sun.sun_path), "%s", address + 5);
+      unlink (sun.sun_path);
+
+      if ( (sock = socket (AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	   bind (sock, (struct sockaddr *) &sun, sizeof(sun)) || listen (sock, backlog) )
+	{
+	  dl_log (2, 0, "Cannot listen on %s: %s\n", address, strerror (errno));
+	  if ( sock >= 0 )
+	    close (sock);
+	  return -1;
+	}
+
+      snprintf (bound, boundsize, "%s", address);
+
+      return sock;
+    }
+
+  if ( server_splitaddr (address, host, sizeof(host), port, sizeof(port)) )
+    {
+      dl_log (2, 0, "Invalid listen address: %s\n", address);
+      return -1;
+    }
+
+  /* Only listen on other interfaces when asked to */
+  if ( ! host[0] )
+    snprintf (host, sizeof(host), "localhost");
+
+  memset (&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_PASSIVE;
+
+  if ( (rv = getaddrinfo (host, port, &hints, &addrlist)) )
+    {
+      dl_log (2, 0, "Cannot resolve listen address %s: %s\n", address, gai_strerror (rv));
+      return -1;
+    }
+
+  /* Bind the first address that works */
+  for (addr = addrlist; addr; addr = addr->ai_next)
+    {
+      if ( (sock = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0 )
+	continue;
+
+      setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+      if ( bind (sock, addr->ai_addr, addr->ai_addrlen) == 0 && listen (sock, backlog) == 0 )
+	break;
+
+      close (sock);
+      sock = -1;
+    }
+
+  freeaddrinfo (addrlist);
+
+  if ( sock < 0 )
+    {
+      dl_log (2, 0, "Cannot listen on %s: %s\n", address, strerror (errno));
+      return -1;
+    }
+
+  if ( getsockname (sock, (struct sockaddr *) &local, &locallen) ||
+       getnameinfo ((struct sockaddr *) &local, locallen, localhost, sizeof(localhost),
+		    localport, sizeof(localport), NI_NUMERICHOST | NI_NUMERICSERV) )
+    {
+      snprintf (localhost, sizeof(localhost), "%s", host);
+      snprintf (localport, sizeof(localport), "%s", port);
+    }
+
+  snprintf (bound, boundsize, "%s%s%s:%s", (strchr (localhost, ':')) ? "[" : "",
+	    localhost, (strchr (localhost, ':')) ? "]" : "", localport);
+
+  return sock;
+}  /* End of server_listen() */
+
+
+/***************************************************************************
+ * server_spawn:
+ *
+ * Start a detached thread with all signals blocked, so handlers run in
+ * the main thread.  Threads it starts inherit the blocked signals.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+server_spawn (void *(*routine) (void *), void *arg)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  sigset_t blocked;
+  sigset_t previous;
+  int rv;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  sigfillset (&blocked);
+  pthread_sigmask (SIG_SETMASK, &blocked, &previous);
+  rv = pthread_create (&thread, &attr, routine, arg);
+  pthread_sigmask (SIG_SETMASK, &previous, NULL);
+
+  pthread_attr_destroy (&attr);
+
+  if ( rv )
+    {
+      dl_log (2, 0, "Cannot start thread: %s\n", strerror (rv));
+      return -1;
+    }
+
+  return 0;
+}  /* End of server_spawn() */
+
+
+/***************************************************************************
+ * server_new:
+ *
+ * Allocate a server with a ring of up to packets packets within
+ * databytes of packet data, packets of up to packetsize bytes.  The
+ * server is read-only, without INFO and reply delay, until the
+ * caller sets them before server_start().
+ *
+ * Returns the server on success and NULL on error.
+ ***************************************************************************/
+Server *
+server_new (const char *serverid, int64_t packets, size_t databytes, int packetsize)
+{
+  Server *server;
+
+  if ( packets <= 0 || packetsize <= 0 )
+    return NULL;
+
+  if ( ! (server = (Server *) calloc (1, sizeof(Server))) )
+    {
+      dl_log (2, 0, "Cannot allocate DataLink server\n");
+      return NULL;
+    }
+
+  if ( ! (server->ring = dl_ring_new (packets, databytes)) )
+    {
+      free (server);
+      return NULL;
+    }
+
+  pthread_mutex_init (&server->lock, NULL);
+  pthread_cond_init (&server->added, NULL);
+
+  snprintf (server->serverid, sizeof(server->serverid), "%s", serverid);
+  server->packetsize = packetsize;
+  server->listenfd   = -1;
+
+  return server;
+}  /* End of server_new() */
+
+
+/***************************************************************************
+ * server_start:
+ *
+ * Start a thread accepting clients on a listening socket, at most
+ * maxclients at a time, each served by its own thread.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+server_start (Server *server, int listenfd, int maxclients)
+{
+  if ( ! server || listenfd < 0 || maxclients <= 0 )
+    return -1;
+
+  server->listenfd   = listenfd;
+  server->maxclients = maxclients;
+
+  return server_spawn (accept_thread, server);
+}  /* End of server_start() */
+
+
+/***************************************************************************
+ * server_add:
+ *
+ * Add a packet to the ring, evicting the oldest when full, and wake
+ * streaming clients.  A writable server assigns the packet ID and
+ * packet time, otherwise a packet ID not after the latest means the
+ * source restarted its IDs and the ring is emptied so packet IDs
+ * remain in order.  Packets larger than the packet size are dropped.
+ *
+ * Returns the packet ID on success and -1 when the packet is dropped.
+ ***************************************************************************/
+int64_t
+server_add (Server *server, const DLPacket *packet, const void *packetdata)
+{
+  const DLRingPacket *latest;
+  DLPacket numbered;
+  int64_t pktid = -1;
+
+  if ( packet->datasize < 0 || packet->datasize > server->packetsize )
+    return -1;
+
+  pthread_mutex_lock (&server->lock);
+
+  if ( server->writable )
+    {
+      /* Packet IDs are the ring sequence numbers */
+      numbered = *packet;
+      numbered.pktid   = server->ring->next;
+      numbered.pkttime = dlp_time ();
+      packet = &numbered;
+    }
+  else if ( (latest = dl_ring_get (server->ring, server->ring->next - 1, NULL)) &&
+	    packet->pktid <= latest->pktid )
+    {
+      dl_log (1, 1, "Source packet IDs restarted at %lld, emptying the served ring\n",
+	      (long long int) packet->pktid);
+      dl_ring_clear (server->ring);
+    }
+
+  if ( dl_ring_add (server->ring, packet, packetdata) >= 0 )
+    {
+      pktid = packet->pktid;
+      pthread_cond_broadcast (&server->added);
+    }
+
+  pthread_mutex_unlock (&server->lock);
+
+  return pktid;
+}  /* End of server_add() */
+
+
+/***************************************************************************
+ * accept_thread:
+ *
+ * Accept clients, each served by a detached thread, refusing clients
+ * over the limit.
+ ***************************************************************************/
+static void *
+accept_thread (void *arg)
+{
+  Server *server = (Server *) arg;
+  pthread_attr_t attr;
+  pthread_t thread;
+  ServerClient *client;
+  int sock;
+  int one = 1;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  for (;;)
+    {
+      if ( (sock = accept (server->listenfd, NULL, NULL)) < 0 )
+	{
+	  if ( errno != EINTR && errno != ECONNABORTED )
+	    dlp_usleep (100000);
+	  continue;
+	}
+
+      pthread_mutex_lock (&server->lock);
+
+      if ( server->clients >= server->maxclients )
+	{
+	  server->refused++;
+	  pthread_mutex_unlock (&server->lock);
+
+	  dl_log (1, 2, "Refused a DataLink client, limit of %d clients reached\n",
+		  server->maxclients);
+	  close (sock);
+	  continue;
+	}
+
+      server->clients++;
+      server->totalclients++;
+      pthread_mutex_unlock (&server->lock);
+
+      setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      if ( ! (client = (ServerClient *) calloc (1, sizeof(ServerClient))) ||
+	   ! (client->data = (char *) malloc (server->packetsize)) )
+	{
+	  dl_log (2, 0, "Cannot allocate DataLink client\n");
+	  close (sock);
+	  free (client);
+
+	  pthread_mutex_lock (&server->lock);
+	  server->clients--;
+	  pthread_mutex_unlock (&server->lock);
+	  continue;
+	}
+
+      client->server = server;
+      client->sock   = sock;
+      snprintf (client->addr, sizeof(client->addr), "client %llu",
+		(unsigned long long int) server->totalclients);
+
+      if ( pthread_create (&thread, &attr, client_thread, client) )
+	{
+	  dl_log (2, 0, "Cannot start DataLink client thread\n");
+	  close (sock);
+	  free (client->data);
+	  free (client);
+
+	  pthread_mutex_lock (&server->lock);
+	  server->clients--;
+	  pthread_mutex_unlock (&server->lock);
+	}
+    }
+
+  return NULL;
+}  /* End of accept_thread() */
+
+
+/***************************************************************************
+ * client_thread:
+ *
+ * Serve the commands of a client until it disconnects, streaming
+ * packets in between when in streaming mode.
+ ***************************************************************************/
+static void *
+client_thread (void *arg)
+{
+  ServerClient *client = (ServerClient *) arg;
+  Server *server = client->server;
+  unsigned char preheader[3];
+  char header[256];
+
+  dl_log (1, 2, "[%s] DataLink client connected\n", client->addr);
+
+  for (;;)
+    {
+      if ( client->streaming )
+	{
+	  if ( client_stream (client) )
+	    break;
+
+	  if ( ! client_pending (client) )
+	    continue;
+	}
+
+      /* Receive a command: 'DL', header length and header */
+      if ( client_recv (client, preheader, 3) || preheader[0] != 'D' || preheader[1] != 'L' ||
+	   client_recv (client, header, preheader[2]) )
+	break;
+
+      header[preheader[2]] = '\0';
+
+      dl_log (1, 3, "[%s] Command: %s\n", client->addr, header);
+
+      if ( client_command (client, header) || client_flush (client) )
+	break;
+    }
+
+  dl_log (1, 2, "[%s] DataLink client disconnected\n", client->addr);
+
+  pthread_mutex_lock (&server->lock);
+  server->clients--;
+  pthread_mutex_unlock (&server->lock);
+
+  close (client->sock);
+
+  if ( client->matching )
+    regfree (&client->match);
+  if ( client->rejecting )
+    regfree (&client->reject);
+
+  free (client->data);
+  free (client);
+
+  return NULL;
+}  /* End of client_thread() */
+
+
+/***************************************************************************
+ * client_command:
+ *
+ * Handle a command, receiving its payload if any, and queue the reply.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+client_command (ServerClient *client, char *header)
+{
+  Server *server = client->server;
+  const DLRingPacket *found;
+  DLRingPacket packet;
+  char reply[256];
+  char type[32];
+  char match[200];
+  long long int pktid;
+  long long int pkttime;
+  long long int after;
+  int64_t seq;
+  int size;
+
+  if ( server->replydelay && strncmp (header, "WRITE", 5) && strncmp (header, "STREAM", 6) )
+    dlp_usleep (server->replydelay);
+
+  if ( ! strncmp (header, "ID", 2) )
+    {
+      snprintf (reply, sizeof(reply), "ID DataLink %s :: DLPROTO:1.0 PACKETSIZE:%d%s",
+		server->serverid, server->packetsize, (server->writable) ? " WRITE" : "");
+      return server_send (client, reply, NULL, 0);
+    }
+  else if ( ! strncmp (header, "WRITE", 5) )
+    {
+      if ( server->writable )
+	return client_write (client, header);
+
+      /* The connection is closed, the payload is not read */
+      if ( ! server_reply (client, "ERROR", 0, "Server is read-only") )
+	client_flush (client);
+      return -1;
+    }
+  else if ( ! strncmp (header, "READ", 4) )
+    {
+      if ( sscanf (header, "READ %lld", &pktid) != 1 )
+	return server_reply (client, "ERROR", 0, "Cannot parse READ command");
+
+      pthread_mutex_lock (&server->lock);
+      seq = client_copy (client, dl_ring_find (server->ring, pktid), &packet);
+      pthread_mutex_unlock (&server->lock);
+
+      if ( seq < 0 )
+	return server_reply (client, "ERROR", 0, "Packet not found");
+
+      return client_packet (client, &packet);
+    }
+  else if ( ! strncmp (header, "POSITION SET", 12) )
+    {
+      pthread_mutex_lock (&server->lock);
+
+      if ( ! strcmp (header + 12, " EARLIEST") )
+	{
+	  seq = server->ring->first;
+	  client->nextseq = seq;
+	}
+      else if ( ! strcmp (header + 12, " LATEST") )
+	{
+	  seq = server->ring->next - 1;
+	  client->nextseq = server->ring->next;
+	}
+      else if ( sscanf (header + 12, " %lld %lld", &pktid, &pkttime) == 2 &&
+		(found = dl_ring_get (server->ring, (seq = dl_ring_find (server->ring, pktid)), NULL)) &&
+		(pkttime == DLTERROR || found->pkttime == pkttime) )
+	{
+	  /* Streaming continues after the packet */
+	  client->nextseq = seq + 1;
+	}
+      else
+	{
+	  seq = -1;
+	}
+
+      /* Positioning in an empty ring starts at the next packet with ID 0 */
+      found = dl_ring_get (server->ring, seq, NULL);
+      pktid = (found) ? found->pktid : 0;
+
+      pthread_mutex_unlock (&server->lock);
+
+      if ( seq < 0 )
+	return server_reply (client, "ERROR", 0, "Packet not found");
+
+      snprintf (reply, sizeof(reply), "Positioned to packet ID %lld", pktid);
+      return server_reply (client, "OK", pktid, reply);
+    }
+  else if ( ! strncmp (header, "POSITION AFTER", 14) )
+    {
+      if ( sscanf (header + 14, " %lld", &after) != 1 )
+	return server_reply (client, "ERROR", 0, "Cannot parse POSITION AFTER command");
+
+      /* First packet with data ending after the time, in the order added */
+      pthread_mutex_lock (&server->lock);
+
+      if ( (found = dl_ring_get (server->ring, (seq = dl_ring_after (server->ring, after)), NULL)) )
+	{
+	  client->nextseq = seq;
+	  pktid = found->pktid;
+	}
+
+      pthread_mutex_unlock (&server->lock);
+
+      if ( seq < 0 )
+	return server_reply (client, "ERROR", 0, "No packet with data after the time");
+
+      snprintf (reply, sizeof(reply), "Positioned to packet ID %lld", pktid);
+      return server_reply (client, "OK", pktid, reply);
+    }
+  else if ( ! strncmp (header, "MATCH", 5) )
+    {
+      if ( sscanf (header, "MATCH %d", &size) != 1 )
+	return -1;
+
+      return client_pattern (client, &client->match, &client->matching, size);
+    }
+  else if ( ! strncmp (header, "REJECT", 6) )
+    {
+      if ( sscanf (header, "REJECT %d", &size) != 1 )
+	return -1;
+
+      return client_pattern (client, &client->reject, &client->rejecting, size);
+    }
+  else if ( ! strncmp (header, "ENDSTREAM", 9) )
+    {
+      client->streaming = 0;
+      return server_send (client, "ENDSTREAM", NULL, 0);
+    }
+  else if ( ! strncmp (header, "STREAM", 6) )
+    {
+      client->streaming = 1;
+
+      /* Start with new packets unless positioned */
+      pthread_mutex_lock (&server->lock);
+      if ( ! client->nextseq )
+	client->nextseq = server->ring->next;
+      server->streamed = 1;
+      pthread_mutex_unlock (&server->lock);
+
+      return 0;
+    }
+  else if ( ! strncmp (header, "INFO", 4) && server->info )
+    {
+      match[0] = '\0';
+
+      if ( sscanf (header, "INFO %31s %199s", type, match) < 1 )
+	return server_reply (client, "ERROR", 0, "Cannot parse INFO command");
+
+      return server->info (server, client, type, match);
+    }
+
+  return server_reply (client, "ERROR", 0, "Unsupported command");
+}  /* End of client_command() */
+
+
+/***************************************************************************
+ * client_write:
+ *
+ * Receive a WRITE payload and add the packet, acknowledged with its
+ * packet ID when requested.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+client_write (ServerClient *client, char *header)
+{
+  Server *server = client->server;
+  DLPacket packet;
+  char flags[10];
+  long long int datastart;
+  long long int dataend;
+  int64_t pktid;
+  int size;
+
+  memset (&packet, 0, sizeof(packet));
+
+  /* Width of the stream ID is MAXSTREAMID - 1 */
+  if ( sscanf (header, "WRITE %59s %lld %lld %9s %d", packet.streamid, &datastart, &dataend,
+	       flags, &size) != 5 || size < 0 )
+    return server_reply (client, "ERROR", 0, "Cannot parse WRITE command");
+
+  if ( size > server->packetsize )
+    {
+      /* Discard the payload, then report the error */
+      while ( size > 0 )
+	{
+	  if ( client_recv (client, client->data, (size > server->packetsize) ? server->packetsize : size) )
+	    return -1;
+	  size -= server->packetsize;
+	}
+
+      return server_reply (client, "ERROR", 0, "Packet larger than the maximum packet size");
+    }
+
+  if ( client_recv (client, client->data, size) )
+    return -1;
+
+  packet.datastart = datastart;
+  packet.dataend   = dataend;
+  packet.datasize  = size;
+
+  pktid = server_add (server, &packet, client->data);
+
+  if ( strchr (flags, 'A') )
+    {
+      if ( server->replydelay )
+	dlp_usleep (server->replydelay);
+
+      if ( pktid < 0 )
+	return server_reply (client, "ERROR", 0, "Cannot add packet");
+
+      return server_reply (client, "OK", pktid, NULL);
+    }
+
+  return 0;
+}  /* End of client_write() */
+
+
+/***************************************************************************
+ * client_stream:
+ *
+ * Send up to SERVER_BATCH available packets that pass the match and
+ * reject patterns, waiting up to SERVER_WAITMS for a first one.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+client_stream (ServerClient *client)
+{
+  Server *server = client->server;
+  DLRingPacket packet;
+  struct timespec deadline;
+  int count;
+
+  for (count = 0; count < SERVER_BATCH; count++)
+    {
+      pthread_mutex_lock (&server->lock);
+
+      if ( count == 0 && client->nextseq >= server->ring->next )
+	{
+	  clock_gettime (CLOCK_REALTIME, &deadline);
+	  deadline.tv_nsec += SERVER_WAITMS * 1000000;
+	  if ( deadline.tv_nsec >= 1000000000 )
+	    {
+	      deadline.tv_sec++;
+	      deadline.tv_nsec -= 1000000000;
+	    }
+
+	  pthread_cond_timedwait (&server->added, &server->lock, &deadline);
+	}
+
+      if ( client->nextseq >= server->ring->next )
+	{
+	  pthread_mutex_unlock (&server->lock);
+	  break;
+	}
+
+      /* Skip packets evicted before they were sent */
+      if ( client->nextseq < server->ring->first )
+	{
+	  server->skipped += server->ring->first - client->nextseq;
+	  client->nextseq = server->ring->first;
+	}
+
+      client_copy (client, client->nextseq++, &packet);
+
+      pthread_mutex_unlock (&server->lock);
+
+      if ( ! client_selected (client, packet.streamid) )
+	continue;
+
+      if ( client_packet (client, &packet) )
+	return -1;
+    }
+
+  return client_flush (client);
+}  /* End of client_stream() */
+
+
+/***************************************************************************
+ * client_selected:
+ *
+ * Return true if a stream passes the match and reject patterns.
+ ***************************************************************************/
+static int
+client_selected (ServerClient *client, const char *streamid)
+{
+  if ( client->matching && regexec (&client->match, streamid, 0, NULL, 0) )
+    return 0;
+
+  if ( client->rejecting && ! regexec (&client->reject, streamid, 0, NULL, 0) )
+    return 0;
+
+  return 1;
+}  /* End of client_selected() */
+
+
+/***************************************************************************
+ * client_pattern:
+ *
+ * Receive a MATCH or REJECT pattern of up to MAXREGEXSIZE bytes and
+ * compile it, an empty pattern clears it.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***************************************************************************/
+static int
+client_pattern (ServerClient *client, regex_t *regex, int *active, int size)
+{
+  char *pattern;
+  int rv;
+
+  if ( size < 0 || size > MAXREGEXSIZE || ! (pattern = (char *) malloc (size + 1)) )
+    return -1;
+
+  if ( client_recv (client, pattern, size) )
+    {
+      free (pattern);
+      return -1;
+    }
+
+  pattern[size] = '\0';
+
+  if ( *active )
+    {
+      regfree (regex);
+      *active = 0;
+    }
+
+  if ( size == 0 )
+    rv = server_reply (client, "OK", 0, "Pattern cleared");
+  else if ( regcomp (regex, pattern, REG_EXTENDED | REG_NOSUB) )
+    rv = server_reply (client, "ERROR", 0, "Cannot compile pattern");
+  else
+    {
+      *active = 1;
+      rv = server_reply (client, "OK", 0, "Pattern accepted");
+    }
+
+  free (pattern);
+
+  return rv;
+}  /* End of client_pattern() */
+
+
+/***************************************************************************
+ * client_copy:
+ *
+ * Copy a packet from the ring into the client data buffer, so it is
+ * sent after the ring is unlocked.  Must be called with the server
+ * locked.
+ *
+ * Returns the sequence number and -1 when the packet is not in the ring.
+ ***************************************************************************/
+static int64_t
+client_copy (ServerClient *client, int64_t seq, DLRingPacket *packet)
+{
+  const DLRingPacket *found;
+  const void *data;
+
+  if ( ! (found = dl_ring_get (client->server->ring, seq, &data)) )
+    return -1;
+
+  *packet = *found;
+  memcpy (client->data, data, found->datasize);
+
+  return seq;
+}  /* End of client_copy() */
+
+
+/***************************************************************************
+ * client_packet:
+ *
+ * Queue a PACKET with data from the client data buffer.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+client_packet (ServerClient *client, const DLRingPacket *packet)
+{
+  char header[256];
+
+  snprintf (header, sizeof(header), "PACKET %s %lld %lld %lld %lld %d", packet->streamid,
+	    (long long int) packet->pktid, (long long int) packet->pkttime,
+	    (long long int) packet->datastart, (long long int) packet->dataend,
+	    packet->datasize);
+
+  return server_send (client, header, client->data, packet->datasize);
+}  /* End of client_packet() */
+
+
+/***************************************************************************
+ * server_send:
+ *
+ * Queue a DataLink packet with header and optional data for a client.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+server_send (ServerClient *client, const char *header, const void *data, size_t datasize)
+{
+  char preheader[3];
+  size_t headerlen = strlen (header);
+
+  preheader[0] = 'D';
+  preheader[1] = 'L';
+  preheader[2] = (char) headerlen;
+
+  if ( client_queue (client, preheader, 3) || client_queue (client, header, headerlen) ||
+       (data && client_queue (client, data, datasize)) )
+    return -1;
+
+  return 0;
+}  /* End of server_send() */
+
+
+/***************************************************************************
+ * server_reply:
+ *
+ * Queue an "OK" or "ERROR" reply with a value and optional message.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+server_reply (ServerClient *client, const char *status, int64_t value, const char *message)
+{
+  char header[256];
+  size_t size = (message) ? strlen (message) : 0;
+
+  snprintf (header, sizeof(header), "%s %lld %d", status, (long long int) value, (int) size);
+
+  return server_send (client, header, message, size);
+}  /* End of server_reply() */
+
+
+/***************************************************************************
+ * client_pending:
+ *
+ * Return true if received data is buffered or available on the socket.
+ ***************************************************************************/
+static int
+client_pending (ServerClient *client)
+{
+  struct pollfd pfd;
+
+  if ( client->readpos < client->readlen )
+    return 1;
+
+  pfd.fd = client->sock;
+  pfd.events = POLLIN;
+
+  return (poll (&pfd, 1, 0) > 0);
+}  /* End of client_pending() */
+
+
+/***************************************************************************
+ * client_recv:
+ *
+ * Read exactly size bytes, flushing pending output first.
+ *
+ * Returns 0 on success and -1 on error or end of stream.
+ ***************************************************************************/
+static int
+client_recv (ServerClient *client, void *buffer, size_t size)
+{
+  ssize_t nread;
+  size_t copy;
+
+  while ( size > 0 )
+    {
+      if ( client->readpos == client->readlen )
+	{
+	  if ( client_flush (client) )
+	    return -1;
+
+	  if ( (nread = recv (client->sock, client->readbuf, sizeof(client->readbuf), 0)) < 0 &&
+	       errno == EINTR )
+	    continue;
+
+	  if ( nread <= 0 )
+	    return -1;
+
+	  client->readlen = nread;
+	  client->readpos = 0;
+	}
+
+      copy = (client->readlen - client->readpos < size) ? client->readlen - client->readpos : size;
+      memcpy (buffer, client->readbuf + client->readpos, copy);
+      client->readpos += copy;
+      buffer = (char *) buffer + copy;
+      size -= copy;
+    }
+
+  return 0;
+}  /* End of client_recv() */
+
+
+/***************************************************************************
+ * client_queue:
+ *
+ * Append data to the output buffer, flushing when full.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+client_queue (ServerClient *client, const void *buffer, size_t size)
+{
+  size_t copy;
+
+  while ( size > 0 )
+    {
+      if ( client->writelen == sizeof(client->writebuf) && client_flush (client) )
+	return -1;
+
+      copy = sizeof(client->writebuf) - client->writelen;
+      if ( copy > size )
+	copy = size;
+
+      memcpy (client->writebuf + client->writelen, buffer, copy);
+      client->writelen += copy;
+      buffer = (const char *) buffer + copy;
+      size -= copy;
+    }
+
+  return 0;
+}  /* End of client_queue() */
+
+
+/***************************************************************************
+ * client_flush:
+ *
+ * Send all buffered output.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+client_flush (ServerClient *client)
+{
+  size_t sent = 0;
+  ssize_t nsent;
+
+  while ( sent < client->writelen )
+    {
+      if ( (nsent = send (client->sock, client->writebuf + sent, client->writelen - sent,
+			  MSG_NOSIGNAL)) < 0 )
+	{
+	  if ( errno == EINTR )
+	    continue;
+	  return -1;
+	}
+
+      sent += nsent;
+    }
+
+  client->writelen = 0;
+
+  return 0;
+}  /* End of client_flush() */
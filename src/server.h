@@ -0,0 +1,51 @@
+/***************************************************************************
+ * server.h
+ *
+ * DataLink server protocol and listener setup shared by dalimock, the
+ * embedded server of dali2dali and the metrics endpoint.
+ ***************************************************************************/
+
+#ifndef SERVER_H
+#define SERVER_H 1
+
+#include <pthread.h>
+
+#include <libdali.h>
+
+typedef struct Server_s Server;
+typedef struct ServerClient_s ServerClient;
+
+/* Send an INFO reply of a type, limited to streams matching a pattern */
+typedef int (*ServerInfo) (Server *server, ServerClient *client,
+			   const char *type, const char *match);
+
+/* Packet ring served to clients, each served by its own thread */
+struct Server_s {
+  pthread_mutex_t lock;
+  pthread_cond_t  added;        /* Broadcast when packets are added */
+  DLRing       *ring;           /* Packets, sequence numbers from ring->first to ring->next - 1 */
+  char          serverid[100];  /* Server ID in the ID reply */
+  int           packetsize;     /* Largest packet data size */
+  int           writable;       /* Accept WRITE, packet IDs are assigned by the server */
+  unsigned long replydelay;     /* Delay before each command reply, microseconds */
+  ServerInfo    info;           /* INFO handler, NULL to refuse INFO */
+  int           maxclients;     /* Client limit */
+  int           clients;        /* Current clients */
+  uint64_t      totalclients;   /* Clients accepted */
+  uint64_t      refused;        /* Clients refused at the limit */
+  uint64_t      skipped;        /* Packets evicted before a client streamed them */
+  int           streamed;       /* Set when a client first starts streaming */
+  int           listenfd;
+};
+
+extern int     server_splitaddr (const char *address, char *host, size_t hostsize,
+				 char *port, size_t portsize);
+extern int     server_listen (const char *address, int backlog, char *bound, size_t boundsize);
+extern int     server_spawn (void *(*routine) (void *), void *arg);
+extern Server *server_new (const char *serverid, int64_t packets, size_t databytes, int packetsize);
+extern int     server_start (Server *server, int listenfd, int maxclients);
+extern int64_t server_add (Server *server, const DLPacket *packet, const void *packetdata);
+extern int     server_send (ServerClient *client, const char *header, const void *data, size_t datasize);
+extern int     server_reply (ServerClient *client, const char *status, int64_t value, const char *message);
+
+#endif /* SERVER_H */